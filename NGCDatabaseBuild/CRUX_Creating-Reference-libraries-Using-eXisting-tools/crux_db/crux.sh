@@ -2,7 +2,7 @@
 
 ### this script is run as follows
 # sh ~CRUX/crux_db/crux.sh  -n <Metabarcode locus primer set name>  -f <Metabarcode locus forward primer sequence>  -r <Metabarcode locus reverse primer sequence>  -s <Shortest amplicon expected>  -m <Longest amplicon expected>  -o <path to output directory>  -d <path to crux_db>  -x <If retaining intermediate files no argument needed>  -u <If running on an HPC this is your username: e.g. eecurd>  -l <If running locally no argument needed>  -k <Chunk size for breaking up blast seeds (default
-# 500)> -e	<Maximum number of mismatch between primers and EMBL database sequences> -g <Maximum number of allowed errors for filtering and trimming the BLAST seed sequences with cutadapt> -t <The number of threads to launch for the first round of BLAST>  -v <The minimum accepted value for BLAST hits in the first round of BLAST >  -i <The minimum percent ID for BLAST hits in the first round of BLAST>  -c <Minimum percent of length of a query that a BLAST hit must cover >  -a <Maximum number of
+# 500)> -e	<Maximum number of mismatch between primers and EMBL database sequences> -g <Maximum primer site error rate (errors / primer length) of the amplicons kept by ecoPCR -T> -t <The number of threads to launch for the first round of BLAST>  -v <The minimum accepted value for BLAST hits in the first round of BLAST >  -i <The minimum percent ID for BLAST hits in the first round of BLAST>  -c <Minimum percent of length of a query that a BLAST hit must cover >  -a <Maximum number of
 # BLAST hits to return for each query>  -j <The number of threads to launch for the first round of BLAST>  -w <The minimum accepted value for BLAST hits in the first round of BLAST>  -p  <The minimum percent ID for BLAST hits in the first round of BLAST >  -f <Minimum percent of length of a query that a BLAST hit must cover>  -b <Job Submit header>  -h <Shows program usage then quits>
 
 NAME=""
@@ -91,7 +91,7 @@ done
 
 if [ "${HELP}" = "TRUE" ]
 then
-  printf "<<< CRUX: Sequence Creating Reference Libraries Using eXisting tools>>>\n\nThe purpose of these script is to generate metabarcode locus specific reference libraries. This script takes PCR primer sets, runs ecoPRC (in silico PCR) on EMBL (or other OBITools formatted) databases, then BLASTs the resulting sequences ncbi's nr database, and generates database files for unique NCBI sequences. The final databases are either filtered (sequences with ambiguous taxonomy removed) of unfiltered and consist of a fasta file, a taxonomy file, and a Bowtie2 Index library. \n	For successful implementation \n		1. Make sure you have all of the dependencies and correct paths in the crux_config.sh file\n		2. All parameters can be modified using the arguments below.  Alternatively, all parameters can be altered in the crux_vars.sh folder\n\nArguments:\n- Required:\n	-n	Metabarcode locus primer set name\n	-f	Metabarcode locus forward primer sequence  \n	-r	Metabarcode locus reverse primer sequence  \n	-s	Shortest amplicon expected (e.g. 100 bp shorter than the average amplicon length\n	-m	Longest amplicon expected (e.g. 100 bp longer than the average amplicon length\n	-o	path to output directory\n	-d	path to crux_db\n\n- Optional:\n	-q	If retaining intermediate files: -x (no argument needed; Default is to delete intermediate files) \n	-u	If running on an HPC (e.g. UCLA's Hoffman2 cluster), this is your username: e.g. eecurd\n	-l	If running locally: -l  (no argument needed)\n	-k	Chunk size for breaking up blast seeds (default 500)\n	-e	Maximum number of mismatch between primers and EMBL database sequences (default 3)\n	-g	Maximum number of allowed errors for filtering and trimming the BLAST seed sequences with cutadapt (default 0.3)\n	-t	The number of threads to launch for the first round of BLAST (default 10)\n	-v	The minimum accepted value for BLAST hits in the first round of BLAST (default 0.00001)\n	-i 	The minimum percent ID for BLAST hits in the first round of BLAST (default 50)\n	-c	Minimum percent of length of a query that a BLAST hit must cover (default 100)\n	-a	Maximum number of BLAST hits to return for each query (default 10000)\n	-z	BLAST gap opening penalty\n	-y	BLAST gap extension penalty\n	-j	The number of threads to launch for the first round of BLAST (default 10)\n	-w	The minimum accepted value for BLAST hits in the first round of BLAST (default 0.00001)\n	-p 	The minimum percent ID for BLAST hits in the first round of BLAST (default 70)\n	-x	Minimum percent of length of a query that a BLAST hit must cover (default 70)\n	-b	HPC mode header template\n\n- Other:\n	-h	Shows program usage then quits\n\n\n"
+  printf "<<< CRUX: Sequence Creating Reference Libraries Using eXisting tools>>>\n\nThe purpose of these script is to generate metabarcode locus specific reference libraries. This script takes PCR primer sets, runs ecoPRC (in silico PCR) on EMBL (or other OBITools formatted) databases, then BLASTs the resulting sequences ncbi's nr database, and generates database files for unique NCBI sequences. The final databases are either filtered (sequences with ambiguous taxonomy removed) of unfiltered and consist of a fasta file, a taxonomy file, and a Bowtie2 Index library. \n	For successful implementation \n		1. Make sure you have all of the dependencies and correct paths in the crux_config.sh file\n		2. All parameters can be modified using the arguments below.  Alternatively, all parameters can be altered in the crux_vars.sh folder\n\nArguments:\n- Required:\n	-n	Metabarcode locus primer set name\n	-f	Metabarcode locus forward primer sequence  \n	-r	Metabarcode locus reverse primer sequence  \n	-s	Shortest amplicon expected (e.g. 100 bp shorter than the average amplicon length\n	-m	Longest amplicon expected (e.g. 100 bp longer than the average amplicon length\n	-o	path to output directory\n	-d	path to crux_db\n\n- Optional:\n	-q	If retaining intermediate files: -x (no argument needed; Default is to delete intermediate files) \n	-u	If running on an HPC (e.g. UCLA's Hoffman2 cluster), this is your username: e.g. eecurd\n	-l	If running locally: -l  (no argument needed)\n	-k	Chunk size for breaking up blast seeds (default 500)\n	-e	Maximum number of mismatch between primers and EMBL database sequences (default 3)\n	-g	Maximum primer site error rate (errors / primer length) of the amplicons kept by ecoPCR -T (default 0.3)\n	-t	The number of threads to launch for the first round of BLAST (default 10)\n	-v	The minimum accepted value for BLAST hits in the first round of BLAST (default 0.00001)\n	-i 	The minimum percent ID for BLAST hits in the first round of BLAST (default 50)\n	-c	Minimum percent of length of a query that a BLAST hit must cover (default 100)\n	-a	Maximum number of BLAST hits to return for each query (default 10000)\n	-z	BLAST gap opening penalty\n	-y	BLAST gap extension penalty\n	-j	The number of threads to launch for the first round of BLAST (default 10)\n	-w	The minimum accepted value for BLAST hits in the first round of BLAST (default 0.00001)\n	-p 	The minimum percent ID for BLAST hits in the first round of BLAST (default 70)\n	-x	Minimum percent of length of a query that a BLAST hit must cover (default 70)\n	-b	HPC mode header template\n\n- Other:\n	-h	Shows program usage then quits\n\n\n"
   exit
 else
   echo ""
@@ -172,7 +172,6 @@ ${ATS} #load ATS, Hoffman2 specific module for managing submitted jobs.
 echo " "
 mkdir -p ${ODIR}/Run_info/blast_jobs
 mkdir -p ${ODIR}/Run_info/blast_logs
-mkdir -p ${ODIR}/Run_info/cut_adapt_out
 
 
 ##########################
@@ -195,7 +194,9 @@ do
  db1=${db%/}
  j=${db1#${OBI_DB}/}
  echo "..."${j}" ecoPCR is running"
- ${ecoPCR} -d ${db}${j} -e ${ERROR:=$ECOPCR_e} -l ${SHRT} -L ${LNG} ${FP} ${RP} -D 1 > ${ODIR}/${NAME}_ecoPCR/raw_out/${NAME}_${j}_ecoPCR_out
+ #-f writes one fasta amplicon per taxid, ready for blast
+ #-T removes the primer sites and drops amplicons whose primer sites have too many errors
+ ${ecoPCR} -d ${db}${j} -e ${ERROR:=$ECOPCR_e} -l ${SHRT} -L ${LNG} ${FP} ${RP} -f -T ${CDERROR:=$CUTADAPT_ERROR} > ${ODIR}/${NAME}_ecoPCR/raw_out/${NAME}_${j}_ecoPCR_out
  echo "..."${j}" ecoPCR is finished"
  echo ""
 date
@@ -210,23 +211,15 @@ echo " "
 echo " "
 echo "Part 1.2:"
 echo "Clean ${NAME} ecoPCR output for blasting"
-mkdir -p ${ODIR}/cutadapt_files
 mkdir -p ${ODIR}/${NAME}_ecoPCR/
-mkdir -p ${ODIR}/${NAME}_ecoPCR/clean_up
 mkdir -p ${ODIR}/${NAME}_ecoPCR/cleaned
-# make primer files for cutadapt step
-printf ">${NAME}_F\n${FP}\n>${NAME}_R\n${RP}" > "${ODIR}/cutadapt_files/${NAME}.fasta"
-python ${DB}/scripts/crux_format_primers_cutadapt.py ${ODIR}/cutadapt_files/${NAME}.fasta ${ODIR}/cutadapt_files/g_${NAME}.fasta ${ODIR}/cutadapt_files/a_${NAME}.fasta
-#run ecoPCR through cutadapt to verify that the primer seqeunce exists, and to trim it off
+#ecoPCR already checked and trimmed the primer sites (-T), no cutadapt pass is needed
 for str in ${ODIR}/${NAME}_ecoPCR/raw_out/*_ecoPCR_out
 do
  str1=${str%_ecoPCR_out}
  j=${str1#${ODIR}/${NAME}_ecoPCR/raw_out/}
- #reformat ecoPCR out and remove duplicate reads by taxid
- tail -n +14 ${str} |cut -d "|" -f 3,21|sed "s/ | /,/g"|awk -F"," '!_[$1]++' | sed "s/\s//g" |awk 'BEGIN { FS=","; } {print ">"$1"\n"$2}' > ${ODIR}/${NAME}_ecoPCR/clean_up/${j}_ecoPCR_blast_input.fasta
- #run cut adapt
- ${CUTADAPT} -e ${CDERROR:=$CUTADAPT_ERROR} -a file:${ODIR}/cutadapt_files/a_${NAME}.fasta  --untrimmed-output ${ODIR}/${NAME}_ecoPCR/cleaned/${j}_untrimmed_1.fasta -o ${ODIR}/${NAME}_ecoPCR/cleaned/${j}_ecoPCR_blast_input_a_clean.fasta ${ODIR}/${NAME}_ecoPCR/clean_up/${j}_ecoPCR_blast_input.fasta >> ${ODIR}/Run_info/cut_adapt_out/${j}_cutadapt-report.txt
- ${CUTADAPT} -e ${CDERROR:=$CUTADAPT_ERROR} -g file:${ODIR}/cutadapt_files/g_${NAME}.fasta  --untrimmed-output ${ODIR}/${NAME}_ecoPCR/cleaned/${j}_untrimmed_2.fasta -o ${ODIR}/${NAME}_ecoPCR/cleaned/${j}_ecoPCR_blast_input_a_and_g_clean.fasta ${ODIR}/${NAME}_ecoPCR/cleaned/${j}_ecoPCR_blast_input_a_clean.fasta >> ${ODIR}/Run_info/cut_adapt_out/${j}_cutadapt-report.txt
+ #ecoPCR out is already in fasta format, deduplicated by taxid
+ mv ${str} ${ODIR}/${NAME}_ecoPCR/cleaned/${j}_ecoPCR_blast_input_a_and_g_clean.fasta
  echo "..."${j}" is clean"
 date
 done
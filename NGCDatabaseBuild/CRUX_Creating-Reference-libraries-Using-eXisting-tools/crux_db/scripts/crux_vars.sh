@@ -9,7 +9,7 @@
 # EcoPCR parameters
 ECOPCR_e="3"						# max errors allowed by oligonucleotide (0 by default)
 
-CUTADAPT_ERROR=".3"   # Cutadapt max error allowed between primer and query sequence
+CUTADAPT_ERROR=".3"   # max primer site error rate (errors / primer length) kept by ecoPCR -T
 
 
 # BLAST 1 parameters
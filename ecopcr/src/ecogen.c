@@ -0,0 +1,769 @@
+#include "libecoPCR/ecoPCR.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <getopt.h>
+
+#define VERSION "0.1"
+
+/*
+ * ranks of the generated taxonomy, from the root to the leaves :
+ * a taxonomy of depth d uses the last d ranks
+ */
+#define GEN_MAX_DEPTH (8)
+
+static const char *rank_names[GEN_MAX_DEPTH] = {"superkingdom",
+                                                "kingdom",
+                                                "phylum",
+                                                "class",
+                                                "order",
+                                                "family",
+                                                "genus",
+                                                "species"};
+
+static const char *root_rank = "no rank";
+
+/*
+ * generated taxon : taxids are given level by level, from 1 for
+ * the root, the taxon index is taxid - 1
+ */
+typedef struct {
+	int32_t rank;		// index in the sorted .rdx ranks
+	int32_t parent;		// index of the parent taxon
+	char    *name;
+} ecogentaxon_t;
+
+/*
+ * xorshift64* : the same seed gives the same database
+ * on every host
+ */
+static uint64_t random_state = 1;
+
+static uint64_t next_random(void)
+{
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+
+	return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void seed_random(uint64_t seed)
+{
+	int32_t i;
+
+	random_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+	if (!random_state)
+		random_state = 1;
+
+	for (i=0; i < 8; i++)
+		next_random();
+}
+
+/**
+ * @return	a random number in [0,1[
+ */
+static double uniform_random(void)
+{
+	return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @return	a random integer in [from,to]
+ */
+static int32_t random_between(int32_t from,int32_t to)
+{
+	return from + (int32_t)(next_random() % (uint64_t)(to - from + 1));
+}
+
+/**
+ * Bases matched by an IUPAC code, as a mask of A=1, C=2, G=4, T=8
+ * @return	the mask, 0 for an unknown code
+ */
+static int32_t iupac_mask(char code)
+{
+	switch (toupper(code))
+	{
+		case 'A': return 1;
+		case 'C': return 2;
+		case 'G': return 4;
+		case 'T': return 8;
+		case 'U': return 8;
+		case 'R': return 1|4;
+		case 'Y': return 2|8;
+		case 'S': return 2|4;
+		case 'W': return 1|8;
+		case 'K': return 4|8;
+		case 'M': return 1|2;
+		case 'B': return 2|4|8;
+		case 'D': return 1|4|8;
+		case 'H': return 1|2|8;
+		case 'V': return 1|2|4;
+		case 'N': return 1|2|4|8;
+	}
+
+	return 0;
+}
+
+/**
+ * Draw one of the bases of a mask
+ */
+static char random_base(int32_t mask)
+{
+	static const char bases[4] = {'A','C','G','T'};
+	int32_t count = 0;
+	int32_t chosen[4];
+	int32_t i;
+
+	for (i=0; i < 4; i++)
+		if (mask & (1 << i))
+			chosen[count++] = i;
+
+	return bases[chosen[next_random() % count]];
+}
+
+static char complement(char base)
+{
+	switch (base)
+	{
+		case 'A': return 'T';
+		case 'C': return 'G';
+		case 'G': return 'C';
+		case 'T': return 'A';
+	}
+
+	return base;
+}
+
+static void reverse_complement(char *seq,int32_t length)
+{
+	int32_t i;
+	char    c;
+
+	for (i=0; i < length / 2; i++)
+	{
+		c = complement(seq[i]);
+		seq[i] = complement(seq[length-i-1]);
+		seq[length-i-1] = c;
+	}
+
+	if (length % 2)
+		seq[length/2] = complement(seq[length/2]);
+}
+
+/**
+ * Draw a background sequence with the given GC content
+ */
+static void random_sequence(char *seq,int32_t length,double gc)
+{
+	int32_t i;
+	double  draw;
+
+	for (i=0; i < length; i++)
+	{
+		draw = uniform_random();
+
+		if (draw < gc)
+			seq[i] = (draw < gc / 2) ? 'G':'C';
+		else
+			seq[i] = (draw < gc + (1 - gc) / 2) ? 'A':'T';
+	}
+}
+
+/**
+ * Write a primer site : every base matches the primer, except
+ * the ones drawn as mismatches, at most maxerr of them
+ * @param	site	receives the site, primer length bases
+ * @param	primer	the primer, IUPAC codes allowed
+ * @param	rate	mismatch probability of a base
+ * @param	maxerr	maximum mismatch count
+ *
+ * @return	the mismatch count
+ */
+static int32_t plant_primer(char *site,const char *primer,double rate,int32_t maxerr)
+{
+	int32_t errors = 0;
+	int32_t mask;
+	int32_t i;
+
+	for (i=0; primer[i]; i++)
+	{
+		mask = iupac_mask(primer[i]);
+
+		if (mask != 15 && errors < maxerr && uniform_random() < rate)
+		{
+			site[i] = random_base(15 & ~mask);
+			errors++;
+		}
+		else
+			site[i] = random_base(mask);
+	}
+
+	return errors;
+}
+
+/**
+ * Store a big endian integer in a record buffer
+ */
+static void store_int32(char *record,int32_t value)
+{
+	if (is_big_endian())
+		value = swap_int32_t(value);
+
+	memcpy(record,&value,sizeof(int32_t));
+}
+
+static int compare_strings(const void *s1,const void *s2)
+{
+	return strcmp(*(const char**)s1,*(const char**)s2);
+}
+
+/*
+ * scientific names are sorted as by ecoPCRFormat.py,
+ * on their uppercase letters
+ */
+static ecogentaxon_t *sorted_taxa = NULL;
+
+static int compare_names(const void *t1,const void *t2)
+{
+	const unsigned char *a = (const unsigned char*)sorted_taxa[*(const int32_t*)t1].name;
+	const unsigned char *b = (const unsigned char*)sorted_taxa[*(const int32_t*)t2].name;
+
+	while (*a && toupper(*a) == toupper(*b))
+	{
+		a++;
+		b++;
+	}
+
+	return toupper(*a) - toupper(*b);
+}
+
+static FILE *create_taxonomy_file(const char *prefix,const char *extension)
+{
+	char filename[1024];
+
+	snprintf(filename,1024,"%s.%s",prefix,extension);
+
+	fprintf(stderr,"# Writing file %s\n",filename);
+
+	return create_ecorecorddb(filename);
+}
+
+static FILE *create_shard(const char *prefix,int32_t index)
+{
+	char filename[1024];
+
+	snprintf(filename,1024,"%s_%03d.sdx",prefix,index);
+
+	fprintf(stderr,"# Writing file %s\n",filename);
+
+	return create_ecorecorddb(filename);
+}
+
+/**
+ * Build the taxonomy : a root and depth levels below it,
+ * every taxon of a level having fanout children
+ * @param	count	receives the taxon count
+ * @param	leaves	receives the index of the first leaf
+ *
+ * @return	the taxa, sorted by taxid
+ */
+static ecogentaxon_t *build_taxonomy(int32_t depth,int32_t fanout,
+		                             int32_t *count,int32_t *leaves)
+{
+	ecogentaxon_t *taxa;
+	const char    *labels[GEN_MAX_DEPTH+1];
+	int32_t       levelrank[GEN_MAX_DEPTH+1];
+	int64_t       total  = 1;
+	int64_t       width  = 1;
+	int32_t       first  = 0;	// first taxon of the previous level
+	int32_t       next   = 1;
+	int32_t       level;
+	int32_t       i;
+	int32_t       j;
+
+	for (level=1; level <= depth; level++)
+	{
+		width *= fanout;
+		total += width;
+		if (total > 100000000)
+			ECOERROR(ECO_ASSERT_ERROR,"Taxonomy too large, lower its depth or fan-out");
+	}
+
+	/* ranks are numbered in the name order of the .rdx file */
+
+	labels[0] = root_rank;
+	for (level=1; level <= depth; level++)
+		labels[level] = rank_names[GEN_MAX_DEPTH - depth + level - 1];
+
+	for (level=0; level <= depth; level++)
+	{
+		levelrank[level] = (strcmp(root_rank,labels[level]) < 0);
+		for (i=0; i < GEN_MAX_DEPTH; i++)
+			if (strcmp(rank_names[i],labels[level]) < 0)
+				levelrank[level]++;
+	}
+
+	taxa = ECOMALLOC(sizeof(ecogentaxon_t) * total,"Allocate taxonomy");
+
+	taxa[0].rank   = levelrank[0];
+	taxa[0].parent = 0;
+	taxa[0].name   = ECOMALLOC(5,"Allocate taxon name");
+	strcpy(taxa[0].name,"root");
+
+	for (level=1, width=1; level <= depth; level++)
+	{
+		for (i=first; i < first + width; i++)
+			for (j=0; j < fanout; j++, next++)
+			{
+				taxa[next].rank   = levelrank[level];
+				taxa[next].parent = i;
+				taxa[next].name   = ECOMALLOC(strlen(labels[level]) + 12,
+				                              "Allocate taxon name");
+				sprintf(taxa[next].name,"%c%s %d",
+				        toupper(labels[level][0]),labels[level]+1,next+1);
+			}
+
+		first += width;
+		width *= fanout;
+	}
+
+	*count  = total;
+	*leaves = first;
+
+	return taxa;
+}
+
+/**
+ * Write the .rdx, .tdx and .ndx files of the taxonomy. The .rdx
+ * file holds every rank, ecoPCR looks for them whatever the depth.
+ */
+static void write_taxonomy(const char *prefix,ecogentaxon_t *taxa,int32_t count)
+{
+	const char *labels[GEN_MAX_DEPTH+1];
+	char       *record = NULL;
+	int32_t    size    = 0;
+	int32_t    *order;
+	int32_t    namelength;
+	int32_t    classlength;
+	int32_t    i;
+	FILE       *f;
+
+	labels[0] = root_rank;
+	for (i=0; i < GEN_MAX_DEPTH; i++)
+		labels[i+1] = rank_names[i];
+
+	qsort(labels,GEN_MAX_DEPTH+1,sizeof(char*),compare_strings);
+
+	f = create_taxonomy_file(prefix,"rdx");
+
+	for (i=0; i <= GEN_MAX_DEPTH; i++)
+		write_ecorecord(f,(void*)labels[i],strlen(labels[i]));
+
+	close_ecorecorddb(f,GEN_MAX_DEPTH+1);
+
+	/* .tdx : taxid, rank, parent index and name */
+
+	f = create_taxonomy_file(prefix,"tdx");
+
+	for (i=0; i < count; i++)
+	{
+		namelength = strlen(taxa[i].name);
+
+		if (16 + namelength > size)
+		{
+			size = 16 + namelength + 64;
+			if (record)
+				record = ECOREALLOC(record,size,"Increase record buffer");
+			else
+				record = ECOMALLOC(size,"Allocate record buffer");
+		}
+
+		store_int32(record,i+1);
+		store_int32(record+4,taxa[i].rank);
+		store_int32(record+8,taxa[i].parent);
+		store_int32(record+12,namelength);
+		memcpy(record+16,taxa[i].name,namelength);
+
+		write_ecorecord(f,record,16 + namelength);
+	}
+
+	close_ecorecorddb(f,count);
+
+	/* .ndx : the scientific names, sorted */
+
+	order = ECOMALLOC(sizeof(int32_t) * count,"Allocate name order");
+
+	for (i=0; i < count; i++)
+		order[i] = i;
+
+	sorted_taxa = taxa;
+	qsort(order,count,sizeof(int32_t),compare_names);
+
+	classlength = strlen("scientific name");
+
+	f = create_taxonomy_file(prefix,"ndx");
+
+	for (i=0; i < count; i++)
+	{
+		namelength = strlen(taxa[order[i]].name);
+
+		if (16 + namelength + classlength > size)
+		{
+			size = 16 + namelength + classlength + 64;
+			record = ECOREALLOC(record,size,"Increase record buffer");
+		}
+
+		store_int32(record,1);
+		store_int32(record+4,namelength);
+		store_int32(record+8,classlength);
+		store_int32(record+12,order[i]);
+		memcpy(record+16,taxa[order[i]].name,namelength);
+		memcpy(record+16+namelength,"scientific name",classlength);
+
+		write_ecorecord(f,record,16 + namelength + classlength);
+	}
+
+	close_ecorecorddb(f,count);
+
+	ECOFREE(order,"Free name order");
+	ECOFREE(record,"Free record buffer");
+}
+
+/* ----------------------------------------------- */
+/* printout help                                   */
+/* ----------------------------------------------- */
+#define PP fprintf(stdout,
+
+static void PrintHelp()
+{
+        PP      "------------------------------------------\n");
+        PP      " ecogen Version %s\n", VERSION);
+        PP      "------------------------------------------\n");
+        PP      "synopsis : generate a synthetic database (.rdx, .tdx, .ndx\n");
+        PP      "           and .sdx files) with primer sites planted in\n");
+        PP      "           its sequences\n");
+        PP      "usage: ecogen [options] -o database [primer1 primer2]\n");
+        PP      "------------------------------------------\n");
+        PP      "options:\n");
+        PP      "-A : maximum [A]mplicon length between the primer sites\n");
+        PP      "     (300 by default)\n\n");
+        PP      "-a : minimum [A]mplicon length between the primer sites\n");
+        PP      "     (50 by default)\n\n");
+        PP      "-D : [D]epth of the taxonomy below its root (%d by default, 1 to %d).\n",
+                GEN_MAX_DEPTH,GEN_MAX_DEPTH);
+        PP      "     The leaves are species, their ancestors genus, family...\n\n");
+        PP      "-e : maximum number of [E]rrors planted in a primer site\n");
+        PP      "     (3 by default)\n\n");
+        PP      "-F : [F]an-out, the number of children of every taxon that is\n");
+        PP      "     not a leaf (4 by default)\n\n");
+        PP      "-g : [G]C content of the sequences, between 0 and 1\n");
+        PP      "     (0.5 by default)\n\n");
+        PP      "-h : [H]elp - print <this> help\n\n");
+        PP      "-L : maximum sequence [L]ength (5000 by default)\n\n");
+        PP      "-l : minimum sequence [L]ength (500 by default)\n\n");
+        PP      "-m : [M]ismatch probability of a primer site base (0 by default)\n\n");
+        PP      "-n : [N]umber of sequences (10000 by default)\n\n");
+        PP      "-o : [O]utput database prefix\n\n");
+        PP      "-p : [P]roportion of the sequences holding a primer site pair\n");
+        PP      "     (0.5 by default)\n\n");
+        PP      "-S : [S]eed of the random generator (1 by default)\n\n");
+        PP      "-s : number of sequences per [S]equence file (0 by default, a\n");
+        PP      "     single file)\n\n");
+        PP      "------------------------------------------\n");
+        PP      "first argument : oligonucleotide for direct strand\n\n");
+        PP      "second argument : oligonucleotide for reverse strand\n\n");
+        PP      "------------------------------------------\n");
+        PP      "Sequence lengths are drawn uniformly between -l and -L and\n");
+        PP      "the sequences are spread uniformly over the species.\n");
+        PP      "A planted amplicon is the first primer, -a to -A random\n");
+        PP      "bases and the reverse complement of the second primer,\n");
+        PP      "on the direct or the reverse strand. Each base of a site\n");
+        PP      "is a mismatch with the -m probability, up to -e mismatches\n");
+        PP      "per site. The definition of a sequence gives the position,\n");
+        PP      "the strand and the mismatch counts of its amplicon.\n");
+        PP      "The same options and seed give the same database.\n");
+        PP      "------------------------------------------\n\n");
+}
+
+#undef PP
+
+/* ----------------------------------------------- */
+/* printout usage and exit                         */
+/* ----------------------------------------------- */
+
+#define PP fprintf(stderr,
+
+static void ExitUsage(stat)
+        int stat;
+{
+        PP      "usage: ecogen [-h] [-D depth] [-F fanout] [-n count] [-l length] [-L length]\n");
+        PP      "              [-g gc] [-s count] [-S seed] [-p proportion] [-m rate] [-e count]\n");
+        PP      "              [-a length] [-A length] -o database [primer1 primer2]\n");
+        PP      "type \"ecogen -h\" for help\n");
+
+        if (stat)
+            exit(stat);
+}
+
+#undef  PP
+
+/* ----------------------------------------------- */
+/* MAIN						                       */
+/* ----------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+	int32_t         carg;
+	int32_t         errflag      = 0;
+	int32_t         depth        = GEN_MAX_DEPTH;	// taxonomy levels below the root
+	int32_t         fanout       = 4;		// children of an inner taxon
+	int32_t         count        = 10000;	// sequences
+	int32_t         minlength    = 500;		// sequence length range
+	int32_t         maxlength    = 5000;
+	int32_t         minamplicon  = 50;		// bases between the primer sites
+	int32_t         maxamplicon  = 300;
+	int32_t         shard_size   = 0;		// sequences per .sdx file
+	int32_t         maxerr       = 3;		// mismatches per primer site
+	double          gc           = 0.5;
+	double          planted      = 0.5;		// sequences holding a site pair
+	double          rate         = 0.0;		// mismatch probability of a site base
+	unsigned long long seed      = 1;
+	char            *output      = NULL;	// generated database
+	char            *primer1     = NULL;
+	char            *primer2     = NULL;
+
+	ecogentaxon_t   *taxa;
+	int32_t         taxcount;
+	int32_t         leaves;
+
+	ecoseq_t        seq;
+	char            AC[20];
+	char            DE[128];
+	char            *SQ;
+	int32_t         length;
+	int32_t         length1      = 0;
+	int32_t         length2      = 0;
+	int32_t         amplicon;
+	int32_t         position;
+	int32_t         error1;
+	int32_t         error2;
+	int32_t         reverse;
+	int32_t         sites        = 0;
+	int64_t         bases        = 0;
+	int32_t         i;
+
+	FILE            *shard       = NULL;
+	int32_t         shard_idx    = 0;
+	int32_t         in_shard     = 0;
+
+	while ((carg = getopt(argc, argv, "hA:a:D:e:F:g:L:l:m:n:o:p:S:s:")) != -1) {
+
+		switch (carg) {
+	        /* -------------------- */
+	        case 'A':     /* max amplicon length */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&maxamplicon);
+	          break;
+
+	        /* -------------------- */
+	        case 'a':     /* min amplicon length */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&minamplicon);
+	          break;
+
+	        /* -------------------- */
+	        case 'D':     /* taxonomy depth    */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&depth);
+	          break;
+
+	        /* -------------------- */
+	        case 'e':     /* errors per site   */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&maxerr);
+	          break;
+
+	        /* -------------------- */
+	        case 'F':     /* taxonomy fan-out  */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&fanout);
+	          break;
+
+	        /* -------------------- */
+	        case 'g':     /* GC content        */
+	        /* -------------------- */
+	          sscanf(optarg,"%lf",&gc);
+	          break;
+
+	        /* -------------------- */
+	        case 'h':     /* help              */
+	        /* -------------------- */
+	          PrintHelp();
+	          exit(0);
+	          break;
+
+	        /* -------------------- */
+	        case 'L':     /* max sequence length */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&maxlength);
+	          break;
+
+	        /* -------------------- */
+	        case 'l':     /* min sequence length */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&minlength);
+	          break;
+
+	        /* -------------------- */
+	        case 'm':     /* mismatch rate     */
+	        /* -------------------- */
+	          sscanf(optarg,"%lf",&rate);
+	          break;
+
+	        /* -------------------- */
+	        case 'n':     /* sequence count    */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&count);
+	          break;
+
+	        /* -------------------- */
+	        case 'o':     /* output name       */
+	        /* -------------------- */
+	          output = ECOMALLOC(strlen(optarg)+1,
+	                             "Error on output allocation");
+	          strcpy(output,optarg);
+	          break;
+
+	        /* -------------------- */
+	        case 'p':     /* planted proportion */
+	        /* -------------------- */
+	          sscanf(optarg,"%lf",&planted);
+	          break;
+
+	        /* -------------------- */
+	        case 'S':     /* random seed       */
+	        /* -------------------- */
+	          sscanf(optarg,"%llu",&seed);
+	          break;
+
+	        /* -------------------- */
+	        case 's':     /* sequences per file */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&shard_size);
+	          break;
+
+	        case '?':     /* bad option        */
+	          errflag++;
+		}
+	}
+
+	if (optind + 2 == argc)
+	{
+		primer1 = argv[optind];
+		primer2 = argv[optind+1];
+		length1 = strlen(primer1);
+		length2 = strlen(primer2);
+
+		for (i=0; i < length1; i++)
+			if (!iupac_mask(primer1[i]))
+				errflag++;
+
+		for (i=0; i < length2; i++)
+			if (!iupac_mask(primer2[i]))
+				errflag++;
+	}
+	else if (optind != argc)
+		errflag++;
+
+	if (!output || depth < 1 || depth > GEN_MAX_DEPTH || fanout < 1 ||
+		count < 1 || minlength < 1 || maxlength < minlength ||
+		minamplicon < 0 || maxamplicon < minamplicon ||
+		shard_size < 0 || maxerr < 0 ||
+		gc < 0 || gc > 1 || planted < 0 || planted > 1 || rate < 0 || rate > 1 ||
+		length1 > MAX_PAT_LEN || length2 > MAX_PAT_LEN ||
+		(primer1 && (!length1 || !length2)))
+		errflag++;
+
+	if (errflag)
+		ExitUsage(errflag);
+
+	seed_random(seed);
+
+	taxa = build_taxonomy(depth,fanout,&taxcount,&leaves);
+	write_taxonomy(output,taxa,taxcount);
+
+	SQ = ECOMALLOC(maxlength+1,"Allocate sequence buffer");
+
+	seq.AC = AC;
+	seq.DE = DE;
+	seq.SQ = SQ;
+
+	for (i=0; i < count; i++)
+	{
+		if (shard && shard_size && in_shard == shard_size)
+		{
+			close_ecorecorddb(shard,in_shard);
+			shard = NULL;
+		}
+
+		if (!shard)
+		{
+			shard    = create_shard(output,++shard_idx);
+			in_shard = 0;
+		}
+
+		length = random_between(minlength,maxlength);
+		random_sequence(SQ,length,gc);
+
+		snprintf(AC,sizeof(AC),"SYN%07d",i+1);
+		strcpy(DE,"synthetic sequence");
+
+		/* amplicon : primer1, random bases, reverse complement of primer2 */
+
+		if (primer1 && uniform_random() < planted &&
+			length >= length1 + minamplicon + length2)
+		{
+			amplicon = random_between(minamplicon,
+			                          (maxamplicon < length - length1 - length2) ?
+			                           maxamplicon : length - length1 - length2);
+			amplicon+= length1 + length2;
+			position = random_between(0,length - amplicon);
+			reverse  = next_random() & 1;
+
+			error1 = plant_primer(SQ+position,primer1,rate,maxerr);
+			error2 = plant_primer(SQ+position+amplicon-length2,primer2,rate,maxerr);
+			reverse_complement(SQ+position+amplicon-length2,length2);
+
+			if (reverse)
+			{
+				reverse_complement(SQ,length);
+				position = length - position - amplicon;
+			}
+
+			snprintf(DE,sizeof(DE),
+			         "synthetic sequence; amplicon %d..%d on %s strand; errors %d %d",
+			         position+1,position+amplicon,(reverse) ? "reverse":"direct",
+			         error1,error2);
+			sites++;
+		}
+
+		seq.taxid     = random_between(leaves,taxcount-1);
+		seq.SQ_length = length;
+
+		write_ecoseq(shard,&seq,0);
+
+		bases += length;
+		in_shard++;
+	}
+
+	if (shard)
+		close_ecorecorddb(shard,in_shard);
+
+	fprintf(stderr,"# %d taxa, %d sequences of %lld bases, %d amplicons planted\n",
+	        taxcount,count,(long long)bases,sites);
+
+	return 0;
+}
@@ -43,6 +43,21 @@ void getLineContent(char *stream, ecoseq_t *seq, ecoseq_t *oligoseq_1, ecoseq_t
 	}
 }
 
+/**
+ * Fill the sequence and oligo structures from an amplicon
+ * read in a binary ecoPCR result file
+ **/
+void getResultContent(ecoresult_t *result, ecotaxonomy_t *taxonomy, ecoseq_t *seq, ecoseq_t *oligoseq_1, ecoseq_t *oligoseq_2){
+	
+	seq->AC				  = result->AC;
+	seq->taxid			  = taxonomy->taxons->taxon[result->taxon].taxid;
+	seq->SQ				  = result->amplicon;
+	seq->SQ_length		  = strlen(result->amplicon);
+	oligoseq_1->SQ		  = result->oligo1;
+	oligoseq_1->SQ_length = strlen(result->oligo1);
+	oligoseq_2->SQ		  = result->oligo2;
+	oligoseq_2->SQ_length = strlen(result->oligo2);
+}
 
 void freememory(char **tab, int32_t num){
 	int32_t i;
@@ -95,7 +110,7 @@ static void PrintHelp()
         PP      " -r    : [R]estrict search to subtree under given taxomic id\n\n");
         PP      " -v    : in[V]ert the sense of matching, to select non-matching lines.\n\n");
         PP      " argument:\n");
-        PP      " ecoPCR ouput file name\n");
+        PP      " ecoPCR ouput file name, either a text or a binary (-b) result file\n");
         PP      "------------------------------------------\n\n");
         PP		" http://www.grenoble.prabi.fr/trac/ecoPCR/\n");
         PP      "------------------------------------------\n\n");
@@ -156,6 +171,8 @@ int main(int argc, char **argv){
 	int32_t       	*ignored_taxid		= NULL;		// stores the ignored taxid
 
 	FILE			*file				= NULL;		// stores the data stream, stdin by default
+	ecoresultfile_t	*binary				= NULL;		// stores the binary result file
+	ecoresult_t		*result				= NULL;		// stores the current binary result
 	char			*stream				= ECOMALLOC(sizeof(char *)*LINE_BUFF_SIZE,"error stream buffer allocation"); 
 	char			*orig				= ECOMALLOC(sizeof(char *)*LINE_BUFF_SIZE,"error orig buffer allocation"); 
 
@@ -312,7 +329,15 @@ int main(int argc, char **argv){
 
 		matchingresult = 0;
 
-		if ( (file = fopen(argv[optind], "r")) == NULL)
+		binary = NULL;
+		file   = NULL;
+		
+		if (is_ecoresult_file(argv[optind]))
+		{
+			binary = open_ecoresult(argv[optind],taxonomy);
+			printf("# Processing %s...\n",argv[optind]);
+		}
+		else if ( (file = fopen(argv[optind], "r")) == NULL)
 		{
 			if (isatty(fileno(stdin)) == 0)
 			{
@@ -325,16 +350,23 @@ int main(int argc, char **argv){
 		else
 			printf("# Processing %s...\n",argv[optind]);
 		
-		while( fgets(stream, LINE_BUFF_SIZE, file) != NULL ){
+		while( (binary) ? (result = readnext_ecoresult(binary)) != NULL
+		                : fgets(stream, LINE_BUFF_SIZE, file) != NULL ){
 		 		
-		 	if (stream[0]!= '#')
+		 	if (binary)
+		 		getResultContent(result,taxonomy,seq,oligoseq_1,oligoseq_2);
+		 		
+		 	if (binary || stream[0]!= '#')
 		 	{
 		 		
-		 		stream[LINE_BUFF_SIZE-1]=0;
+		 		if (!binary)
+		 		{
+		 			stream[LINE_BUFF_SIZE-1]=0;
 		 		
-		 		strcpy(orig,stream);
+		 			strcpy(orig,stream);
 		 		
-				getLineContent(stream,seq,oligoseq_1,oligoseq_2);	
+					getLineContent(stream,seq,oligoseq_1,oligoseq_2);	
+		 		}
 
 				/* -----------------------------------------------*/
 				/* is ignored if at least one option -i 		  */
@@ -380,14 +412,21 @@ int main(int argc, char **argv){
 			       			
 				if 	( good )
 				{
-					printf("%s",orig);
+					if (binary)
+						print_ecoresult(stdout,result,taxonomy,binary->head.kingdom_mode);
+					else
+						printf("%s",orig);
 	     			matchingresult++;
 				}
 		 	}
 		}
-		if ( file != stdin )
+		if (binary)
+			close_ecoresult(binary);
+		else if ( file != stdin )
     		fclose(file);
     		
+		flush_ecoresult(stdout);
+		
     	printf("# %d matching result(s)\n#\n",matchingresult);
 	}
 	 	
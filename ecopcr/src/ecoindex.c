@@ -0,0 +1,164 @@
+#include "libecoPCR/ecoPCR.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#define VERSION "0.1"
+
+/* ----------------------------------------------- */
+/* printout help                                   */
+/* ----------------------------------------------- */
+#define PP fprintf(stdout,
+
+static void PrintHelp()
+{
+        PP      "------------------------------------------\n");
+        PP      " ecoindex Version %s\n", VERSION);
+        PP      "------------------------------------------\n");
+        PP      "synopsis : build the FM-index (.fdx), the k-mer index (.kdx),\n");
+        PP      "           the taxonomy snapshot (.cdx), the shared memory\n");
+        PP      "           image or the manifest (.mdx) of a database\n");
+        PP      "usage: ecoindex [options] -d database\n");
+        PP      "------------------------------------------\n");
+        PP      "options:\n");
+        PP      "-d : [D]atabase to index : to match the expected format, the database\n");
+        PP      "     has to be formated first by the ecoPCRFormat.py program located.\n");
+        PP      "     in the tools directory.\n\n");
+        PP      "-h : [H]elp - print <this> help\n\n");
+        PP      "-k : build the [K]-mer index instead of the FM-index, with k-mers\n");
+        PP      "     of the given length (%d to %d, %d suits most primers).\n\n",
+                KMERIDX_MIN_K,KMERIDX_MAX_K,KMERIDX_DEFAULT_K);
+        PP      "-M : add the new or changed .sdx and .ldx files of the database\n");
+        PP      "     to its [M]anifest, under the next database version.\n\n");
+        PP      "-m : build the [M]emory image of the taxonomy and of the uncompressed\n");
+        PP      "     sequences in the given file, for instance in /dev/shm.\n\n");
+        PP      "-t : build the [T]axonomy snapshot : the taxonomy as columns mapped\n");
+        PP      "     without parsing, with the lineage and the subtree of each taxon.\n\n");
+        PP      "------------------------------------------\n");
+        PP      "When the index exists, ecoPCR looks for the primers in it\n");
+        PP      "and only reads the sequences where both primers of a\n");
+        PP      "strand are found. The index is ignored once an .sdx file\n");
+        PP      "changes and has to be built again. Building the FM-index\n");
+        PP      "needs about 17 bytes of memory per base, the k-mer index\n");
+        PP      "about 5.\n");
+        PP      "The k-mer index is used when primers split in one piece\n");
+        PP      "per allowed error give pieces of at least k bases.\n");
+        PP      "When the ECOPCRIMAGE environment variable gives the name\n");
+        PP      "of a memory image, the programs using the database named\n");
+        PP      "as with -d map the image instead of reading the files :\n");
+        PP      "concurrent jobs of a node share a single copy of the\n");
+        PP      "database. The image is refused once an .sdx, .tdx, .rdx\n");
+        PP      "or .ldx file changes and has to be built again.\n");
+        PP      "The taxonomy snapshot is used as long as it is younger\n");
+        PP      "than the .rdx, .tdx and .ldx files.\n");
+        PP      "The manifest lists the files of the database with the\n");
+        PP      "version where they appeared, their record count, size and\n");
+        PP      "crc32. ecoPCR -n reads only the files newer than a version.\n");
+        PP      "------------------------------------------\n\n");
+}
+
+#undef PP
+
+/* ----------------------------------------------- */
+/* printout usage and exit                         */
+/* ----------------------------------------------- */
+
+#define PP fprintf(stderr,
+
+static void ExitUsage(stat)
+        int stat;
+{
+        PP      "usage: ecoindex [-h] [-k size | -m image | -t | -M] -d database\n");
+        PP      "type \"ecoindex -h\" for help\n");
+
+        if (stat)
+            exit(stat);
+}
+
+#undef  PP
+
+/* ----------------------------------------------- */
+/* MAIN						                       */
+/* ----------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+	int32_t  carg;
+	int32_t  errflag = 0;
+	char     *prefix = NULL;
+	int32_t  k       = 0;
+	char     *image  = NULL;
+	int32_t  snapshot= 0;
+	int32_t  manifest= 0;
+
+	while ((carg = getopt(argc, argv, "hd:k:Mm:t")) != -1) {
+
+		switch (carg) {
+	        /* -------------------- */
+	        case 'd':     /* database name     */
+	        /* -------------------- */
+	          prefix = ECOMALLOC(strlen(optarg)+1,
+	                             "Error on prefix allocation");
+	          strcpy(prefix,optarg);
+	          break;
+
+	        /* -------------------- */
+	        case 'h':     /* help              */
+	        /* -------------------- */
+	          PrintHelp();
+	          exit(0);
+	          break;
+
+	        /* -------------------- */
+	        case 'k':     /* k-mer index       */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&k);
+	          if (k < KMERIDX_MIN_K || k > KMERIDX_MAX_K)
+	          	errflag++;
+	          break;
+
+	        /* -------------------- */
+	        case 'M':     /* manifest          */
+	        /* -------------------- */
+	          manifest = 1;
+	          break;
+
+	        /* -------------------- */
+	        case 'm':     /* memory image      */
+	        /* -------------------- */
+	          image = optarg;
+	          break;
+
+	        /* -------------------- */
+	        case 't':     /* taxonomy snapshot */
+	        /* -------------------- */
+	          snapshot = 1;
+	          break;
+
+	        case '?':     /* bad option        */
+	          errflag++;
+		}
+	}
+
+	if (!prefix || optind < argc || (!!k + !!image + snapshot + manifest > 1))
+		errflag++;
+
+	if (errflag)
+		ExitUsage(errflag);
+
+	if (manifest)
+		update_manifest(prefix);
+	else if (snapshot)
+		build_taxsnapshot(prefix);
+	else if (image)
+		build_ecoimage(prefix,image);
+	else if (k)
+		build_kmeridx(prefix,k);
+	else
+		build_fmindex(prefix);
+
+	ECOFREE(prefix,"Free prefix");
+
+	return 0;
+}
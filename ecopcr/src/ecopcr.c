@@ -4,10 +4,28 @@
 #include <string.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
 
 
 #define VERSION "1.0.1"
 
+#define STRAND_DIRECT  (1)
+#define STRAND_REVERSE (2)
+#define STRAND_BOTH    (STRAND_DIRECT | STRAND_REVERSE)
+
+#define QUERY_MAX_LENGTH (4096)
+#define QUERY_MAX_ARGS   (256)
+
+#define CHECKPOINT_PERIOD (60)		/* seconds between two checkpoints */
+
 
 /* ----------------------------------------------- */
 /* printout help                                   */                                           
@@ -24,7 +42,15 @@ static void PrintHelp()
         PP      "------------------------------------------\n");
         PP      "options:\n");
         PP      "-a    : Salt concentration in M for Tm computation (default 0.05 M)\n\n");
+        PP      "-b    : write the amplicons in the given [b]inary columnar file\n");
+        PP      "        instead of the result table. Taxa are stored as taxonomy\n");
+        PP      "        indices, oligonucleotides in a dictionary and amplicons\n");
+        PP      "        packed two bases per byte. ecogrep reads such files.\n\n");
         PP      "-c    : Consider that the database sequences are [c]ircular\n\n");
+        PP      "-C    : [C]overage mode : instead of the amplicon table, print for each\n");
+        PP      "        taxonomic rank the number of taxa selected by -r and -i present\n");
+        PP      "        in the taxonomy, having sequences in the database and having\n");
+        PP      "        at least one amplified sequence. Cannot be used with -U.\n\n");
         PP      "-d    : [D]atabase : to match the expected format, the database\n");
         PP      "        has to be formatted first by the ecoPCRFormat.py program located.\n");
         PP      "        in the tools directory.\n");
@@ -33,24 +59,100 @@ static void PrintHelp()
         PP      "            .tdx : contains information concerning the taxonomy\n");
         PP      "            .rdx : contains the taxonomy rank\n\n");
         PP      "        ecoPCR needs all the file type. As a result, you have to write the\n");
-        PP      "        database radical without any extension. For example /ecoPCRDB/gbmam\n\n");
+        PP      "        database radical without any extension. For example /ecoPCRDB/gbmam\n");
+        PP      "        When the database has an FM-index (.fdx) built by ecoindex, the\n");
+        PP      "        primers are looked for in the index and only the sequences\n");
+        PP      "        holding a primer pair are read (linear mode, not with -C and -s).\n");
+        PP      "        Without FM-index, a k-mer index (.kdx, ecoindex -k) is used the\n");
+        PP      "        same way when the primers are long enough for its k-mers.\n");
+        PP      "        On a database sorted by ecosort, the sequence blocks whose\n");
+        PP      "        q-gram summary cannot hold a primer pair are skipped.\n\n");
         PP      "-D    : Keeps the specified number of nucleotides on each side of the in silico \n");
         PP      "        amplified sequences (including the amplified DNA fragment plus the two target \n");
         PP      "        sequences of the primers).\n\n");
         PP      "-e    : [E]rror : max errors allowed by oligonucleotide (0 by default)\n\n");
+        PP      "-f    : [F]asta output : print, for each taxon, its first amplicon as a\n");
+        PP      "        fasta sequence titled by the taxid. The header is not printed and\n");
+        PP      "        sequences of taxa already reported are skipped.\n\n");
         PP      "-h    : [H]elp - print <this> help\n\n");
+        PP      "-H    : save primer [H]its found on each sequence in the given index file.\n");
+        PP      "        This index can be used by the -U option to run again the same\n");
+        PP      "        primer pair with other -l, -L, -D or -k values, or a narrower\n");
+        PP      "        -r/-i selection, without scanning the database again. Only\n");
+        PP      "        the sequences selected by -r and -i are indexed.\n\n");
         PP      "-i    : [I]gnore the given taxonomy id.\n");
         PP      "        Taxonomy id are available using the ecofind program.\n");
         PP      "        see its help typing ecofind -h for more information.\n\n");        
+        PP      "-j    : number of threads sharing the scan of the sequences (1 by\n");
+        PP      "        default). Sequences are scanned by batches, dealt to the threads\n");
+        PP      "        according to their lengths. A sequence longer than the share of\n");
+        PP      "        a thread, like a complete genome, is cut into overlapping windows\n");
+        PP      "        scanned in parallel.\n\n");
+        PP      "-K    : save a chec[K]point of the run in the given file every %d\n",CHECKPOINT_PERIOD);
+        PP      "        seconds and at the end : last sequence processed and size of\n");
+        PP      "        the results, which must be written in a file. Not available\n");
+        PP      "        with -b, -C, -f, -H and -U.\n\n");
         PP      "-k    : [K]ingdom mode : set the kingdom mode\n");
         PP      "        super kingdom mode by default.\n\n");
         PP      "-l    : minimum [L]ength : define the minimum amplication length. \n\n");
         PP      "-L    : maximum [L]ength : define the maximum amplicationlength. \n\n");
         PP      "-m    : Salt correction method for Tm computation (SANTALUCIA : 1\n");
 		PP      "        or OWCZARZY:2, default=1)\n\n");
+        PP      "-n    : only read the sequence files added or changed after the\n");
+        PP      "        given version of the database manifest (.mdx, see ecoindex\n");
+        PP      "        -M). The files left out must still have the crc32 of the\n");
+        PP      "        manifest. Not available with -U.\n\n");
+        PP      "-P    : [P]rofile the run : time spent and items processed by\n");
+        PP      "        read_ecorecord, uncompress, EncodeSequence, the primer\n");
+        PP      "        scans (ManberAll), the pairing loops (printRepeat included),\n");
+        PP      "        nparam_CalcTwoTM and printRepeat, with sequences, bases and\n");
+        PP      "        amplicons per second, printed as JSON on stderr at the end.\n");
+        PP      "        Stage times are summed over the threads.\n\n");
+        PP      "-R    : [R]esume the run saved by -K : results written after the\n");
+        PP      "        checkpoint are removed and the sequences before it skipped.\n");
+        PP      "        The results must be appended to the ones of the first run\n");
+        PP      "        (ecoPCR ... -K run.ckp -R >> results). Without checkpoint\n");
+        PP      "        file, the run starts again from the beginning. A checkpoint\n");
+        PP      "        saved with other primers, -e, -l, -L, -D, -c, -k, -S, -T, -r,\n");
+        PP      "        -i, -a, -m or -n values is refused.\n\n");
         PP      "-r    : [R]estricts the search to the given taxonomic id.\n");
         PP      "        Taxonomy id are available using the ecofind program.\n");
-        PP      "        see its help typing ecofind -h for more information.\n\n");
+        PP      "        see its help typing ecofind -h for more information.\n");
+        PP      "        On a database sorted by ecosort, only the sequence blocks\n");
+        PP      "        holding the restricted taxa are read.\n\n");
+        PP      "-S    : [S]trands scanned : D (direct strand only), R (reverse strand\n");
+        PP      "        only) or both (default). On oriented databases, the strand\n");
+        PP      "        counts printed at the end of a run on both strands tell when\n");
+        PP      "        one of them can be skipped. Not available with -H.\n\n");
+        PP      "-s    : [S]tream sequences of at least the given length : they are\n");
+        PP      "        uncompressed and scanned by chunks, so memory use does not\n");
+        PP      "        depend on their length. Needs -L, not available with -c,\n");
+        PP      "        -H and -U.\n\n");
+        PP      "-T    : [T]rim mode : amplicons are reported without primer sites nor\n");
+        PP      "        flanking regions (-D is ignored). Amplicons with a primer site\n");
+        PP      "        error rate (errors / primer length) above the given value are\n");
+        PP      "        dropped.\n\n");
+        PP      "-U    : [U]se the primer hits stored by a former run with the -H option\n");
+        PP      "        instead of scanning the database. Primers and circular mode\n");
+        PP      "        must be the same, error count cannot be greater and -r/-i\n");
+        PP      "        cannot select a sequence the indexed run did not select.\n\n");
+        PP      "-x    : keep the result lines of each sequence file of the database\n");
+        PP      "        in the given cache directory, under a digest of the file and\n");
+        PP      "        of the primers, -e, -l, -L, -D, -c, -k, -S, -T, -r, -i, -a,\n");
+        PP      "        -m and the taxonomy. The sequence files found in the cache\n");
+        PP      "        are not read again : their results are copied. Not available\n");
+        PP      "        with -b, -C, -f, -H, -K and -U.\n\n");
+        PP      "-z    : send the query to the ecoPCR server listening on the given\n");
+        PP      "        Unix socket. The server writes the results and messages on\n");
+        PP      "        the standard output and error of this program, which exits\n");
+        PP      "        with the status of the query. Other options and the\n");
+        PP      "        primers are passed as they are : file names are relative to\n");
+        PP      "        the server directory and cannot hold spaces. The database of\n");
+        PP      "        the server is used unless -d is given.\n\n");
+        PP      "-Z    : server mode : load the taxonomy and the sequences of the\n");
+        PP      "        database once, then answer the queries sent with -z on the\n");
+        PP      "        given Unix socket, each one by a child process. No primer\n");
+        PP      "        is given to the server.\n\n");
         PP      "\n");
         PP      "------------------------------------------\n");
         PP      "first argument : oligonucleotide for direct strand\n\n");
@@ -97,7 +199,8 @@ static void PrintHelp()
 static void ExitUsage(stat)
         int stat;
 {
-        PP      "usage: ecoPCR [-d database] [-l value] [-L value] [-e value] [-r taxid] [-i taxid] [-k] oligo1 oligo2\n");
+        PP      "usage: ecoPCR [-d database] [-l value] [-L value] [-e value] [-r taxid] [-i taxid] [-k] [-C] [-f] [-j threads] [-s length] [-S D|R|both] [-T rate] [-b file] [-H file] [-U file] [-K file [-R]] [-n version] [-P] [-x directory] [-z socket] oligo1 oligo2\n");
+        PP      "       ecoPCR -Z socket [-d database]\n");
         PP      "type \"ecoPCR -h\" for help\n");
 
         if (stat)
@@ -106,105 +209,560 @@ static void ExitUsage(stat)
 
 #undef  PP
 
-void printRepeat(ecoseq_t *seq,
-				 char* primer1, char* primer2,
-				 PNNParams tparm,
-                 PatternPtr o1, PatternPtr o2,
-                 char strand, 
-                 char kingdom,
-                 int32_t pos1, int32_t pos2,
-                 int32_t err1, int32_t err2,
-                 ecotaxonomy_t *taxonomy,
-                 int32_t delta)
+/* ----------------------------------------------- */
+/* read the next sequence from a primer hit index  */
+/* ----------------------------------------------- */
+
+static ecoseq_t *nextIndexedSequence(FILE *hitidx,
+		                             const char *prefix,
+		                             SeqPtr *apatseq,
+		                             int32_t error_max,
+		                             int32_t circular)
 {
-	char     *AC;
-	int32_t  seqlength;
-	int32_t	 taxid;
-	int32_t  species_taxid;
-	int32_t  genus_taxid;
-	int32_t  family_taxid;
-	int32_t  superkingdom_taxid;
-	char     *rank;
-	char     *scientificName;
-	char     *genus_name;
-	char     *family_name;
-	char     *superkingdom_name;
-	
-	ecotx_t  *taxon;
-	ecotx_t  *main_taxon;
-	
-	char     oligo1[MAX_PAT_LEN+1];
-	char     oligo2[MAX_PAT_LEN+1];
-	
-	int32_t  error1;
-	int32_t  error2;
-	int32_t  ldelta,rdelta;
-	
-	char     *amplifia = NULL;
-	int32_t  amplength;
-	double   tm1,tm2;
-	double   tm=0;
-	
-	int32_t i;
+	SeqPtr   hits;
+	ecoseq_t *seq;
+	int32_t  file_index;
+	long     offset;
 
-	AC = seq->AC;
-	seqlength = seq->SQ_length;
+	hits = readnext_hitidx(hitidx,&file_index,&offset,*apatseq,error_max);
 
-	
-	main_taxon    = &taxonomy->taxons->taxon[seq->taxid];
-	taxid         = main_taxon->taxid;
-	scientificName= main_taxon->name;				
-	rank          = taxonomy->ranks->label[main_taxon->rank];
-	taxon         = eco_getspecies(main_taxon,taxonomy);
-	if (taxon)
+	if (!hits)
+		return NULL;
+
+	hits->circular = circular;
+	*apatseq = hits;
+
+	seq = ecoseq_fetch(prefix,file_index,offset);
+
+	if (seq->SQ_length != hits->seqlen)
+		ECOERROR(ECO_ASSERT_ERROR,"Primer hit index does not match the database");
+
+	return seq;
+}
+
+/* ----------------------------------------------- */
+/* scan batches of sequences with several threads  */
+/* ----------------------------------------------- */
+
+#define BATCH_SEQUENCES (1024)			/* max sequences in a batch */
+#define BATCH_LENGTH    (32 << 20)		/* max nucleotides in a batch */
+
+typedef struct {
+	ecoseq_t  *seq;
+	SeqPtr    apatseq;
+	int32_t   file_index;
+	long      offset;
+	int32_t   scanned;		/* hits found by the batch scan */
+	int32_t   hits;			/* hits of the sequence known by the main loop */
+	int32_t   threads;		/* threads sharing the scan of the sequence */
+} ecoscantask_t;
+
+typedef struct {
+	ecoscheduler_t *scheduler;
+	int32_t        threads;
+	PatternPtr     o1,o2,o1c,o2c;
+	int32_t        strands;
+	int32_t        circular;
+	ecotaxonomy_t  *taxonomy;
+	int32_t        *restricted_taxid;
+	int32_t        r;
+	int32_t        *ignored_taxid;
+	int32_t        g;
+	int32_t        count;
+	int32_t        current;
+	void           *todo[BATCH_SEQUENCES];
+	int64_t        cost[BATCH_SEQUENCES];
+	ecoscantask_t  task[BATCH_SEQUENCES];
+} ecoscanbatch_t;
+
+/**
+ * Look for the four primer patterns on the whole sequence of a task,
+ * the main loop clips the hits to its scanned regions
+ */
+static void scanTask(void *context,void *todo)
+{
+	ecoscanbatch_t *batch = context;
+	ecoscantask_t  *task  = todo;
+	SeqPtr         seq;
+	int32_t        end;
+
+	seq = task->apatseq = ecoseq2apatseq(task->seq,task->apatseq,batch->circular);
+	end = seq->seqlen + seq->circular;
+
+	/* both first primers are looked for in a single pass */
+	if (batch->strands == STRAND_BOTH && task->threads == 1)
+	{
+		if (ecoManberPair(seq,batch->o1,0,end,batch->o2,2,seq->seqlen))
+			ecoManberWindows(seq,batch->o2c,1,0,end,1);
+
+		if (seq->hitpos[2]->top)
+			ecoManberWindows(seq,batch->o1c,3,0,end,1);
+
+		return;
+	}
+
+	if ((batch->strands & STRAND_DIRECT) &&
+		ecoManberWindows(seq,batch->o1,0,0,end,task->threads))
+		ecoManberWindows(seq,batch->o2c,1,0,end,task->threads);
+
+	if ((batch->strands & STRAND_REVERSE) &&
+		ecoManberWindows(seq,batch->o2,2,0,seq->seqlen,task->threads))
+		ecoManberWindows(seq,batch->o1c,3,0,end,task->threads);
+}
+
+/**
+ * Scan the sequences of a batch. Sequences are scheduled by length,
+ * a sequence longer than the share of a thread is scanned alone,
+ * cut in windows.
+ */
+static void scanBatch(ecoscanbatch_t *batch)
+{
+	ecoscantask_t *task;
+	int64_t       total = 0;
+	int32_t       count = 0;
+	int32_t       i;
+
+	for (i=0; i < batch->count; i++)
+		if (batch->task[i].scanned)
+			total += batch->task[i].seq->SQ_length;
+
+	for (i=0; i < batch->count; i++)
+	{
+		task = batch->task + i;
+
+		if (!task->scanned)
+			continue;
+
+		if ((int64_t)task->seq->SQ_length * batch->threads >= total)
 		{
-			species_taxid = taxon->taxid;
-			scientificName= taxon->name;				
+			task->threads = batch->threads;
+			scanTask(batch,task);
 		}
-	else 
-		species_taxid = -1;
-		
-	taxon         = eco_getgenus((taxon) ? taxon:main_taxon,taxonomy);
-	if (taxon)
+		else
+		{
+			task->threads = 1;
+			batch->todo[count] = task;
+			batch->cost[count] = task->seq->SQ_length;
+			count++;
+		}
+	}
+
+	ecoscheduler_run(batch->scheduler,scanTask,batch,
+	                 batch->todo,batch->cost,count);
+}
+
+/**
+ * Read the next sequence of the database, the sequences being read
+ * and scanned by batches
+ * @param	prefix	name of the database to start the iteration,
+ * 					NULL to get the next sequence
+ *
+ * @return	the next sequence or NULL at the end of the database
+ */
+static ecoseq_t *nextScannedSequence(ecoscanbatch_t *batch,
+		                             const char *prefix,
+		                             ecoblockidx_t *blocks)
+{
+	ecoscantask_t *task;
+	ecoseq_t      *seq;
+	int64_t       length = 0;
+	int32_t       taxid;
+	int32_t       selected;
+
+	if (prefix || batch->current == batch->count)
+	{
+		batch->count = batch->current = 0;
+
+		seq = ecoseq_readahead(prefix,blocks);
+
+		while (seq)
 		{
-			genus_taxid = taxon->taxid;
-			genus_name= taxon->name;				
+			task = batch->task + batch->count;
+			task->seq = seq;
+			ecoseq_readahead_position(&(task->file_index),&(task->offset));
+
+			/* a slot does not keep the buffer of a much longer sequence */
+			if (task->apatseq && task->apatseq->datsiz > BATCH_LENGTH / BATCH_SEQUENCES &&
+				task->apatseq->datsiz > 2 * (seq->SQ_length + batch->circular))
+			{
+				ECOFREE(task->apatseq->data,"Free sequence data buffer");
+				task->apatseq->data   = NULL;
+				task->apatseq->datsiz = 0;
+			}
+
+			taxid    = batch->taxonomy->taxons->taxon[seq->taxid].taxid;
+			selected = !seq->stream &&
+			           (!batch->r || eco_is_taxid_included(batch->taxonomy,
+			                                               batch->restricted_taxid,
+			                                               batch->r,taxid)) &&
+			           (!batch->g || !eco_is_taxid_included(batch->taxonomy,
+			                                                batch->ignored_taxid,
+			                                                batch->g,taxid));
+
+			/* a duplicated sequence uses the hits of the one it shares */
+			task->hits    = selected;
+			task->scanned = selected && !(seq->duplicate && batch->count &&
+			                              task[-1].hits);
+
+			length += seq->SQ_length;
+			batch->count++;
+
+			if (batch->count == BATCH_SEQUENCES || length >= BATCH_LENGTH)
+				break;
+
+			seq = ecoseq_readahead(NULL,blocks);
 		}
-	else 
+
+		if (!batch->count)
+			return NULL;
+
+		scanBatch(batch);
+	}
+
+	return batch->task[batch->current++].seq;
+}
+
+/**
+ * Hits of the last sequence returned by nextScannedSequence
+ * @return	the sequence hits, NULL if it was not scanned
+ */
+static SeqPtr scannedHits(ecoscanbatch_t *batch,int32_t *file_index,long *offset)
+{
+	ecoscantask_t *task = batch->task + batch->current - 1;
+
+	*file_index = task->file_index;
+	*offset     = task->offset;
+
+	return (task->scanned) ? task->apatseq:NULL;
+}
+
+/* ----------------------------------------------- */
+/* read the sequences where the FM-index of the    */
+/* database locates a primer pair                  */
+/* ----------------------------------------------- */
+
+typedef struct {
+	ecofmindex_t *index;
+	ecofmhit_t   *hits[MAX_PATTERN];
+	int32_t      count[MAX_PATTERN];
+	int32_t      cursor[MAX_PATTERN];	/* first hit of the current sequence */
+	int32_t      record;				/* next database record */
+	SeqPtr       apatseq;
+} ecofmscan_t;
+
+/**
+ * Look for the primers in the FM-index
+ * @param	patterns	the four patterns in hit stack order,
+ * 						NULL for a pattern of a skipped strand
+ */
+static ecofmscan_t *newFMScan(ecofmindex_t *index,PatternPtr *patterns)
+{
+	ecofmscan_t *scan;
+	int32_t     i;
+
+	scan = ECOMALLOC(sizeof(ecofmscan_t),"Allocate FM-index scan");
+	scan->index = index;
+
+	for (i=0; i < MAX_PATTERN; i++)
+		if (patterns[i])
+			scan->hits[i] = search_fmindex(index,patterns[i],scan->count+i);
+
+	scan->apatseq = ECOMALLOC(sizeof(Seq),
+	                          "Error in Allocation of a new Seq structure");
+
+	for (i=0; i < MAX_PATTERN; i++)
+	{
+		if (! (scan->apatseq->hitpos[i] = NewStacki(kMinStackiSize)))
+			ECOERROR(ECO_MEM_ERROR,"Error in hit stack Allocation");
+
+		if (! (scan->apatseq->hiterr[i] = NewStacki(kMinStackiSize)))
+			ECOERROR(ECO_MEM_ERROR,"Error in error stack Allocation");
+	}
+
+	return scan;
+}
+
+static void deleteFMScan(ecofmscan_t *scan)
+{
+	int32_t i;
+
+	for (i=0; i < MAX_PATTERN; i++)
+		if (scan->hits[i])
+			ECOFREE(scan->hits[i],"Free FM-index hits");
+
+	delete_apatseq(scan->apatseq);
+	delete_fmindex(scan->index);
+	ECOFREE(scan,"Free FM-index scan");
+}
+
+/**
+ * Read the next sequence holding both primers of a strand. The hit
+ * stacks of apatseq are filled as if ManberAll had been run on the
+ * whole sequence, sequence data are not loaded.
+ *
+ * @return	the next sequence or NULL at the end of the database
+ */
+static ecoseq_t *nextFMSequence(ecofmscan_t *scan,const char *prefix,
+		                        SeqPtr *apatseq,int32_t *file_index,long *offset)
+{
+	ecofmindex_t  *index = scan->index;
+	ecofmrecord_t *record;
+	ecofmhit_t    *hits;
+	ecoseq_t      *seq;
+	int32_t       found[MAX_PATTERN];
+	int32_t       i;
+	int32_t       j;
+
+	while (scan->record < index->records)
+	{
+		record = index->record + scan->record++;
+
+		/* records sharing a sequence are consecutive and share its hits */
+
+		for (i=0; i < MAX_PATTERN; i++)
 		{
-			genus_taxid = -1;
-			genus_name  = "###";
+			hits = scan->hits[i];
+
+			while (scan->cursor[i] < scan->count[i] &&
+				   hits[scan->cursor[i]].text < record->text)
+				scan->cursor[i]++;
+
+			for (j=scan->cursor[i]; j < scan->count[i] && hits[j].text == record->text; j++);
+
+			found[i] = j - scan->cursor[i];
 		}
-	
-	taxon         = eco_getfamily((taxon) ? taxon:main_taxon,taxonomy);
-	if (taxon)
+
+		if (!((found[0] && found[1]) || (found[2] && found[3])))
+			continue;
+
+		seq = ecoseq_fetch(prefix,record->file_index,record->offset);
+
+		if (seq->SQ_length != index->start[record->text+1] - index->start[record->text] - 1)
+			ECOERROR(ECO_ASSERT_ERROR,"FM-index does not match the database");
+
+		*apatseq = scan->apatseq;
+		(*apatseq)->name     = seq->AC;
+		(*apatseq)->seqsiz   = (*apatseq)->seqlen = seq->SQ_length;
+		(*apatseq)->circular = 0;
+
+		for (i=0; i < MAX_PATTERN; i++)
 		{
-			family_taxid = taxon->taxid;
-			family_name= taxon->name;				
+			(*apatseq)->hitpos[i]->top = (*apatseq)->hiterr[i]->top = 0;
+
+			for (j=0,hits=scan->hits[i]+scan->cursor[i]; j < found[i]; j++)
+			{
+				PushiIn((*apatseq)->hitpos+i,hits[j].position);
+				PushiIn((*apatseq)->hiterr+i,hits[j].error);
+			}
 		}
-	else 
+
+		*file_index = record->file_index;
+		*offset     = record->offset;
+
+		return seq;
+	}
+
+	return NULL;
+}
+
+/* ----------------------------------------------- */
+/* read the sequences where the k-mer index of the */
+/* database gives candidates for a primer pair     */
+/* ----------------------------------------------- */
+
+typedef struct {
+	ecokmeridx_t *index;
+	PatternPtr   patterns[MAX_PATTERN];
+	ecokmerhit_t *hits[MAX_PATTERN];
+	int32_t      count[MAX_PATTERN];
+	int32_t      cursor[MAX_PATTERN];	/* first candidate of the current sequence */
+	int32_t      record;				/* next database record */
+	SeqPtr       apatseq;
+} ecokmerscan_t;
+
+/**
+ * Look for the candidate positions of the primers in the k-mer index
+ * @param	patterns	the four patterns in hit stack order,
+ * 						NULL for a pattern of a skipped strand
+ *
+ * @return	the scan, owning the index, NULL if a primer is too short
+ * 			for the index
+ */
+static ecokmerscan_t *newKmerScan(ecokmeridx_t *index,PatternPtr *patterns)
+{
+	ecokmerscan_t *scan;
+	int32_t       i;
+
+	scan = ECOMALLOC(sizeof(ecokmerscan_t),"Allocate k-mer index scan");
+	scan->index = index;
+
+	for (i=0; i < MAX_PATTERN; i++)
+		if ((scan->patterns[i] = patterns[i]) &&
+			!(scan->hits[i] = search_kmeridx(index,patterns[i],scan->count+i)))
 		{
-			family_taxid = -1;
-			family_name  = "###";
+			for (i=0; i < MAX_PATTERN; i++)
+				if (scan->hits[i])
+					ECOFREE(scan->hits[i],"Free k-mer index candidates");
+			ECOFREE(scan,"Free k-mer index scan");
+			return NULL;
 		}
-	
-	if (kingdom)
-		taxon         = eco_getkingdom((taxon) ? taxon:main_taxon,taxonomy);
-	else
-		taxon         = eco_getsuperkingdom((taxon) ? taxon:main_taxon,taxonomy);
-		
-	if (taxon)
+
+	return scan;
+}
+
+static void deleteKmerScan(ecokmerscan_t *scan)
+{
+	int32_t i;
+
+	for (i=0; i < MAX_PATTERN; i++)
+		if (scan->hits[i])
+			ECOFREE(scan->hits[i],"Free k-mer index candidates");
+
+	if (scan->apatseq)
+		delete_apatseq(scan->apatseq);
+	delete_kmeridx(scan->index);
+	ECOFREE(scan,"Free k-mer index scan");
+}
+
+/**
+ * Read the next sequence holding both primers of a strand. Candidate
+ * positions are checked on the sequence, mixed sequences are scanned
+ * entirely : the hit stacks of apatseq are filled as if ManberAll had
+ * been run on the whole sequence.
+ *
+ * @return	the next sequence or NULL at the end of the database
+ */
+static ecoseq_t *nextKmerSequence(ecokmerscan_t *scan,const char *prefix,
+		                          SeqPtr *apatseq,int32_t *file_index,long *offset)
+{
+	ecokmeridx_t  *index = scan->index;
+	ecofmrecord_t *record;
+	ecokmerhit_t  *hits;
+	ecoseq_t      *seq;
+	SeqPtr        aseq;
+	int32_t       found[MAX_PATTERN];
+	int32_t       mixed;
+	int32_t       begin;
+	int32_t       end;
+	int32_t       i;
+	int32_t       j;
+
+	while (scan->record < index->records)
+	{
+		record = index->record + scan->record++;
+		mixed  = KMERIDX_MIXED(index->mixed,record->text);
+
+		/* records sharing a sequence are consecutive and share its candidates */
+
+		for (i=0; i < MAX_PATTERN; i++)
+		{
+			hits = scan->hits[i];
+
+			while (scan->cursor[i] < scan->count[i] &&
+				   hits[scan->cursor[i]].text < record->text)
+				scan->cursor[i]++;
+
+			for (j=scan->cursor[i]; j < scan->count[i] && hits[j].text == record->text; j++);
+
+			found[i] = j - scan->cursor[i];
+		}
+
+		if (!mixed && !((found[0] && found[1]) || (found[2] && found[3])))
+			continue;
+
+		seq = ecoseq_fetch(prefix,record->file_index,record->offset);
+
+		if (seq->SQ_length != index->start[record->text+1] - index->start[record->text] - 1)
+			ECOERROR(ECO_ASSERT_ERROR,"k-mer index does not match the database");
+
+		aseq = scan->apatseq = ecoseq2apatseq(seq,scan->apatseq,0);
+
+		for (i=0; i < MAX_PATTERN; i++)
 		{
-			superkingdom_taxid = taxon->taxid;
-			superkingdom_name= taxon->name;				
+			if (!scan->patterns[i])
+				continue;
+
+			if (mixed)
+			{
+				ecoManberWindows(aseq,scan->patterns[i],i,0,aseq->seqlen,1);
+				continue;
+			}
+
+			/* overlapping candidate windows are checked at once */
+
+			hits = scan->hits[i] + scan->cursor[i];
+
+			for (j=0; j < found[i]; )
+			{
+				begin = hits[j].position;
+				end   = begin + scan->patterns[i]->patlen;
+
+				for (j++; j < found[i] && hits[j].position < end; j++)
+					end = hits[j].position + scan->patterns[i]->patlen;
+
+				ecoManberWindows(aseq,scan->patterns[i],i,begin,end - begin,1);
+			}
 		}
-	else 
+
+		if (!((aseq->hitpos[0]->top && aseq->hitpos[1]->top) ||
+			  (aseq->hitpos[2]->top && aseq->hitpos[3]->top)))
 		{
-			superkingdom_taxid = -1;
-			superkingdom_name  = "###";
+			delete_ecoseq(seq);
+			continue;
 		}
+
+		*apatseq    = aseq;
+		*file_index = record->file_index;
+		*offset     = record->offset;
+
+		return seq;
+	}
+
+	return NULL;
+}
+
+/**
+ * Build the result describing an amplicon
+ * @return	0 if the amplicon is dropped in trim mode
+ */
+static int32_t buildRepeat(ecoresult_t *result,
+				 ecoseq_t *seq,
+				 char* primer1, char* primer2,
+				 PNNParams tparm,
+                 PatternPtr o1, PatternPtr o2,
+                 char strand, 
+                 int32_t pos1, int32_t pos2,
+                 int32_t err1, int32_t err2,
+                 int32_t delta,
+                 double trim_rate)
+{
+	int32_t  seqlength;
+	
+	char     *oligo1 = result->oligo1;
+	char     *oligo2 = result->oligo2;
+	
+	int32_t  ldelta,rdelta;
+	
+	char     *amplifia = NULL;
+	int32_t  amplength;
+	int64_t  timer;
 	
+	int32_t i;
+
+	/*
+	 * in trim mode, primer sites are checked against the error rate
+	 * and removed, whatever the -D option is
+	 */
+	if (trim_rate >= 0)
+	{
+		if (err1 > trim_rate * o1->patlen || err2 > trim_rate * o2->patlen)
+			return 0;
+		delta = 0;
+	}
+
+	seqlength = seq->SQ_length;
 
+	memset(result,0,sizeof(ecoresult_t));
 
 	ldelta=(pos1 <= delta)?pos1:delta;
 
@@ -213,7 +771,10 @@ void printRepeat(ecoseq_t *seq,
 	/*rdelta=((pos2+delta)>=seqlength)?seqlength-pos2-1:delta;        */
 	rdelta=((pos2+delta)>=seqlength)?seqlength-pos2:delta;
 
-	amplifia = getSubSequence(seq->SQ,pos1-ldelta,pos2+rdelta);
+	if (seq->stream)
+		amplifia = ecoseq_stream_subsequence(seq,pos1-ldelta,pos2+rdelta);
+	else
+		amplifia = getSubSequence(seq->SQ,pos1-ldelta,pos2+rdelta);
 	amplength= strlen(amplifia)-rdelta-ldelta;
 	
 	if (strand=='R')
@@ -224,11 +785,11 @@ void printRepeat(ecoseq_t *seq,
 		strncpy(oligo1,amplifia + rdelta ,o2->patlen);
 
 		oligo1[o2->patlen]=0;
-		error1=err2;
+		result->error1=err2;
 
 		strncpy(oligo2, amplifia + rdelta + amplength - o1->patlen,o1->patlen);
 		oligo2[o1->patlen]=0;
-		error2=err1;
+		result->error2=err1;
 		
 		if (delta==0)
 			amplifia+=o2->patlen;
@@ -243,11 +804,11 @@ void printRepeat(ecoseq_t *seq,
 	{
 		strncpy(oligo1,amplifia+ldelta,o1->patlen);
 		oligo1[o1->patlen]=0;
-		error1=err1;
+		result->error1=err1;
 		
 		strncpy(oligo2,amplifia + ldelta + amplength - o2->patlen,o2->patlen);
 		oligo2[o2->patlen]=0;
-		error2=err2;
+		result->error2=err2;
 		
 		if (delta==0)
 			amplifia+=o1->patlen;
@@ -271,41 +832,1062 @@ void printRepeat(ecoseq_t *seq,
 		for (i=1;i<=rdelta;i++)
 			amplifia[delta-i]|=32;
 
-		amplifia[delta]=0;
+		amplifia[delta]=0;
+
+	}
+	
+	/* tm of reverse hits is computed over the other primer length */
+	timer = ecostat_clock();
+	result->tm1=nparam_CalcTwoTM(tparm,oligo1,primer1,o1->patlen) - 273.15;
+	result->tm2=nparam_CalcTwoTM(tparm,oligo2,primer2,o2->patlen) - 273.15;
+	ecostat_add(ECOSTAT_TM,timer,2);
+	
+	result->AC        = seq->AC;
+	result->DE        = seq->DE;
+	result->SQ_length = seqlength;
+	result->taxon     = seq->taxid;
+	result->strand    = strand;
+	result->amplength = amplength - o1->patlen - o2->patlen;
+	result->amplicon  = amplifia;
+	
+	return 1;
+}
+
+static void emitRepeat(ecoresult_t *result,
+                       char kingdom,
+                       ecotaxonomy_t *taxonomy,
+                       ecoresultfile_t *binary,
+                       char *fasta_taxa)
+{
+	if (binary)
+		write_ecoresult(binary,result);
+	else if (fasta_taxa)
+	{
+		fasta_taxa[result->taxon]=1;
+		print_ecoresult_fasta(stdout,result,taxonomy);
+	}
+	else
+		print_ecoresult(stdout,result,taxonomy,kingdom);
+}
+
+void printRepeat(ecoseq_t *seq,
+				 char* primer1, char* primer2,
+				 PNNParams tparm,
+                 PatternPtr o1, PatternPtr o2,
+                 char strand, 
+                 char kingdom,
+                 int32_t pos1, int32_t pos2,
+                 int32_t err1, int32_t err2,
+                 ecotaxonomy_t *taxonomy,
+                 int32_t delta,
+                 ecoresultfile_t *binary,
+                 char *fasta_taxa,
+                 double trim_rate)
+{
+	ecoresult_t result;
+	int64_t     timer = ecostat_clock();
+	int32_t     built;
+
+	if (fasta_taxa && fasta_taxa[seq->taxid])
+		return;
+
+	built = buildRepeat(&result,seq,primer1,primer2,tparm,o1,o2,strand,
+	                    pos1,pos2,err1,err2,delta,trim_rate);
+	if (built)
+		emitRepeat(&result,kingdom,taxonomy,binary,fasta_taxa);
+
+	ecostat_add(ECOSTAT_PRINT,timer,built);
+}
+
+/* ----------------------------------------------- */
+/* scan a sequence read by chunks                  */
+/* ----------------------------------------------- */
+
+/*
+ * Hits of one strand. The amplicons of a first primer hit are
+ * known once the window holds lmax bases after it, pending hits
+ * are resolved as the stream goes. Second primer hits close to
+ * the sequence start are kept apart, as in linear mode they can
+ * still pair with first primer hits close to the sequence end.
+ */
+typedef struct {
+	PatternPtr    first;		/* primer read on the strand */
+	PatternPtr    second;		/* complement of the other primer */
+	char          strand;
+	int32_t       shift;		/* length correction of the strand */
+	ecoscanner_t  scan1;
+	ecoscanner_t  scan2;
+	StackiPtr     pos1;			/* first primer hits */
+	StackiPtr     err1;
+	int32_t       resolved;		/* first primer hits already paired */
+	StackiPtr     headpos;		/* second primer hits near the start */
+	StackiPtr     headerr;
+	StackiPtr     pos2;			/* other second primer hits */
+	StackiPtr     err2;
+	StackiPtr     newpos;		/* second primer hits of the chunk */
+	StackiPtr     newerr;
+	int32_t       firsthit;		/* first hit of the first primer */
+	int32_t       count;		/* amplicons found */
+} ecostrand_t;
+
+static void initStrand(ecostrand_t *s,PatternPtr first,PatternPtr second,
+                       char strand,int32_t shift)
+{
+	s->first  = first;
+	s->second = second;
+	s->strand = strand;
+	s->shift  = shift;
+
+	ecoscanner_init(&(s->scan1),first);
+	ecoscanner_init(&(s->scan2),second);
+
+	s->pos1    = NewStacki(kMinStackiSize);
+	s->err1    = NewStacki(kMinStackiSize);
+	s->headpos = NewStacki(kMinStackiSize);
+	s->headerr = NewStacki(kMinStackiSize);
+	s->pos2    = NewStacki(kMinStackiSize);
+	s->err2    = NewStacki(kMinStackiSize);
+	s->newpos  = NewStacki(kMinStackiSize);
+	s->newerr  = NewStacki(kMinStackiSize);
+
+	s->resolved = 0;
+	s->firsthit = -1;
+	s->count    = 0;
+}
+
+static void freeStrand(ecostrand_t *s)
+{
+	if (!s->first)
+		return;
+
+	FreeStacki(s->pos1);
+	FreeStacki(s->err1);
+	FreeStacki(s->headpos);
+	FreeStacki(s->headerr);
+	FreeStacki(s->pos2);
+	FreeStacki(s->err2);
+	FreeStacki(s->newpos);
+	FreeStacki(s->newerr);
+}
+
+/*
+ * drop the first values of a pair of stacks
+ */
+static void dropHits(StackiPtr pos,StackiPtr err,int32_t count)
+{
+	if (count <= 0)
+		return;
+
+	memmove(pos->val,pos->val+count,sizeof(Int32) * (pos->top - count));
+	memmove(err->val,err->val+count,sizeof(Int32) * (err->top - count));
+	pos->top -= count;
+	err->top -= count;
+}
+
+/*
+ * scan a chunk and sort the second primer hits. As in a whole
+ * sequence scan, they only count when they start after the first
+ * hit of the first primer.
+ */
+static void scanChunk(ecostrand_t *s,const char *data,int32_t length,
+                      int32_t position,int32_t headlimit)
+{
+	int32_t i;
+	int32_t pos;
+
+	if (!s->first)
+		return;
+
+	ecoscanner_feed(&(s->scan1),data,length,position,&(s->pos1),&(s->err1));
+
+	if (s->firsthit < 0 && s->pos1->top)
+		s->firsthit = s->pos1->val[0];
+
+	s->newpos->top = s->newerr->top = 0;
+	ecoscanner_feed(&(s->scan2),data,length,position,&(s->newpos),&(s->newerr));
+
+	for (i=0; i < s->newpos->top; i++)
+	{
+		pos = s->newpos->val[i];
+
+		if (s->firsthit >= 0 && pos >= s->firsthit + s->first->patlen)
+		{
+			if (pos + s->second->patlen <= headlimit)
+			{
+				PushiIn(&(s->headpos),pos);
+				PushiIn(&(s->headerr),s->newerr->val[i]);
+			}
+			else
+			{
+				PushiIn(&(s->pos2),pos);
+				PushiIn(&(s->err2),s->newerr->val[i]);
+			}
+		}
+	}
+}
+
+static int32_t pairHit(ecostrand_t *s,int32_t posi,int32_t posj,
+                       int32_t seqlength,int32_t lmin,int32_t lmax)
+{
+	int32_t length = 0;
+
+	if (posj > posi)
+		length = posj - posi + s->shift - s->first->patlen - s->second->patlen;
+	if (posj < posi)
+		length = posj + seqlength - posi - s->first->patlen - s->second->patlen;
+
+	return (length>0) &&	// For when primers touch or overlap
+		   (!lmin || (length >= lmin)) &&
+		   (!lmax || (length <= lmax));
+}
+
+/*
+ * pair the first primer hits whose amplicons are all in the window.
+ * Amplicons are printed, or appended to the deferred array when
+ * deferred is not NULL.
+ */
+static void resolveStrand(ecostrand_t *s,ecoseq_t *seq,int32_t ready,int32_t span,
+                          char *oligo1,char *oligo2,PNNParams tparm,
+                          char kingdom,int32_t lmin,int32_t lmax,
+                          ecotaxonomy_t *taxonomy,int32_t delta,
+                          ecoresultfile_t *binary,char *fasta_taxa,
+                          double trim_rate,int32_t count_only,
+                          ecoresult_t **deferred,int32_t *deferred_count)
+{
+	ecoresult_t result;
+	StackiPtr   pos;
+	StackiPtr   err;
+	int32_t     posi;
+	int32_t     posj;
+	int32_t     i;
+	int32_t     j;
+	int32_t     k;
+
+	if (!s->first)
+		return;
+
+	for (; s->resolved < s->pos1->top; s->resolved++)
+	{
+		posi = s->pos1->val[s->resolved];
+
+		if (posi > ready)
+			break;
+
+		for (k=0; k < 2; k++)
+		{
+			pos = (k) ? s->pos2:s->headpos;
+			err = (k) ? s->err2:s->headerr;
+
+			for (j=0; j < pos->top; j++)
+			{
+				posj = pos->val[j] + s->second->patlen;
+
+				if (posj > posi + span)
+					break;
+
+				if (!pairHit(s,posi,posj,seq->SQ_length,lmin,lmax))
+					continue;
+
+				s->count++;
+
+				if (count_only)
+					continue;
+
+				if (!deferred)
+					printRepeat(seq,oligo1,oligo2,tparm,s->first,s->second,
+					            s->strand,kingdom,posi,posj,
+					            s->err1->val[s->resolved],err->val[j],
+					            taxonomy,delta,binary,fasta_taxa,trim_rate);
+				else if (buildRepeat(&result,seq,oligo1,oligo2,tparm,
+				                     s->first,s->second,s->strand,posi,posj,
+				                     s->err1->val[s->resolved],err->val[j],
+				                     delta,trim_rate))
+				{
+					*deferred = ECOREALLOC(*deferred,
+					                       sizeof(ecoresult_t) * (*deferred_count+1),
+					                       "Increase deferred result array");
+					result.amplicon = strcpy(ECOMALLOC(strlen(result.amplicon)+1,
+					                                   "Allocate deferred amplicon"),
+					                         result.amplicon);
+					(*deferred)[(*deferred_count)++] = result;
+				}
+			}
+		}
+	}
+
+	/* hits which cannot pair anymore */
+
+	if (s->resolved > 1024 && s->resolved * 2 > s->pos1->top)
+	{
+		dropHits(s->pos1,s->err1,s->resolved);
+		s->resolved = 0;
+	}
+
+	posi = (s->resolved < s->pos1->top) ? s->pos1->val[s->resolved]:ready;
+	if (posi > ready)
+		posi = ready;
+
+	for (i=0; i < s->pos2->top && s->pos2->val[i] + s->second->patlen <= posi; i++);
+
+	if (i > 1024 && i * 2 > s->pos2->top)
+		dropHits(s->pos2,s->err2,i);
+}
+
+/**
+ * Look for the amplicons of a sequence read by chunks.
+ *
+ * Gives the same results as a whole sequence scan in linear mode
+ * with a maximum amplicon length, only a window of lmax bases plus
+ * a chunk is kept in memory. Direct strand amplicons are printed
+ * as they are found, reverse strand ones are printed at the end.
+ *
+ * @param	strands		strands scanned, an other one is skipped
+ * @param	counts		receives the amplicon counts of the direct
+ * 						and reverse strands
+ *
+ * @return	the number of amplicons found
+ */
+static int32_t streamRepeats(ecoseq_t *seq,
+                             char *oligo1,char *oligo2,PNNParams tparm,
+                             PatternPtr o1,PatternPtr o2,
+                             PatternPtr o1c,PatternPtr o2c,
+                             char kingdom,int32_t lmin,int32_t lmax,
+                             ecotaxonomy_t *taxonomy,int32_t delta,
+                             ecoresultfile_t *binary,char *fasta_taxa,
+                             double trim_rate,int32_t count_only,
+                             int32_t strands,int32_t *counts)
+{
+	ecostrand_t direct;
+	ecostrand_t reverse;
+	ecoresult_t *deferred = NULL;
+	int32_t     deferred_count = 0;
+	int32_t     span;
+	int32_t     headlimit;
+	int32_t     keep_from;
+	int32_t     ready;
+	int32_t     length;
+	int32_t     start;
+	int32_t     end;
+	char        *window;
+	int32_t     i;
+
+	span      = lmax + o1->patlen + o2->patlen;
+	headlimit = span;
+	keep_from = 0;
+
+	memset(&direct,0,sizeof(ecostrand_t));
+	memset(&reverse,0,sizeof(ecostrand_t));
+
+	if (strands & STRAND_DIRECT)
+		initStrand(&direct,o1,o2c,'D',0);
+	if (strands & STRAND_REVERSE)
+		initStrand(&reverse,o2,o1c,'R',1);
+
+	ecoseq_stream_start(seq,headlimit + delta);
+
+	while ((length = ecoseq_stream_next(seq,keep_from)))
+	{
+		window = ecoseq_stream_window(seq,&start,&end);
+
+		scanChunk(&direct,window + (end - length - start),length,end - length,headlimit);
+		scanChunk(&reverse,window + (end - length - start),length,end - length,headlimit);
+
+		/* all the amplicons of a hit at ready or before are in the window */
+
+		ready = end - span - delta - 1;
+
+		resolveStrand(&direct,seq,ready,span,oligo1,oligo2,tparm,kingdom,lmin,lmax,
+		              taxonomy,delta,binary,fasta_taxa,trim_rate,count_only,
+		              NULL,NULL);
+		resolveStrand(&reverse,seq,ready,span,oligo1,oligo2,tparm,kingdom,lmin,lmax,
+		              taxonomy,delta,binary,fasta_taxa,trim_rate,count_only,
+		              &deferred,&deferred_count);
+
+		keep_from = end - o1->patlen - o2->patlen;
+		if (direct.first && direct.resolved < direct.pos1->top &&
+			direct.pos1->val[direct.resolved] < keep_from)
+			keep_from = direct.pos1->val[direct.resolved];
+		if (reverse.first && reverse.resolved < reverse.pos1->top &&
+			reverse.pos1->val[reverse.resolved] < keep_from)
+			keep_from = reverse.pos1->val[reverse.resolved];
+		keep_from -= delta;
+	}
+
+	resolveStrand(&direct,seq,seq->SQ_length,span,oligo1,oligo2,tparm,kingdom,lmin,lmax,
+	              taxonomy,delta,binary,fasta_taxa,trim_rate,count_only,
+	              NULL,NULL);
+	resolveStrand(&reverse,seq,seq->SQ_length,span,oligo1,oligo2,tparm,kingdom,lmin,lmax,
+	              taxonomy,delta,binary,fasta_taxa,trim_rate,count_only,
+	              &deferred,&deferred_count);
+
+	for (i=0; i < deferred_count; i++)
+	{
+		if (!fasta_taxa || !fasta_taxa[seq->taxid])
+			emitRepeat(deferred+i,kingdom,taxonomy,binary,fasta_taxa);
+		ECOFREE(deferred[i].amplicon,"Free deferred amplicon");
+	}
+
+	if (deferred)
+		ECOFREE(deferred,"Free deferred result array");
+
+	freeStrand(&direct);
+	freeStrand(&reverse);
+
+	counts[0] = direct.count;
+	counts[1] = reverse.count;
+
+	return direct.count + reverse.count;
+}
+
+/**
+ * every parameter changing the result lines of a sequence, as one
+ * line : key of the result cache, checked when a run is resumed
+ **/
+static char *runParameters(const char *oligo1,const char *oligo2,int32_t error_max,
+		                   int32_t lmin,int32_t lmax,int32_t delta,int32_t circular,
+		                   int32_t kingdom_mode,int32_t strands,double trim_rate,
+		                   double salt,int32_t saltmethod,
+		                   int32_t *restricted_taxid,int32_t r,
+		                   int32_t *ignored_taxid,int32_t g)
+{
+	char    *parameters;
+	char    *p;
+	int32_t i;
+
+	parameters = ECOMALLOC(strlen(oligo1)+strlen(oligo2)+12*(r+g)+256,
+	                       "Allocate run parameters");
+	p = parameters + sprintf(parameters,
+	                         "v=%s p=%s,%s e=%d l=%d L=%d D=%d c=%d k=%d S=%d T=%g salt=%g,%d r=",
+	                         VERSION,oligo1,oligo2,error_max,lmin,lmax,delta,
+	                         circular,kingdom_mode,strands,trim_rate,salt,saltmethod);
+	for (i=0; i < r; i++)
+		p+=sprintf(p,"%d,",restricted_taxid[i]);
+	p+=sprintf(p," i=");
+	for (i=0; i < g; i++)
+		p+=sprintf(p,"%d,",ignored_taxid[i]);
+
+	return parameters;
+}
+
+/* ----------------------------------------------- */
+/* checkpoints of a long run                       */
+/* ----------------------------------------------- */
+
+typedef struct {
+	int32_t file_index;				/* last sequence processed */
+	long    offset;
+	int64_t output;					/* result bytes written until then */
+	int32_t strandCount[3];
+} ecocheckpoint_t;
+
+/**
+ * save a checkpoint once the results of the sequences it covers
+ * are written. The checkpoint file is replaced at once.
+ **/
+static void writeCheckpoint(const char *name,ecocheckpoint_t *checkpoint,
+		                    const char *parameters)
+{
+	struct stat st;
+	char        *tmpname;
+	FILE        *f;
+
+	flush_ecoresult(stdout);
+	fflush(stdout);
+
+	if (fstat(fileno(stdout),&st))
+		ECOERROR(ECO_IO_ERROR,"Cannot get the output size");
+
+	checkpoint->output = st.st_size;
+
+	tmpname = ECOMALLOC(strlen(name)+5,"Allocate checkpoint name");
+	sprintf(tmpname,"%s.tmp",name);
+
+	f = fopen(tmpname,"w");
+
+	if (!f ||
+		fprintf(f,"%s\n%d %ld %lld %d %d %d\n",
+		        parameters,
+		        checkpoint->file_index,checkpoint->offset,
+		        (long long)checkpoint->output,
+		        checkpoint->strandCount[0],
+		        checkpoint->strandCount[1],
+		        checkpoint->strandCount[2]) < 0 ||
+		fclose(f) ||
+		rename(tmpname,name))
+		ECOERROR(ECO_IO_ERROR,"Cannot write the checkpoint");
+
+	ECOFREE(tmpname,"Free checkpoint name");
+}
+
+/**
+ * read the checkpoint of an interrupted run with the same parameters
+ *
+ * @return 1 if the checkpoint exists, else 0
+ **/
+static int32_t readCheckpoint(const char *name,ecocheckpoint_t *checkpoint,
+		                      const char *parameters)
+{
+	char      *saved;
+	int32_t   length;
+	long long output;
+	FILE      *f;
+	int       read;
+
+	f = fopen(name,"r");
+
+	if (!f)
+		return 0;
+
+	length = strlen(parameters) + 2;
+	saved  = ECOMALLOC(length+1,"Allocate checkpoint parameters");
+
+	if (!fgets(saved,length+1,f) ||
+		strncmp(saved,parameters,length-2) || strcmp(saved+length-2,"\n"))
+		ECOERROR(ECO_IO_ERROR,"The checkpoint was saved with other parameters");
+
+	read = fscanf(f,"%d %ld %lld %d %d %d",
+	              &(checkpoint->file_index),&(checkpoint->offset),
+	              &output,
+	              checkpoint->strandCount,
+	              checkpoint->strandCount+1,
+	              checkpoint->strandCount+2);
+	fclose(f);
+
+	if (read != 6)
+		ECOERROR(ECO_IO_ERROR,"The checkpoint is not the one of this run");
+
+	checkpoint->output = output;
+
+	ECOFREE(saved,"Free checkpoint parameters");
+
+	return 1;
+}
+
+/* ----------------------------------------------- */
+/* result cache                                    */
+/* ----------------------------------------------- */
+
+/**
+ * The result lines of each .sdx file of the database are kept in a
+ * cache file whose key holds the SHA-1 of the file content and every
+ * parameter changing them. A run finding the cache file of a shard
+ * copies it to the output instead of reading the shard, shards
+ * changed since the cache was filled get new cache files.
+ *
+ * A cache file is made of its full key, the strand counts of the
+ * shard and the result lines.
+ **/
+
+#define CACHE_MAGIC "ECOCACHE1"
+
+typedef struct {
+	char    *directory;
+	int32_t count;					/* .sdx files of the database */
+	char    **key;					/* key of each shard, from 1  */
+	char    *hit;					/* shards found in the cache  */
+	const char *excluded;			/* shards left out of the run */
+	int32_t current;				/* shard of the last sequence */
+	FILE    *capture;				/* cache file being filled    */
+	char    *capture_name;
+	int32_t strandCount[3];			/* counts when capture began  */
+} ecoresultcache_t;
+
+/**
+ * name of the cache file of a shard key
+ **/
+static char *cacheFileName(ecoresultcache_t *cache,const char *key)
+{
+	char *name;
+
+	name = ECOMALLOC(strlen(cache->directory)+32,"Allocate cache file name");
+	sprintf(name,"%s/%08x%08x.ecc",cache->directory,
+	        (uint32_t)crc32(0L,(const Bytef*)key,strlen(key)),
+	        (uint32_t)adler32(1L,(const Bytef*)key,strlen(key)));
+
+	return name;
+}
+
+/**
+ * open the cache of a run : compute the key of each shard and look
+ * for its cache file
+ * @param directory  the cache directory
+ * @param prefix     the database
+ * @param parameters the run parameters changing the results
+ * @param excluded   shards left out of the run, NULL if none
+ **/
+static ecoresultcache_t *openResultCache(const char *directory,const char *prefix,
+		                                 const char *parameters,const char *excluded)
+{
+	ecoresultcache_t *cache;
+	static const char *taxfiles[] = {"tdx","rdx","ldx"};
+	char       filename[1024];
+	char       *name;
+	char       *saved;
+	char       *expected;
+	char       taxhash[3][41];
+	char       hash[41];
+	int64_t    size;
+	int32_t    keylength;
+	int32_t    found = 0;
+	int32_t    i;
+	FILE       *f;
+
+	cache = ECOMALLOC(sizeof(ecoresultcache_t),"Allocate result cache");
+	cache->directory = ECOMALLOC(strlen(directory)+1,"Allocate cache directory");
+	strcpy(cache->directory,directory);
+
+	/* the taxonomy gives the names and ranks printed */
+	for (i=0; i < 3; i++)
+	{
+		snprintf(filename,1024,"%s.%s",prefix,taxfiles[i]);
+		file_hash(filename,&size,taxhash[i]);
+	}
+
+	cache->count    = ecoseq_file_count(prefix);
+	cache->excluded = excluded;
+
+	cache->key = ECOMALLOC(sizeof(char*) * (cache->count+1),"Allocate cache keys");
+	cache->hit = ECOMALLOC(cache->count+1,"Allocate cache hits");
+
+	keylength = strlen(parameters)+256;
+	saved     = ECOMALLOC(keylength+32,"Allocate cache key");
+	expected  = ECOMALLOC(keylength+32,"Allocate cache key");
+
+	for (i=1; i <= cache->count; i++)
+	{
+		if (excluded && excluded[i])
+			continue;
+
+		snprintf(filename,1024,"%s_%03d.sdx",prefix,i);
+		file_hash(filename,&size,hash);
+
+		cache->key[i] = ECOMALLOC(keylength,"Allocate cache key");
+		sprintf(cache->key[i],"%s tax=%s,%s,%s shard=%s,%lld",
+		        parameters,taxhash[0],taxhash[1],taxhash[2],hash,(long long)size);
+
+		name = cacheFileName(cache,cache->key[i]);
+		f    = fopen(name,"r");
+
+		/* a cache file of the same name for another key is a miss */
+		if (f)
+		{
+			sprintf(expected,"%s %s\n",CACHE_MAGIC,cache->key[i]);
+			cache->hit[i] = fgets(saved,keylength+32,f) && !strcmp(saved,expected);
+			fclose(f);
+		}
+
+		found += cache->hit[i];
+		ECOFREE(name,"Free cache file name");
+	}
+
+	ECOFREE(expected,"Free cache key");
+	ECOFREE(saved,"Free cache key");
+
+	fprintf(stderr,"# %d of %d sequence files found in the result cache %s\n",
+			found,cache->count,directory);
+
+	return cache;
+}
+
+/**
+ * close the cache file of the current shard
+ **/
+static void endShard(ecoresultcache_t *cache,int32_t *strandCount)
+{
+	char *name;
+
+	if (!cache->capture)
+		return;
+
+	flush_ecoresult(stdout);
+	copy_ecoresult(NULL);
+
+	name = cacheFileName(cache,cache->key[cache->current]);
+
+	/* the strand counts are written over the place kept for them */
+	if (fseek(cache->capture,strlen(CACHE_MAGIC)+strlen(cache->key[cache->current])+2,SEEK_SET) ||
+		fprintf(cache->capture,"%10d %10d %10d\n",
+		        strandCount[0] - cache->strandCount[0],
+		        strandCount[1] - cache->strandCount[1],
+		        strandCount[2] - cache->strandCount[2]) < 0 ||
+		fclose(cache->capture) ||
+		rename(cache->capture_name,name))
+		ECOERROR(ECO_IO_ERROR,"Cannot write the result cache");
+
+	cache->capture = NULL;
+	ECOFREE(name,"Free cache file name");
+	ECOFREE(cache->capture_name,"Free cache file name");
+}
+
+/**
+ * copy the cached results of a shard to the output
+ **/
+static void copyShard(ecoresultcache_t *cache,int32_t *strandCount)
+{
+	static char buffer[1024*1024];
+	char    *name;
+	int32_t counts[3];
+	size_t  read;
+	int     c;
+	FILE    *f;
+
+	name = cacheFileName(cache,cache->key[cache->current]);
+	f    = fopen(name,"r");
+
+	if (!f)
+		ECOERROR(ECO_IO_ERROR,"Cannot read the result cache");
+
+	while ((c = getc(f)) != EOF && c != '\n');
+
+	if (fscanf(f,"%d %d %d",counts,counts+1,counts+2) != 3 ||
+		getc(f) != '\n')
+		ECOERROR(ECO_IO_ERROR,"Bad result cache file");
+
+	flush_ecoresult(stdout);
+
+	while ((read = fread(buffer,1,sizeof(buffer),f)) > 0)
+		if (fwrite(buffer,1,read,stdout) != read)
+			ECOERROR(ECO_IO_ERROR,"Cannot write results");
+
+	if (ferror(f))
+		ECOERROR(ECO_IO_ERROR,"Cannot read the result cache");
+
+	fclose(f);
+	fflush(stdout);
+
+	strandCount[0] += counts[0];
+	strandCount[1] += counts[1];
+	strandCount[2] += counts[2];
+
+	ECOFREE(name,"Free cache file name");
+}
+
+/**
+ * start filling the cache file of the current shard
+ **/
+static void beginShard(ecoresultcache_t *cache,int32_t *strandCount)
+{
+	const char *key = cache->key[cache->current];
+	char       *name;
+
+	name = cacheFileName(cache,key);
+	cache->capture_name = ECOMALLOC(strlen(name)+32,"Allocate cache file name");
+	sprintf(cache->capture_name,"%s.%d.tmp",name,(int)getpid());
+	ECOFREE(name,"Free cache file name");
+
+	cache->capture = fopen(cache->capture_name,"w");
+
+	if (!cache->capture ||
+		fprintf(cache->capture,"%s %s\n%10d %10d %10d\n",CACHE_MAGIC,key,0,0,0) < 0)
+		ECOERROR(ECO_IO_ERROR,"Cannot write the result cache");
+
+	flush_ecoresult(stdout);
+	copy_ecoresult(cache->capture);
+	memcpy(cache->strandCount,strandCount,sizeof(cache->strandCount));
+}
+
+/**
+ * move the cache to the shard of the next sequence : the results
+ * of the cached shards in between are copied to the output
+ * @param file_index shard of the next sequence, count+1 at the end
+ **/
+static void advanceResultCache(ecoresultcache_t *cache,int32_t file_index,
+		                       int32_t *strandCount)
+{
+	while (cache->current < file_index && cache->current <= cache->count)
+	{
+		endShard(cache,strandCount);
+		cache->current++;
+
+		if (cache->current > cache->count)
+			break;
+
+		if (cache->excluded && cache->excluded[cache->current])
+			continue;
+
+		if (cache->hit[cache->current])
+			copyShard(cache,strandCount);
+		else
+			beginShard(cache,strandCount);
+	}
+}
+
+/* ----------------------------------------------- */
+/* resident server mode                            */
+/* ----------------------------------------------- */
+
+static char          *server_prefix   = NULL;	/* database loaded by the server */
+static ecotaxonomy_t *server_taxonomy = NULL;
+
+static int ecoPCR(int argc, char **argv);
+
+/**
+ * read a query line from a client, without its end of line, and
+ * the client stdout and stderr descriptors sent along with it
+ **/
+static int32_t readQuery(int client,char *query,int *fds)
+{
+	struct msghdr  message;
+	struct iovec   data;
+	struct cmsghdr *control;
+	char           buffer[CMSG_SPACE(2*sizeof(int))];
+	ssize_t        n;
+	int32_t        length = 0;
+	char           *end;
+
+	fds[0] = fds[1] = -1;
+
+	memset(&message,0,sizeof(message));
+	data.iov_base          = query;
+	data.iov_len           = QUERY_MAX_LENGTH-1;
+	message.msg_iov        = &data;
+	message.msg_iovlen     = 1;
+	message.msg_control    = buffer;
+	message.msg_controllen = sizeof(buffer);
+
+	n = recvmsg(client,&message,0);
+
+	if (n > 0)
+	{
+		length  = n;
+		control = CMSG_FIRSTHDR(&message);
+
+		if (control &&
+			control->cmsg_level == SOL_SOCKET &&
+			control->cmsg_type  == SCM_RIGHTS &&
+			control->cmsg_len   == CMSG_LEN(2*sizeof(int)))
+			memcpy(fds,CMSG_DATA(control),2*sizeof(int));
+	}
+
+	while (length > 0 && length < QUERY_MAX_LENGTH-1 &&
+		   !memchr(query,'\n',length) &&
+		   (n = read(client,query+length,QUERY_MAX_LENGTH-1-length)) > 0)
+		length+= n;
+
+	query[length]=0;
+
+	if ((end = strchr(query,'\n')))
+		*end = 0;
+
+	return strlen(query);
+}
+
+/**
+ * child side of a connection : the query line gives the ecoPCR
+ * arguments. A grandchild runs ecoPCR writing on the stdout and
+ * stderr of the client, the child sends back its exit status.
+ **/
+static void answerQuery(int client,char *program)
+{
+	char    query[QUERY_MAX_LENGTH];
+	char    *argv[QUERY_MAX_ARGS+4];
+	char    answer[32];
+	int     fds[2];
+	int     argc;
+	int     status;
+	char    *token;
+	pid_t   pid;
+
+	readQuery(client,query,fds);
+
+	if (fds[0] < 0 || fds[1] < 0)
+		exit(1);
+
+	argv[0]=program;
+	argv[1]="-d";
+	argv[2]=server_prefix;
+	argc=3;
+
+	for (token=strtok(query," \t\r");
+		 token && argc < QUERY_MAX_ARGS+3;
+		 token=strtok(NULL," \t\r"))
+		argv[argc++]=token;
+
+	argv[argc]=NULL;
+
+	/* the server ignores SIGCHLD, this child waits for its own */
+	signal(SIGCHLD,SIG_DFL);
+
+	if ((pid = fork()) == 0)
+	{
+		dup2(fds[0],1);
+		dup2(fds[1],2);
+		close(fds[0]);
+		close(fds[1]);
+		close(client);
+
+		optind=1;
+
+		exit(ecoPCR(argc,argv));
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+
+	if (pid < 0 || waitpid(pid,&status,0) != pid)
+		status = 1;
+	else if (WIFEXITED(status))
+		status = WEXITSTATUS(status);
+	else
+		status = 128 + WTERMSIG(status);
+
+	sprintf(answer,"%d\n",status);
+	write(client,answer,strlen(answer));
+
+	exit(0);
+}
+
+/**
+ * load the taxonomy and the sequences of the database once, then fork
+ * a child answering each connection on the socket. Children share the
+ * loaded data with the server, queries cannot disturb each other.
+ **/
+static void serveQueries(const char *socket_name,char *prefix,char *program)
+{
+	struct sockaddr_un address;
+	int                server;
+	int                client;
+	pid_t              pid;
+	int32_t            count;
+
+	if (strlen(socket_name) >= sizeof(address.sun_path))
+		ECOERROR(ECO_IO_ERROR,"Server socket name is too long");
+
+	server_prefix   = prefix;
+	server_taxonomy = read_taxonomy(prefix,0);
+	count           = ecoseq_preload(prefix);
+
+	memset(&address,0,sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path,socket_name);
+
+	unlink(socket_name);
+
+	if ((server = socket(AF_UNIX,SOCK_STREAM,0)) < 0 ||
+		bind(server,(struct sockaddr*)&address,sizeof(address)) < 0 ||
+		listen(server,16) < 0)
+		ECOERROR(ECO_IO_ERROR,"Cannot listen on the server socket");
+
+	/* children are not waited for */
+	signal(SIGCHLD,SIG_IGN);
+
+	fprintf(stderr,"# %d sequences of %s loaded, waiting for queries on %s\n",
+			count,prefix,socket_name);
+	fflush(stderr);
+
+	for (;;)
+	{
+		if ((client = accept(server,NULL,NULL)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ECOERROR(ECO_IO_ERROR,"Cannot accept a query");
+		}
+
+		fflush(stdout);
+
+		if ((pid = fork()) == 0)
+		{
+			close(server);
+			answerQuery(client,program);
+		}
+
+		if (pid < 0)
+			fprintf(stderr,"# Cannot fork to answer a query\n");
+
+		close(client);
+	}
+}
+
+/**
+ * send the arguments, but the -z option, to a server as a query line,
+ * with the stdout and stderr descriptors the server writes on
+ *
+ * @return	the exit status of the query
+ **/
+static int forwardQuery(const char *socket_name,int argc,char **argv)
+{
+	struct sockaddr_un address;
+	struct msghdr      message;
+	struct iovec       data;
+	struct cmsghdr     *control;
+	char               buffer[CMSG_SPACE(2*sizeof(int))];
+	int                fds[2] = {1,2};
+	char               query[QUERY_MAX_LENGTH];
+	char               answer[32];
+	int                server;
+	int32_t            length = 0;
+	ssize_t            n;
+	int                status;
+	int                i;
+
+	query[0]=0;
 
+	for (i=1; i < argc; i++)
+	{
+		if (!strcmp(argv[i],"-z"))
+			i++;
+		else if (strncmp(argv[i],"-z",2))
+		{
+			length+= strlen(argv[i]) + 1;
+			if (length >= QUERY_MAX_LENGTH - 1 || strpbrk(argv[i]," \t\r\n"))
+				ECOERROR(ECO_ASSERT_ERROR,"Query cannot be sent to the server");
+			strcat(query,argv[i]);
+			strcat(query," ");
+		}
 	}
-	
-	tm1=nparam_CalcTwoTM(tparm,oligo1,primer1,o1->patlen) - 273.15;
-	tm2=nparam_CalcTwoTM(tparm,oligo2,primer2,o2->patlen) - 273.15;
-	tm = (tm1 < tm2) ? tm1:tm2;
-	printf("%-15s | %9d | %8d | %-20s | %8d | %-30s | %8d | %-30s | %8d | %-30s | %8d | %-30s | %c | %-32s | %2d | %5.2f | %-32s | %2d | %5.2f | %5d | %s | %s\n",
-			AC,
-			seqlength,
-			taxid,
-			rank,
-			species_taxid,
-			scientificName,
-			genus_taxid,
-			genus_name,
-			family_taxid,
-			family_name,
-			superkingdom_taxid,
-			superkingdom_name,
-			strand,
-			oligo1,
-			error1,
-			tm1,
-			oligo2,
-			error2,
-			tm2,
-			amplength - o1->patlen - o2->patlen,
-			amplifia,
-			seq->DE
-		  );
-
-}
-
-int main(int argc, char **argv) 
+
+	strcat(query,"\n");
+
+	if (strlen(socket_name) >= sizeof(address.sun_path))
+		ECOERROR(ECO_IO_ERROR,"Server socket name is too long");
+
+	memset(&address,0,sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path,socket_name);
+
+	if ((server = socket(AF_UNIX,SOCK_STREAM,0)) < 0 ||
+		connect(server,(struct sockaddr*)&address,sizeof(address)) < 0)
+		ECOERROR(ECO_IO_ERROR,"Cannot connect to the ecoPCR server");
+
+	fflush(stdout);
+	fflush(stderr);
+
+	memset(&message,0,sizeof(message));
+	memset(buffer,0,sizeof(buffer));
+	data.iov_base          = query;
+	data.iov_len           = strlen(query);
+	message.msg_iov        = &data;
+	message.msg_iovlen     = 1;
+	message.msg_control    = buffer;
+	message.msg_controllen = sizeof(buffer);
+
+	control             = CMSG_FIRSTHDR(&message);
+	control->cmsg_level = SOL_SOCKET;
+	control->cmsg_type  = SCM_RIGHTS;
+	control->cmsg_len   = CMSG_LEN(2*sizeof(int));
+	memcpy(CMSG_DATA(control),fds,2*sizeof(int));
+
+	if (sendmsg(server,&message,0) != (ssize_t)strlen(query))
+		ECOERROR(ECO_IO_ERROR,"Cannot send the query to the server");
+
+	shutdown(server,SHUT_WR);
+
+	length = 0;
+	while (length < (int32_t)sizeof(answer)-1 &&
+		   (n = read(server,answer+length,sizeof(answer)-1-length)) > 0)
+		length+= n;
+
+	answer[length]=0;
+	close(server);
+
+	if (sscanf(answer,"%d",&status) != 1)
+		ECOERROR(ECO_IO_ERROR,"No answer from the ecoPCR server");
+
+	return status;
+}
+
+int ecoPCR(int argc, char **argv)
 {
 	ecoseq_t      *seq;
 	ecotaxonomy_t *taxonomy;
@@ -363,8 +1945,65 @@ int main(int argc, char **argv)
 	int32_t		  saltmethod=SALT_METHOD_SANTALUCIA;
 	double		  salt=0.05;
 	CNNParams     tparm;
+	
+	char          *hitidx_name = NULL;
+	char          *reuse_name  = NULL;
+	FILE          *hitidx      = NULL;
+	int32_t       hitidx_count = 0;
+	int32_t       scan_lmax;
+	int32_t       seqfile_idx;
+	long          seqoffset;
+	
+	ecocoverage_t *coverage    = NULL;
+	char          *binary_name = NULL;
+	ecoresultfile_t *binary    = NULL;
+	int32_t       fasta_mode   = 0;
+	char          *fasta_taxa  = NULL;
+	double        trim_rate    = -1;
+	int32_t       coverage_mode= 0;
+	int32_t       seqAmplified;
+	int32_t       scanned      = 0;
+	int32_t       shared;
+	int32_t       paired       = 0;
+	ecoblockidx_t *blocks      = NULL;
+	int32_t       threads      = 1;
+	int32_t       stream_min   = 0;
+	ecoscanbatch_t *batch      = NULL;
+	SeqPtr        prescanned   = NULL;
+	int32_t       strands      = STRAND_BOTH;
+	int32_t       strandAmplified[2];
+	int32_t       strandCount[3] = {0,0,0};	// direct only, reverse only, both
+	char          complement[MAX_PAT_LEN+1];
+	ecofmindex_t  *fmindex     = NULL;
+	ecofmscan_t   *fmscan      = NULL;
+	ecokmeridx_t  *kmeridx     = NULL;
+	ecokmerscan_t *kmerscan    = NULL;
+	PatternPtr    indexpatterns[MAX_PATTERN];
+	int32_t       selected;
+	char          *server_name = NULL;
+	char          *client_name = NULL;
+	char          *checkpoint_name = NULL;
+	int32_t       resume       = 0;
+	int32_t       resumed      = 0;
+	int32_t       done;
+	time_t        checkpoint_time = 0;
+	ecocheckpoint_t checkpoint;
+	struct stat   output_stat;
+	char          *cache_name  = NULL;
+	ecoresultcache_t *cache    = NULL;
+	char          *parameters;
+	char          *checkpoint_parameters = NULL;
+	int32_t       since        = -1;
+	ecomanifest_t *manifest;
+	char          *excluded    = NULL;
+	char          *skipped     = NULL;
+	int32_t       shards       = 0;
+	int32_t       stats        = 0;
+	int64_t       statBases    = 0;
+	int64_t       statHits     = 0;
+	int64_t       timer;
 
-    while ((carg = getopt(argc, argv, "hcd:l:L:e:i:r:km:a:tD:")) != -1) {
+    while ((carg = getopt(argc, argv, "hb:cCd:fj:K:l:L:e:i:n:Pr:Rkm:a:s:S:tD:H:T:U:x:z:Z:")) != -1) {
     	
      switch (carg) {
                                 /* -------------------- */
@@ -406,6 +2045,12 @@ int main(int argc, char **argv)
           sscanf(optarg,"%d",&error_max);
           break;
           		
+                                /* -------------------- */
+        case 'C':               /* coverage mode        */
+                                /* -------------------- */
+          coverage_mode = 1;
+          break;
+
           						/* -------------------- */
         case 'k':               /* set the kingdom mode */
           kingdom_mode = 1;		/* -------------------- */
@@ -446,6 +2091,116 @@ int main(int argc, char **argv)
 		case 'a':               /* set salt 	         */
 					/* --------------------------------- */
 		sscanf(optarg,"%lf",&(salt));
+		break;
+
+					/* --------------------------------- */
+		case 'b':               /* binary output                     */
+					/* --------------------------------- */
+		binary_name = ECOMALLOC(strlen(optarg)+1,
+		                        "Error on binary file name allocation");
+		strcpy(binary_name,optarg);
+		break;
+
+					/* --------------------------------- */
+		case 'f':               /* fasta output                      */
+					/* --------------------------------- */
+		fasta_mode = 1;
+		break;
+
+					/* --------------------------------- */
+		case 'j':               /* threads scanning the sequences    */
+					/* --------------------------------- */
+		sscanf(optarg,"%d",&threads);
+		if (threads < 1)
+			errflag++;
+		break;
+
+					/* --------------------------------- */
+		case 'H':               /* save primer hits                  */
+					/* --------------------------------- */
+		hitidx_name = ECOMALLOC(strlen(optarg)+1,
+		                        "Error on hit index name allocation");
+		strcpy(hitidx_name,optarg);
+		break;
+
+					/* --------------------------------- */
+		case 'S':               /* strands scanned                   */
+					/* --------------------------------- */
+		if (!strcmp(optarg,"D"))
+			strands = STRAND_DIRECT;
+		else if (!strcmp(optarg,"R"))
+			strands = STRAND_REVERSE;
+		else if (!strcmp(optarg,"both"))
+			strands = STRAND_BOTH;
+		else
+			errflag++;
+		break;
+
+					/* --------------------------------- */
+		case 's':               /* stream long sequences             */
+					/* --------------------------------- */
+		sscanf(optarg,"%d",&stream_min);
+		if (stream_min < 1)
+			errflag++;
+		break;
+
+					/* --------------------------------- */
+		case 'T':               /* primer trimming error rate        */
+					/* --------------------------------- */
+		sscanf(optarg,"%lf",&trim_rate);
+		if (trim_rate < 0)
+			errflag++;
+		break;
+
+					/* --------------------------------- */
+		case 'U':               /* use saved primer hits             */
+					/* --------------------------------- */
+		reuse_name = ECOMALLOC(strlen(optarg)+1,
+		                       "Error on hit index name allocation");
+		strcpy(reuse_name,optarg);
+		break;
+
+					/* --------------------------------- */
+		case 'K':               /* checkpoint file                   */
+					/* --------------------------------- */
+		checkpoint_name = optarg;
+		break;
+
+					/* --------------------------------- */
+		case 'R':               /* resume from the checkpoint        */
+					/* --------------------------------- */
+		resume = 1;
+		break;
+
+					/* --------------------------------- */
+		case 'n':               /* newer files of the manifest       */
+					/* --------------------------------- */
+		if (sscanf(optarg,"%d",&since) != 1 || since < 0)
+			errflag++;
+		break;
+
+					/* --------------------------------- */
+		case 'P':               /* run statistics                    */
+					/* --------------------------------- */
+		stats = 1;
+		break;
+
+					/* --------------------------------- */
+		case 'x':               /* result cache directory            */
+					/* --------------------------------- */
+		cache_name = optarg;
+		break;
+
+					/* --------------------------------- */
+		case 'z':               /* query an ecoPCR server            */
+					/* --------------------------------- */
+		client_name = optarg;
+		break;
+
+					/* --------------------------------- */
+		case 'Z':               /* ecoPCR server mode                */
+					/* --------------------------------- */
+		server_name = optarg;
 		break;
 
 		case '?':               /* bad option           */
@@ -455,6 +2210,26 @@ int main(int argc, char **argv)
 
 	}
 	
+	/**
+	 * a server takes no primer, a query sent to a server cannot
+	 * start another one
+	 **/
+	if (server_name)
+	{
+		if (!prefix)
+			prefix = getenv("ECOPCRDB");
+		if (!prefix || optind < argc || client_name || server_prefix)
+			ExitUsage(1);
+		serveQueries(server_name,prefix,argv[0]);
+	}
+
+	if (client_name)
+	{
+		if (server_prefix)
+			ExitUsage(1);
+		return forwardQuery(client_name,argc,argv);
+	}
+
 	/**
 	 * check the path to the database is given as last argument
 	 */
@@ -493,22 +2268,93 @@ int main(int argc, char **argv)
 	                  
     if (!oligo1 || !oligo2)
     		errflag++;
+    		
+    if (hitidx_name && reuse_name)
+    		errflag++;
+    		
+    if (coverage_mode && reuse_name)
+    		errflag++;
+    		
+    if (fasta_mode && (coverage_mode || binary_name))
+    		errflag++;
+    		
+    if (stream_min && (!lmax || circular || hitidx_name || reuse_name))
+    		errflag++;
+    		
+    if (strands != STRAND_BOTH && hitidx_name)
+    		errflag++;
+    		
+    if (resume && !checkpoint_name)
+    		errflag++;
+    		
+    if (checkpoint_name &&
+        (coverage_mode || fasta_mode || binary_name || hitidx_name || reuse_name))
+    		errflag++;
+    		
+    if (since >= 0 && reuse_name)
+    		errflag++;
+    		
+    if (cache_name &&
+        (coverage_mode || fasta_mode || binary_name || hitidx_name || reuse_name ||
+         checkpoint_name))
+    		errflag++;
 	
 	if (errflag)
 		ExitUsage(errflag);
 		
+	if (stats)
+		ecostats_enable();
+		
+	/**
+	 * results are written in a file from which a resumed run
+	 * removes what follows the checkpoint
+	 **/
+	if (checkpoint_name)
+	{
+		if (fstat(fileno(stdout),&output_stat) || !S_ISREG(output_stat.st_mode))
+			ECOERROR(ECO_IO_ERROR,"Checkpoints need the results to be written in a file");
+
+		memset(&checkpoint,0,sizeof(checkpoint));
+
+		/* the sequence files read with -n are part of the run */
+		parameters = runParameters(oligo1,oligo2,error_max,lmin,lmax,delta,
+		                           circular,kingdom_mode,strands,trim_rate,
+		                           salt,saltmethod,restricted_taxid,r,ignored_taxid,g);
+		checkpoint_parameters = ECOMALLOC(strlen(parameters)+16,
+		                                  "Allocate checkpoint parameters");
+		sprintf(checkpoint_parameters,"%s n=%d",parameters,since);
+		ECOFREE(parameters,"Free run parameters");
+
+		if (resume)
+		{
+			resumed = readCheckpoint(checkpoint_name,&checkpoint,checkpoint_parameters);
+
+			if (output_stat.st_size < checkpoint.output)
+				ECOERROR(ECO_IO_ERROR,"Results are shorter than at the checkpoint, append them with >>");
+
+			if (ftruncate(fileno(stdout),checkpoint.output) ||
+				lseek(fileno(stdout),0,SEEK_END) < 0)
+				ECOERROR(ECO_IO_ERROR,"Cannot cut the results at the checkpoint");
+
+			memcpy(strandCount,checkpoint.strandCount,sizeof(strandCount));
+
+			if (resumed)
+			{
+				fprintf(stderr,"# Resuming after record %ld of file %d\n",
+						checkpoint.offset,checkpoint.file_index);
+				ecoseq_iterator_resume(checkpoint.file_index,checkpoint.offset);
+			}
+		}
+
+		checkpoint_time = time(NULL) + CHECKPOINT_PERIOD;
+	}
+
 	o1 = buildPattern(oligo1,error_max);
 	o2 = buildPattern(oligo2,error_max);
 	
-	o1c = complementPattern(o1);
-	o2c = complementPattern(o2);
-	
-	printf("#@ecopcr-v2\n");
-	printf("#\n");
-	printf("# ecoPCR version %s\n",VERSION);
-	printf("# direct  strand oligo1 : %-32s ; oligo2c : %32s\n", o1->cpat,o2c->cpat);
-	printf("# reverse strand oligo2 : %-32s ; oligo1c : %32s\n", o2->cpat,o1c->cpat);
-	printf("# max error count by oligonucleotide : %d\n",error_max);
+	/* complement patterns are only compiled for the scanned strands */
+	o1c = (strands & STRAND_REVERSE) ? complementPattern(o1):NULL;
+	o2c = (strands & STRAND_DIRECT)  ? complementPattern(o2):NULL;
 	
 	double tm,tm1,tm2;
 
@@ -516,29 +2362,255 @@ int main(int argc, char **argv)
 	tm2=nparam_CalcSelfTM(&tparm,o2->cpat,o2->patlen) - 273.15;
 	tm = (tm1 < tm2) ? tm1:tm2;
 
-	printf("# optimal Tm for primers 1 : %5.2f\n",tm1);
-	printf("# optimal Tm for primers 2 : %5.2f\n",tm2);
-
-	printf("# database : %s\n",prefix);
-	if (lmin && lmax)
-		printf("# amplifiat length between [%d,%d] bp\n",lmin,lmax);
-	else if (lmin)
-		printf("# amplifiat length larger than %d bp\n",lmin);
-	else if (lmax)
-		printf("# amplifiat length smaller than %d bp\n",lmax);
-	if (kingdom_mode)
-		printf("# output in kingdom mode\n");
+	/**
+	 * the fasta output is used as is, without header, the
+	 * header of a resumed run is already written
+	 */
+	if (!fasta_mode && !resumed)
+	{
+		printf("#@ecopcr-v2\n");
+		printf("#\n");
+		printf("# ecoPCR version %s\n",VERSION);
+		printf("# direct  strand oligo1 : %-32s ; oligo2c : %32s\n", o1->cpat,
+		       ecoComplementPattern(strcpy(complement,o2->cpat)));
+		printf("# reverse strand oligo2 : %-32s ; oligo1c : %32s\n", o2->cpat,
+		       ecoComplementPattern(strcpy(complement,o1->cpat)));
+		printf("# max error count by oligonucleotide : %d\n",error_max);
+	
+		printf("# optimal Tm for primers 1 : %5.2f\n",tm1);
+		printf("# optimal Tm for primers 2 : %5.2f\n",tm2);
+
+		printf("# database : %s\n",prefix);
+		if (lmin && lmax)
+			printf("# amplifiat length between [%d,%d] bp\n",lmin,lmax);
+		else if (lmin)
+			printf("# amplifiat length larger than %d bp\n",lmin);
+		else if (lmax)
+			printf("# amplifiat length smaller than %d bp\n",lmax);
+		if (kingdom_mode)
+			printf("# output in kingdom mode\n");
+		else
+			printf("# output in superkingdom mode\n");
+		if (circular)
+			printf("# DB sequences are considered as circular\n");
+		else
+			printf("# DB sequences are considered as linear\n");
+		if (strands == STRAND_DIRECT)
+			printf("# direct strand only\n");
+		else if (strands == STRAND_REVERSE)
+			printf("# reverse strand only\n");
+		if (coverage_mode)
+			printf("# coverage report mode\n");
+		else if (binary_name)
+			printf("# binary output in %s\n",binary_name);
+		printf("#\n");
+	}
+
+	if (server_taxonomy && !strcmp(prefix,server_prefix))
+		taxonomy = server_taxonomy;
 	else
-		printf("# output in superkingdom mode\n");
-	if (circular)
-		printf("# DB sequences are considered as circular\n");
+		taxonomy = read_taxonomy(prefix,0);
+
+	/**
+	 * with -n, only the sequence files added or changed after the
+	 * given version of the database manifest are read
+	 **/
+	if (since >= 0)
+	{
+		manifest = read_manifest(prefix);
+
+		if (!manifest)
+			ECOERROR(ECO_IO_ERROR,"The database has no manifest, build it with ecoindex -M");
+
+		shards   = check_manifest(manifest,prefix,since);
+		excluded = ECOMALLOC(shards+1,"Allocate excluded sequence files");
+
+		for (i=1, selected=0; i <= shards; i++)
+			if (!(excluded[i] = manifest->shard[i].version <= since))
+				selected++;
+
+		fprintf(stderr,"# %d of %d sequence files newer than version %d of %s\n",
+				selected,shards,since,prefix);
+
+		delete_manifest(manifest);
+	}
+
+	/**
+	 * the cache key holds every parameter changing the result lines
+	 **/
+	if (cache_name)
+	{
+		parameters = runParameters(oligo1,oligo2,error_max,lmin,lmax,delta,
+		                           circular,kingdom_mode,strands,trim_rate,
+		                           salt,saltmethod,restricted_taxid,r,ignored_taxid,g);
+		cache = openResultCache(cache_name,prefix,parameters,excluded);
+		ECOFREE(parameters,"Free run parameters");
+	}
+
+	/* excluded and cached sequence files are not read */
+	if (excluded || cache)
+	{
+		shards  = (cache) ? cache->count : shards;
+		skipped = ECOMALLOC(shards+1,"Allocate skipped sequence files");
+
+		for (i=1; i <= shards; i++)
+			skipped[i] = (excluded && excluded[i]) || (cache && cache->hit[i]);
+
+		ecoseq_iterator_skip(skipped,shards);
+	}
+
+	/**
+	 * when hits are saved, the second primer is looked for on the whole
+	 * sequence so the index stays valid whatever the length limits are
+	 **/
+	scan_lmax = (hitidx_name) ? 0:lmax;
+
+	if (coverage_mode)
+		coverage = new_ecocoverage(taxonomy,restricted_taxid,r,ignored_taxid,g);
+	else if (fasta_mode)
+		fasta_taxa = ECOMALLOC(taxonomy->taxons->count,
+		                       "Allocate reported taxon flags");
+	else if (binary_name)
+		binary = create_ecoresult(binary_name,taxonomy,oligo1,oligo2,
+		                          kingdom_mode,error_max,lmin,lmax,delta,circular);
+
+	/**
+	 * with an FM-index or a k-mer index, the primers are looked for
+	 * in the index and only the sequences holding a primer pair are
+	 * read. Linear mode only, coverage needs every sequence of the
+	 * database.
+	 **/
+	indexpatterns[0] = (strands & STRAND_DIRECT)  ? o1:NULL;
+	indexpatterns[1] = o2c;
+	indexpatterns[2] = (strands & STRAND_REVERSE) ? o2:NULL;
+	indexpatterns[3] = o1c;
+
+	if (!reuse_name && !circular && !coverage_mode && !stream_min)
+	{
+		fmindex = read_fmindex(prefix);
+
+		if (!fmindex && (kmeridx = read_kmeridx(prefix)) &&
+			!(kmerscan = newKmerScan(kmeridx,indexpatterns)))
+		{
+			fprintf(stderr,"# Primers too short for the %d-mer index of %s, ignored\n",
+					kmeridx->k,
+					prefix);
+			delete_kmeridx(kmeridx);
+		}
+	}
+
+	if (reuse_name)
+	{
+		hitidx = open_hitidx(reuse_name,o1,o2,error_max,circular,taxonomy,
+		                     restricted_taxid,r,ignored_taxid,g,&hitidx_count);
+		fprintf(stderr,"# Reading primer hit index %s containing %d sequences...\n",
+				reuse_name,
+				hitidx_count);
+		seq = nextIndexedSequence(hitidx,prefix,&apatseq,error_max,circular);
+	}
+	else if (fmindex)
+	{
+		if (hitidx_name)
+			hitidx = create_hitidx(hitidx_name,o1,o2,error_max,circular,
+			                       restricted_taxid,r,ignored_taxid,g);
+
+		fprintf(stderr,"# Looking for primers in the FM-index of %s (%d sequences)...\n",
+				prefix,
+				fmindex->records);
+
+		fmscan = newFMScan(fmindex,indexpatterns);
+		seq    = nextFMSequence(fmscan,prefix,&apatseq,&seqfile_idx,&seqoffset);
+	}
+	else if (kmerscan)
+	{
+		if (hitidx_name)
+			hitidx = create_hitidx(hitidx_name,o1,o2,error_max,circular,
+			                       restricted_taxid,r,ignored_taxid,g);
+
+		fprintf(stderr,"# Looking for primers in the %d-mer index of %s (%d sequences)...\n",
+				kmeridx->k,
+				prefix,
+				kmeridx->records);
+
+		seq = nextKmerSequence(kmerscan,prefix,&apatseq,&seqfile_idx,&seqoffset);
+	}
 	else
-		printf("# DB sequences are considered as linear\n");
-	printf("#\n");
+	{
+		if (hitidx_name)
+			hitidx = create_hitidx(hitidx_name,o1,o2,error_max,circular,
+			                       restricted_taxid,r,ignored_taxid,g);
+
+		/**
+		 * on a database sorted by taxonomy, a restricted search
+		 * skips the blocks without any restricted taxon, and the
+		 * q-gram summaries skip the blocks which cannot hold a
+		 * primer pair (not in circular mode, where primers may
+		 * span the sequence ends, nor for coverage)
+		 **/
+		blocks = read_blockidx(prefix,taxonomy);
+
+		if (blocks && r > 0)
+			fprintf(stderr,"# %d of %d sequence blocks hold restricted taxa\n",
+					select_blockidx(blocks,taxonomy,restricted_taxid,r),
+					blocks->count);
+
+		if (blocks && !circular && !coverage_mode &&
+			(selected = screen_blockidx(blocks,indexpatterns)) >= 0)
+			fprintf(stderr,"# %d of %d sequence blocks may hold a primer pair\n",
+					selected,
+					blocks->count);
+		else if (blocks && r == 0)
+		{
+			delete_blockidx(blocks);
+			blocks = NULL;
+		}
+
+		/* blocks followed by one starting before the checkpoint are done */
+		if (blocks && resumed)
+			for (i=0; i+1 < blocks->count; i++)
+				if (blocks->block[i+1].file_index < checkpoint.file_index ||
+					(blocks->block[i+1].file_index == checkpoint.file_index &&
+					 blocks->block[i+1].offset <= checkpoint.offset))
+					blocks->block[i].selected = 0;
+
+		if (blocks && skipped)
+			for (i=0; i < blocks->count; i++)
+				if (blocks->block[i].file_index <= shards &&
+					skipped[blocks->block[i].file_index])
+					blocks->block[i].selected = 0;
+
+		ecoseq_set_streaming(stream_min);
 
-	taxonomy = read_taxonomy(prefix,0);
+		/**
+		 * sequences are read and uncompressed by a second thread
+		 * while the current one is scanned
+		 **/
+		if (threads > 1)
+		{
+			/**
+			 * with several threads, sequences are scanned by batches
+			 * shared between the threads according to their lengths
+			 **/
+			batch = ECOMALLOC(sizeof(ecoscanbatch_t),"Allocate scan batch");
+			batch->scheduler = new_ecoscheduler(threads);
+			batch->threads   = threads;
+			batch->o1        = o1;
+			batch->o2        = o2;
+			batch->o1c       = o1c;
+			batch->o2c       = o2c;
+			batch->strands   = strands;
+			batch->circular  = circular;
+			batch->taxonomy  = taxonomy;
+			batch->restricted_taxid = restricted_taxid;
+			batch->r         = r;
+			batch->ignored_taxid = ignored_taxid;
+			batch->g         = g;
 
-	seq = ecoseq_iterator(prefix);
+			seq = nextScannedSequence(batch,prefix,blocks);
+		}
+		else
+			seq = ecoseq_readahead(prefix,blocks);
+	}
 		
 	checkedSequence = 0;
 	positiveSequence= 0;
@@ -547,15 +2619,54 @@ int main(int argc, char **argv)
 	while(seq)
 	{	
 		checkedSequence++;
+		
+		/**
+		 * a duplicated sequence is not scanned again when the hits
+		 * of the sequence it shares are still in apatseq
+		 **/
+		if (!seq->duplicate)
+			scanned = 0;
+		shared = seq->duplicate && scanned && !reuse_name && !fmscan && !kmerscan;
+		paired = 0;
+
+		if (batch)
+			prescanned = scannedHits(batch,&seqfile_idx,&seqoffset);
+		else if (fmscan || kmerscan)
+			prescanned = apatseq;
+		else if (!reuse_name)
+			ecoseq_readahead_position(&seqfile_idx,&seqoffset);
+		
+		/**
+		 * a resumed run skips the sequences before the checkpoint
+		 **/
+		done = resumed && (seqfile_idx < checkpoint.file_index ||
+		                   (seqfile_idx == checkpoint.file_index &&
+		                    seqoffset <= checkpoint.offset));
+		
+		/**
+		 * the results of a cached sequence file are copied, the
+		 * ones of a new file go to the cache too
+		 **/
+		if (cache)
+			advanceResultCache(cache,seqfile_idx,strandCount);
+		
+		/* the index paths still give sequences of skipped files */
+		if (skipped && seqfile_idx <= shards && skipped[seqfile_idx])
+		{
+			done    = 1;
+			scanned = 0;
+		}
+		
 		/**
 		* check if current sequence should be included
 		**/
-		if ( (r == 0) || 
-		     (eco_is_taxid_included(taxonomy, 
-		                            restricted_taxid, 
-		                            r, 
-		                            taxonomy->taxons->taxon[seq->taxid].taxid)
-		     ) 
+		if ( !done &&
+		     ((r == 0) || 
+		      (eco_is_taxid_included(taxonomy, 
+		                             restricted_taxid, 
+		                             r, 
+		                             taxonomy->taxons->taxon[seq->taxid].taxid)
+		      ))
 		   )
 		     if ((g == 0) || 
 		         !(eco_is_taxid_included(taxonomy, 
@@ -564,6 +2675,7 @@ int main(int argc, char **argv)
 		                                 taxonomy->taxons->taxon[seq->taxid].taxid)
 		          )
 		        )
+		       if (!fasta_taxa || hitidx_name || !fasta_taxa[seq->taxid])
 		     {
 		
 				//scname = taxonomy->taxons->taxon[seq->taxid].name;
@@ -572,9 +2684,46 @@ int main(int argc, char **argv)
 				//strncpy(tail,seq->SQ+seq->SQ_length-10,10);
 				//tail[10]=0;
 		
-				apatseq=ecoseq2apatseq(seq,apatseq,circular);
+				seqAmplified = 0;
+				strandAmplified[0] = strandAmplified[1] = 0;
 				
-				o1Hits = ManberAll(apatseq,o1,0,0,apatseq->seqlen+apatseq->circular);
+				if (binary)
+					set_ecoresult_sequence(binary,seq);
+				
+				if (seq->stream)
+				{
+					/* long sequence read by chunks */
+					seqAmplified = streamRepeats(seq,oligo1,oligo2,&tparm,o1,o2,o1c,o2c,
+					                             kingdom_mode,lmin,lmax,taxonomy,delta,
+					                             binary,fasta_taxa,trim_rate,coverage!=NULL,
+					                             strands,strandAmplified);
+					o1Hits = 0;
+				}
+				else if (reuse_name || shared)
+					o1Hits = (strands & STRAND_DIRECT) ? apatseq->hitpos[0]->top:0;
+				else if (prescanned)
+				{
+					apatseq = prescanned;
+					o1Hits  = apatseq->hitpos[0]->top;
+					scanned = 1;
+				}
+				else
+				{
+					apatseq=ecoseq2apatseq(seq,apatseq,circular);
+					/**
+					 * without threads, the first primers of both strands
+					 * are looked for in a single pass over the sequence
+					 **/
+					paired = strands == STRAND_BOTH && threads == 1;
+					if (paired)
+						o1Hits = ecoManberPair(apatseq,o1,0,apatseq->seqlen+apatseq->circular,
+						                       o2,2,apatseq->seqlen);
+					else if (strands & STRAND_DIRECT)
+						o1Hits = ecoManberWindows(apatseq,o1,0,0,apatseq->seqlen+apatseq->circular,threads);
+					else
+						o1Hits = 0;
+					scanned = 1;
+				}
 				o2cHits= 0;
 				
 				if (o1Hits)
@@ -582,7 +2731,7 @@ int main(int argc, char **argv)
 					stktmp = apatseq->hitpos[0];
 					begin = stktmp->val[0] + o1->patlen;
 					
-					if (lmax)
+					if (scan_lmax)
 						length= stktmp->val[stktmp->top-1] + o1->patlen - begin + lmax + o2->patlen;
 					else
 						length= apatseq->seqlen - begin;
@@ -592,8 +2741,13 @@ int main(int argc, char **argv)
 						begin = 0;
 						length=apatseq->seqlen+circular;
 					}	
-					o2cHits = ManberAll(apatseq,o2c,1,begin,length);
+					if (reuse_name || shared || prescanned)
+						o2cHits = clip_hitidx(apatseq,o2c,1,begin,length);
+					else
+						o2cHits = ecoManberWindows(apatseq,o2c,1,begin,length,threads);
 		
+					timer = ecostat_clock();
+					
 					if (o2cHits)
 						for (i=0; i < o1Hits;i++)
 						{
@@ -620,23 +2774,38 @@ int main(int argc, char **argv)
 											(!lmin || (length >= lmin)) &&
 											(!lmax || (length <= lmax)))
 										{
-										    printRepeat(seq,oligo1,oligo2,&tparm,o1,o2c,'D',kingdom_mode,posi,posj,erri,errj,taxonomy,delta);
+											strandAmplified[0]++;
+											if (coverage)
+												seqAmplified++;
+											else
+											    printRepeat(seq,oligo1,oligo2,&tparm,o1,o2c,'D',kingdom_mode,posi,posj,erri,errj,taxonomy,delta,binary,fasta_taxa,trim_rate);
 											//printf("%s\tD\t%s...%s (%d)\t%d\t%d\t%d\t%d\t%s\n",seq->AC,head,tail,seq->SQ_length,o1Hits,o2cHits,posi,posj,scname);
 										}
 									}
 								}
 							}
 						}
+					
+					ecostat_add(ECOSTAT_PAIRING,timer,(int64_t)o1Hits * o2cHits);
 				}
 					
-				o2Hits = ManberAll(apatseq,o2,2,0,apatseq->seqlen);
+				if (seq->stream)
+					o2Hits = 0;  /* both strands already scanned */
+				else if (!(strands & STRAND_REVERSE))
+					o2Hits = 0;
+				else if (coverage && seqAmplified && !hitidx_name)
+					o2Hits = 0;  /* already counted, reverse strand is useless */
+				else if (reuse_name || shared || prescanned || paired)
+					o2Hits = apatseq->hitpos[2]->top;
+				else
+					o2Hits = ecoManberWindows(apatseq,o2,2,0,apatseq->seqlen,threads);
 				o1cHits= 0;
 				if (o2Hits)
 				{
 					stktmp = apatseq->hitpos[2];
 					begin = stktmp->val[0] + o2->patlen;
 					
-					if (lmax)
+					if (scan_lmax)
 						length= stktmp->val[stktmp->top-1] + o2->patlen - begin + lmax + o1->patlen;
 					else
 						length= apatseq->seqlen - begin;
@@ -647,7 +2816,12 @@ int main(int argc, char **argv)
 						length=apatseq->seqlen+circular;
 					}	
 
-					o1cHits = ManberAll(apatseq,o1c,3,begin,length);
+					if (reuse_name || shared || prescanned)
+						o1cHits = clip_hitidx(apatseq,o1c,3,begin,length);
+					else
+						o1cHits = ecoManberWindows(apatseq,o1c,3,begin,length,threads);
+					
+					timer = ecostat_clock();
 					
 					if (o1cHits)
 						for (i=0; i < o2Hits;i++)
@@ -674,20 +2848,128 @@ int main(int argc, char **argv)
 											(!lmin || (length >= lmin)) &&
 											(!lmax || (length <= lmax)))
 										{
-										    printRepeat(seq,oligo1,oligo2,&tparm,o2,o1c,'R',kingdom_mode,posi,posj,erri,errj,taxonomy,delta);
+											strandAmplified[1]++;
+											if (coverage)
+												seqAmplified++;
+											else
+											    printRepeat(seq,oligo1,oligo2,&tparm,o2,o1c,'R',kingdom_mode,posi,posj,erri,errj,taxonomy,delta,binary,fasta_taxa,trim_rate);
 											//printf("%s\tR\t%s...%s (%d)\t%d\t%d\t%d\t%d\t%s\n",seq->AC,head,tail,seq->SQ_length,o2Hits,o1cHits,posi,posj,scname);
 										}
 									}
 								}
 							}
 						}
+					
+					ecostat_add(ECOSTAT_PAIRING,timer,(int64_t)o2Hits * o1cHits);
 				}	
 				
+				if (hitidx_name && ((o1Hits && o2cHits) || (o2Hits && o1cHits)))
+				{
+					if (!batch && !fmscan && !kmerscan)
+						ecoseq_readahead_position(&seqfile_idx,&seqoffset);
+					write_hitidx(hitidx,seqfile_idx,seqoffset,apatseq);
+					hitidx_count++;
+				}
+				
+				statBases+=seq->SQ_length;
+				statHits +=strandAmplified[0] + strandAmplified[1];
+				
+				if (strandAmplified[0] || strandAmplified[1])
+					strandCount[(strandAmplified[0] && strandAmplified[1]) ? 2:
+					            (strandAmplified[0] ? 0:1)]++;
+				
+				if (coverage)
+					ecocoverage_add(coverage,seq->taxid,seqAmplified);
+				
 		} /* End of taxonomic selection */
 		
+		if (checkpoint_name && !done)
+		{
+			checkpoint.file_index = seqfile_idx;
+			checkpoint.offset     = seqoffset;
+			
+			if (time(NULL) >= checkpoint_time)
+			{
+				memcpy(checkpoint.strandCount,strandCount,sizeof(strandCount));
+				writeCheckpoint(checkpoint_name,&checkpoint,checkpoint_parameters);
+				checkpoint_time = time(NULL) + CHECKPOINT_PERIOD;
+			}
+		}
+		
 		delete_ecoseq(seq);
 		
-		seq = ecoseq_iterator(NULL);
+		if (reuse_name)
+			seq = nextIndexedSequence(hitidx,prefix,&apatseq,error_max,circular);
+		else if (fmscan)
+			seq = nextFMSequence(fmscan,prefix,&apatseq,&seqfile_idx,&seqoffset);
+		else if (kmerscan)
+			seq = nextKmerSequence(kmerscan,prefix,&apatseq,&seqfile_idx,&seqoffset);
+		else if (batch)
+			seq = nextScannedSequence(batch,NULL,blocks);
+		else
+			seq = ecoseq_readahead(NULL,blocks);
+	}
+	
+	if (cache)
+		advanceResultCache(cache,cache->count+1,strandCount);
+	
+	flush_ecoresult(stdout);
+	
+	/* a resumed finished run has nothing left to do */
+	if (checkpoint_name)
+	{
+		memcpy(checkpoint.strandCount,strandCount,sizeof(strandCount));
+		writeCheckpoint(checkpoint_name,&checkpoint,checkpoint_parameters);
+	}
+	
+	/**
+	 * in coverage mode, the reverse strand of an amplified sequence
+	 * is not scanned, strand counts are meaningless
+	 **/
+	if (!coverage)
+		fprintf(stderr,"# amplified sequences : %d on the direct strand only, "
+		               "%d on the reverse strand only, %d on both\n",
+		               strandCount[0],strandCount[1],strandCount[2]);
+	
+	print_ecostats(stderr,checkedSequence,statBases,statHits);
+	
+	if (hitidx_name)
+	{
+		close_ecorecorddb(hitidx,hitidx_count+1);
+		fprintf(stderr,"# %d sequences stored in primer hit index %s\n",
+				hitidx_count,
+				hitidx_name);
+	}
+	else if (reuse_name)
+		fclose(hitidx);
+	
+	if (coverage)
+	{
+		ecocoverage_print(stdout,coverage);
+		delete_ecocoverage(coverage);
+	}
+	
+	if (binary)
+		close_ecoresult(binary);
+	
+	if (fasta_taxa)
+		ECOFREE(fasta_taxa,"Free reported taxon flags");
+	
+	if (blocks)
+		delete_blockidx(blocks);
+	
+	if (fmscan)
+		deleteFMScan(fmscan);
+	
+	if (kmerscan)
+		deleteKmerScan(kmerscan);
+	
+	if (batch)
+	{
+		delete_ecoscheduler(batch->scheduler);
+		for (i=0; i < BATCH_SEQUENCES; i++)
+			delete_apatseq(batch->task[i].apatseq);
+		ECOFREE(batch,"Free scan batch");
 	}
 	
 	ECOFREE(restricted_taxid, "Error: could not free restricted_taxid\n");
@@ -695,3 +2977,12 @@ int main(int argc, char **argv)
 		
 	return 0;
 }
+
+/* ----------------------------------------------- */
+/* MAIN                                            */
+/* ----------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+	return ecoPCR(argc,argv);
+}
@@ -0,0 +1,361 @@
+#include "libecoPCR/ecoPCR.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#define VERSION "0.1"
+
+/*
+ * location of a sequence record in the source database
+ * and its sort key
+ */
+typedef struct {
+	int32_t rank;		// preorder rank of the sequence taxon
+	int32_t order;		// position in the source database
+	int32_t file_index;
+	long    offset;
+} ecosortentry_t;
+
+static int compare_entries(const void *e1,const void *e2)
+{
+	const ecosortentry_t *a = e1;
+	const ecosortentry_t *b = e2;
+
+	if (a->rank != b->rank)
+		return (a->rank < b->rank) ? -1 : 1;
+
+	return (a->order < b->order) ? -1 : (a->order > b->order);
+}
+
+/**
+ * Copy a taxonomy file of the source database
+ * @param	from		source database prefix
+ * @param	to			output database prefix
+ * @param	extension	file extension
+ * @param	required	abort if the source file does not exist
+ */
+static void copy_taxonomy_file(const char *from,const char *to,
+		                       const char *extension,int32_t required)
+{
+	char   filename[1024];
+	char   buffer[65536];
+	FILE   *input;
+	FILE   *output;
+	size_t size;
+
+	snprintf(filename,1024,"%s.%s",from,extension);
+	input = fopen(filename,"rb");
+
+	if (!input)
+	{
+		if (required)
+			ECOERROR(ECO_IO_ERROR,"Cannot open taxonomy file");
+		return;
+	}
+
+	snprintf(filename,1024,"%s.%s",to,extension);
+	output = fopen(filename,"wb");
+
+	if (!output)
+		ECOERROR(ECO_IO_ERROR,"Cannot create taxonomy file");
+
+	while ((size = fread(buffer,1,sizeof(buffer),input)) > 0)
+		if (fwrite(buffer,1,size,output)!=size)
+			ECOERROR(ECO_IO_ERROR,"Cannot write taxonomy file");
+
+	fclose(input);
+	fclose(output);
+}
+
+static FILE *create_shard(const char *prefix,int32_t index)
+{
+	char filename[1024];
+
+	snprintf(filename,1024,"%s_%03d.sdx",prefix,index);
+
+	fprintf(stderr,"# Writing file %s\n",filename);
+
+	return create_ecorecorddb(filename);
+}
+
+/* ----------------------------------------------- */
+/* printout help                                   */
+/* ----------------------------------------------- */
+#define PP fprintf(stdout,
+
+static void PrintHelp()
+{
+        PP      "------------------------------------------\n");
+        PP      " ecosort Version %s\n", VERSION);
+        PP      "------------------------------------------\n");
+        PP      "synopsis : rewrite a database with its sequences sorted\n");
+        PP      "           by taxonomy and build its block index (.bdx)\n");
+        PP      "usage: ecosort [options] -d database -o database\n");
+        PP      "------------------------------------------\n");
+        PP      "options:\n");
+        PP      "-b : number of sequences per [B]lock (1000 by default)\n\n");
+        PP      "-d : [D]atabase to sort : to match the expected format, the database\n");
+        PP      "     has to be formated first by the ecoPCRFormat.py program located.\n");
+        PP      "     in the tools directory.\n\n");
+        PP      "-h : [H]elp - print <this> help\n\n");
+        PP      "-o : [O]utput database prefix\n\n");
+        PP      "-q : length of the [Q]-grams summarized for each block (%d by\n",
+                BLOCKIDX_DEFAULT_Q);
+        PP      "     default, %d to %d, 0 for no summary)\n\n",
+                BLOCKIDX_MIN_Q,BLOCKIDX_MAX_Q);
+        PP      "-s : number of sequences per [S]equence file (0 by default, a\n");
+        PP      "     single file)\n\n");
+        PP      "------------------------------------------\n");
+        PP      "The sequences of a taxon and of its subtree are stored\n");
+        PP      "contiguously, ecoPCR -r only reads the blocks holding\n");
+        PP      "the restricted taxa.\n");
+        PP      "ecoPCR also skips the blocks whose q-gram summary shows\n");
+        PP      "that they cannot hold the primers. This needs primers of\n");
+        PP      "m bases allowed e errors with m-q+1-e*q > 0, and blocks\n");
+        PP      "holding few q-grams : lower -b on long sequences.\n");
+        PP      "------------------------------------------\n\n");
+}
+
+#undef PP
+
+/* ----------------------------------------------- */
+/* printout usage and exit                         */
+/* ----------------------------------------------- */
+
+#define PP fprintf(stderr,
+
+static void ExitUsage(stat)
+        int stat;
+{
+        PP      "usage: ecosort [-h] [-b count] [-q length] [-s count] -d database -o database\n");
+        PP      "type \"ecosort -h\" for help\n");
+
+        if (stat)
+            exit(stat);
+}
+
+#undef  PP
+
+/* ----------------------------------------------- */
+/* MAIN						                       */
+/* ----------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+	int32_t         carg;
+	int32_t         errflag      = 0;
+	int32_t         block_size   = 1000;	// sequences per block
+	int32_t         shard_size   = 0;		// sequences per .sdx file
+	int32_t         qgram        = BLOCKIDX_DEFAULT_Q;	// block summary q-grams
+	char            *prefix      = NULL;	// source database
+	char            *output      = NULL;	// sorted database
+
+	ecotaxonomy_t   *taxonomy;
+	ecoseq_t        *seq;
+	int32_t         *rank;
+
+	ecosortentry_t  *entries     = NULL;
+	int32_t         count        = 0;
+	int32_t         size         = 0;
+	int32_t         i;
+
+	FILE            *shard       = NULL;
+	FILE            *blocks;
+	int32_t         shard_idx    = 0;
+	int32_t         in_shard     = 0;
+	int32_t         in_block     = 0;
+	long            block_offset = 0;
+	int32_t         block_first  = 0;
+	int32_t         block_last   = 0;
+	int32_t         block_count  = 0;
+
+	char            *last_SQ     = NULL;	// last sequence stored in full
+	int32_t         last_size    = 0;
+	int32_t         last_length  = -1;
+	long            last_offset  = 0;
+	long            here;
+
+	while ((carg = getopt(argc, argv, "hb:d:o:q:s:")) != -1) {
+
+		switch (carg) {
+	        /* -------------------- */
+	        case 'b':     /* sequences per block */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&block_size);
+	          break;
+
+	        /* -------------------- */
+	        case 'd':     /* database name     */
+	        /* -------------------- */
+	          prefix = ECOMALLOC(strlen(optarg)+1,
+	                             "Error on prefix allocation");
+	          strcpy(prefix,optarg);
+	          break;
+
+	        /* -------------------- */
+	        case 'h':     /* help              */
+	        /* -------------------- */
+	          PrintHelp();
+	          exit(0);
+	          break;
+
+	        /* -------------------- */
+	        case 'o':     /* output name       */
+	        /* -------------------- */
+	          output = ECOMALLOC(strlen(optarg)+1,
+	                             "Error on output allocation");
+	          strcpy(output,optarg);
+	          break;
+
+	        /* -------------------- */
+	        case 'q':     /* summary q-grams   */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&qgram);
+	          break;
+
+	        /* -------------------- */
+	        case 's':     /* sequences per file */
+	        /* -------------------- */
+	          sscanf(optarg,"%d",&shard_size);
+	          break;
+
+	        case '?':     /* bad option        */
+	          errflag++;
+		}
+	}
+
+	if (!prefix || !output || block_size < 1 || shard_size < 0 ||
+		(qgram && (qgram < BLOCKIDX_MIN_Q || qgram > BLOCKIDX_MAX_Q)) ||
+		optind < argc || !strcmp(prefix,output))
+		errflag++;
+
+	if (errflag)
+		ExitUsage(errflag);
+
+	taxonomy = read_taxonomy(prefix,0);
+	rank     = eco_taxonomy_preorder(taxonomy,NULL);
+
+	/* collect sequence locations and sort them by taxon preorder rank */
+
+	seq = ecoseq_iterator(prefix);
+
+	while (seq)
+	{
+		if (count == size)
+		{
+			size = size ? size * 2 : 4096;
+			if (entries)
+				entries = ECOREALLOC(entries,sizeof(ecosortentry_t) * size,
+				                     "Increase sort table");
+			else
+				entries = ECOMALLOC(sizeof(ecosortentry_t) * size,
+				                    "Allocate sort table");
+		}
+
+		entries[count].rank  = rank[seq->taxid];
+		entries[count].order = count;
+		ecoseq_iterator_position(&(entries[count].file_index),
+		                         &(entries[count].offset));
+		count++;
+
+		delete_ecoseq(seq);
+		seq = ecoseq_iterator(NULL);
+	}
+
+	qsort(entries,count,sizeof(ecosortentry_t),compare_entries);
+
+	copy_taxonomy_file(prefix,output,"rdx",1);
+	copy_taxonomy_file(prefix,output,"tdx",1);
+	copy_taxonomy_file(prefix,output,"ldx",0);
+	copy_taxonomy_file(prefix,output,"ndx",1);
+
+	/* write the sorted sequence files and their block index */
+
+	blocks = create_blockidx(output,taxonomy,qgram);
+
+	for (i=0; i < count; i++)
+	{
+		if (in_block == block_size || (shard_size && in_shard == shard_size))
+		{
+			write_blockidx(blocks,shard_idx,block_offset,in_block,
+			               block_first,block_last);
+			block_count++;
+			in_block = 0;
+		}
+
+		if (shard && shard_size && in_shard == shard_size)
+		{
+			close_ecorecorddb(shard,in_shard);
+			shard = NULL;
+		}
+
+		if (!shard)
+		{
+			shard    = create_shard(output,++shard_idx);
+			in_shard = 0;
+		}
+
+		if (!in_block)
+		{
+			block_offset = ftell(shard);
+			block_first  = entries[i].rank;
+			last_length  = -1;
+		}
+
+		block_last = entries[i].rank;
+
+		seq  = ecoseq_fetch(prefix,entries[i].file_index,entries[i].offset);
+		here = ftell(shard);
+
+		/*
+		 * identical sequences sharing a block are stored once,
+		 * a block never refers to the records of an other one
+		 */
+
+		if (seq->SQ_length == last_length &&
+			!memcmp(seq->SQ,last_SQ,last_length))
+			write_ecoseq(shard,seq,here - last_offset);
+		else
+		{
+			write_ecoseq(shard,seq,0);
+			summarize_blockidx(seq);
+
+			if (seq->SQ_length >= last_size)
+			{
+				last_size = seq->SQ_length + 1;
+				if (last_SQ)
+					last_SQ = ECOREALLOC(last_SQ,last_size,
+					                     "Increase sequence buffer");
+				else
+					last_SQ = ECOMALLOC(last_size,
+					                    "Allocate sequence buffer");
+			}
+
+			memcpy(last_SQ,seq->SQ,seq->SQ_length);
+			last_length = seq->SQ_length;
+			last_offset = here;
+		}
+
+		delete_ecoseq(seq);
+
+		in_block++;
+		in_shard++;
+	}
+
+	if (in_block)
+	{
+		write_blockidx(blocks,shard_idx,block_offset,in_block,
+		               block_first,block_last);
+		block_count++;
+	}
+
+	if (shard)
+		close_ecorecorddb(shard,in_shard);
+
+	close_ecorecorddb(blocks,block_count + 1);
+
+	fprintf(stderr,"# %d sequences sorted in %d blocks\n",count,block_count);
+
+	return 0;
+}
@@ -34,6 +34,7 @@ void *read_ecorecord(FILE *f,int32_t *recordSize)
 	static void *buffer    =NULL;
 	int32_t      buffersize=0;
 	int32_t      read;
+	int64_t      timer = ecostat_clock();
 	
 	if (!recordSize)
 		ECOERROR(ECO_ASSERT_ERROR,
@@ -71,6 +72,8 @@ void *read_ecorecord(FILE *f,int32_t *recordSize)
 	if (read != *recordSize)
 		ECOERROR(ECO_IO_ERROR,"Reading record data error");
 		
+	ecostat_add(ECOSTAT_READ,timer,*recordSize + sizeof(int32_t));
+	
 	return buffer;	 
 };
 
@@ -120,3 +123,133 @@ FILE *open_ecorecorddb(const char *filename,
 	return f;                  
 }
 
+
+
+
+/**
+ * Create a database file. A null record count is written
+ * and must be updated by close_ecorecorddb.
+ * @param	filename	name of the file
+ *
+ * @return	FILE type
+ **/
+FILE *create_ecorecorddb(const char *filename)
+{
+	FILE *f;
+
+	f = fopen(filename,"wb");
+
+	if (!f)
+		ECOERROR(ECO_IO_ERROR,"Cannot create file");
+
+	write_ecoint32(f,0);
+
+	return f;
+}
+
+/**
+ * Write an integer in the big endian order used by the database files
+ * @param	*f		the file
+ * @param	value	the integer
+ **/
+void write_ecoint32(FILE *f,int32_t value)
+{
+	if (is_big_endian())
+		value = swap_int32_t(value);
+
+	if (fwrite(&value,sizeof(int32_t),1,f)!=1)
+		ECOERROR(ECO_IO_ERROR,"Writing integer error");
+}
+
+/**
+ * Write a record prefixed by its size, as read back by read_ecorecord
+ * @param	*f			the file
+ * @param	record		the record data
+ * @param	recordSize	the size of the record
+ **/
+void write_ecorecord(FILE *f,void *record,int32_t recordSize)
+{
+	write_ecoint32(f,recordSize);
+
+	if (fwrite(record,1,recordSize,f)!=(size_t)recordSize)
+		ECOERROR(ECO_IO_ERROR,"Writing record data error");
+}
+
+/**
+ * Store the record count at the beginning of the file and close it
+ * @param	*f		the file returned by create_ecorecorddb
+ * @param	count	the number of records written
+ **/
+void close_ecorecorddb(FILE *f,int32_t count)
+{
+	if (fseek(f,0,SEEK_SET))
+		ECOERROR(ECO_IO_ERROR,"Cannot seek to file beginning");
+
+	write_ecoint32(f,count);
+
+	fclose(f);
+}
+
+/**
+ * Swap the byte order of an integer array
+ * @param	array	the integers
+ * @param	count	the number of integers
+ **/
+void swap_ecoarray(int32_t *array,int32_t count)
+{
+	int32_t i;
+
+	for (i=0; i < count; i++)
+		array[i] = swap_int32_t(array[i]);
+}
+
+/**
+ * Write an array as a record
+ * @param	*f		the file
+ * @param	array	the array data
+ * @param	size	the size of the array in bytes
+ * @param	swap	true for an array of integers, written in big endian order
+ **/
+void write_ecoarray(FILE *f,void *array,int32_t size,int32_t swap)
+{
+	if (swap && is_big_endian())
+		swap_ecoarray(array,size / sizeof(int32_t));
+
+	write_ecorecord(f,array,size);
+
+	if (swap && is_big_endian())
+		swap_ecoarray(array,size / sizeof(int32_t));
+}
+
+/**
+ * Read a record written by write_ecoarray in its own buffer,
+ * read_ecorecord reusing a single one
+ * @param	*f		the file
+ * @param	size	receives the size of the array in bytes
+ * @param	swap	true for an array of integers
+ *
+ * @return	the array, to be freed by the caller
+ **/
+void *read_ecoarray(FILE *f,int32_t *size,int32_t swap)
+{
+	void    *array;
+	int32_t read;
+
+	read = fread(size,1,sizeof(int32_t),f);
+
+	if (read != sizeof(int32_t))
+		ECOERROR(ECO_IO_ERROR,"Reading record size error");
+
+	if (is_big_endian())
+		*size = swap_int32_t(*size);
+
+	array = ECOMALLOC((*size) ? *size:1,"Allocate array record");
+
+	if (fread(array,1,*size,f) != (size_t)*size)
+		ECOERROR(ECO_IO_ERROR,"Reading record data error");
+
+	if (swap && is_big_endian())
+		swap_ecoarray(array,*size / sizeof(int32_t));
+
+	return array;
+}
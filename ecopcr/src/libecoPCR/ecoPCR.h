@@ -38,6 +38,9 @@ typedef struct {
 	char    *AC;
 	char    *DE;
 	char    *SQ;
+	int32_t duplicate;  /* SQ is the one of the previous record */
+	struct ecoseqstream *stream;  /* if not NULL, SQ is not loaded and is
+	                                 read by chunks (see ecoseq_stream_next) */
 } ecoseq_t;
 
 /*
@@ -109,12 +112,325 @@ typedef struct {
 } econameidx_t;
 
 
+/*
+ * 
+ * Taxonomy snapshot types
+ * 
+ */
+
+#define TAXSNAPSHOT_SPECIES      (0)	/* lineage columns */
+#define TAXSNAPSHOT_GENUS        (1)
+#define TAXSNAPSHOT_FAMILY       (2)
+#define TAXSNAPSHOT_KINGDOM      (3)
+#define TAXSNAPSHOT_SUPERKINGDOM (4)
+#define TAXSNAPSHOT_LINEAGE      (5)
+
+typedef struct {
+	int32_t count;
+	int32_t rankcount;
+	int32_t *taxid;
+	int32_t *rank;
+	int32_t *parent;		/* index of the parent taxon */
+	int32_t *name;			/* offset in names */
+	int32_t *first;			/* preorder interval of the subtree */
+	int32_t *last;
+	int32_t *bytaxid;		/* taxon indices sorted by taxid */
+	int32_t *lineage[TAXSNAPSHOT_LINEAGE];	/* taxon index at a rank, -1 if none */
+	int32_t *ranklabel;		/* offset in names */
+	char    *names;
+	size_t  size;
+	void    *data;
+} ecotaxsnapshot_t;
+
  typedef struct {
 	ecorankidx_t *ranks;
 	econameidx_t *names;
 	ecotxidx_t   *taxons;
+	ecotaxsnapshot_t *snapshot;	/* NULL if not read from a .cdx file */
 } ecotaxonomy_t;
 
+/*
+ * 
+ * Coverage report types
+ * 
+ */
+
+typedef struct {
+	ecotaxonomy_t *taxonomy;
+	int32_t       *restricted;
+	int32_t       r;
+	int32_t       *ignored;
+	int32_t       g;
+	int32_t       *sequences;
+	int32_t       *amplified;
+	char          *selected;
+} ecocoverage_t;
+
+/*
+ * 
+ * Amplification result types
+ * 
+ */
+
+typedef struct {
+	char     *AC;
+	char     *DE;
+	int32_t  SQ_length;
+	int32_t  taxon;
+	char     strand;
+	char     oligo1[MAX_PAT_LEN+1];
+	char     oligo2[MAX_PAT_LEN+1];
+	int32_t  error1;
+	int32_t  error2;
+	double   tm1;
+	double   tm2;
+	int32_t  amplength;
+	char     *amplicon;
+} ecoresult_t;
+
+typedef struct {
+	int32_t  taxoncount;
+	int32_t  kingdom_mode;
+	int32_t  error_max;
+	int32_t  lmin;
+	int32_t  lmax;
+	int32_t  delta;
+	int32_t  circular;
+	char     *primer1;
+	char     *primer2;
+} ecoresulthead_t;
+
+typedef struct {
+	int32_t  taxon;
+	int32_t  SQ_length;
+	char     *AC;
+	char     *DE;
+} ecoresultseq_t;
+
+typedef struct {
+	int32_t  sequence;
+	int32_t  amplength;
+	int32_t  oligo1;
+	int32_t  oligo2;
+	int32_t  length;
+	int32_t  lower_prefix;
+	int32_t  lower_suffix;
+	double   tm1;
+	double   tm2;
+	char     strand;
+	char     error1;
+	char     error2;
+	char     packed;
+	char     *data;
+} ecoresultrow_t;
+
+typedef struct {
+	FILE            *f;
+	int32_t         writing;
+	int32_t         recordcount;
+	ecoresulthead_t head;
+
+	int32_t         seqcount;
+	int32_t         seqsize;
+	ecoresultseq_t  *sequences;
+	ecoseq_t        *pending;
+
+	int32_t         oligocount;
+	int32_t         oligosize;
+	char            **oligos;
+	int32_t         hashsize;
+	int32_t         *hash;
+
+	int32_t         rowcount;
+	int32_t         rowsize;
+	int32_t         current;
+	ecoresultrow_t  *block;
+	int32_t         datasize;
+	int32_t         datalength;
+	char            *data;
+
+	ecoresult_t     result;
+	int32_t         amplicon_size;
+	char            *amplicon;
+} ecoresultfile_t;
+
+/*
+ * 
+ * Incremental scan types
+ * 
+ */
+
+typedef struct {
+	PatternPtr pattern;
+	UInt32     r[2 * MAX_PAT_ERR + 4];	/* Manber state kept between chunks */
+} ecoscanner_t;
+
+/*
+ * 
+ * Work scheduler types
+ * 
+ */
+
+typedef struct ecoscheduler ecoscheduler_t;
+
+typedef void (*ecotask_t)(void *context,void *task);
+
+/*
+ * 
+ * FM-index types
+ * 
+ */
+
+#define FMINDEX_SIGMA (28)	/* sentinel, separator and letters */
+
+/* longest text : its int32_t arrays must fit an ECOMALLOC size */
+#define FMINDEX_MAX_LENGTH (0x7FFFFFFF / (int32_t)sizeof(int32_t))
+
+typedef struct {
+	int32_t  file_index;
+	long     offset;
+	int32_t  text;			/* indexed sequence of the record */
+} ecofmrecord_t;
+
+typedef struct {
+	int32_t       length;		/* text length */
+	int32_t       sigma;		/* symbols used */
+	int32_t       sequences;	/* distinct sequences of the text */
+	int32_t       records;		/* database records */
+	int32_t       occ_step;
+	int32_t       sample;
+	int32_t       C[FMINDEX_SIGMA+1];
+	char          letter[FMINDEX_SIGMA];
+	int32_t       *start;		/* text position of each sequence */
+	ecofmrecord_t *record;
+	unsigned char *bwt;
+	int32_t       *occ;			/* symbol counts every occ_step rows */
+	uint32_t      *sampled;		/* rows whose text position is stored */
+	int32_t       *rank;		/* sampled rows before each word of sampled */
+	int32_t       *samples;		/* text positions of the sampled rows */
+} ecofmindex_t;
+
+typedef struct {
+	int32_t  text;
+	int32_t  position;
+	int32_t  error;
+} ecofmhit_t;
+
+/*
+ * 
+ * Database image types
+ * 
+ */
+
+typedef struct ecoimage ecoimage_t;	/* mapped image, see ecoimage.c */
+
+/*
+ * 
+ * Database manifest types
+ * 
+ */
+
+typedef struct {
+	int32_t  version;		/* database version adding or changing the file */
+	int32_t  records;
+	int64_t  size;
+	uint32_t digest;		/* crc32 of the file content */
+} ecomanifestentry_t;
+
+typedef struct {
+	int32_t  size_hi;		/* file size, -1 if the file is missing */
+	int32_t  size_lo;
+	int32_t  mtime_hi;		/* modification time, in seconds */
+	int32_t  mtime_lo;
+	int32_t  mtime_ns;
+} ecofilestamp_t;
+
+typedef struct {
+	int32_t            version;	/* last version of the database */
+	int32_t            count;	/* last .sdx file listed */
+	ecomanifestentry_t *shard;	/* shard[i] : file _i.sdx, version 0 if unlisted */
+	ecomanifestentry_t local;	/* .ldx file, version 0 if unlisted */
+} ecomanifest_t;
+
+/*
+ * 
+ * k-mer index types
+ * 
+ */
+
+#define KMERIDX_DEFAULT_K (10)
+#define KMERIDX_MIN_K     (4)
+#define KMERIDX_MAX_K     (12)
+
+/* longest text : its int32_t postings must fit an ECOMALLOC size */
+#define KMERIDX_MAX_LENGTH (0x7FFFFFFF / (int32_t)sizeof(int32_t))
+
+typedef struct {
+	int32_t       k;
+	int32_t       length;		/* text length */
+	int32_t       sequences;	/* distinct sequences of the text */
+	int32_t       records;		/* database records */
+	int32_t       *start;		/* text position of each sequence */
+	ecofmrecord_t *record;
+	uint32_t      *mixed;		/* sequences with other letters than ACGT */
+	int32_t       *bucket;		/* first posting of each k-mer */
+	int32_t       *posting;		/* text positions of the k-mers */
+} ecokmeridx_t;
+
+typedef struct {
+	int32_t  text;
+	int32_t  position;
+} ecokmerhit_t;
+
+#define KMERIDX_MIXED(mixed,text)     ((mixed)[(text) >> 5] & ((uint32_t)1 << ((text) & 31)))
+#define KMERIDX_SET_MIXED(mixed,text) ((mixed)[(text) >> 5] |= ((uint32_t)1 << ((text) & 31)))
+
+/*
+ * 
+ * Block index types
+ * 
+ */
+
+typedef struct {
+	int32_t  file_index;
+	long     offset;
+	int32_t  count;
+	int32_t  first;      /* taxon preorder rank range of the block */
+	int32_t  last;
+	int32_t  selected;
+	int32_t  mixed;      /* holds other letters than ACGT */
+	int32_t  bits;       /* q-gram summary size */
+	int32_t  summary;    /* first word of the summary in summaries */
+} ecoblock_t;
+
+#define BLOCKIDX_MIN_Q     (3)
+#define BLOCKIDX_MAX_Q     (12)
+#define BLOCKIDX_DEFAULT_Q (6)
+
+typedef struct {
+	int32_t    count;
+	int32_t    q;         /* q-gram length of the summaries, 0 if none */
+	uint32_t   *summaries;
+	ecoblock_t block[1];
+} ecoblockidx_t;
+
+/*
+ * 
+ * Primer hit index types
+ * 
+ */
+
+typedef struct {
+	char     magic[8];
+	int32_t  error_max;
+	int32_t  circular;
+	int32_t  length1;
+	int32_t  length2;
+	int32_t  restricted;	/* -r and -i taxid counts, the taxids */
+	int32_t  ignored;		/* follow the oligos                  */
+	char     oligos[1];
+} ecohitidxhead_t;
+
  
 /*****************************************************
  * 
@@ -192,6 +508,15 @@ FILE *open_ecorecorddb(const char *filename,
                        
 void *read_ecorecord(FILE *,int32_t *recordSize);
 
+FILE *create_ecorecorddb(const char *filename);
+void  write_ecoint32(FILE *f,int32_t value);
+void  write_ecorecord(FILE *f,void *record,int32_t recordSize);
+void  close_ecorecorddb(FILE *f,int32_t count);
+
+void  swap_ecoarray(int32_t *array,int32_t count);
+void  write_ecoarray(FILE *f,void *array,int32_t size,int32_t swap);
+void *read_ecoarray(FILE *f,int32_t *size,int32_t swap);
+
 
 
 /* 
@@ -226,9 +551,28 @@ ecotaxonomy_t    *read_taxonomy(const char *prefix,int32_t readAlternativeName);
 
 ecotx_t *eco_findtaxonbytaxid(ecotaxonomy_t *taxonomy, int32_t taxid);
 
+ecotx_t *eco_findtaxonatrank(ecotx_t *taxon, int32_t rankidx);
+
 int eco_isundertaxon(ecotx_t *taxon, int other_taxid);
 
 ecoseq_t *ecoseq_iterator(const char *prefix);
+void      ecoseq_iterator_position(int32_t *file_index,long *offset);
+void      ecoseq_iterator_resume(int32_t file_index,long offset);
+void      ecoseq_iterator_skip(const char *skipped,int32_t count);
+ecoseq_t *ecoseq_fetch(const char *prefix,int32_t file_index,long offset);
+int32_t   ecoseq_record_count(const char *prefix);
+int32_t   ecoseq_file_count(const char *prefix);
+int32_t   ecoseq_preload(const char *prefix);
+ecoseq_t *ecoseq_block_iterator(const char *prefix,ecoblockidx_t *index);
+ecoseq_t *ecoseq_readahead(const char *prefix,ecoblockidx_t *blocks);
+void      ecoseq_readahead_position(int32_t *file_index,long *offset);
+void      write_ecoseq(FILE *f,ecoseq_t *seq,int32_t backoffset);
+
+void      ecoseq_set_streaming(int32_t min_length);
+void      ecoseq_stream_start(ecoseq_t *seq,int32_t head_length);
+int32_t   ecoseq_stream_next(ecoseq_t *seq,int32_t keep_from);
+char     *ecoseq_stream_window(ecoseq_t *seq,int32_t *start,int32_t *end);
+char     *ecoseq_stream_subsequence(ecoseq_t *seq,int32_t begin,int32_t end);
 
 
 
@@ -250,8 +594,24 @@ int32_t rank_index(const char* label,ecorankidx_t* ranks);
 int32_t  delete_apatseq(SeqPtr pseq);
 PatternPtr buildPattern(const char *pat, int32_t error_max);
 PatternPtr complementPattern(PatternPtr pat);
+int32_t    patternKmers(PatternPtr pattern,int32_t offset,int32_t k,
+		                int32_t *kmers,int32_t max);
 
 SeqPtr ecoseq2apatseq(ecoseq_t *in,SeqPtr out,int32_t circular);
+Int32  ecoManberWindows(SeqPtr seq,PatternPtr pattern,int patnum,
+		                int begin,int length,int32_t threads);
+Int32  ecoManberPair(SeqPtr seq,
+		             PatternPtr pattern1,int patnum1,int length1,
+		             PatternPtr pattern2,int patnum2,int length2);
+
+void   ecoscanner_init(ecoscanner_t *scanner,PatternPtr pattern);
+Int32  ecoscanner_feed(ecoscanner_t *scanner,const char *data,int32_t length,
+		               int32_t position,StackiPtr *hitpos,StackiPtr *hiterr);
+
+ecoscheduler_t *new_ecoscheduler(int32_t threads);
+void            ecoscheduler_run(ecoscheduler_t *scheduler,ecotask_t run,void *context,
+		                         void **tasks,int64_t *costs,int32_t count);
+void            delete_ecoscheduler(ecoscheduler_t *scheduler);
 
 char *ecoComplementPattern(char *nucAcSeq);
 char *ecoComplementSequence(char *nucAcSeq);
@@ -263,6 +623,170 @@ ecotx_t *eco_getfamily(ecotx_t *taxon,ecotaxonomy_t *taxonomy);
 ecotx_t *eco_getkingdom(ecotx_t *taxon,ecotaxonomy_t *taxonomy);
 ecotx_t *eco_getsuperkingdom(ecotx_t *taxon,ecotaxonomy_t *taxonomy);
 
+/*
+ * 
+ * Block index functions
+ * 
+ */
+
+int32_t       *eco_taxonomy_preorder(ecotaxonomy_t *taxonomy,int32_t **last);
+FILE          *create_blockidx(const char *prefix,ecotaxonomy_t *taxonomy,int32_t q);
+void           summarize_blockidx(ecoseq_t *seq);
+void           write_blockidx(FILE *f,int32_t file_index,long offset,int32_t count,
+		                      int32_t first,int32_t last);
+ecoblockidx_t *read_blockidx(const char *prefix,ecotaxonomy_t *taxonomy);
+int32_t        select_blockidx(ecoblockidx_t *index,ecotaxonomy_t *taxonomy,
+		                       int32_t *taxids,int32_t count);
+int32_t        screen_blockidx(ecoblockidx_t *index,PatternPtr *patterns);
+void           delete_blockidx(ecoblockidx_t *index);
+
+/*
+ * 
+ * FM-index functions
+ * 
+ */
+
+int32_t       build_fmindex(const char *prefix);
+ecofmindex_t *read_fmindex(const char *prefix);
+ecofmhit_t   *search_fmindex(ecofmindex_t *index,PatternPtr pattern,int32_t *count);
+void          delete_fmindex(ecofmindex_t *index);
+
+/*
+ * 
+ * k-mer index functions
+ * 
+ */
+
+int32_t       build_kmeridx(const char *prefix,int32_t k);
+ecokmeridx_t *read_kmeridx(const char *prefix);
+ecokmerhit_t *search_kmeridx(ecokmeridx_t *index,PatternPtr pattern,int32_t *count);
+void          delete_kmeridx(ecokmeridx_t *index);
+
+/*
+ * 
+ * Taxonomy snapshot functions
+ * 
+ */
+
+int32_t           build_taxsnapshot(const char *prefix);
+ecotaxsnapshot_t *read_taxsnapshot(const char *prefix);
+ecorankidx_t     *taxsnapshot_rankidx(ecotaxsnapshot_t *snapshot);
+ecotxidx_t       *taxsnapshot_taxonomyidx(ecotaxsnapshot_t *snapshot);
+int32_t           taxsnapshot_index(ecotaxsnapshot_t *snapshot,int32_t taxid);
+int32_t           taxsnapshot_isunder(ecotaxsnapshot_t *snapshot,int32_t taxon,int32_t other_taxid);
+
+/*
+ * 
+ * Database image functions
+ * 
+ */
+
+int32_t       build_ecoimage(const char *prefix,const char *filename);
+ecoimage_t   *attach_ecoimage(const char *prefix);
+ecorankidx_t *image_rankidx(ecoimage_t *image);
+ecotxidx_t   *image_taxonomyidx(ecoimage_t *image);
+int32_t       image_sequence_count(ecoimage_t *image);
+void          image_sequence(ecoimage_t *image,int32_t record,
+                             int32_t *file_index,long *offset,ecoseq_t *seq);
+
+/*
+ * 
+ * Database manifest functions
+ * 
+ */
+
+uint32_t       file_digest(const char *filename,int64_t *size);
+void           file_hash(const char *filename,int64_t *size,char *hash);
+ecomanifest_t *read_manifest(const char *prefix);
+int32_t        update_manifest(const char *prefix);
+int32_t        check_manifest(ecomanifest_t *manifest,const char *prefix,int32_t since);
+void           delete_manifest(ecomanifest_t *manifest);
+ecofilestamp_t *database_stamps(const char *prefix,int32_t taxonomy,int32_t *count);
+int32_t        same_database_stamps(const char *prefix,int32_t taxonomy,
+                                    const ecofilestamp_t *stamps,int32_t count);
+
+/*
+ * 
+ * Run statistics functions
+ * 
+ */
+
+#define ECOSTAT_READ       (0)	/* read_ecorecord                 */
+#define ECOSTAT_UNCOMPRESS (1)	/* uncompress of a sequence       */
+#define ECOSTAT_ENCODE     (2)	/* EncodeSequence                 */
+#define ECOSTAT_MANBER     (3)	/* primer scans (ManberAll)       */
+#define ECOSTAT_PAIRING    (4)	/* pairing loops of ecoPCR        */
+#define ECOSTAT_TM         (5)	/* nparam_CalcTwoTM               */
+#define ECOSTAT_PRINT      (6)	/* printRepeat                    */
+#define ECOSTAT_STAGES     (7)
+
+void    ecostats_enable(void);
+int64_t ecostat_clock(void);
+void    ecostat_add(int32_t stage,int64_t start,int64_t items);
+void    print_ecostats(FILE *output,int64_t sequences,int64_t bases,int64_t hits);
+
+/*
+ * 
+ * Primer hit index functions
+ * 
+ */
+
+FILE    *create_hitidx(const char *filename,
+		               PatternPtr o1, PatternPtr o2,
+		               int32_t error_max, int32_t circular,
+		               int32_t *restricted, int32_t r,
+		               int32_t *ignored, int32_t g);
+void     write_hitidx(FILE *f,int32_t file_index,long offset,SeqPtr seq);
+FILE    *open_hitidx(const char *filename,
+		             PatternPtr o1, PatternPtr o2,
+		             int32_t error_max, int32_t circular,
+		             ecotaxonomy_t *taxonomy,
+		             int32_t *restricted, int32_t r,
+		             int32_t *ignored, int32_t g,
+		             int32_t *count);
+SeqPtr   readnext_hitidx(FILE *f,int32_t *file_index,long *offset,
+		                 SeqPtr seq,int32_t error_max);
+int32_t  clip_hitidx(SeqPtr seq,PatternPtr pattern,int32_t patnum,
+		             int32_t begin,int32_t length);
+
+/*
+ * 
+ * Amplification result functions
+ * 
+ */
+
+ecoresultfile_t *create_ecoresult(const char *filename,
+		                          ecotaxonomy_t *taxonomy,
+		                          const char *primer1, const char *primer2,
+		                          int32_t kingdom_mode, int32_t error_max,
+		                          int32_t lmin, int32_t lmax,
+		                          int32_t delta, int32_t circular);
+void             set_ecoresult_sequence(ecoresultfile_t *file,ecoseq_t *seq);
+void             write_ecoresult(ecoresultfile_t *file,ecoresult_t *result);
+int32_t          is_ecoresult_file(const char *filename);
+ecoresultfile_t *open_ecoresult(const char *filename,ecotaxonomy_t *taxonomy);
+ecoresult_t     *readnext_ecoresult(ecoresultfile_t *file);
+int32_t          close_ecoresult(ecoresultfile_t *file);
+void             print_ecoresult(FILE *output,ecoresult_t *result,
+		                         ecotaxonomy_t *taxonomy,int32_t kingdom_mode);
+void             print_ecoresult_fasta(FILE *output,ecoresult_t *result,
+		                               ecotaxonomy_t *taxonomy);
+void             flush_ecoresult(FILE *output);
+void             copy_ecoresult(FILE *copy);
+
+/*
+ * 
+ * Coverage report functions
+ * 
+ */
+
+ecocoverage_t *new_ecocoverage(ecotaxonomy_t *taxonomy,
+		                       int32_t *restricted_taxid, int32_t r,
+		                       int32_t *ignored_taxid, int32_t g);
+int32_t        delete_ecocoverage(ecocoverage_t *coverage);
+void           ecocoverage_add(ecocoverage_t *coverage,int32_t taxon,int32_t amplified);
+void           ecocoverage_print(FILE *output,ecocoverage_t *coverage);
+
 int eco_is_taxid_ignored(int32_t *ignored_taxid, int32_t tab_len, int32_t taxid);
 int eco_is_taxid_included(ecotaxonomy_t *taxonomy, int32_t *included_taxid, int32_t tab_len, int32_t taxid);
 
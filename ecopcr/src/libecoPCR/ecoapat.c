@@ -68,7 +68,8 @@ void EncodeSequence(SeqPtr seq)
 
 SeqPtr ecoseq2apatseq(ecoseq_t *in,SeqPtr out,int32_t circular)
 {
-        int    i;
+        int     i;
+        int64_t timer;
 
 		if (!out)
 		{
@@ -106,7 +107,9 @@ SeqPtr ecoseq2apatseq(ecoseq_t *in,SeqPtr out,int32_t circular)
 
 		out->cseq = in->SQ;
 		
+		timer = ecostat_clock();
 		EncodeSequence(out);
+		ecostat_add(ECOSTAT_ENCODE,timer,out->seqlen);
 
         return out;
 }
@@ -197,3 +200,60 @@ PatternPtr complementPattern(PatternPtr pat)
 	return pattern;
 		
 }
+
+/**
+ * List the k-mers of A, C, G and T matching exactly a pattern
+ * from a position, ambiguous pattern letters being expanded.
+ * k-mers are coded on two bits per base, A=0, C=1, G=2 and T=3.
+ *
+ * @param	pattern	the pattern
+ * @param	offset	first pattern position of the k-mers
+ * @param	k		k-mer length
+ * @param	kmers	receives at most max k-mers
+ * @param	max		size of kmers
+ *
+ * @return	the number of k-mers, -1 when there are more than max
+ */
+int32_t patternKmers(PatternPtr pattern,int32_t offset,int32_t k,
+		             int32_t *kmers,int32_t max)
+{
+	static const char letter[4] = {'A','C','G','T'};
+	int32_t base[4];
+	int32_t bases;
+	int32_t count = 1;
+	int32_t kmer;
+	int32_t i;
+	int32_t j;
+	int32_t b;
+	UInt32  bit;
+
+	kmers[0] = 0;
+
+	for (i=0; i < k; i++)
+	{
+		bit = (UInt32)1 << (pattern->patlen - 1 - offset - i);
+
+		for (b=0,bases=0; b < 4; b++)
+			if (pattern->smat[letter[b] - 'A'] & bit)
+				base[bases++] = b;
+
+		if (!bases)
+			return 0;
+
+		if (count * bases > max)
+			return -1;
+
+		/* in place, from the last k-mer as each one moves forward */
+
+		for (j=count-1; j >= 0; j--)
+		{
+			kmer = kmers[j] << 2;
+			for (b=bases-1; b >= 0; b--)
+				kmers[j * bases + b] = kmer | base[b];
+		}
+
+		count*=bases;
+	}
+
+	return count;
+}
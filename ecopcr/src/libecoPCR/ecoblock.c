@@ -0,0 +1,645 @@
+#include "../libapat/libstki.h"
+#include "../libapat/apat.h"
+
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Block index (.bdx) of a database sorted by taxonomy with ecosort.
+ *
+ * Sequence records are sorted by the preorder rank of their taxon in
+ * the taxonomy tree, so the sequences of a clade are contiguous. The
+ * index gives, for each block of consecutive records of a .sdx file,
+ * the range of preorder ranks of its taxa. The taxa of a clade have
+ * the ranks [pre(clade),last(clade)], so a restricted search only
+ * reads the blocks overlapping these ranges.
+ *
+ * Each block also holds a summary of the q-grams of its sequences :
+ * a presence bitmap indexed by q-gram, hashed when the block holds
+ * too few q-grams for a 4^q bits map. A pattern of length m matched
+ * with at most e mismatches shares at least m-q+1-e*q of its q-grams
+ * with the sequence (q-gram lemma), so the blocks where fewer of
+ * them are present are skipped. Blocks holding other letters than
+ * A, C, G and T are never skipped.
+ *
+ * The first record of the file holds the magic string, the taxon
+ * count and the q-gram length, the next ones describe the blocks in
+ * database order. Files of the first version have no summaries.
+ */
+
+#define BLOCKIDX_MAGIC    "ECOBDX02"
+#define BLOCKIDX_MAGIC_V1 "ECOBDX01"
+
+#define BLOCKIDX_MIN_BITS  (64)
+#define BLOCKIDX_EXPANSION (64)		/* q-grams looked up for a position */
+
+#define IS_UPPER(c) (((c) >= 'A') && ((c) <= 'Z'))
+
+typedef struct {
+	char     magic[8];
+	int32_t  taxoncount;
+	int32_t  q;
+} ecoblockidxhead_t;
+
+typedef struct {
+	int32_t  file_index;
+	int32_t  offset_hi;
+	int32_t  offset_lo;
+	int32_t  count;
+	int32_t  first;
+	int32_t  last;
+	int32_t  mixed;
+	int32_t  bits;
+	uint32_t summary[1];
+} ecoblockformat_t;
+
+#define BLOCKIDX_FORMAT_V1_INTS (6)
+#define BLOCKIDX_FORMAT_INTS    (offsetof(ecoblockformat_t,summary) / sizeof(int32_t))
+
+/*
+ * q-grams of the block being written
+ */
+
+static int32_t summary_q      = 0;
+static int32_t *summary_qgram = NULL;
+static int32_t summary_count  = 0;
+static int32_t summary_size   = 0;
+static int32_t summary_mixed  = 0;
+
+static FILE    *open_blockfile(const char *prefix,int32_t *count,int32_t abort_on_error,
+		                       const char *mode);
+static int32_t qgram_bit(int32_t qgram,int32_t q,int32_t bits);
+
+
+/**
+ * Compute the preorder rank of each taxon of the taxonomy.
+ *
+ * Children are visited in taxonomy index order, so the ranks only
+ * depend on the .tdx file.
+ *
+ * @param	taxonomy	the taxonomy
+ * @param	last		if not NULL, receives an array giving for each
+ * 						taxon the greatest rank of its subtree
+ *
+ * @return	an array of ranks indexed by taxon index
+ */
+int32_t *eco_taxonomy_preorder(ecotaxonomy_t *taxonomy,int32_t **last)
+{
+	ecotx_t  *taxons = taxonomy->taxons->taxon;
+	int32_t  count   = taxonomy->taxons->count;
+	int32_t  *pre;
+	int32_t  *end;
+	int32_t  *first_child;
+	int32_t  *children;
+	int32_t  *stack;
+	int32_t  *next;
+	int32_t  top;
+	int32_t  rank;
+	int32_t  parent;
+	int32_t  taxon;
+	int32_t  i;
+
+	pre         = ECOMALLOC(sizeof(int32_t) * count,"Allocate preorder ranks");
+	end         = ECOMALLOC(sizeof(int32_t) * count,"Allocate subtree ranks");
+	first_child = ECOMALLOC(sizeof(int32_t) * (count+1),"Allocate children index");
+	children    = ECOMALLOC(sizeof(int32_t) * count,"Allocate children table");
+	next        = ECOMALLOC(sizeof(int32_t) * count,"Allocate children cursor");
+	stack       = ECOMALLOC(sizeof(int32_t) * count,"Allocate taxonomy stack");
+
+	/* children lists, stored contiguously by parent */
+
+	for (i=0; i < count; i++)
+	{
+		parent = taxons[i].parent - taxons;
+		if (parent!=i)
+			first_child[parent+1]++;
+	}
+
+	for (i=0; i < count; i++)
+		first_child[i+1]+=first_child[i];
+
+	memcpy(next,first_child,sizeof(int32_t) * count);
+
+	for (i=0; i < count; i++)
+	{
+		parent = taxons[i].parent - taxons;
+		if (parent!=i)
+			children[next[parent]++]=i;
+	}
+
+	/* depth first walk from each root */
+
+	rank = 0;
+
+	for (i=0; i < count; i++)
+		if (taxons[i].parent - taxons == i)
+		{
+			top = 0;
+			stack[top++] = i;
+			pre[i]  = rank++;
+			next[i] = first_child[i];
+
+			while (top)
+			{
+				taxon = stack[top-1];
+
+				if (next[taxon] < first_child[taxon+1])
+				{
+					parent = taxon;
+					taxon  = children[next[parent]++];
+					pre[taxon]  = rank++;
+					next[taxon] = first_child[taxon];
+					stack[top++] = taxon;
+				}
+				else
+				{
+					end[taxon] = rank - 1;
+					top--;
+				}
+			}
+		}
+
+	ECOFREE(first_child,"Free children index");
+	ECOFREE(children,"Free children table");
+	ECOFREE(next,"Free children cursor");
+	ECOFREE(stack,"Free taxonomy stack");
+
+	if (last)
+		*last = end;
+	else
+		ECOFREE(end,"Free subtree ranks");
+
+	return pre;
+}
+
+FILE *open_blockfile(const char *prefix,int32_t *count,int32_t abort_on_error,
+		             const char *mode)
+{
+	char    filename[1024];
+	int32_t length;
+
+	length = snprintf(filename,1024,"%s.bdx",prefix);
+
+	if (length >= 1024)
+		ECOERROR(ECO_ASSERT_ERROR,"file name is too long");
+
+	if (*mode=='w')
+		return create_ecorecorddb(filename);
+
+	return open_ecorecorddb(filename,count,abort_on_error);
+}
+
+/*
+ * bit of a q-gram in a block summary
+ */
+int32_t qgram_bit(int32_t qgram,int32_t q,int32_t bits)
+{
+	int32_t shift = 32;
+
+	if (bits == 1 << (2 * q))
+		return qgram;
+
+	while (bits > 1)
+	{
+		bits >>= 1;
+		shift--;
+	}
+
+	return (int32_t)(((uint32_t)qgram * 0x9E3779B1U) >> shift);
+}
+
+/**
+ * Create the block index of a database
+ * @param	prefix		name of the database (radical without extension)
+ * @param	taxonomy	taxonomy of the database
+ * @param	q			q-gram length of the block summaries,
+ * 						0 for no summary
+ *
+ * @return	file object
+ */
+FILE *create_blockidx(const char *prefix,ecotaxonomy_t *taxonomy,int32_t q)
+{
+	FILE              *f;
+	ecoblockidxhead_t head;
+
+	if (q && (q < BLOCKIDX_MIN_Q || q > BLOCKIDX_MAX_Q))
+		ECOERROR(ECO_ASSERT_ERROR,"Bad q-gram length");
+
+	f = open_blockfile(prefix,NULL,1,"w");
+
+	memcpy(head.magic,BLOCKIDX_MAGIC,sizeof(head.magic));
+	head.taxoncount = taxonomy->taxons->count;
+	head.q          = q;
+
+	summary_q     = q;
+	summary_count = 0;
+	summary_mixed = 0;
+
+	if (is_big_endian())
+	{
+		head.taxoncount = swap_int32_t(head.taxoncount);
+		head.q          = swap_int32_t(head.q);
+	}
+
+	write_ecorecord(f,&head,sizeof(head));
+
+	return f;
+}
+
+/**
+ * Add the q-grams of a sequence to the summary of the block
+ * being written
+ * @param	seq		a sequence stored in the block
+ */
+void summarize_blockidx(ecoseq_t *seq)
+{
+	uint32_t mask  = (1 << (2 * summary_q)) - 1;
+	uint32_t qgram = 0;
+	int32_t  valid = 0;
+	int32_t  base;
+	char     *c;
+
+	if (!summary_q)
+		return;
+
+	if (summary_count + seq->SQ_length > summary_size)
+	{
+		summary_size = (summary_count + seq->SQ_length) * 2;
+		if (summary_qgram)
+			summary_qgram = ECOREALLOC(summary_qgram,sizeof(int32_t) * summary_size,
+			                           "Increase block q-grams");
+		else
+			summary_qgram = ECOMALLOC(sizeof(int32_t) * summary_size,
+			                          "Allocate block q-grams");
+	}
+
+	/* lower case letters are read as A by the apat encoding */
+
+	for (c=seq->SQ; *c; c++)
+	{
+		switch (IS_UPPER(*c) ? *c : 'A')
+		{
+		case 'A': base = 0; break;
+		case 'C': base = 1; break;
+		case 'G': base = 2; break;
+		case 'T': base = 3; break;
+		default :
+			base = -1;
+			summary_mixed = 1;
+		}
+
+		if (base < 0)
+		{
+			valid = 0;
+			continue;
+		}
+
+		qgram = ((qgram << 2) | base) & mask;
+
+		if (++valid >= summary_q)
+			summary_qgram[summary_count++] = qgram;
+	}
+}
+
+/**
+ * Describe a block of sequence records, with the summary of the
+ * sequences given to summarize_blockidx since the previous block
+ * @param	f			block index returned by create_blockidx
+ * @param	file_index	index of the .sdx file holding the block
+ * @param	offset		offset of the first record of the block
+ * @param	count		number of records in the block
+ * @param	first		lowest taxon preorder rank in the block
+ * @param	last		highest taxon preorder rank in the block
+ */
+void write_blockidx(FILE *f,int32_t file_index,long offset,int32_t count,
+		            int32_t first,int32_t last)
+{
+	ecoblockformat_t *block;
+	int32_t          *data;
+	int32_t          bits = 0;
+	int32_t          words;
+	int32_t          size;
+	int32_t          bit;
+	int32_t          i;
+
+	/* about 8 bits per q-gram, up to one bit per possible q-gram */
+
+	if (summary_q)
+		for (bits=BLOCKIDX_MIN_BITS;
+			 bits < 8 * summary_count && bits < 1 << (2 * summary_q);
+			 bits*=2);
+
+	words = (bits + 31) / 32;
+	size  = offsetof(ecoblockformat_t,summary) + sizeof(uint32_t) * words;
+	block = ECOMALLOC(size,"Allocate block record");
+	data  = (int32_t*)block;
+
+	block->file_index = file_index;
+	block->offset_hi  = (int32_t)((int64_t)offset >> 32);
+	block->offset_lo  = (int32_t)((int64_t)offset & 0xFFFFFFFF);
+	block->count      = count;
+	block->first      = first;
+	block->last       = last;
+	block->mixed      = summary_mixed;
+	block->bits       = bits;
+
+	for (i=0; i < summary_count; i++)
+	{
+		bit = qgram_bit(summary_qgram[i],summary_q,bits);
+		block->summary[bit >> 5] |= (uint32_t)1 << (bit & 31);
+	}
+
+	summary_count = 0;
+	summary_mixed = 0;
+
+	if (is_big_endian())
+		for (i=0; i < size / (int32_t)sizeof(int32_t); i++)
+			data[i] = swap_int32_t(data[i]);
+
+	write_ecorecord(f,block,size);
+
+	ECOFREE(block,"Free block record");
+}
+
+/**
+ * Read the block index of a database
+ * @param	prefix		name of the database (radical without extension)
+ * @param	taxonomy	taxonomy of the database
+ *
+ * @return	the block index, or NULL if the database has none
+ */
+ecoblockidx_t *read_blockidx(const char *prefix,ecotaxonomy_t *taxonomy)
+{
+	FILE              *f;
+	ecoblockidx_t     *index;
+	ecoblockidxhead_t *head;
+	ecoblockformat_t  *raw;
+	int32_t           *data;
+	int32_t           count;
+	int32_t           rs;
+	int32_t           version = 0;
+	int32_t           words;
+	int32_t           used = 0;
+	int32_t           size = 0;
+	int32_t           records = 0;
+	int32_t           i;
+	int32_t           j;
+
+	f = open_blockfile(prefix,&count,0,"r");
+
+	if (!f)
+		return NULL;
+
+	head = read_ecorecord(f,&rs);
+
+	if (!head)
+		ECOERROR(ECO_IO_ERROR,"Not a block index file");
+
+	if (!memcmp(head->magic,BLOCKIDX_MAGIC,sizeof(head->magic)))
+		version = 2;
+	else if (!memcmp(head->magic,BLOCKIDX_MAGIC_V1,sizeof(head->magic)))
+		version = 1;
+	else
+		ECOERROR(ECO_IO_ERROR,"Not a block index file");
+
+	if (is_big_endian())
+	{
+		head->taxoncount = swap_int32_t(head->taxoncount);
+		head->q          = swap_int32_t(head->q);
+	}
+
+	if (head->taxoncount!=taxonomy->taxons->count)
+		ECOERROR(ECO_ASSERT_ERROR,"Block index was built with another taxonomy");
+
+	count--;  /* header record */
+
+	index = ECOMALLOC(sizeof(ecoblockidx_t) + sizeof(ecoblock_t) * count,
+	                  "Allocate block index");
+
+	index->count = count;
+	index->q     = (version > 1) ? head->q : 0;
+
+	for (i=0; i < count; i++)
+	{
+		raw  = read_ecorecord(f,&rs);
+
+		if (!raw)
+			ECOERROR(ECO_IO_ERROR,"Truncated block index");
+
+		data = (int32_t*)raw;
+		if (is_big_endian())
+			for (j=0; j < rs / (int32_t)sizeof(int32_t); j++)
+				data[j] = swap_int32_t(data[j]);
+
+		index->block[i].file_index = raw->file_index;
+		index->block[i].offset     = (long)(((int64_t)raw->offset_hi << 32) | (uint32_t)raw->offset_lo);
+		index->block[i].count      = raw->count;
+		index->block[i].first      = raw->first;
+		index->block[i].last       = raw->last;
+		index->block[i].selected   = 1;
+		records+=raw->count;
+
+		if (version == 1)
+			continue;
+
+		/* summaries are stored together, blocks keep their position */
+
+		words = (raw->bits + 31) / 32;
+
+		if (used + words > size)
+		{
+			size = (used + words) * 2;
+			if (index->summaries)
+				index->summaries = ECOREALLOC(index->summaries,sizeof(uint32_t) * size,
+				                              "Increase block summaries");
+			else
+				index->summaries = ECOMALLOC(sizeof(uint32_t) * size,
+				                             "Allocate block summaries");
+		}
+
+		memcpy(index->summaries + used,raw->summary,sizeof(uint32_t) * words);
+
+		index->block[i].mixed   = raw->mixed;
+		index->block[i].bits    = raw->bits;
+		index->block[i].summary = used;
+		used+=words;
+	}
+
+	fclose(f);
+
+	/* sequence files appended after the sort are not in the blocks */
+	if (records != ecoseq_record_count(prefix))
+	{
+		fprintf(stderr,"# Block index of %s does not match the database, ignored\n",
+		        prefix);
+		delete_blockidx(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+void delete_blockidx(ecoblockidx_t *index)
+{
+	if (index->summaries)
+		ECOFREE(index->summaries,"Free block summaries");
+	ECOFREE(index,"Free block index");
+}
+
+/**
+ * Select the blocks holding sequences of the given taxa
+ * @param	index		block index
+ * @param	taxonomy	taxonomy of the database
+ * @param	taxids		taxids of the clades looked for
+ * @param	count		number of taxids
+ *
+ * @return	the number of selected blocks
+ */
+int32_t select_blockidx(ecoblockidx_t *index,ecotaxonomy_t *taxonomy,
+		                int32_t *taxids,int32_t count)
+{
+	int32_t *pre;
+	int32_t *last;
+	ecotx_t *taxon;
+	int32_t t;
+	int32_t i;
+	int32_t j;
+	int32_t selected = 0;
+
+	pre = eco_taxonomy_preorder(taxonomy,&last);
+
+	for (i=0; i < index->count; i++)
+		index->block[i].selected = 0;
+
+	for (j=0; j < count; j++)
+	{
+		taxon = eco_findtaxonbytaxid(taxonomy,taxids[j]);
+
+		if (!taxon)
+			continue;
+
+		t = taxon - taxonomy->taxons->taxon;
+
+		for (i=0; i < index->count; i++)
+			if (index->block[i].first <= last[t] &&
+				index->block[i].last  >= pre[t])
+				index->block[i].selected = 1;
+	}
+
+	for (i=0; i < index->count; i++)
+		selected+=index->block[i].selected;
+
+	ECOFREE(pre,"Free preorder ranks");
+	ECOFREE(last,"Free subtree ranks");
+
+	return selected;
+}
+
+/**
+ * Deselect the blocks where no primer pair can be found according
+ * to their q-gram summaries
+ * @param	index		block index
+ * @param	patterns	the four patterns in hit stack order,
+ * 						NULL for a pattern of a skipped strand
+ *
+ * @return	the number of selected blocks, -1 if the index has no
+ * 			summary or if the primers are too short for its q-grams
+ */
+int32_t screen_blockidx(ecoblockidx_t *index,PatternPtr *patterns)
+{
+	int32_t    *qgram;
+	int32_t    *expansion;
+	int32_t    positions[MAX_PATTERN];
+	int32_t    needed[MAX_PATTERN];
+	int32_t    found[MAX_PATTERN];
+	int32_t    q = index->q;
+	ecoblock_t *block;
+	uint32_t   *summary;
+	int32_t    selected = 0;
+	int32_t    bit;
+	int32_t    i;
+	int32_t    j;
+	int32_t    k;
+	int32_t    p;
+
+	if (!q)
+		return -1;
+
+	for (p=0; p < MAX_PATTERN; p++)
+		if (patterns[p])
+		{
+			positions[p] = patterns[p]->patlen - q + 1;
+			needed[p]    = positions[p] - patterns[p]->maxerr * q;
+
+			if (needed[p] < 1)
+				return -1;
+		}
+
+	/* q-grams of each pattern position, -1 count if too ambiguous */
+
+	qgram     = ECOMALLOC(sizeof(int32_t) * MAX_PATTERN * MAX_PAT_LEN * BLOCKIDX_EXPANSION,
+	                      "Allocate pattern q-grams");
+	expansion = ECOMALLOC(sizeof(int32_t) * MAX_PATTERN * MAX_PAT_LEN,
+	                      "Allocate pattern q-gram counts");
+
+	for (p=0; p < MAX_PATTERN; p++)
+		if (patterns[p])
+			for (j=0; j < positions[p]; j++)
+				expansion[p * MAX_PAT_LEN + j] =
+					patternKmers(patterns[p],j,q,
+					             qgram + (p * MAX_PAT_LEN + j) * BLOCKIDX_EXPANSION,
+					             BLOCKIDX_EXPANSION);
+
+	for (i=0; i < index->count; i++)
+	{
+		block = index->block + i;
+
+		if (!block->selected || block->mixed)
+		{
+			selected+=block->selected;
+			continue;
+		}
+
+		summary = index->summaries + block->summary;
+
+		for (p=0; p < MAX_PATTERN; p++)
+		{
+			found[p] = 0;
+
+			if (patterns[p])
+				for (j=0; j < positions[p]; j++)
+				{
+					if (expansion[p * MAX_PAT_LEN + j] < 0)
+					{
+						found[p]++;
+						continue;
+					}
+
+					for (k=0; k < expansion[p * MAX_PAT_LEN + j]; k++)
+					{
+						bit = qgram_bit(qgram[(p * MAX_PAT_LEN + j) * BLOCKIDX_EXPANSION + k],
+						                q,block->bits);
+						if (summary[bit >> 5] & ((uint32_t)1 << (bit & 31)))
+						{
+							found[p]++;
+							break;
+						}
+					}
+				}
+
+			found[p] = patterns[p] && found[p] >= needed[p];
+		}
+
+		block->selected = (found[0] && found[1]) || (found[2] && found[3]);
+		selected+=block->selected;
+	}
+
+	ECOFREE(qgram,"Free pattern q-grams");
+	ECOFREE(expansion,"Free pattern q-gram counts");
+
+	return selected;
+}
+
+#undef IS_UPPER
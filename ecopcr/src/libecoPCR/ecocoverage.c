@@ -0,0 +1,211 @@
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SEL_DONE       1
+#define SEL_RESTRICTED 2
+#define SEL_IGNORED    4
+
+static int32_t taxon_selection(ecocoverage_t *coverage,int32_t taxon);
+static int32_t is_taxon_selected(ecocoverage_t *coverage,int32_t taxon);
+static void    mark_lineage(ecotaxonomy_t *taxonomy,char *flags,int32_t taxon);
+
+
+/**
+ * Allocate per taxon counters for a coverage report
+ * @param	taxonomy	the taxonomy used to summarize the counts
+ * @param	restricted_taxid	taxids the report is restricted to
+ * @param	r			number of restricted taxids
+ * @param	ignored_taxid		taxids excluded from the report
+ * @param	g			number of ignored taxids
+ *
+ * @return	a coverage structure
+ */
+ecocoverage_t *new_ecocoverage(ecotaxonomy_t *taxonomy,
+		                       int32_t *restricted_taxid, int32_t r,
+		                       int32_t *ignored_taxid, int32_t g)
+{
+	ecocoverage_t *coverage;
+	int32_t        count;
+
+	count = taxonomy->taxons->count;
+
+	coverage = ECOMALLOC(sizeof(ecocoverage_t),
+	                     "Allocate coverage structure");
+
+	coverage->taxonomy  = taxonomy;
+	coverage->restricted= restricted_taxid;
+	coverage->r         = r;
+	coverage->ignored   = ignored_taxid;
+	coverage->g         = g;
+
+	coverage->sequences = ECOMALLOC(sizeof(int32_t) * count,
+	                                "Allocate taxon sequence counters");
+	coverage->amplified = ECOMALLOC(sizeof(int32_t) * count,
+	                                "Allocate taxon amplification counters");
+	coverage->selected  = ECOMALLOC(sizeof(char) * count,
+	                                "Allocate taxon selection flags");
+
+	return coverage;
+}
+
+int32_t delete_ecocoverage(ecocoverage_t *coverage)
+{
+	if (coverage)
+	{
+		ECOFREE(coverage->sequences,"Free taxon sequence counters");
+		ECOFREE(coverage->amplified,"Free taxon amplification counters");
+		ECOFREE(coverage->selected,"Free taxon selection flags");
+		ECOFREE(coverage,"Free coverage structure");
+
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Count a sequence for its taxon
+ * @param	coverage	coverage structure
+ * @param	taxon		index of the sequence taxon in the taxonomy
+ * @param	amplified	true if at least one amplicon was found
+ */
+void ecocoverage_add(ecocoverage_t *coverage,int32_t taxon,int32_t amplified)
+{
+	coverage->sequences[taxon]++;
+	if (amplified)
+		coverage->amplified[taxon]++;
+}
+
+/**
+ * Check if a taxon belongs to the restricted subtrees and not
+ * to the ignored ones. Flags are cached in the selected array
+ * so each lineage is only walked once.
+ */
+int32_t taxon_selection(ecocoverage_t *coverage,int32_t taxon)
+{
+	ecotx_t  *taxons;
+	int32_t  i;
+	int32_t  parent;
+	int32_t  flags;
+
+	if (coverage->selected[taxon] & SEL_DONE)
+		return coverage->selected[taxon];
+
+	taxons = coverage->taxonomy->taxons->taxon;
+	flags  = SEL_DONE;
+
+	if (coverage->r==0)
+		flags|=SEL_RESTRICTED;
+
+	for (i=0; i < coverage->r; i++)
+		if (taxons[taxon].taxid==coverage->restricted[i])
+			flags|=SEL_RESTRICTED;
+
+	for (i=0; i < coverage->g; i++)
+		if (taxons[taxon].taxid==coverage->ignored[i])
+			flags|=SEL_IGNORED;
+
+	parent = taxons[taxon].parent - taxons;
+
+	if (parent!=taxon)
+		flags|=taxon_selection(coverage,parent) & (SEL_RESTRICTED|SEL_IGNORED);
+
+	coverage->selected[taxon] = flags;
+
+	return flags;
+}
+
+int32_t is_taxon_selected(ecocoverage_t *coverage,int32_t taxon)
+{
+	int32_t flags = taxon_selection(coverage,taxon);
+
+	return (flags & SEL_RESTRICTED) && !(flags & SEL_IGNORED);
+}
+
+/**
+ * Flag a taxon and all its ancestors
+ */
+void mark_lineage(ecotaxonomy_t *taxonomy,char *flags,int32_t taxon)
+{
+	ecotx_t *taxons = taxonomy->taxons->taxon;
+	int32_t  parent;
+
+	while (!flags[taxon])
+	{
+		flags[taxon] = 1;
+		parent = taxons[taxon].parent - taxons;
+		if (parent==taxon)
+			break;
+		taxon = parent;
+	}
+}
+
+/**
+ * Print, for each taxonomic rank, the number of selected taxa in the
+ * taxonomy, the number of them having at least one sequence in the
+ * database and the number of them having at least one amplified sequence.
+ */
+void ecocoverage_print(FILE *output,ecocoverage_t *coverage)
+{
+	ecotaxonomy_t *taxonomy = coverage->taxonomy;
+	int32_t       count     = taxonomy->taxons->count;
+	int32_t       ranks     = taxonomy->ranks->count;
+	char          *present;
+	char          *amplified;
+	int32_t       *rank_total;
+	int32_t       *rank_present;
+	int32_t       *rank_amplified;
+	int32_t       sequences = 0;
+	int32_t       positive  = 0;
+	int32_t       i;
+	int32_t       rank;
+
+	present        = ECOMALLOC(count,"Allocate present taxon flags");
+	amplified      = ECOMALLOC(count,"Allocate amplified taxon flags");
+	rank_total     = ECOMALLOC(sizeof(int32_t)*ranks,"Allocate rank counters");
+	rank_present   = ECOMALLOC(sizeof(int32_t)*ranks,"Allocate rank counters");
+	rank_amplified = ECOMALLOC(sizeof(int32_t)*ranks,"Allocate rank counters");
+
+	for (i=0; i < count; i++)
+	{
+		sequences+=coverage->sequences[i];
+		positive +=coverage->amplified[i];
+		if (coverage->sequences[i])
+			mark_lineage(taxonomy,present,i);
+		if (coverage->amplified[i])
+			mark_lineage(taxonomy,amplified,i);
+	}
+
+	for (i=0; i < count; i++)
+		if (is_taxon_selected(coverage,i))
+		{
+			rank = taxonomy->taxons->taxon[i].rank;
+			rank_total[rank]++;
+			if (present[i])
+				rank_present[rank]++;
+			if (amplified[i])
+				rank_amplified[rank]++;
+		}
+
+	fprintf(output,"# sequences in the selected taxa : %d\n",sequences);
+	fprintf(output,"# amplified sequences            : %d\n",positive);
+	fprintf(output,"#\n");
+	fprintf(output,"# %-20s | %9s | %9s | %9s | %8s\n",
+			"rank","taxonomy","present","amplified","coverage");
+
+	for (rank=0; rank < ranks; rank++)
+		if (rank_total[rank])
+			fprintf(output,"%-22s | %9d | %9d | %9d | %8.2f\n",
+					taxonomy->ranks->label[rank],
+					rank_total[rank],
+					rank_present[rank],
+					rank_amplified[rank],
+					(rank_present[rank]) ? 100.0 * rank_amplified[rank] / rank_present[rank]:0.0);
+
+	ECOFREE(present,"Free present taxon flags");
+	ECOFREE(amplified,"Free amplified taxon flags");
+	ECOFREE(rank_total,"Free rank counters");
+	ECOFREE(rank_present,"Free rank counters");
+	ECOFREE(rank_amplified,"Free rank counters");
+}
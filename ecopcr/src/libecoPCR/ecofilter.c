@@ -8,6 +8,23 @@ int eco_is_taxid_included(	ecotaxonomy_t *taxonomy,
 	int i;
 	ecotx_t *taxon;
 	
+	if (taxonomy->snapshot)
+	{
+		i = taxsnapshot_index(taxonomy->snapshot,taxid);
+		
+		if (i >= 0)
+		{
+			taxon = taxonomy->taxons->taxon + i;
+			for (i=0; i < tab_len; i++)
+				if (taxsnapshot_isunder(taxonomy->snapshot,
+				                        taxon - taxonomy->taxons->taxon,
+				                        restricted_taxid[i]))
+					return 1;
+		}
+		
+		return 0;
+	}
+	
 	taxon = eco_findtaxonbytaxid(taxonomy, taxid);
 	
 	if (taxon)
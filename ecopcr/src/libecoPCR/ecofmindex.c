@@ -0,0 +1,650 @@
+#include "../libapat/libstki.h"
+#include "../libapat/apat.h"
+
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * FM-index (.fdx) of the database sequences.
+ *
+ * The distinct sequences of the database are concatenated, each one
+ * followed by a separator, the text ending with a sentinel. Bases are
+ * encoded as in apat sequences. The index holds the Burrows-Wheeler
+ * transform of this text, the symbol counts every FMINDEX_OCC_STEP
+ * rows and the text position of the rows whose suffix starts on a
+ * multiple of FMINDEX_SAMPLE.
+ *
+ * Text symbols are dense : the sentinel, the separator, then the
+ * letters found in the database in alphabetical order.
+ *
+ * Primers are looked for by backward search, a mismatch being tried
+ * on each primer position while the error count allows it. Only the
+ * primer occurrences are visited, whatever the database size.
+ *
+ * File records : header, stamps of the .sdx files, sequence starts in
+ * the text, database records, BWT, symbol counts, sampled row flags,
+ * sampled row ranks, sampled positions. The index is ignored when an
+ * .sdx file changed since it was built.
+ */
+
+#define FMINDEX_MAGIC    "ECOFDX02"
+#define FMINDEX_OCC_STEP (128)			/* rows between two symbol counts */
+#define FMINDEX_SAMPLE   (32)			/* text positions between two samples */
+
+#define FMINDEX_END      (0)			/* text sentinel */
+#define FMINDEX_SEP      (1)			/* sequence separator */
+
+#define IS_UPPER(c) (((c) >= 'A') && ((c) <= 'Z'))
+
+typedef struct {
+	char     magic[8];
+	int32_t  length;
+	int32_t  sigma;
+	int32_t  sequences;
+	int32_t  records;
+	int32_t  occ_step;
+	int32_t  sample;
+	int32_t  C[FMINDEX_SIGMA+1];
+	char     letter[FMINDEX_SIGMA];
+} ecofmindexhead_t;
+
+#define FMINDEX_HEAD_INTS ((offsetof(ecofmindexhead_t,letter) - \
+                            offsetof(ecofmindexhead_t,length)) / sizeof(int32_t))
+
+typedef struct {
+	int32_t  file_index;
+	int32_t  offset_hi;
+	int32_t  offset_lo;
+	int32_t  text;
+} ecofmrecordformat_t;
+
+typedef struct {
+	ecofmindex_t *index;
+	PatternPtr   pattern;
+	ecofmhit_t   *hits;
+	int32_t      count;
+	int32_t      size;
+} ecofmsearch_t;
+
+static int32_t *suffix_array(const unsigned char *text,int32_t length,int32_t sigma);
+static int32_t  occurrences(ecofmindex_t *index,int32_t symbol,int32_t row);
+static int32_t  locate(ecofmindex_t *index,int32_t row);
+static void     search_node(ecofmsearch_t *search,int32_t position,
+		                    int32_t low,int32_t high,int32_t errors);
+static int      compare_hits(const void *h1,const void *h2);
+
+
+/*
+ * suffix array by prefix doubling, ranks being sorted with two
+ * counting sort passes at each step
+ */
+int32_t *suffix_array(const unsigned char *text,int32_t length,int32_t sigma)
+{
+	int32_t *sa;
+	int32_t *rank;
+	int32_t *tmp;
+	int32_t *count;
+	int32_t *swap;
+	int32_t classes;
+	int32_t k;
+	int32_t p;
+	int32_t i;
+	int32_t a;
+	int32_t b;
+
+	sa    = ECOMALLOC(sizeof(int32_t) * length,"Allocate suffix array");
+	rank  = ECOMALLOC(sizeof(int32_t) * length,"Allocate suffix ranks");
+	tmp   = ECOMALLOC(sizeof(int32_t) * length,"Allocate suffix buffer");
+	count = ECOMALLOC(sizeof(int32_t) * ((length > sigma) ? length:sigma),
+	                  "Allocate suffix counts");
+
+	for (i=0; i < length; i++)
+		count[text[i]]++;
+	for (i=1; i < sigma; i++)
+		count[i]+=count[i-1];
+	for (i=length-1; i >= 0; i--)
+		sa[--count[text[i]]] = i;
+
+	rank[sa[0]] = 0;
+	for (i=1,classes=1; i < length; i++)
+	{
+		if (text[sa[i]]!=text[sa[i-1]])
+			classes++;
+		rank[sa[i]] = classes - 1;
+	}
+
+	for (k=1; classes < length; k<<=1)
+	{
+		/* order by the rank of the second half */
+
+		p = 0;
+		for (i=length-k; i < length; i++)
+			tmp[p++] = i;
+		for (i=0; i < length; i++)
+			if (sa[i] >= k)
+				tmp[p++] = sa[i] - k;
+
+		/* stable order by the rank of the first half */
+
+		memset(count,0,sizeof(int32_t) * classes);
+		for (i=0; i < length; i++)
+			count[rank[i]]++;
+		for (i=1; i < classes; i++)
+			count[i]+=count[i-1];
+		for (i=length-1; i >= 0; i--)
+			sa[--count[rank[tmp[i]]]] = tmp[i];
+
+		tmp[sa[0]] = 0;
+		for (i=1,classes=1; i < length; i++)
+		{
+			a = sa[i-1];
+			b = sa[i];
+			if (rank[a]!=rank[b] ||
+				((a+k < length) ? rank[a+k]:-1) != ((b+k < length) ? rank[b+k]:-1))
+				classes++;
+			tmp[b] = classes - 1;
+		}
+
+		swap = rank;
+		rank = tmp;
+		tmp  = swap;
+	}
+
+	ECOFREE(rank,"Free suffix ranks");
+	ECOFREE(tmp,"Free suffix buffer");
+	ECOFREE(count,"Free suffix counts");
+
+	return sa;
+}
+
+/**
+ * Build the FM-index of a database
+ * @param	prefix	database name, the index is written in prefix.fdx
+ *
+ * @return	the number of indexed bases
+ */
+int32_t build_fmindex(const char *prefix)
+{
+	ecofmindexhead_t     head;
+	ecofmrecordformat_t  *record   = NULL;
+	ecofilestamp_t       *stamps;
+	int32_t              stampcount;
+	int32_t              records   = 0;
+	int32_t              rsize     = 0;
+	int32_t              *start    = NULL;
+	int32_t              sequences = 0;
+	int32_t              ssize     = 0;
+	unsigned char        *text     = NULL;
+	int64_t              length    = 0;
+	int64_t              tsize     = 0;
+	int32_t              symbol[ALPHA_LEN];
+	int32_t              *sa;
+	unsigned char        *bwt;
+	int32_t              *occ;
+	int32_t              checkpoints;
+	int32_t              occsize;
+	uint32_t             *sampled;
+	int32_t              *rank;
+	int32_t              *sample;
+	int32_t              words;
+	int32_t              samples;
+	int32_t              count[FMINDEX_SIGMA];
+	ecoseq_t             *seq;
+	char                 *c;
+	char                 filename[1024];
+	FILE                 *f;
+	long                 offset;
+	int32_t              i;
+	int32_t              j;
+
+	memset(&head,0,sizeof(ecofmindexhead_t));
+	memset(symbol,0,sizeof(symbol));
+
+	/* stamped first : a file changed while it is read is out of date */
+	stamps = database_stamps(prefix,0,&stampcount);
+
+	/* concatenate the distinct sequences */
+
+	seq = ecoseq_iterator(prefix);
+
+	while (seq)
+	{
+		if (records == rsize)
+		{
+			rsize = rsize ? rsize * 2 : 4096;
+			if (record)
+				record = ECOREALLOC(record,sizeof(ecofmrecordformat_t) * rsize,
+				                    "Increase FM-index record table");
+			else
+				record = ECOMALLOC(sizeof(ecofmrecordformat_t) * rsize,
+				                   "Allocate FM-index record table");
+		}
+
+		if (!seq->duplicate || !sequences)
+		{
+			if (sequences + 1 >= ssize)
+			{
+				ssize = ssize ? ssize * 2 : 4096;
+				if (start)
+					start = ECOREALLOC(start,sizeof(int32_t) * ssize,
+					                   "Increase FM-index sequence table");
+				else
+					start = ECOMALLOC(sizeof(int32_t) * ssize,
+					                  "Allocate FM-index sequence table");
+			}
+
+			if (length + seq->SQ_length + 2 > FMINDEX_MAX_LENGTH)
+			{
+				fprintf(stderr,"# An FM-index holds at most %d bases\n",FMINDEX_MAX_LENGTH);
+				ECOERROR(ECO_ASSERT_ERROR,"Database too large for an FM-index");
+			}
+
+			if (length + seq->SQ_length + 2 > tsize)
+			{
+				tsize = (length + seq->SQ_length + 2) * 2;
+				if (tsize > FMINDEX_MAX_LENGTH)
+					tsize = FMINDEX_MAX_LENGTH;
+				if (text)
+					text = ECOREALLOC(text,tsize,"Increase FM-index text");
+				else
+					text = ECOMALLOC(tsize,"Allocate FM-index text");
+			}
+
+			start[sequences++] = length;
+
+			for (c=seq->SQ; *c; c++)
+			{
+				text[length] = IS_UPPER(*c) ? *c - 'A' : 0;
+				symbol[text[length]] = 1;
+				text[length++]+=2;
+			}
+
+			text[length++] = FMINDEX_SEP;
+		}
+
+		ecoseq_iterator_position(&(record[records].file_index),&offset);
+		record[records].offset_hi = (int32_t)((int64_t)offset >> 32);
+		record[records].offset_lo = (int32_t)((int64_t)offset & 0xFFFFFFFF);
+		record[records].text      = sequences - 1;
+		records++;
+
+		delete_ecoseq(seq);
+		seq = ecoseq_iterator(NULL);
+	}
+
+	if (!sequences)
+		ECOERROR(ECO_ASSERT_ERROR,"Cannot index an empty database");
+
+	start[sequences] = length;
+	text[length++]   = FMINDEX_END;
+
+	/* dense symbols, letters are coded after the sentinel and separator */
+
+	head.sigma = 2;
+	for (i=0; i < ALPHA_LEN; i++)
+		if (symbol[i])
+		{
+			head.letter[head.sigma] = 'A' + i;
+			symbol[i] = head.sigma++;
+		}
+
+	for (i=0; i < length; i++)
+		if (text[i] >= 2)
+			text[i] = symbol[text[i]-2];
+
+	sa = suffix_array(text,length,head.sigma);
+
+	/* BWT, symbol counts and samples */
+
+	bwt         = ECOMALLOC(length,"Allocate BWT");
+	checkpoints = length / FMINDEX_OCC_STEP + 1;
+	occsize     = sizeof(int32_t) * checkpoints * head.sigma;
+	occ         = ECOMALLOC(occsize,"Allocate symbol counts");
+	words       = (length + 31) / 32;
+	sampled     = ECOMALLOC(sizeof(uint32_t) * words,"Allocate sampled rows");
+	rank        = ECOMALLOC(sizeof(int32_t) * words,"Allocate sampled row ranks");
+	sample      = ECOMALLOC(sizeof(int32_t) * (length / FMINDEX_SAMPLE + 1),
+	                        "Allocate sampled positions");
+
+	memset(count,0,sizeof(count));
+
+	for (i=0,samples=0; i < length; i++)
+	{
+		if (!(i % FMINDEX_OCC_STEP))
+			memcpy(occ + (i / FMINDEX_OCC_STEP) * head.sigma,count,
+			       sizeof(int32_t) * head.sigma);
+
+		if (!(i % 32))
+			rank[i / 32] = samples;
+
+		bwt[i] = (sa[i]) ? text[sa[i]-1] : text[length-1];
+		count[bwt[i]]++;
+
+		if (!(sa[i] % FMINDEX_SAMPLE))
+		{
+			sampled[i / 32] |= (uint32_t)1 << (i % 32);
+			sample[samples++] = sa[i];
+		}
+	}
+
+	for (i=0,j=0; i < head.sigma; i++)
+	{
+		head.C[i] = j;
+		j+=count[i];
+	}
+	head.C[head.sigma] = j;
+
+	ECOFREE(sa,"Free suffix array");
+	ECOFREE(text,"Free FM-index text");
+
+	/* write the index */
+
+	memcpy(head.magic,FMINDEX_MAGIC,sizeof(head.magic));
+	head.length    = length;
+	head.sequences = sequences;
+	head.records   = records;
+	head.occ_step  = FMINDEX_OCC_STEP;
+	head.sample    = FMINDEX_SAMPLE;
+
+	snprintf(filename,1024,"%s.fdx",prefix);
+	f = create_ecorecorddb(filename);
+
+	if (is_big_endian())
+		swap_ecoarray(&(head.length),FMINDEX_HEAD_INTS);
+
+	write_ecorecord(f,&head,sizeof(ecofmindexhead_t));
+	write_ecoarray(f,stamps,sizeof(ecofilestamp_t) * stampcount,1);
+	write_ecoarray(f,start,sizeof(int32_t) * (sequences+1),1);
+	write_ecoarray(f,record,sizeof(ecofmrecordformat_t) * records,1);
+	write_ecorecord(f,bwt,length);
+	write_ecoarray(f,occ,occsize,1);
+	write_ecoarray(f,sampled,sizeof(uint32_t) * words,1);
+	write_ecoarray(f,rank,sizeof(int32_t) * words,1);
+	write_ecoarray(f,sample,sizeof(int32_t) * samples,1);
+
+	close_ecorecorddb(f,9);
+
+	fprintf(stderr,"# %d sequences, %d distinct, %d bases indexed in %s\n",
+	        records,sequences,(int32_t)length - sequences - 1,filename);
+
+	ECOFREE(stamps,"Free database stamps");
+	ECOFREE(record,"Free FM-index record table");
+	ECOFREE(start,"Free FM-index sequence table");
+	ECOFREE(bwt,"Free BWT");
+	ECOFREE(occ,"Free symbol counts");
+	ECOFREE(sampled,"Free sampled rows");
+	ECOFREE(rank,"Free sampled row ranks");
+	ECOFREE(sample,"Free sampled positions");
+
+	return length - sequences - 1;
+}
+
+/**
+ * Read the FM-index of a database
+ * @param	prefix	database name
+ *
+ * @return	the index, NULL if the database has no FM-index or if
+ * 			a database file changed since the index was built
+ */
+ecofmindex_t *read_fmindex(const char *prefix)
+{
+	ecofmindex_t        *index;
+	ecofmindexhead_t    *head;
+	ecofmrecordformat_t *format;
+	ecofilestamp_t      *stamps;
+	char                filename[1024];
+	FILE                *f;
+	int32_t             count;
+	int32_t             size;
+	int32_t             i;
+
+	snprintf(filename,1024,"%s.fdx",prefix);
+	f = open_ecorecorddb(filename,&count,0);
+
+	if (!f)
+		return NULL;
+
+	head = read_ecoarray(f,&size,0);
+
+	if (size != sizeof(ecofmindexhead_t) ||
+		memcmp(head->magic,FMINDEX_MAGIC,sizeof(head->magic)))
+		ECOERROR(ECO_IO_ERROR,"Not an FM-index file");
+
+	if (is_big_endian())
+		swap_ecoarray(&(head->length),FMINDEX_HEAD_INTS);
+
+	stamps = read_ecoarray(f,&size,1);
+
+	if (!same_database_stamps(prefix,0,stamps,size / sizeof(ecofilestamp_t)) ||
+		head->records != ecoseq_record_count(prefix))
+	{
+		fprintf(stderr,"# FM-index %s does not match the database, ignored\n",
+		        filename);
+		ECOFREE(stamps,"Free database stamps");
+		ECOFREE(head,"Free FM-index header");
+		fclose(f);
+		return NULL;
+	}
+
+	index = ECOMALLOC(sizeof(ecofmindex_t),"Allocate FM-index");
+
+	index->length    = head->length;
+	index->sigma     = head->sigma;
+	index->sequences = head->sequences;
+	index->records   = head->records;
+	index->occ_step  = head->occ_step;
+	index->sample    = head->sample;
+	memcpy(index->C,head->C,sizeof(index->C));
+	memcpy(index->letter,head->letter,sizeof(index->letter));
+
+	ECOFREE(stamps,"Free database stamps");
+	ECOFREE(head,"Free FM-index header");
+
+	index->start = read_ecoarray(f,&size,1);
+
+	format = read_ecoarray(f,&size,1);
+	index->record = ECOMALLOC(sizeof(ecofmrecord_t) * index->records,
+	                          "Allocate FM-index records");
+	for (i=0; i < index->records; i++)
+	{
+		index->record[i].file_index = format[i].file_index;
+		index->record[i].offset     = (long)(((int64_t)format[i].offset_hi << 32) |
+		                                     (uint32_t)format[i].offset_lo);
+		index->record[i].text       = format[i].text;
+	}
+	ECOFREE(format,"Free FM-index record table");
+
+	index->bwt     = read_ecoarray(f,&size,0);
+	index->occ     = read_ecoarray(f,&size,1);
+	index->sampled = read_ecoarray(f,&size,1);
+	index->rank    = read_ecoarray(f,&size,1);
+	index->samples = read_ecoarray(f,&size,1);
+
+	fclose(f);
+
+	return index;
+}
+
+void delete_fmindex(ecofmindex_t *index)
+{
+	ECOFREE(index->start,"Free FM-index sequence starts");
+	ECOFREE(index->record,"Free FM-index records");
+	ECOFREE(index->bwt,"Free BWT");
+	ECOFREE(index->occ,"Free symbol counts");
+	ECOFREE(index->sampled,"Free sampled rows");
+	ECOFREE(index->rank,"Free sampled row ranks");
+	ECOFREE(index->samples,"Free sampled positions");
+	ECOFREE(index,"Free FM-index");
+}
+
+/*
+ * count of a symbol in the BWT rows before row
+ */
+int32_t occurrences(ecofmindex_t *index,int32_t symbol,int32_t row)
+{
+	int32_t       count;
+	unsigned char *bwt;
+	unsigned char *end;
+
+	count = index->occ[(row / index->occ_step) * index->sigma + symbol];
+	bwt   = index->bwt + (row / index->occ_step) * index->occ_step;
+	end   = index->bwt + row;
+
+	for (; bwt < end; bwt++)
+		count+=(*bwt == symbol);
+
+	return count;
+}
+
+/*
+ * text position of a BWT row, walking back to a sampled row
+ */
+int32_t locate(ecofmindex_t *index,int32_t row)
+{
+	int32_t  steps = 0;
+	int32_t  symbol;
+	uint32_t word;
+
+	while (!((index->sampled[row / 32] >> (row % 32)) & 1))
+	{
+		symbol = index->bwt[row];
+		row    = index->C[symbol] + occurrences(index,symbol,row);
+		steps++;
+	}
+
+	word = index->sampled[row / 32] & (((uint32_t)1 << (row % 32)) - 1);
+
+	return index->samples[index->rank[row / 32] + __builtin_popcount(word)] + steps;
+}
+
+/*
+ * extend the match of the pattern suffix starting at position + 1
+ * by one symbol, on the left
+ */
+void search_node(ecofmsearch_t *search,int32_t position,
+		         int32_t low,int32_t high,int32_t errors)
+{
+	ecofmindex_t *index   = search->index;
+	PatternPtr   pattern  = search->pattern;
+	UInt32       bit;
+	int32_t      symbol;
+	int32_t      l;
+	int32_t      h;
+	int32_t      row;
+
+	if (position < 0)
+	{
+		for (row=low; row < high; row++)
+		{
+			if (search->count == search->size)
+			{
+				search->size = search->size ? search->size * 2 : 1024;
+				if (search->hits)
+					search->hits = ECOREALLOC(search->hits,
+					                          sizeof(ecofmhit_t) * search->size,
+					                          "Increase FM-index hits");
+				else
+					search->hits = ECOMALLOC(sizeof(ecofmhit_t) * search->size,
+					                         "Allocate FM-index hits");
+			}
+
+			search->hits[search->count].position = locate(index,row);
+			search->hits[search->count].error    = errors;
+			search->count++;
+		}
+		return;
+	}
+
+	bit = (UInt32)1 << (pattern->patlen - 1 - position);
+
+	/* separators and sentinel never match, even as a mismatch */
+
+	for (symbol=2; symbol < index->sigma; symbol++)
+	{
+		l = index->C[symbol] + occurrences(index,symbol,low);
+		h = index->C[symbol] + occurrences(index,symbol,high);
+
+		if (l >= h)
+			continue;
+
+		if (pattern->smat[index->letter[symbol] - 'A'] & bit)
+			search_node(search,position - 1,l,h,errors);
+		else if (errors < pattern->maxerr && !(pattern->omask & bit))
+			search_node(search,position - 1,l,h,errors + 1);
+	}
+}
+
+int compare_hits(const void *h1,const void *h2)
+{
+	const ecofmhit_t *a = h1;
+	const ecofmhit_t *b = h2;
+
+	if (a->text != b->text)
+		return (a->text < b->text) ? -1 : 1;
+
+	return (a->position < b->position) ? -1 : (a->position > b->position);
+}
+
+/**
+ * Look for a pattern in the indexed sequences, with at most
+ * pattern->maxerr mismatches.
+ *
+ * Hits are the ones ManberAll reports on each sequence, with the
+ * lowest error count, their positions are relative to the sequence.
+ *
+ * @param	index	the FM-index
+ * @param	pattern	pattern looked for, without indels
+ * @param	count	receives the number of hits
+ *
+ * @return	the hits, sorted by sequence and position
+ */
+ecofmhit_t *search_fmindex(ecofmindex_t *index,PatternPtr pattern,int32_t *count)
+{
+	ecofmsearch_t search;
+	int32_t       low;
+	int32_t       high;
+	int32_t       middle;
+	int32_t       i;
+
+	if (pattern->hasIndel)
+		ECOERROR(ECO_ASSERT_ERROR,"FM-index search does not handle indels");
+
+	search.index   = index;
+	search.pattern = pattern;
+	search.hits    = NULL;
+	search.count   = 0;
+	search.size    = 0;
+
+	search_node(&search,pattern->patlen - 1,0,index->length,0);
+
+	/* text positions to sequence positions */
+
+	for (i=0; i < search.count; i++)
+	{
+		low  = 0;
+		high = index->sequences;
+
+		while (high - low > 1)
+		{
+			middle = (low + high) / 2;
+			if (index->start[middle] <= search.hits[i].position)
+				low = middle;
+			else
+				high = middle;
+		}
+
+		search.hits[i].text      = low;
+		search.hits[i].position -= index->start[low];
+	}
+
+	if (search.count)
+		qsort(search.hits,search.count,sizeof(ecofmhit_t),compare_hits);
+
+	*count = search.count;
+
+	return search.hits;
+}
+
+#undef IS_UPPER
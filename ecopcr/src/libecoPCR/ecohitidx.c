@@ -0,0 +1,383 @@
+#include "../libapat/libstki.h"
+#include "../libapat/apat.h"
+
+#include "ecoPCR.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HITIDX_MAGIC "ECOHDX02"
+
+static int32_t *pack_hits(int32_t *data,StackiPtr hitpos,StackiPtr hiterr);
+static int32_t is_selection_narrower(ecotaxonomy_t *taxonomy,
+		                             int32_t *saved_r,int32_t sr,int32_t *saved_g,int32_t sg,
+		                             int32_t *restricted,int32_t r,int32_t *ignored,int32_t g);
+
+
+/**
+ * Create a primer hit index file (.hdx).
+ *
+ * The file follows the layout of the other database files : a record
+ * count followed by size prefixed records. The first record describes
+ * the primer pair and the taxonomic selection of the scan, the next
+ * ones the hits found on each selected sequence.
+ *
+ * @param	filename	name of the index file
+ * @param	o1			first primer pattern
+ * @param	o2			second primer pattern
+ * @param	error_max	max error count used during the scan
+ * @param	circular	circular mode used during the scan
+ * @param	restricted	taxids of the -r option
+ * @param	r			count of restricted taxids
+ * @param	ignored		taxids of the -i option
+ * @param	g			count of ignored taxids
+ *
+ * @return	file object
+ */
+FILE *create_hitidx(const char *filename,
+		            PatternPtr o1, PatternPtr o2,
+		            int32_t error_max, int32_t circular,
+		            int32_t *restricted, int32_t r,
+		            int32_t *ignored, int32_t g)
+{
+	FILE            *f;
+	ecohitidxhead_t *head;
+	int32_t         *taxids;
+	int32_t         size;
+	int32_t         i;
+
+	f = create_ecorecorddb(filename);
+
+	size = sizeof(ecohitidxhead_t) + o1->patlen + o2->patlen +
+	       (r + g) * sizeof(int32_t);
+	head = ECOMALLOC(size,"Allocate primer hit index header");
+	taxids = ECOMALLOC((r + g + 1) * sizeof(int32_t),"Allocate primer hit index header");
+
+	memcpy(head->magic,HITIDX_MAGIC,sizeof(head->magic));
+	head->error_max = error_max;
+	head->circular  = circular;
+	head->length1   = o1->patlen;
+	head->length2   = o2->patlen;
+	head->restricted= r;
+	head->ignored   = g;
+	memcpy(head->oligos,o1->cpat,o1->patlen);
+	memcpy(head->oligos+o1->patlen,o2->cpat,o2->patlen);
+
+	for (i=0; i < r; i++)
+		taxids[i] = restricted[i];
+	for (i=0; i < g; i++)
+		taxids[r+i] = ignored[i];
+
+	if (is_big_endian())
+	{
+		head->error_max = swap_int32_t(head->error_max);
+		head->circular  = swap_int32_t(head->circular);
+		head->length1   = swap_int32_t(head->length1);
+		head->length2   = swap_int32_t(head->length2);
+		head->restricted= swap_int32_t(head->restricted);
+		head->ignored   = swap_int32_t(head->ignored);
+		swap_ecoarray(taxids,r + g);
+	}
+
+	/* the oligos leave the taxids unaligned */
+	memcpy(head->oligos+o1->patlen+o2->patlen,taxids,(r + g) * sizeof(int32_t));
+
+	write_ecorecord(f,head,size);
+
+	ECOFREE(taxids,"Free primer hit index header");
+	ECOFREE(head,"Free primer hit index header");
+
+	return f;
+}
+
+int32_t *pack_hits(int32_t *data,StackiPtr hitpos,StackiPtr hiterr)
+{
+	int32_t i;
+
+	for (i=0; i < hitpos->top; i++)
+	{
+		*(data++) = hitpos->val[i];
+		*(data++) = hiterr->val[i];
+	}
+
+	return data;
+}
+
+/**
+ * Store the hits of the four patterns found on a sequence
+ * @param	f			primer hit index returned by create_hitidx
+ * @param	file_index	index of the .sdx file holding the sequence
+ * @param	offset		offset of the sequence record in this file
+ * @param	seq			apat sequence holding the hit stacks
+ */
+void write_hitidx(FILE *f,int32_t file_index,long offset,SeqPtr seq)
+{
+	static int32_t *buffer = NULL;
+	static int32_t buffsize= 0;
+	int32_t        size;
+	int32_t        *data;
+	int32_t        i;
+
+	size = 4 + MAX_PATTERN;
+	for (i=0; i < MAX_PATTERN; i++)
+		size+=seq->hitpos[i]->top * 2;
+
+	if (size > buffsize)
+	{
+		buffsize = size;
+		if (buffer)
+			buffer = ECOREALLOC(buffer,buffsize*sizeof(int32_t),
+			                    "Increase primer hit buffer");
+		else
+			buffer = ECOMALLOC(buffsize*sizeof(int32_t),
+			                   "Allocate primer hit buffer");
+	}
+
+	buffer[0] = file_index;
+	buffer[1] = (int32_t)((int64_t)offset >> 32);
+	buffer[2] = (int32_t)((int64_t)offset & 0xFFFFFFFF);
+	buffer[3] = seq->seqlen;
+
+	for (i=0; i < MAX_PATTERN; i++)
+		buffer[4+i] = seq->hitpos[i]->top;
+
+	data = buffer + 4 + MAX_PATTERN;
+	for (i=0; i < MAX_PATTERN; i++)
+		data = pack_hits(data,seq->hitpos[i],seq->hiterr[i]);
+
+	if (is_big_endian())
+		for (i=0; i < size; i++)
+			buffer[i] = swap_int32_t(buffer[i]);
+
+	write_ecorecord(f,buffer,size * sizeof(int32_t));
+}
+
+/*
+ * A sequence selected by the replay must have been selected by the
+ * scan : every restricted taxon of the replay is under a restricted
+ * taxon of the scan, and every taxon ignored by the scan is ignored
+ * by the replay or outside of its restricted taxa.
+ */
+int32_t is_selection_narrower(ecotaxonomy_t *taxonomy,
+		                      int32_t *saved_r,int32_t sr,int32_t *saved_g,int32_t sg,
+		                      int32_t *restricted,int32_t r,int32_t *ignored,int32_t g)
+{
+	int32_t i;
+	int32_t j;
+
+	if (sr && !r)
+		return 0;
+
+	if (sr)
+		for (i=0; i < r; i++)
+			if (!eco_is_taxid_included(taxonomy,saved_r,sr,restricted[i]))
+				return 0;
+
+	for (i=0; i < sg; i++)
+	{
+		if (eco_is_taxid_included(taxonomy,ignored,g,saved_g[i]))
+			continue;
+
+		if (!r || eco_is_taxid_included(taxonomy,restricted,r,saved_g[i]))
+			return 0;
+
+		for (j=0; j < r; j++)
+			if (eco_is_taxid_included(taxonomy,saved_g+i,1,restricted[j]))
+				return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Open a primer hit index and check it has been built
+ * with a compatible primer pair and taxonomic selection.
+ *
+ * @param	filename	name of the index file
+ * @param	o1			first primer pattern
+ * @param	o2			second primer pattern
+ * @param	error_max	max error count requested, must not be
+ * 						greater than the one used to build the index
+ * @param	circular	circular mode requested
+ * @param	taxonomy	the taxonomy of the database
+ * @param	restricted	taxids of the -r option, the replay cannot
+ * @param	r			select sequences the scan did not select
+ * @param	ignored		taxids of the -i option
+ * @param	g			count of ignored taxids
+ * @param	count		receives the number of indexed sequences
+ *
+ * @return	file object positioned on the first hit record
+ */
+FILE *open_hitidx(const char *filename,
+		          PatternPtr o1, PatternPtr o2,
+		          int32_t error_max, int32_t circular,
+		          ecotaxonomy_t *taxonomy,
+		          int32_t *restricted, int32_t r,
+		          int32_t *ignored, int32_t g,
+		          int32_t *count)
+{
+	FILE            *f;
+	ecohitidxhead_t *head;
+	int32_t         *taxids;
+	int32_t         rs;
+
+	f = open_ecorecorddb(filename,count,1);
+
+	head = read_ecorecord(f,&rs);
+
+	if (!head || memcmp(head->magic,HITIDX_MAGIC,sizeof(head->magic)))
+		ECOERROR(ECO_IO_ERROR,"Not a primer hit index file");
+
+	(*count)--;  /* header record */
+
+	if (is_big_endian())
+	{
+		head->error_max = swap_int32_t(head->error_max);
+		head->circular  = swap_int32_t(head->circular);
+		head->length1   = swap_int32_t(head->length1);
+		head->length2   = swap_int32_t(head->length2);
+		head->restricted= swap_int32_t(head->restricted);
+		head->ignored   = swap_int32_t(head->ignored);
+	}
+
+	if (head->restricted < 0 || head->ignored < 0 ||
+		rs != (int32_t)(sizeof(ecohitidxhead_t) + head->length1 + head->length2 +
+		                (head->restricted + head->ignored) * sizeof(int32_t)))
+		ECOERROR(ECO_IO_ERROR,"Bad primer hit index header");
+
+	if (head->length1!=o1->patlen ||
+		head->length2!=o2->patlen ||
+		strncmp(head->oligos,o1->cpat,o1->patlen) ||
+		strncmp(head->oligos+o1->patlen,o2->cpat,o2->patlen))
+		ECOERROR(ECO_ASSERT_ERROR,"Primer hit index was built with other primers");
+
+	if (head->error_max < error_max)
+		ECOERROR(ECO_ASSERT_ERROR,"Primer hit index was built with a lower error count");
+
+	if (head->circular!=circular)
+		ECOERROR(ECO_ASSERT_ERROR,"Primer hit index was built with another circular mode");
+
+	taxids = ECOMALLOC((head->restricted + head->ignored + 1) * sizeof(int32_t),
+	                   "Allocate primer hit index taxids");
+	memcpy(taxids,head->oligos+head->length1+head->length2,
+	       (head->restricted + head->ignored) * sizeof(int32_t));
+
+	if (is_big_endian())
+		swap_ecoarray(taxids,head->restricted + head->ignored);
+
+	if (!is_selection_narrower(taxonomy,
+	                           taxids,head->restricted,
+	                           taxids+head->restricted,head->ignored,
+	                           restricted,r,ignored,g))
+		ECOERROR(ECO_ASSERT_ERROR,"Primer hit index was built with a narrower -r/-i selection");
+
+	ECOFREE(taxids,"Free primer hit index taxids");
+
+	return f;
+}
+
+/**
+ * Read the hits of the next indexed sequence.
+ *
+ * The hit stacks of the apat sequence are filled back as if
+ * ManberAll had been run, keeping only hits with at most
+ * error_max errors. Sequence data are not loaded.
+ *
+ * @param	f			primer hit index returned by open_hitidx
+ * @param	file_index	receives the index of the .sdx file
+ * @param	offset		receives the offset of the sequence record
+ * @param	seq			apat sequence receiving the hits or NULL
+ * @param	error_max	max error count kept
+ *
+ * @return	the apat sequence or NULL at the end of the index
+ */
+SeqPtr readnext_hitidx(FILE *f,int32_t *file_index,long *offset,
+		               SeqPtr seq,int32_t error_max)
+{
+	int32_t *raw;
+	int32_t *data;
+	int32_t rs;
+	int32_t i;
+	int32_t j;
+
+	raw = read_ecorecord(f,&rs);
+
+	if (!raw)
+		return NULL;
+
+	if (is_big_endian())
+		for (i=0; i < (int32_t)(rs/sizeof(int32_t)); i++)
+			raw[i] = swap_int32_t(raw[i]);
+
+	if (!seq)
+	{
+		seq = ECOMALLOC(sizeof(Seq),
+		                "Error in Allocation of a new Seq structure");
+
+		for (i  = 0 ; i < MAX_PATTERN ; i++)
+		{
+		   if (! (seq->hitpos[i] = NewStacki(kMinStackiSize)))
+			   ECOERROR(ECO_MEM_ERROR,"Error in hit stack Allocation");
+
+		   if (! (seq->hiterr[i] = NewStacki(kMinStackiSize)))
+			   ECOERROR(ECO_MEM_ERROR,"Error in error stack Allocation");
+		}
+	}
+
+	*file_index = raw[0];
+	*offset     = (long)(((int64_t)raw[1] << 32) | (uint32_t)raw[2]);
+	seq->seqsiz = seq->seqlen = raw[3];
+
+	data = raw + 4 + MAX_PATTERN;
+	for (i=0; i < MAX_PATTERN; i++)
+	{
+		seq->hitpos[i]->top = seq->hiterr[i]->top = 0;
+
+		for (j=0; j < raw[4+i]; j++,data+=2)
+			if (data[1] <= error_max)
+			{
+				PushiIn(seq->hitpos+i,data[0]);
+				PushiIn(seq->hiterr+i,data[1]);
+			}
+	}
+
+	return seq;
+}
+
+/**
+ * Restrict the hits of a pattern to a window of the sequence.
+ *
+ * Keeps only the hits which would have been reported by
+ * ManberAll(seq,pattern,patnum,begin,length).
+ *
+ * @return	the number of hits kept
+ */
+int32_t clip_hitidx(SeqPtr seq,PatternPtr pattern,int32_t patnum,
+		            int32_t begin,int32_t length)
+{
+	StackiPtr hitpos;
+	StackiPtr hiterr;
+	int64_t   end;
+	int32_t   i;
+	int32_t   kept;
+
+	hitpos = seq->hitpos[patnum];
+	hiterr = seq->hiterr[patnum];
+
+	end = (int64_t)begin + length;
+	if (end > seq->seqlen + seq->circular)
+		end = seq->seqlen + seq->circular;
+
+	for (i=0,kept=0; i < hitpos->top; i++)
+		if (hitpos->val[i] >= begin &&
+			hitpos->val[i] + pattern->patlen <= end)
+		{
+			hitpos->val[kept] = hitpos->val[i];
+			hiterr->val[kept] = hiterr->val[i];
+			kept++;
+		}
+
+	hitpos->top = hiterr->top = kept;
+
+	return kept;
+}
@@ -0,0 +1,432 @@
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Database image : the taxonomy and the uncompressed sequences of a
+ * database in a single file, usually in /dev/shm, mapped read-only by
+ * every process using the database. The pages are shared, so memory
+ * and loading time are paid once per node.
+ *
+ * The image holds no pointer : taxa refer to their parent by index,
+ * strings by their offset in the image. It is written in the byte
+ * order of the node building it.
+ *
+ * Layout : header, rank label offsets, taxa, sequences, stamps of the
+ * database files, strings. An image is refused once one of the .sdx,
+ * .tdx, .rdx or .ldx files changed since it was built.
+ *
+ * The image of a database is used when the ECOPCRIMAGE environment
+ * variable gives its name. The image records the database with the
+ * canonical path of its directory : a relative or an absolute name
+ * of the database, or a name through a symbolic link, all use it.
+ */
+
+#define IMAGE_MAGIC  "ECOIMG02"
+#define IMAGE_PREFIX (1024)
+
+typedef struct {
+	char     magic[8];
+	int32_t  endian;		/* 1 in the byte order of the writer */
+	int32_t  rankcount;
+	int32_t  taxoncount;
+	int32_t  sequencecount;
+	int32_t  stampcount;
+	int32_t  unused;
+	int64_t  size;
+	char     prefix[IMAGE_PREFIX];
+} ecoimagehead_t;
+
+typedef struct {
+	int64_t  name;
+	int32_t  taxid;
+	int32_t  rank;
+	int32_t  parent;		/* index of the parent taxon */
+	int32_t  unused;
+} ecoimagetaxon_t;
+
+typedef struct {
+	int64_t  offset;		/* of the record in its .sdx file */
+	int64_t  AC;
+	int64_t  DE;
+	int64_t  SQ;
+	int32_t  file_index;
+	int32_t  taxid;
+	int32_t  SQ_length;
+	int32_t  duplicate;
+} ecoimageseq_t;
+
+struct ecoimage {
+	ecoimagehead_t  *head;
+	int64_t         *ranks;
+	ecoimagetaxon_t *taxa;
+	ecoimageseq_t   *sequences;
+	ecofilestamp_t  *stamps;
+	char            *data;
+};
+
+static int64_t write_string(FILE *f,const char *string,int32_t length,int64_t *size);
+static void    canonical_prefix(const char *prefix,char *canonical);
+
+/**
+ * Build the image of a database.
+ * @param	prefix		name of the database (radical without extension)
+ * @param	filename	name of the image, in /dev/shm or any file system
+ *
+ * @return	the number of sequences in the image
+ */
+int32_t build_ecoimage(const char *prefix,const char *filename)
+{
+	ecoimagehead_t  head;
+	ecotaxonomy_t   *taxonomy;
+	int64_t         *ranks;
+	ecoimagetaxon_t *taxa;
+	ecoimageseq_t   *sequences;
+	ecofilestamp_t  *stamps;
+	ecoseq_t        *seq;
+	int64_t         size;
+	int64_t         SQ = 0;
+	long            offset;
+	int32_t         count;
+	int32_t         sequencecount;
+	int32_t         i;
+	char            *tmpname;
+	FILE            *f;
+
+	/* the image is built from the database files, not from an older image */
+	unsetenv("ECOPCRIMAGE");
+
+	/* stamped first : a file changed while it is read is out of date */
+	stamps = database_stamps(prefix,1,&count);
+
+	taxonomy      = read_taxonomy(prefix,0);
+	sequencecount = ecoseq_record_count(prefix);
+
+	memset(&head,0,sizeof(head));
+	memcpy(head.magic,IMAGE_MAGIC,8);
+	head.endian        = 1;
+	head.rankcount     = taxonomy->ranks->count;
+	head.taxoncount    = taxonomy->taxons->count;
+	head.sequencecount = sequencecount;
+	head.stampcount    = count;
+	canonical_prefix(prefix,head.prefix);
+
+	ranks     = ECOMALLOC(sizeof(int64_t) * (head.rankcount + 1),
+	                      "Allocate image rank labels");
+	taxa      = ECOMALLOC(sizeof(ecoimagetaxon_t) * (head.taxoncount + 1),
+	                      "Allocate image taxa");
+	sequences = ECOMALLOC(sizeof(ecoimageseq_t) * (sequencecount + 1),
+	                      "Allocate image sequences");
+
+	tmpname = ECOMALLOC(strlen(filename)+5,"Allocate image file name");
+	sprintf(tmpname,"%s.tmp",filename);
+
+	f = fopen(tmpname,"w");
+	if (!f)
+		ECOERROR(ECO_IO_ERROR,"Cannot open the database image");
+
+	/* strings are written after the tables, which are known at the end */
+
+	size = sizeof(ecoimagehead_t)
+	     + sizeof(int64_t) * head.rankcount
+	     + sizeof(ecoimagetaxon_t) * head.taxoncount
+	     + sizeof(ecoimageseq_t) * sequencecount
+	     + sizeof(ecofilestamp_t) * head.stampcount;
+
+	if (fseek(f,size,SEEK_SET))
+		ECOERROR(ECO_IO_ERROR,"Cannot write the database image");
+
+	for (i=0; i < head.rankcount; i++)
+		ranks[i] = write_string(f,taxonomy->ranks->label[i],
+		                        strlen(taxonomy->ranks->label[i]),&size);
+
+	for (i=0; i < head.taxoncount; i++)
+	{
+		taxa[i].name   = write_string(f,taxonomy->taxons->taxon[i].name,
+		                              strlen(taxonomy->taxons->taxon[i].name),&size);
+		taxa[i].taxid  = taxonomy->taxons->taxon[i].taxid;
+		taxa[i].rank   = taxonomy->taxons->taxon[i].rank;
+		taxa[i].parent = taxonomy->taxons->taxon[i].parent - taxonomy->taxons->taxon;
+	}
+
+	fprintf(stderr,"# Writing the image of %s in %s...\n",prefix,filename);
+
+	count = 0;
+	seq   = ecoseq_iterator(prefix);
+
+	while (seq)
+	{
+		if (count == sequencecount)
+			ECOERROR(ECO_IO_ERROR,"Database changed while building its image");
+
+		ecoseq_iterator_position(&(sequences[count].file_index),&offset);
+		sequences[count].offset = offset;
+
+		sequences[count].taxid     = seq->taxid;
+		sequences[count].SQ_length = seq->SQ_length;
+		sequences[count].duplicate = seq->duplicate;
+		sequences[count].AC        = write_string(f,seq->AC,strlen(seq->AC),&size);
+		sequences[count].DE        = write_string(f,seq->DE,strlen(seq->DE),&size);
+
+		/* a duplicated sequence shares the bases of the previous record */
+		if (!seq->duplicate || !count)
+			SQ = write_string(f,seq->SQ,seq->SQ_length,&size);
+		sequences[count].SQ = SQ;
+
+		count++;
+		delete_ecoseq(seq);
+		seq = ecoseq_iterator(NULL);
+	}
+
+	if (count != sequencecount)
+		ECOERROR(ECO_IO_ERROR,"Database changed while building its image");
+
+	head.size = size;
+
+	if (fseek(f,0,SEEK_SET) ||
+		fwrite(&head,sizeof(ecoimagehead_t),1,f) != 1 ||
+		fwrite(ranks,sizeof(int64_t),head.rankcount,f) != (size_t)head.rankcount ||
+		fwrite(taxa,sizeof(ecoimagetaxon_t),head.taxoncount,f) != (size_t)head.taxoncount ||
+		fwrite(sequences,sizeof(ecoimageseq_t),count,f) != (size_t)count ||
+		fwrite(stamps,sizeof(ecofilestamp_t),head.stampcount,f) != (size_t)head.stampcount ||
+		fclose(f) ||
+		rename(tmpname,filename))
+		ECOERROR(ECO_IO_ERROR,"Cannot write the database image");
+
+	fprintf(stderr,"# %d taxa and %d sequences stored in %lld bytes\n",
+			head.taxoncount,count,(long long)size);
+
+	ECOFREE(tmpname,"Free image file name");
+	ECOFREE(stamps,"Free database stamps");
+	ECOFREE(sequences,"Free image sequences");
+	ECOFREE(taxa,"Free image taxa");
+	ECOFREE(ranks,"Free image rank labels");
+
+	return count;
+}
+
+/*
+ * write a null terminated string at the end of the image and
+ * return its offset
+ */
+int64_t write_string(FILE *f,const char *string,int32_t length,int64_t *size)
+{
+	int64_t offset = *size;
+
+	if (fwrite(string,1,length,f) != (size_t)length ||
+		fputc(0,f) == EOF)
+		ECOERROR(ECO_IO_ERROR,"Cannot write the database image");
+
+	*size += length + 1;
+
+	return offset;
+}
+
+/*
+ * the database name with the canonical path of its directory, the
+ * name as it is when the directory cannot be resolved
+ */
+void canonical_prefix(const char *prefix,char *canonical)
+{
+	char       directory[IMAGE_PREFIX];
+	char       *resolved;
+	const char *base;
+
+	base = strrchr(prefix,'/');
+
+	if (base)
+	{
+		if (base - prefix >= IMAGE_PREFIX)
+			ECOERROR(ECO_IO_ERROR,"Database name is too long");
+		memcpy(directory,prefix,base - prefix);
+		directory[base - prefix] = 0;
+		base++;
+	}
+	else
+	{
+		strcpy(directory,".");
+		base = prefix;
+	}
+
+	resolved = realpath((*directory) ? directory:"/",NULL);
+
+	if (!resolved)
+	{
+		if (strlen(prefix) >= IMAGE_PREFIX)
+			ECOERROR(ECO_IO_ERROR,"Database name is too long");
+		strcpy(canonical,prefix);
+		return;
+	}
+
+	if (strlen(resolved) + strlen(base) + 2 > IMAGE_PREFIX)
+		ECOERROR(ECO_IO_ERROR,"Database name is too long");
+
+	sprintf(canonical,"%s%s%s",resolved,
+	        (resolved[strlen(resolved)-1] == '/') ? "":"/",base);
+
+	free(resolved);
+}
+
+/**
+ * Attach the image given by the ECOPCRIMAGE environment variable.
+ * The image is mapped once, read-only, and stays mapped.
+ * @param	prefix	name of the database (radical without extension)
+ *
+ * @return	the image, or NULL if there is no image of this database
+ */
+ecoimage_t *attach_ecoimage(const char *prefix)
+{
+	static ecoimage_t *image = NULL;
+	static int32_t    checked = 0;
+	static char       *requested = NULL;	/* last prefix looked for */
+	static int32_t    matched = 0;
+	char              canonical[IMAGE_PREFIX];
+	char              *filename;
+	struct stat       st;
+	int               fd;
+	void              *data;
+
+	filename = getenv("ECOPCRIMAGE");
+
+	if (!filename || !*filename)
+		return NULL;
+
+	if (!image)
+	{
+		fd = open(filename,O_RDONLY);
+
+		if (fd < 0 || fstat(fd,&st) || st.st_size < (off_t)sizeof(ecoimagehead_t))
+			ECOERROR(ECO_IO_ERROR,"Cannot open the database image");
+
+		data = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+		close(fd);
+
+		if (data == MAP_FAILED)
+			ECOERROR(ECO_IO_ERROR,"Cannot map the database image");
+
+		image = ECOMALLOC(sizeof(ecoimage_t),"Allocate database image");
+
+		image->data = data;
+		image->head = data;
+
+		if (memcmp(image->head->magic,IMAGE_MAGIC,8) ||
+			image->head->endian != 1 ||
+			image->head->size != st.st_size)
+			ECOERROR(ECO_IO_ERROR,"Not a database image of this node");
+
+		image->ranks     = (int64_t*)(image->data + sizeof(ecoimagehead_t));
+		image->taxa      = (ecoimagetaxon_t*)(image->ranks + image->head->rankcount);
+		image->sequences = (ecoimageseq_t*)(image->taxa + image->head->taxoncount);
+		image->stamps    = (ecofilestamp_t*)(image->sequences + image->head->sequencecount);
+	}
+
+	if (!requested || strcmp(prefix,requested))
+	{
+		if (requested)
+			ECOFREE(requested,"Free database name");
+		requested = ECOMALLOC(strlen(prefix)+1,"Allocate database name");
+		strcpy(requested,prefix);
+
+		canonical_prefix(prefix,canonical);
+		matched = !strcmp(canonical,image->head->prefix);
+	}
+
+	if (!matched)
+		return NULL;
+
+	if (!checked)
+	{
+		if (!same_database_stamps(prefix,1,image->stamps,image->head->stampcount) ||
+			ecoseq_record_count(prefix) != image->head->sequencecount)
+			ECOERROR(ECO_IO_ERROR,"Database image is out of date");
+		checked = 1;
+	}
+
+	return image;
+}
+
+/**
+ * Rank labels of an image, pointing into it
+ */
+ecorankidx_t *image_rankidx(ecoimage_t *image)
+{
+	ecorankidx_t *index;
+	int32_t      i;
+
+	index = ECOMALLOC(sizeof(ecorankidx_t) + sizeof(char*) * image->head->rankcount,
+	                  "Allocate rank index");
+
+	index->count = image->head->rankcount;
+
+	for (i=0; i < index->count; i++)
+		index->label[i] = image->data + image->ranks[i];
+
+	return index;
+}
+
+/**
+ * Taxa of an image. The taxon structures are built for the
+ * process, their names point into the image.
+ */
+ecotxidx_t *image_taxonomyidx(ecoimage_t *image)
+{
+	ecotxidx_t *index;
+	int32_t    i;
+
+	index = ECOMALLOC(sizeof(ecotxidx_t) + sizeof(ecotx_t) * image->head->taxoncount,
+	                  "Allocate taxonomy");
+
+	index->count = image->head->taxoncount;
+
+	for (i=0; i < index->count; i++)
+	{
+		index->taxon[i].taxid  = image->taxa[i].taxid;
+		index->taxon[i].rank   = image->taxa[i].rank;
+		index->taxon[i].parent = index->taxon + image->taxa[i].parent;
+		index->taxon[i].name   = image->data + image->taxa[i].name;
+	}
+
+	fprintf(stderr,"# %d taxa attached from the database image\n",index->count);
+
+	return index;
+}
+
+/**
+ * Number of sequences of an image
+ */
+int32_t image_sequence_count(ecoimage_t *image)
+{
+	return image->head->sequencecount;
+}
+
+/**
+ * Describe a sequence of an image : its strings point into the image
+ * and must not be freed.
+ * @param	image		the database image
+ * @param	record		index of the sequence in the database order
+ * @param	file_index	set to the .sdx file of the record
+ * @param	offset		set to the offset of the record in this file
+ * @param	seq			filled with the sequence
+ */
+void image_sequence(ecoimage_t *image,int32_t record,
+		            int32_t *file_index,long *offset,ecoseq_t *seq)
+{
+	ecoimageseq_t *s = image->sequences + record;
+
+	*file_index    = s->file_index;
+	*offset        = s->offset;
+
+	seq->taxid     = s->taxid;
+	seq->SQ_length = s->SQ_length;
+	seq->duplicate = s->duplicate;
+	seq->AC        = image->data + s->AC;
+	seq->DE        = image->data + s->DE;
+	seq->SQ        = image->data + s->SQ;
+	seq->stream    = NULL;
+}
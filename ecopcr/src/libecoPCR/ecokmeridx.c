@@ -0,0 +1,543 @@
+#include "../libapat/libstki.h"
+#include "../libapat/apat.h"
+
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * k-mer seed index (.kdx) of the database sequences.
+ *
+ * The distinct sequences of the database are concatenated, each one
+ * followed by a separator. For each k-mer of A, C, G and T, the index
+ * holds the sorted text positions where it occurs.
+ *
+ * A primer of length m found with at most e mismatches is split in
+ * e+1 pieces : one of them at least matches exactly, and the pieces
+ * are longer than m/(e+1) bases. A k-mer of each piece is looked up,
+ * giving the candidate positions of the primer, which are checked
+ * against the sequence by the Manber kernel.
+ *
+ * Sequences holding other letters than A, C, G and T are flagged as
+ * mixed : their k-mers are not indexed and they are always scanned.
+ *
+ * File records : header, stamps of the .sdx files, sequence starts in
+ * the text, database records, mixed sequence flags, first posting of
+ * each k-mer, postings. The index is ignored when an .sdx file changed
+ * since it was built.
+ */
+
+#define KMERIDX_MAGIC     "ECOKDX02"
+#define KMERIDX_EXPANSION (256)			/* k-mers looked up for a seed */
+
+#define KMERIDX_OTHER     (4)			/* code of other letters */
+#define KMERIDX_SEP       (5)			/* sequence separator */
+
+#define IS_UPPER(c) (((c) >= 'A') && ((c) <= 'Z'))
+
+typedef struct {
+	char     magic[8];
+	int32_t  k;
+	int32_t  length;
+	int32_t  sequences;
+	int32_t  records;
+} ecokmeridxhead_t;
+
+#define KMERIDX_HEAD_INTS ((sizeof(ecokmeridxhead_t) - \
+                            offsetof(ecokmeridxhead_t,k)) / sizeof(int32_t))
+
+typedef struct {
+	int32_t  file_index;
+	int32_t  offset_hi;
+	int32_t  offset_lo;
+	int32_t  text;
+} ecokmerrecordformat_t;
+
+static int32_t seed_kmers(ecokmeridx_t *index,PatternPtr pattern,int32_t offset,
+		                  int32_t *kmers,int32_t *postings);
+static int     compare_hits(const void *h1,const void *h2);
+
+
+/**
+ * Build the k-mer index of a database
+ * @param	prefix	database name, the index is written in prefix.kdx
+ * @param	k		indexed k-mer length
+ *
+ * @return	the number of indexed k-mers
+ */
+int32_t build_kmeridx(const char *prefix,int32_t k)
+{
+	ecokmeridxhead_t      head;
+	ecokmerrecordformat_t *record   = NULL;
+	ecofilestamp_t        *stamps;
+	int32_t               stampcount;
+	int32_t               records   = 0;
+	int32_t               rsize     = 0;
+	int32_t               *start    = NULL;
+	int32_t               sequences = 0;
+	int32_t               ssize     = 0;
+	unsigned char         *text     = NULL;
+	int64_t               length    = 0;
+	int64_t               tsize     = 0;
+	uint32_t              *mixed    = NULL;
+	int32_t               *bucket;
+	int32_t               *posting;
+	int32_t               kmers;
+	int32_t               postings;
+	uint32_t              code;
+	uint32_t              mask;
+	int32_t               valid;
+	int32_t               pass;
+	ecoseq_t              *seq;
+	char                  *c;
+	char                  filename[1024];
+	FILE                  *f;
+	long                  offset;
+	int32_t               i;
+
+	if (k < KMERIDX_MIN_K || k > KMERIDX_MAX_K)
+		ECOERROR(ECO_ASSERT_ERROR,"Bad k-mer length");
+
+	memset(&head,0,sizeof(ecokmeridxhead_t));
+
+	/* stamped first : a file changed while it is read is out of date */
+	stamps = database_stamps(prefix,0,&stampcount);
+
+	/* concatenate the distinct sequences */
+
+	seq = ecoseq_iterator(prefix);
+
+	while (seq)
+	{
+		if (records == rsize)
+		{
+			rsize = rsize ? rsize * 2 : 4096;
+			if (record)
+				record = ECOREALLOC(record,sizeof(ecokmerrecordformat_t) * rsize,
+				                    "Increase k-mer index record table");
+			else
+				record = ECOMALLOC(sizeof(ecokmerrecordformat_t) * rsize,
+				                   "Allocate k-mer index record table");
+		}
+
+		if (!seq->duplicate || !sequences)
+		{
+			if (sequences + 1 >= ssize)
+			{
+				ssize = ssize ? ssize * 2 : 4096;
+				if (start)
+				{
+					start = ECOREALLOC(start,sizeof(int32_t) * ssize,
+					                   "Increase k-mer index sequence table");
+					mixed = ECOREALLOC(mixed,sizeof(uint32_t) * (ssize / 32),
+					                   "Increase mixed sequence flags");
+					memset(mixed + ssize / 64,0,sizeof(uint32_t) * (ssize / 64));
+				}
+				else
+				{
+					start = ECOMALLOC(sizeof(int32_t) * ssize,
+					                  "Allocate k-mer index sequence table");
+					mixed = ECOMALLOC(sizeof(uint32_t) * (ssize / 32),
+					                  "Allocate mixed sequence flags");
+				}
+			}
+
+			if (length + seq->SQ_length + 1 > KMERIDX_MAX_LENGTH)
+			{
+				fprintf(stderr,"# A k-mer index holds at most %d bases\n",KMERIDX_MAX_LENGTH);
+				ECOERROR(ECO_ASSERT_ERROR,"Database too large for a k-mer index");
+			}
+
+			if (length + seq->SQ_length + 1 > tsize)
+			{
+				tsize = (length + seq->SQ_length + 1) * 2;
+				if (tsize > KMERIDX_MAX_LENGTH)
+					tsize = KMERIDX_MAX_LENGTH;
+				if (text)
+					text = ECOREALLOC(text,tsize,"Increase k-mer index text");
+				else
+					text = ECOMALLOC(tsize,"Allocate k-mer index text");
+			}
+
+			start[sequences] = length;
+
+			/* lower case letters are read as A by the apat encoding */
+
+			for (c=seq->SQ; *c; c++)
+				switch (IS_UPPER(*c) ? *c : 'A')
+				{
+				case 'A': text[length++] = 0; break;
+				case 'C': text[length++] = 1; break;
+				case 'G': text[length++] = 2; break;
+				case 'T': text[length++] = 3; break;
+				default :
+					text[length++] = KMERIDX_OTHER;
+					KMERIDX_SET_MIXED(mixed,sequences);
+				}
+
+			text[length++] = KMERIDX_SEP;
+			sequences++;
+		}
+
+		ecoseq_iterator_position(&(record[records].file_index),&offset);
+		record[records].offset_hi = (int32_t)((int64_t)offset >> 32);
+		record[records].offset_lo = (int32_t)((int64_t)offset & 0xFFFFFFFF);
+		record[records].text      = sequences - 1;
+		records++;
+
+		delete_ecoseq(seq);
+		seq = ecoseq_iterator(NULL);
+	}
+
+	if (!sequences)
+		ECOERROR(ECO_ASSERT_ERROR,"Cannot index an empty database");
+
+	start[sequences] = length;
+
+	/*
+	 * postings by counting sort : k-mers are counted by the first
+	 * pass and stored by the second one, in text order
+	 */
+
+	kmers  = 1 << (2 * k);
+	mask   = kmers - 1;
+	bucket = ECOMALLOC(sizeof(int32_t) * (kmers + 1),"Allocate k-mer buckets");
+	posting = NULL;
+
+	for (pass=0; pass < 2; pass++)
+	{
+		for (i=0,code=0,valid=0; i < length; i++)
+		{
+			if (text[i] >= KMERIDX_OTHER)
+			{
+				valid = 0;
+				continue;
+			}
+
+			code = ((code << 2) | text[i]) & mask;
+
+			if (++valid < k)
+				continue;
+
+			if (pass)
+				posting[bucket[code]++] = i - k + 1;
+			else
+				bucket[code+1]++;
+		}
+
+		if (!pass)
+		{
+			for (i=0; i < kmers; i++)
+				bucket[i+1]+=bucket[i];
+			postings = bucket[kmers];
+			posting  = ECOMALLOC(sizeof(int32_t) * ((postings) ? postings:1),
+			                     "Allocate k-mer postings");
+		}
+	}
+
+	/* the second pass moved each bucket start to the next one */
+
+	memmove(bucket+1,bucket,sizeof(int32_t) * kmers);
+	bucket[0] = 0;
+
+	ECOFREE(text,"Free k-mer index text");
+
+	/* write the index */
+
+	memcpy(head.magic,KMERIDX_MAGIC,sizeof(head.magic));
+	head.k         = k;
+	head.length    = length;
+	head.sequences = sequences;
+	head.records   = records;
+
+	snprintf(filename,1024,"%s.kdx",prefix);
+	f = create_ecorecorddb(filename);
+
+	if (is_big_endian())
+		swap_ecoarray(&(head.k),KMERIDX_HEAD_INTS);
+
+	write_ecorecord(f,&head,sizeof(ecokmeridxhead_t));
+	write_ecoarray(f,stamps,sizeof(ecofilestamp_t) * stampcount,1);
+	write_ecoarray(f,start,sizeof(int32_t) * (sequences+1),1);
+	write_ecoarray(f,record,sizeof(ecokmerrecordformat_t) * records,1);
+	write_ecoarray(f,mixed,sizeof(uint32_t) * (sequences / 32 + 1),1);
+	write_ecoarray(f,bucket,sizeof(int32_t) * (kmers + 1),1);
+	write_ecoarray(f,posting,sizeof(int32_t) * postings,1);
+
+	close_ecorecorddb(f,7);
+
+	fprintf(stderr,"# %d sequences, %d distinct, %d %d-mers indexed in %s\n",
+	        records,sequences,postings,k,filename);
+
+	ECOFREE(stamps,"Free database stamps");
+	ECOFREE(record,"Free k-mer index record table");
+	ECOFREE(start,"Free k-mer index sequence table");
+	ECOFREE(mixed,"Free mixed sequence flags");
+	ECOFREE(bucket,"Free k-mer buckets");
+	ECOFREE(posting,"Free k-mer postings");
+
+	return postings;
+}
+
+/**
+ * Read the k-mer index of a database
+ * @param	prefix	database name
+ *
+ * @return	the index, NULL if the database has no k-mer index or if
+ * 			a database file changed since the index was built
+ */
+ecokmeridx_t *read_kmeridx(const char *prefix)
+{
+	ecokmeridx_t          *index;
+	ecokmeridxhead_t      *head;
+	ecokmerrecordformat_t *format;
+	ecofilestamp_t        *stamps;
+	char                  filename[1024];
+	FILE                  *f;
+	int32_t               count;
+	int32_t               size;
+	int32_t               i;
+
+	snprintf(filename,1024,"%s.kdx",prefix);
+	f = open_ecorecorddb(filename,&count,0);
+
+	if (!f)
+		return NULL;
+
+	head = read_ecoarray(f,&size,0);
+
+	if (size != sizeof(ecokmeridxhead_t) ||
+		memcmp(head->magic,KMERIDX_MAGIC,sizeof(head->magic)))
+		ECOERROR(ECO_IO_ERROR,"Not a k-mer index file");
+
+	if (is_big_endian())
+		swap_ecoarray(&(head->k),KMERIDX_HEAD_INTS);
+
+	stamps = read_ecoarray(f,&size,1);
+
+	if (!same_database_stamps(prefix,0,stamps,size / sizeof(ecofilestamp_t)) ||
+		head->records != ecoseq_record_count(prefix))
+	{
+		fprintf(stderr,"# k-mer index %s does not match the database, ignored\n",
+		        filename);
+		ECOFREE(stamps,"Free database stamps");
+		ECOFREE(head,"Free k-mer index header");
+		fclose(f);
+		return NULL;
+	}
+
+	index = ECOMALLOC(sizeof(ecokmeridx_t),"Allocate k-mer index");
+
+	index->k         = head->k;
+	index->length    = head->length;
+	index->sequences = head->sequences;
+	index->records   = head->records;
+
+	ECOFREE(stamps,"Free database stamps");
+	ECOFREE(head,"Free k-mer index header");
+
+	index->start = read_ecoarray(f,&size,1);
+
+	format = read_ecoarray(f,&size,1);
+	index->record = ECOMALLOC(sizeof(ecofmrecord_t) * index->records,
+	                          "Allocate k-mer index records");
+	for (i=0; i < index->records; i++)
+	{
+		index->record[i].file_index = format[i].file_index;
+		index->record[i].offset     = (long)(((int64_t)format[i].offset_hi << 32) |
+		                                     (uint32_t)format[i].offset_lo);
+		index->record[i].text       = format[i].text;
+	}
+	ECOFREE(format,"Free k-mer index record table");
+
+	index->mixed   = read_ecoarray(f,&size,1);
+	index->bucket  = read_ecoarray(f,&size,1);
+	index->posting = read_ecoarray(f,&size,1);
+
+	fclose(f);
+
+	return index;
+}
+
+void delete_kmeridx(ecokmeridx_t *index)
+{
+	ECOFREE(index->start,"Free k-mer index sequence starts");
+	ECOFREE(index->record,"Free k-mer index records");
+	ECOFREE(index->mixed,"Free mixed sequence flags");
+	ECOFREE(index->bucket,"Free k-mer buckets");
+	ECOFREE(index->posting,"Free k-mer postings");
+	ECOFREE(index,"Free k-mer index");
+}
+
+/*
+ * k-mers matching exactly the pattern from offset, and their
+ * total posting count
+ *
+ * returns the k-mer count, -1 when more than KMERIDX_EXPANSION
+ * k-mers match the ambiguous letters of the pattern
+ */
+int32_t seed_kmers(ecokmeridx_t *index,PatternPtr pattern,int32_t offset,
+		           int32_t *kmers,int32_t *postings)
+{
+	int32_t count;
+	int32_t j;
+
+	count     = patternKmers(pattern,offset,index->k,kmers,KMERIDX_EXPANSION);
+	*postings = 0;
+
+	for (j=0; j < count; j++)
+		*postings+= index->bucket[kmers[j]+1] - index->bucket[kmers[j]];
+
+	return count;
+}
+
+int compare_hits(const void *h1,const void *h2)
+{
+	const ecokmerhit_t *a = h1;
+	const ecokmerhit_t *b = h2;
+
+	if (a->text != b->text)
+		return (a->text < b->text) ? -1 : 1;
+
+	return (a->position < b->position) ? -1 : (a->position > b->position);
+}
+
+/**
+ * Look for the candidate positions of a pattern in the indexed
+ * sequences.
+ *
+ * Every position where ManberSub finds the pattern with at most
+ * pattern->maxerr mismatches is a candidate, except on mixed
+ * sequences. Positions are relative to the sequence.
+ *
+ * @param	index	the k-mer index
+ * @param	pattern	pattern looked for, without indels
+ * @param	count	receives the number of candidates
+ *
+ * @return	the candidates sorted by sequence and position, NULL if the
+ * 			pattern is too short for the indexed k-mers
+ */
+ecokmerhit_t *search_kmeridx(ecokmeridx_t *index,PatternPtr pattern,int32_t *count)
+{
+	ecokmerhit_t *hits = NULL;
+	int32_t      size  = 0;
+	int32_t      kmers[KMERIDX_EXPANSION];
+	int32_t      best[KMERIDX_EXPANSION];
+	int32_t      seeds;
+	int32_t      postings;
+	int32_t      cost;
+	int32_t      offset;
+	int32_t      pieces;
+	int32_t      piece;
+	int32_t      first;
+	int32_t      last;
+	int32_t      candidate;
+	int32_t      position;
+	int32_t      low;
+	int32_t      high;
+	int32_t      middle;
+	int32_t      p;
+	int32_t      o;
+	int32_t      i;
+	int32_t      j;
+
+	if (pattern->hasIndel)
+		ECOERROR(ECO_ASSERT_ERROR,"k-mer index search does not handle indels");
+
+	*count = 0;
+	pieces = pattern->maxerr + 1;
+	piece  = pattern->patlen / pieces;
+
+	if (piece < index->k)
+		return NULL;
+
+	for (p=0; p < pieces; p++)
+	{
+		/* the seed of a piece is its k-mer with the fewest postings */
+
+		first = p * piece;
+		last  = (p == pieces - 1) ? pattern->patlen : first + piece;
+
+		for (o=first,offset=-1,seeds=0,cost=0; o + index->k <= last; o++)
+		{
+			i = seed_kmers(index,pattern,o,kmers,&postings);
+
+			if (i >= 0 && (offset < 0 || postings < cost))
+			{
+				offset = o;
+				seeds  = i;
+				cost   = postings;
+				memcpy(best,kmers,sizeof(int32_t) * i);
+			}
+		}
+
+		if (offset < 0)
+		{
+			if (hits)
+				ECOFREE(hits,"Free k-mer index candidates");
+			*count = 0;
+			return NULL;
+		}
+
+		if (*count + cost > size)
+		{
+			size = (*count + cost) * 2;
+			if (hits)
+				hits = ECOREALLOC(hits,sizeof(ecokmerhit_t) * size,
+				                  "Increase k-mer index candidates");
+			else
+				hits = ECOMALLOC(sizeof(ecokmerhit_t) * size,
+				                 "Allocate k-mer index candidates");
+		}
+
+		for (i=0; i < seeds; i++)
+			for (j=index->bucket[best[i]]; j < index->bucket[best[i]+1]; j++)
+			{
+				position  = index->posting[j];
+				candidate = position - offset;
+
+				low  = 0;
+				high = index->sequences;
+
+				while (high - low > 1)
+				{
+					middle = (low + high) / 2;
+					if (index->start[middle] <= position)
+						low = middle;
+					else
+						high = middle;
+				}
+
+				candidate-= index->start[low];
+
+				if (candidate >= 0 &&
+					index->start[low] + candidate + pattern->patlen < index->start[low+1])
+				{
+					hits[*count].text     = low;
+					hits[*count].position = candidate;
+					(*count)++;
+				}
+			}
+	}
+
+	if (!hits)
+		hits = ECOMALLOC(sizeof(ecokmerhit_t),"Allocate k-mer index candidates");
+
+	/* a position found by several seeds is kept once */
+
+	if (*count)
+	{
+		qsort(hits,*count,sizeof(ecokmerhit_t),compare_hits);
+
+		for (i=1,j=1; i < *count; i++)
+			if (compare_hits(hits+i,hits+j-1))
+				hits[j++] = hits[i];
+
+		*count = j;
+	}
+
+	return hits;
+}
+
+#undef IS_UPPER
@@ -0,0 +1,594 @@
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <zlib.h>
+#include <sys/stat.h>
+
+/*
+ * Database manifest (.mdx) : a text file listing the files of a
+ * database with the version of the database where they appeared or
+ * last changed, their record count, their size and the crc32 of
+ * their content.
+ *
+ *   #@ecopcr-manifest-v1
+ *   # version file records bytes crc32
+ *   1 gbmam_001.sdx 52341 81220311 5d1e07aa
+ *   1 gbmam_002.sdx 49870 79415220 0c36f1d2
+ *   2 gbmam_003.sdx 1204 2044716 9ab3ee10
+ *   2 gbmam.ldx 12 640 11f0e2c4
+ *
+ * Lines are only appended : each update of the database adds the
+ * lines of its new or changed files with the next version number,
+ * the last line of a file tells its current state. File names are
+ * relative to the directory of the database.
+ */
+
+#define MANIFEST_MAGIC "#@ecopcr-manifest-v1"
+
+#ifdef __APPLE__
+#define MTIME_NS(st) ((st).st_mtimespec.tv_nsec)
+#else
+#define MTIME_NS(st) ((st).st_mtim.tv_nsec)
+#endif
+
+static char    *manifest_name(const char *prefix);
+static const char *base_name(const char *prefix);
+static int32_t manifest_changed(ecomanifestentry_t *entry,int32_t records,
+		                        int64_t size,uint32_t digest);
+static void    file_stamp(const char *filename,ecofilestamp_t *stamp);
+
+typedef struct {
+	uint32_t      h[5];
+	uint64_t      length;		/* bytes hashed */
+	unsigned char block[64];
+	int32_t       used;			/* bytes waiting in block */
+} sha1_t;
+
+static void    sha1_init(sha1_t *sha1);
+static void    sha1_update(sha1_t *sha1,const unsigned char *data,size_t length);
+static void    sha1_block(sha1_t *sha1,const unsigned char *block);
+static void    sha1_final(sha1_t *sha1,unsigned char *digest);
+
+
+char *manifest_name(const char *prefix)
+{
+	char *filename;
+
+	filename = ECOMALLOC(strlen(prefix)+5,"Allocate filename");
+	sprintf(filename,"%s.mdx",prefix);
+
+	return filename;
+}
+
+const char *base_name(const char *prefix)
+{
+	const char *base = strrchr(prefix,'/');
+
+	return (base) ? base+1 : prefix;
+}
+
+int32_t manifest_changed(ecomanifestentry_t *entry,int32_t records,
+		                 int64_t size,uint32_t digest)
+{
+	return !entry->version        ||
+	       entry->records != records ||
+	       entry->size    != size    ||
+	       entry->digest  != digest;
+}
+
+/**
+ * crc32 of a file content
+ * @param	filename	the file
+ * @param	size		set to the file size, -1 if it cannot be read
+ *
+ * @return	the crc32, 0 if the file cannot be read
+ */
+uint32_t file_digest(const char *filename,int64_t *size)
+{
+	static unsigned char buffer[1024*1024];
+	uint32_t crc = crc32(0L,Z_NULL,0);
+	size_t   read;
+	FILE     *f;
+
+	*size = -1;
+	f = fopen(filename,"r");
+
+	if (!f)
+		return 0;
+
+	*size = 0;
+
+	while ((read = fread(buffer,1,sizeof(buffer),f)) > 0)
+	{
+		crc = crc32(crc,buffer,read);
+		*size += read;
+	}
+
+	if (ferror(f))
+		ECOERROR(ECO_IO_ERROR,"Cannot read a database file");
+
+	fclose(f);
+
+	return crc;
+}
+
+#define ROTATE(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+void sha1_init(sha1_t *sha1)
+{
+	sha1->h[0]   = 0x67452301;
+	sha1->h[1]   = 0xEFCDAB89;
+	sha1->h[2]   = 0x98BADCFE;
+	sha1->h[3]   = 0x10325476;
+	sha1->h[4]   = 0xC3D2E1F0;
+	sha1->length = 0;
+	sha1->used   = 0;
+}
+
+void sha1_block(sha1_t *sha1,const unsigned char *block)
+{
+	uint32_t w[80];
+	uint32_t a,b,c,d,e,f,k,t;
+	int32_t  i;
+
+	for (i=0; i < 16; i++)
+		w[i] = ((uint32_t)block[4*i] << 24) | ((uint32_t)block[4*i+1] << 16) |
+		       ((uint32_t)block[4*i+2] << 8) | block[4*i+3];
+
+	for (; i < 80; i++)
+		w[i] = ROTATE(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16],1);
+
+	a = sha1->h[0];
+	b = sha1->h[1];
+	c = sha1->h[2];
+	d = sha1->h[3];
+	e = sha1->h[4];
+
+	for (i=0; i < 80; i++)
+	{
+		if (i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if (i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if (i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+
+		t = ROTATE(a,5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROTATE(b,30);
+		b = a;
+		a = t;
+	}
+
+	sha1->h[0] += a;
+	sha1->h[1] += b;
+	sha1->h[2] += c;
+	sha1->h[3] += d;
+	sha1->h[4] += e;
+}
+
+void sha1_update(sha1_t *sha1,const unsigned char *data,size_t length)
+{
+	size_t n;
+
+	sha1->length += length;
+
+	while (length)
+	{
+		n = 64 - sha1->used;
+		if (n > length)
+			n = length;
+
+		memcpy(sha1->block + sha1->used,data,n);
+		sha1->used += n;
+		data       += n;
+		length     -= n;
+
+		if (sha1->used == 64)
+		{
+			sha1_block(sha1,sha1->block);
+			sha1->used = 0;
+		}
+	}
+}
+
+void sha1_final(sha1_t *sha1,unsigned char *digest)
+{
+	uint64_t bits = sha1->length * 8;
+	int32_t  i;
+
+	sha1->block[sha1->used++] = 0x80;
+
+	if (sha1->used > 56)
+	{
+		memset(sha1->block + sha1->used,0,64 - sha1->used);
+		sha1_block(sha1,sha1->block);
+		sha1->used = 0;
+	}
+
+	memset(sha1->block + sha1->used,0,56 - sha1->used);
+
+	for (i=0; i < 8; i++)
+		sha1->block[56+i] = (unsigned char)(bits >> (56 - 8*i));
+
+	sha1_block(sha1,sha1->block);
+
+	for (i=0; i < 20; i++)
+		digest[i] = (unsigned char)(sha1->h[i/4] >> (24 - 8*(i%4)));
+}
+
+/**
+ * SHA-1 of a file content, identifying the file where a crc32 only
+ * detects errors
+ * @param	filename	the file
+ * @param	size		set to the file size, -1 if it cannot be read
+ * @param	hash		set to the 40 hexadecimal digits of the SHA-1,
+ * 						"none" if the file cannot be read
+ */
+void file_hash(const char *filename,int64_t *size,char *hash)
+{
+	static unsigned char buffer[1024*1024];
+	unsigned char digest[20];
+	sha1_t        sha1;
+	size_t        read;
+	int32_t       i;
+	FILE          *f;
+
+	*size = -1;
+	f = fopen(filename,"r");
+
+	if (!f)
+	{
+		strcpy(hash,"none");
+		return;
+	}
+
+	*size = 0;
+	sha1_init(&sha1);
+
+	while ((read = fread(buffer,1,sizeof(buffer),f)) > 0)
+	{
+		sha1_update(&sha1,buffer,read);
+		*size += read;
+	}
+
+	if (ferror(f))
+		ECOERROR(ECO_IO_ERROR,"Cannot read a database file");
+
+	fclose(f);
+
+	sha1_final(&sha1,digest);
+
+	for (i=0; i < 20; i++)
+		sprintf(hash + 2*i,"%02x",digest[i]);
+}
+
+/**
+ * Read the manifest of a database
+ * @param	prefix	name of the database (radical without extension)
+ *
+ * @return	the manifest, NULL if the database has none
+ */
+ecomanifest_t *read_manifest(const char *prefix)
+{
+	ecomanifest_t      *manifest;
+	ecomanifestentry_t entry;
+	char               *filename;
+	const char         *base;
+	char               line[2048];
+	char               name[1024];
+	long long          size;
+	int32_t            baselength;
+	int32_t            index;
+	int32_t            end;
+	FILE               *f;
+
+	filename = manifest_name(prefix);
+	f = fopen(filename,"r");
+	ECOFREE(filename,"Free filename");
+
+	if (!f)
+		return NULL;
+
+	if (!fgets(line,sizeof(line),f) || strncmp(line,MANIFEST_MAGIC,strlen(MANIFEST_MAGIC)))
+		ECOERROR(ECO_IO_ERROR,"Not a database manifest");
+
+	manifest = ECOMALLOC(sizeof(ecomanifest_t),"Allocate manifest");
+	manifest->shard = ECOMALLOC(sizeof(ecomanifestentry_t),"Allocate manifest");
+
+	base       = base_name(prefix);
+	baselength = strlen(base);
+
+	while (fgets(line,sizeof(line),f))
+	{
+		if (*line=='#' || *line=='\n')
+			continue;
+
+		if (sscanf(line,"%d %1023s %d %lld %x",
+		           &entry.version,name,&entry.records,&size,&entry.digest) != 5 ||
+		    entry.version < 1)
+			ECOERROR(ECO_IO_ERROR,"Bad line in the database manifest");
+
+		entry.size = size;
+
+		if (entry.version > manifest->version)
+			manifest->version = entry.version;
+
+		if (strncmp(name,base,baselength))
+			continue;
+
+		end = 0;
+
+		if (!strcmp(name+baselength,".ldx"))
+			manifest->local = entry;
+		else if (sscanf(name+baselength,"_%d.sdx%n",&index,&end) == 1 &&
+		         !name[baselength+end] && index > 0)
+		{
+			if (index > manifest->count)
+			{
+				manifest->shard = ECOREALLOC(manifest->shard,
+				                             sizeof(ecomanifestentry_t) * (index+1),
+				                             "Grow manifest");
+				memset(manifest->shard + manifest->count + 1,0,
+				       sizeof(ecomanifestentry_t) * (index - manifest->count));
+				manifest->count = index;
+			}
+			manifest->shard[index] = entry;
+		}
+	}
+
+	fclose(f);
+
+	return manifest;
+}
+
+/**
+ * Add to the manifest of a database the lines of its new or changed
+ * files, under a new version. The manifest is created if needed.
+ * @param	prefix	name of the database (radical without extension)
+ *
+ * @return	the current version of the database
+ */
+int32_t update_manifest(const char *prefix)
+{
+	ecomanifest_t      *manifest;
+	ecomanifestentry_t none;
+	ecomanifestentry_t *entry;
+	char               *filename;
+	char               datafile[1024];
+	const char         *base;
+	int32_t            version;
+	int32_t            records;
+	int32_t            count;
+	int32_t            changed = 0;
+	int64_t            size;
+	uint32_t           digest;
+	int32_t            i;
+	FILE               *f;
+	FILE               *data;
+
+	manifest = read_manifest(prefix);
+	version  = (manifest) ? manifest->version + 1 : 1;
+	base     = base_name(prefix);
+
+	filename = manifest_name(prefix);
+	f = fopen(filename,"a");
+
+	if (!f)
+		ECOERROR(ECO_IO_ERROR,"Cannot open the database manifest");
+
+	if (!manifest &&
+		fprintf(f,"%s\n# version file records bytes crc32\n",MANIFEST_MAGIC) < 0)
+		ECOERROR(ECO_IO_ERROR,"Cannot write the database manifest");
+
+	memset(&none,0,sizeof(none));
+	count = ecoseq_file_count(prefix);
+
+	/* the .ldx file is looked at last, i == count + 1 */
+	for (i=1; i <= count + 1; i++)
+	{
+		if (i <= count)
+		{
+			snprintf(datafile,1024,"%s_%03d.sdx",prefix,i);
+			entry = (manifest && i <= manifest->count) ? manifest->shard + i : &none;
+		}
+		else
+		{
+			snprintf(datafile,1024,"%s.ldx",prefix);
+			entry = (manifest) ? &(manifest->local) : &none;
+		}
+
+		data = open_ecorecorddb(datafile,&records,0);
+
+		if (!data)
+			continue;
+
+		fclose(data);
+		digest = file_digest(datafile,&size);
+
+		if (!manifest_changed(entry,records,size,digest))
+			continue;
+
+		if (entry->version)
+			fprintf(stderr,"# %s changed since version %d\n",datafile,entry->version);
+
+		if (fprintf(f,"%d %s%s %d %lld %08x\n",
+		            version,base,datafile+strlen(prefix),records,(long long)size,digest) < 0)
+			ECOERROR(ECO_IO_ERROR,"Cannot write the database manifest");
+
+		changed++;
+	}
+
+	if (fclose(f))
+		ECOERROR(ECO_IO_ERROR,"Cannot write the database manifest");
+
+	if (!changed)
+		version--;
+
+	fprintf(stderr,"# %d files added to the manifest %s, database version %d\n",
+			changed,filename,version);
+
+	ECOFREE(filename,"Free filename");
+	delete_manifest(manifest);
+
+	return version;
+}
+
+/**
+ * Check the .sdx files of a database against its manifest : every
+ * file must be listed, with its current size. The files listed up to
+ * the given version, left out of a run as unchanged, must also have
+ * their crc32 : a file rewritten with the same size is caught.
+ * @param	manifest	the manifest of the database
+ * @param	prefix		name of the database (radical without extension)
+ * @param	since		files listed up to this version are checked by
+ * 						their content
+ *
+ * @return	the number of .sdx files
+ */
+int32_t check_manifest(ecomanifest_t *manifest,const char *prefix,int32_t since)
+{
+	char    filename[1024];
+	int32_t count;
+	int64_t size;
+	int64_t digestsize;
+	FILE    *f;
+	int32_t i;
+
+	count = ecoseq_file_count(prefix);
+
+	for (i=1; i <= count; i++)
+	{
+		snprintf(filename,1024,"%s_%03d.sdx",prefix,i);
+
+		f = fopen(filename,"r");
+		if (!f || fseek(f,0,SEEK_END))
+			ECOERROR(ECO_IO_ERROR,"Cannot read a database file");
+		size = ftell(f);
+		fclose(f);
+
+		if (i > manifest->count || !manifest->shard[i].version ||
+			manifest->shard[i].size != size ||
+			(manifest->shard[i].version <= since &&
+			 (file_digest(filename,&digestsize) != manifest->shard[i].digest ||
+			  digestsize != size)))
+		{
+			fprintf(stderr,"# %s is not the file of the manifest, update it with ecoindex -M\n",
+					filename);
+			ECOERROR(ECO_IO_ERROR,"Database manifest is out of date");
+		}
+	}
+
+	return count;
+}
+
+/*
+ * size and modification time of a file
+ */
+void file_stamp(const char *filename,ecofilestamp_t *stamp)
+{
+	struct stat st;
+
+	memset(stamp,0,sizeof(ecofilestamp_t));
+
+	if (stat(filename,&st))
+	{
+		stamp->size_hi = stamp->size_lo = -1;
+		return;
+	}
+
+	stamp->size_hi  = (int32_t)((int64_t)st.st_size >> 32);
+	stamp->size_lo  = (int32_t)st.st_size;
+	stamp->mtime_hi = (int32_t)((int64_t)st.st_mtime >> 32);
+	stamp->mtime_lo = (int32_t)st.st_mtime;
+	stamp->mtime_ns = MTIME_NS(st);
+}
+
+/**
+ * Stamp the files of a database : the size and modification time of
+ * its .sdx files, then of its .tdx, .rdx and .ldx files. An index
+ * built from the database keeps them, and is out of date when they
+ * change.
+ * @param	prefix		name of the database (radical without extension)
+ * @param	taxonomy	if set, the taxonomy files are stamped too
+ * @param	count		set to the number of stamps
+ *
+ * @return	the stamps
+ */
+ecofilestamp_t *database_stamps(const char *prefix,int32_t taxonomy,int32_t *count)
+{
+	static const char *taxfiles[] = {"tdx","rdx","ldx"};
+	ecofilestamp_t *stamps;
+	char           filename[1024];
+	int32_t        shards;
+	int32_t        i;
+
+	shards = ecoseq_file_count(prefix);
+	*count = shards + ((taxonomy) ? 3:0);
+
+	stamps = ECOMALLOC(sizeof(ecofilestamp_t) * (*count + 1),"Allocate database stamps");
+
+	for (i=0; i < *count; i++)
+	{
+		if (i < shards)
+			snprintf(filename,1024,"%s_%03d.sdx",prefix,i+1);
+		else
+			snprintf(filename,1024,"%s.%s",prefix,taxfiles[i-shards]);
+
+		file_stamp(filename,stamps+i);
+	}
+
+	return stamps;
+}
+
+/**
+ * Check the files of a database against the stamps taken when an
+ * index was built
+ * @param	prefix		name of the database (radical without extension)
+ * @param	taxonomy	if set, the stamps cover the taxonomy files
+ * @param	stamps		stamps of the index, from database_stamps
+ * @param	count		number of stamps
+ *
+ * @return	1 if no file changed since, 0 otherwise
+ */
+int32_t same_database_stamps(const char *prefix,int32_t taxonomy,
+		                     const ecofilestamp_t *stamps,int32_t count)
+{
+	ecofilestamp_t *current;
+	int32_t        currentcount;
+	int32_t        same;
+
+	current = database_stamps(prefix,taxonomy,&currentcount);
+
+	same = currentcount == count &&
+	       !memcmp(current,stamps,sizeof(ecofilestamp_t) * count);
+
+	ECOFREE(current,"Free database stamps");
+
+	return same;
+}
+
+void delete_manifest(ecomanifest_t *manifest)
+{
+	if (manifest)
+	{
+		ECOFREE(manifest->shard,"Free manifest");
+		ECOFREE(manifest,"Free manifest");
+	}
+}
@@ -0,0 +1,136 @@
+#include "../libapat/libstki.h"
+#include "../libapat/apat.h"
+
+#include "ecoPCR.h"
+
+/*
+ * Joint scan of the two primers of a pair.
+ *
+ * The Manber bit vectors of both patterns are packed in the two
+ * halves of a 64 bits word : a base of the sequence is read once
+ * and one shift / mask sequence updates the states of both patterns.
+ * A pattern state uses patlen+1 bits, so packing needs patterns
+ * shorter than 32 bases; the bit shifted from the upper half into
+ * the lower one is removed by the masks, which only hold pattern
+ * positions.
+ */
+
+#define LANE_BITS (32)
+
+static Int32 manberPair(SeqPtr seq,
+		                PatternPtr pattern1,int patnum1,int length1,
+		                PatternPtr pattern2,int patnum2,int length2);
+
+/**
+ * Same as two ManberAll calls starting at the sequence start,
+ * each base being read once.
+ *
+ * @param	seq			apat sequence
+ * @param	pattern1	first pattern looked for
+ * @param	patnum1		index of the hit stack receiving its hits
+ * @param	length1		length of the region scanned for it
+ * @param	pattern2	second pattern looked for
+ * @param	patnum2		index of the hit stack receiving its hits
+ * @param	length2		length of the region scanned for it
+ *
+ * @return	the number of hits of the first pattern
+ */
+Int32 ecoManberPair(SeqPtr seq,
+		            PatternPtr pattern1,int patnum1,int length1,
+		            PatternPtr pattern2,int patnum2,int length2)
+{
+	int64_t timer = ecostat_clock();
+	Int32   hits;
+
+	hits = manberPair(seq,pattern1,patnum1,length1,pattern2,patnum2,length2);
+	ecostat_add(ECOSTAT_MANBER,timer,hits + seq->hitpos[patnum2]->top);
+
+	return hits;
+}
+
+Int32 manberPair(SeqPtr seq,
+		         PatternPtr pattern1,int patnum1,int length1,
+		         PatternPtr pattern2,int patnum2,int length2)
+{
+	uint64_t  smat[ALPHA_LEN];
+	uint64_t  r[2 * MAX_PAT_ERR + 4];
+	uint64_t  *pr;
+	uint64_t  mask1, mask2;
+	uint64_t  smask, cmask, hmask, sindx;
+	uint64_t  found, hits;
+	int32_t   end1, end2, end;
+	int32_t   pos;
+	int       e, emax;
+	UInt8     *data;
+	StackiPtr *stkpos1, *stkerr1;
+	StackiPtr *stkpos2, *stkerr2;
+
+	if (pattern1->hasIndel || pattern2->hasIndel ||
+		pattern1->maxerr != pattern2->maxerr ||
+		pattern1->patlen >= LANE_BITS || pattern2->patlen >= LANE_BITS)
+	{
+		ManberAll(seq,pattern2,patnum2,0,length2);
+		return ManberAll(seq,pattern1,patnum1,0,length1);
+	}
+
+	end1 = (length1 < seq->seqlen + seq->circular) ? length1:seq->seqlen + seq->circular;
+	end2 = (length2 < seq->seqlen + seq->circular) ? length2:seq->seqlen + seq->circular;
+	end  = (end1 > end2) ? end1:end2;
+
+	mask1 = ((uint64_t)1 << pattern1->patlen) - 1;
+	mask2 = ((uint64_t)1 << pattern2->patlen) - 1;
+
+	for (e=0; e < ALPHA_LEN; e++)
+		smat[e] =  ((uint64_t)pattern1->smat[e] & mask1)
+		        | (((uint64_t)pattern2->smat[e] & mask2) << LANE_BITS);
+
+	smask =  ((uint64_t)1 << pattern1->patlen)
+	      | (((uint64_t)1 << pattern2->patlen) << LANE_BITS);
+	cmask =  (~(uint64_t)pattern1->omask & mask1)
+	      | ((~(uint64_t)pattern2->omask & mask2) << LANE_BITS);
+	hmask =  (uint64_t)1 | ((uint64_t)1 << LANE_BITS);
+
+	emax = pattern1->maxerr;
+
+	r[0] = r[1] = 0x0;
+
+	for (e = 0, pr = r + 3 ; e <= emax ; e++, pr += 2)
+		*pr = smask;
+
+	data    = seq->data;
+	stkpos1 = seq->hitpos + patnum1;
+	stkerr1 = seq->hiterr + patnum1;
+	stkpos2 = seq->hitpos + patnum2;
+	stkerr2 = seq->hiterr + patnum2;
+
+	for (pos = 0 ; pos < end ; pos++) {
+
+		sindx = smat[*data++];
+
+		for (e = 0, found = 0, pr = r ; e <= emax ; e++, pr += 2) {
+
+			pr[2]  = pr[3] | smask;
+
+			pr[3]  =   ((pr[0] >> 1) & cmask)       /* sub   */
+			         | ((pr[2] >> 1) & sindx);      /* ident */
+
+			hits = pr[3] & hmask & ~found;
+
+			if (hits) {                             /* found */
+				if ((hits & 0x1L) && pos < end1) {
+					PushiIn(stkpos1, pos - pattern1->patlen + 1);
+					PushiIn(stkerr1, e);
+				}
+				if ((hits >> LANE_BITS) && pos < end2) {
+					PushiIn(stkpos2, pos - pattern2->patlen + 1);
+					PushiIn(stkerr2, e);
+				}
+				found |= hits;
+			}
+		}
+	}
+
+	return (*stkpos1)->top;
+}
+
+#undef LANE_BITS
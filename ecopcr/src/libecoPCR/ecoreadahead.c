@@ -0,0 +1,160 @@
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Read-ahead of the database sequences.
+ *
+ * A producer thread reads and uncompresses the sequence records
+ * while the caller scans the previous ones. Sequences are handed
+ * over through a single producer / single consumer ring : the
+ * producer only writes the head index, the consumer only writes
+ * the tail one, so no lock is needed.
+ */
+
+#define READAHEAD_SIZE  (64)			/* ring slots, a power of 2 */
+#define READAHEAD_MASK  (READAHEAD_SIZE - 1)
+#define READAHEAD_SPINS (64)			/* busy waits before sleeping */
+
+typedef struct {
+	ecoseq_t *seq;
+	int32_t  file_index;
+	long     offset;
+} ecoreadslot_t;
+
+static ecoreadslot_t  ring[READAHEAD_SIZE];
+static uint32_t       ring_head    = 0;	/* next slot filled by the producer */
+static uint32_t       ring_tail    = 0;	/* next slot read by the consumer */
+
+static pthread_t      producer;
+static int32_t        running      = 0;
+static char           readahead_prefix[1024];
+static ecoblockidx_t  *readahead_blocks = NULL;
+
+static int32_t        current_file_idx = 0;
+static long           current_offset   = 0;
+
+static void  wait_ring(int32_t *spins);
+static void *readahead_producer(void *unused);
+
+
+void wait_ring(int32_t *spins)
+{
+	struct timespec delay = {0,20000};
+
+	if (++(*spins) > READAHEAD_SPINS)
+		nanosleep(&delay,NULL);
+}
+
+void *readahead_producer(void *unused)
+{
+	ecoseq_t *seq;
+	uint32_t head;
+	int32_t  spins;
+
+	if (readahead_blocks)
+		seq = ecoseq_block_iterator(readahead_prefix,readahead_blocks);
+	else
+		seq = ecoseq_iterator(readahead_prefix);
+
+	head = __atomic_load_n(&ring_head,__ATOMIC_RELAXED);
+
+	for(;;)
+	{
+		spins = 0;
+		while (head - __atomic_load_n(&ring_tail,__ATOMIC_ACQUIRE) == READAHEAD_SIZE)
+			wait_ring(&spins);
+
+		ring[head & READAHEAD_MASK].seq = seq;
+		ecoseq_iterator_position(&(ring[head & READAHEAD_MASK].file_index),
+		                         &(ring[head & READAHEAD_MASK].offset));
+
+		__atomic_store_n(&ring_head,++head,__ATOMIC_RELEASE);
+
+		if (!seq)
+			break;
+
+		if (readahead_blocks)
+			seq = ecoseq_block_iterator(NULL,readahead_blocks);
+		else
+			seq = ecoseq_iterator(NULL);
+	}
+
+	return NULL;
+}
+
+/**
+ * Iterate over the database sequences, reading them ahead
+ * in a separate thread.
+ *
+ * While an iteration runs, no other sequence iterator nor
+ * ecoseq_fetch can be used.
+ *
+ * @param	prefix	name of the database to start a new iteration,
+ * 					NULL to get the next sequence
+ * @param	blocks	if not NULL, only the selected blocks of this
+ * 					block index are read (see ecoseq_block_iterator)
+ *
+ * @return	the next sequence or NULL at the end of the database
+ */
+ecoseq_t *ecoseq_readahead(const char *prefix,ecoblockidx_t *blocks)
+{
+	ecoreadslot_t *slot;
+	ecoseq_t      *seq;
+	uint32_t      tail;
+	int32_t       spins;
+
+	if (prefix)
+	{
+		if (running)
+			ECOERROR(ECO_ASSERT_ERROR,"A read-ahead iteration is already running");
+
+		strncpy(readahead_prefix,prefix,1023);
+		readahead_prefix[1023]=0;
+		readahead_blocks = blocks;
+		ring_head = ring_tail = 0;
+
+		if (pthread_create(&producer,NULL,readahead_producer,NULL))
+			ECOERROR(ECO_ASSERT_ERROR,"Cannot start the read-ahead thread");
+
+		running = 1;
+	}
+
+	if (!running)
+		return NULL;
+
+	tail = __atomic_load_n(&ring_tail,__ATOMIC_RELAXED);
+
+	spins = 0;
+	while (__atomic_load_n(&ring_head,__ATOMIC_ACQUIRE) == tail)
+		wait_ring(&spins);
+
+	slot = ring + (tail & READAHEAD_MASK);
+	seq  = slot->seq;
+	current_file_idx = slot->file_index;
+	current_offset   = slot->offset;
+
+	__atomic_store_n(&ring_tail,tail+1,__ATOMIC_RELEASE);
+
+	if (!seq)
+	{
+		pthread_join(producer,NULL);
+		running = 0;
+	}
+
+	return seq;
+}
+
+/**
+ * Give back the location of the last sequence returned
+ * by ecoseq_readahead
+ * @param	file_index	receives the index of the .sdx file
+ * @param	offset		receives the offset of the record in this file
+ */
+void ecoseq_readahead_position(int32_t *file_index,long *offset)
+{
+	*file_index = current_file_idx;
+	*offset     = current_offset;
+}
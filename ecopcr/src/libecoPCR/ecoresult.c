@@ -0,0 +1,1144 @@
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+
+/*
+ * Binary result files (.edx) are record files, as the database files :
+ * a record count followed by size prefixed records. Each record starts
+ * with its type :
+ *
+ *   'H' : header, primers and run parameters (first record)
+ *   'S' : a sequence holding at least one amplicon (AC, DE, length and
+ *         taxon index). Sequences are numbered in order of appearance.
+ *   'O' : a new oligonucleotide in the oligo dictionary.
+ *   'B' : a block of at most ECORESULT_BLOCK amplicons stored by columns.
+ *
+ * 'S' and 'O' records are always written before the blocks referring
+ * to them. Amplicons made only of IUPAC uppercase letters, possibly
+ * surrounded by the lowercase flanking regions added by -D, are packed
+ * two bases per byte.
+ */
+
+#define ECORESULT_MAGIC "ECORES01"
+#define ECORESULT_BLOCK 4096
+
+#define RECORD_HEADER   'H'
+#define RECORD_SEQUENCE 'S'
+#define RECORD_OLIGO    'O'
+#define RECORD_BLOCK    'B'
+
+static const char sPackAlpha[] = "ACGTRYSWKMBDHVN";
+
+static int32_t packedLength(int32_t length);
+static int32_t packAmplicon(const char *amplicon,int32_t length,
+		                    int32_t *lower_prefix,int32_t *lower_suffix,
+		                    char *packed);
+static void    unpackAmplicon(const char *packed,int32_t length,
+		                      int32_t lower_prefix,int32_t lower_suffix,
+		                      char *amplicon);
+static uint32_t hashOligo(const char *oligo);
+static int32_t oligoIndex(ecoresultfile_t *file,const char *oligo);
+static void    flushBlock(ecoresultfile_t *file);
+static void    readBlock(ecoresultfile_t *file,char *raw);
+
+static char   *appendString(char *p,const char *s,int32_t width,int32_t left);
+static char   *appendInt(char *p,int32_t value,int32_t width);
+static char   *appendFixed2(char *p,double value,int32_t width);
+static void    flushOutputAtExit(void);
+static char   *reserveOutput(FILE *output,int32_t linesize);
+static void    releaseOutput(FILE *output,char *end);
+
+static char   *put_int32(char *p,int32_t value);
+static char   *put_double(char *p,double value);
+static int32_t get_int32(const char *p);
+static double  get_double(const char *p);
+
+/* -------------------------------------------- */
+/* endian independent encoding                  */
+/* -------------------------------------------- */
+
+char *put_int32(char *p,int32_t value)
+{
+	if (is_big_endian())
+		value = swap_int32_t(value);
+	memcpy(p,&value,sizeof(int32_t));
+	return p+sizeof(int32_t);
+}
+
+int32_t get_int32(const char *p)
+{
+	int32_t value;
+
+	memcpy(&value,p,sizeof(int32_t));
+	if (is_big_endian())
+		value = swap_int32_t(value);
+	return value;
+}
+
+char *put_double(char *p,double value)
+{
+	char    *c = (char*)&value;
+	int32_t i;
+
+	if (is_big_endian())
+		for (i=0; i < (int32_t)sizeof(double); i++)
+			p[i] = c[sizeof(double)-1-i];
+	else
+		memcpy(p,c,sizeof(double));
+
+	return p+sizeof(double);
+}
+
+double get_double(const char *p)
+{
+	double  value;
+	char    *c = (char*)&value;
+	int32_t i;
+
+	if (is_big_endian())
+		for (i=0; i < (int32_t)sizeof(double); i++)
+			c[i] = p[sizeof(double)-1-i];
+	else
+		memcpy(c,p,sizeof(double));
+
+	return value;
+}
+
+/* -------------------------------------------- */
+/* amplicon packing                             */
+/* -------------------------------------------- */
+
+int32_t packedLength(int32_t length)
+{
+	return (length+1)/2;
+}
+
+/**
+ * Pack an amplicon two bases per byte.
+ * @return	1 if the amplicon has been packed, 0 if it must be stored as is
+ */
+int32_t packAmplicon(const char *amplicon,int32_t length,
+		             int32_t *lower_prefix,int32_t *lower_suffix,
+		             char *packed)
+{
+	int32_t i;
+	int32_t code;
+	char    *c;
+	char    base;
+
+	for (i=0; i < length && amplicon[i]>='a' && amplicon[i]<='z'; i++);
+	*lower_prefix = i;
+
+	for (i=0; i < length - *lower_prefix &&
+	          amplicon[length-1-i]>='a' && amplicon[length-1-i]<='z'; i++);
+	*lower_suffix = i;
+
+	memset(packed,0xFF,packedLength(length));
+
+	for (i=0; i < length; i++)
+	{
+		base = amplicon[i];
+
+		if (i < *lower_prefix || i >= length - *lower_suffix)
+			base-=32;
+		else if (base < 'A' || base > 'Z')
+			return 0;
+
+		c = strchr(sPackAlpha,base);
+		if (!c || !base)
+			return 0;
+
+		code = c - sPackAlpha;
+
+		if (i & 1)
+			packed[i/2] = (packed[i/2] & 0xF0) | code;
+		else
+			packed[i/2] = (packed[i/2] & 0x0F) | (code << 4);
+	}
+
+	return 1;
+}
+
+void unpackAmplicon(const char *packed,int32_t length,
+		            int32_t lower_prefix,int32_t lower_suffix,
+		            char *amplicon)
+{
+	int32_t i;
+	int32_t code;
+
+	for (i=0; i < length; i++)
+	{
+		code = (i & 1) ? packed[i/2] & 0x0F : (packed[i/2] >> 4) & 0x0F;
+		amplicon[i] = sPackAlpha[code];
+		if (i < lower_prefix || i >= length - lower_suffix)
+			amplicon[i]|=32;
+	}
+
+	amplicon[length]=0;
+}
+
+/* -------------------------------------------- */
+/* writer                                       */
+/* -------------------------------------------- */
+
+/**
+ * Create a binary result file
+ * @param	filename		name of the result file
+ * @param	taxonomy		taxonomy used by the run
+ * @param	primer1			first primer
+ * @param	primer2			second primer
+ * @param	kingdom_mode	kingdom mode used for the text output
+ * @param	error_max		max error count by oligonucleotide
+ * @param	lmin			min amplification length
+ * @param	lmax			max amplification length
+ * @param	delta			flanking nucleotides kept (-D)
+ * @param	circular		circular mode
+ *
+ * @return	a result file structure
+ */
+ecoresultfile_t *create_ecoresult(const char *filename,
+		                          ecotaxonomy_t *taxonomy,
+		                          const char *primer1, const char *primer2,
+		                          int32_t kingdom_mode, int32_t error_max,
+		                          int32_t lmin, int32_t lmax,
+		                          int32_t delta, int32_t circular)
+{
+	ecoresultfile_t *file;
+	char            *record;
+	char            *p;
+	int32_t         l1;
+	int32_t         l2;
+	int32_t         size;
+
+	file = ECOMALLOC(sizeof(ecoresultfile_t),"Allocate result file");
+
+	file->f       = create_ecorecorddb(filename);
+	file->writing = 1;
+
+	l1 = strlen(primer1);
+	l2 = strlen(primer2);
+
+	size  = sizeof(int32_t) * 11 + 8 + l1 + l2;
+	record= ECOMALLOC(size,"Allocate result header");
+
+	p = put_int32(record,RECORD_HEADER);
+	memcpy(p,ECORESULT_MAGIC,8);
+	p+=8;
+	p = put_int32(p,taxonomy->taxons->count);
+	p = put_int32(p,kingdom_mode);
+	p = put_int32(p,error_max);
+	p = put_int32(p,lmin);
+	p = put_int32(p,lmax);
+	p = put_int32(p,delta);
+	p = put_int32(p,circular);
+	p = put_int32(p,l1);
+	p = put_int32(p,l2);
+	memcpy(p,primer1,l1);
+	memcpy(p+l1,primer2,l2);
+
+	write_ecorecord(file->f,record,size);
+	file->recordcount++;
+
+	ECOFREE(record,"Free result header");
+
+	file->head.taxoncount   = taxonomy->taxons->count;
+	file->head.kingdom_mode = kingdom_mode;
+	file->head.error_max    = error_max;
+	file->head.lmin         = lmin;
+	file->head.lmax         = lmax;
+	file->head.delta        = delta;
+	file->head.circular     = circular;
+
+	file->hashsize = 1024;
+	file->hash     = ECOMALLOC(sizeof(int32_t) * file->hashsize,
+	                           "Allocate oligo dictionary hash");
+	memset(file->hash,0xFF,sizeof(int32_t) * file->hashsize);
+
+	file->seqcount = -1;
+
+	return file;
+}
+
+/**
+ * Declare the sequence the next amplicons belong to.
+ * Its description is only written with its first amplicon.
+ */
+void set_ecoresult_sequence(ecoresultfile_t *file,ecoseq_t *seq)
+{
+	file->pending = seq;
+}
+
+uint32_t hashOligo(const char *oligo)
+{
+	uint32_t h = 5381;
+
+	while (*oligo)
+		h = h * 33 + (unsigned char)*(oligo++);
+
+	return h;
+}
+
+/**
+ * Give back the dictionary index of an oligonucleotide, adding it
+ * to the dictionary (and writing its record) if needed.
+ */
+int32_t oligoIndex(ecoresultfile_t *file,const char *oligo)
+{
+	uint32_t h;
+	int32_t  i;
+	int32_t  l;
+	char     *record;
+
+	h = hashOligo(oligo) & (file->hashsize-1);
+
+	while (file->hash[h] >= 0)
+	{
+		if (!strcmp(file->oligos[file->hash[h]],oligo))
+			return file->hash[h];
+		h = (h+1) & (file->hashsize-1);
+	}
+
+	if (file->oligocount >= file->oligosize)
+	{
+		file->oligosize = (file->oligosize) ? file->oligosize * 2 : 256;
+		file->oligos = ECOREALLOC(file->oligos,sizeof(char*) * file->oligosize,
+		                          "Increase oligo dictionary");
+	}
+
+	l = strlen(oligo);
+	file->oligos[file->oligocount] = ECOMALLOC(l+1,"Allocate dictionary oligo");
+	strcpy(file->oligos[file->oligocount],oligo);
+	file->hash[h] = file->oligocount;
+
+	record = ECOMALLOC(2*sizeof(int32_t)+l,"Allocate oligo record");
+	memcpy(put_int32(put_int32(record,RECORD_OLIGO),l),oligo,l);
+	write_ecorecord(file->f,record,2*sizeof(int32_t)+l);
+	file->recordcount++;
+	ECOFREE(record,"Free oligo record");
+
+	/* keep the hash table at most half full */
+
+	if (++file->oligocount * 2 > file->hashsize)
+	{
+		ECOFREE(file->hash,"Free oligo dictionary hash");
+		file->hashsize*=2;
+		file->hash = ECOMALLOC(sizeof(int32_t) * file->hashsize,
+		                       "Allocate oligo dictionary hash");
+		memset(file->hash,0xFF,sizeof(int32_t) * file->hashsize);
+
+		for (i=0; i < file->oligocount; i++)
+		{
+			h = hashOligo(file->oligos[i]) & (file->hashsize-1);
+			while (file->hash[h] >= 0)
+				h = (h+1) & (file->hashsize-1);
+			file->hash[h] = i;
+		}
+	}
+
+	return file->oligocount-1;
+}
+
+/**
+ * Append an amplicon to the result file
+ */
+void write_ecoresult(ecoresultfile_t *file,ecoresult_t *result)
+{
+	ecoseq_t *seq;
+	char     *record;
+	char     *p;
+	int32_t  ac;
+	int32_t  de;
+	int32_t  size;
+	int32_t  length;
+	int32_t  n;
+
+	if (file->pending)
+	{
+		seq = file->pending;
+		ac  = strlen(seq->AC);
+		de  = strlen(seq->DE);
+
+		size  = 5 * sizeof(int32_t) + ac + de;
+		record= ECOMALLOC(size,"Allocate sequence record");
+
+		p = put_int32(record,RECORD_SEQUENCE);
+		p = put_int32(p,result->taxon);
+		p = put_int32(p,seq->SQ_length);
+		p = put_int32(p,ac);
+		p = put_int32(p,de);
+		memcpy(p,seq->AC,ac);
+		memcpy(p+ac,seq->DE,de);
+
+		write_ecorecord(file->f,record,size);
+		file->recordcount++;
+		file->seqcount++;
+
+		ECOFREE(record,"Free sequence record");
+
+		file->pending = NULL;
+	}
+
+	if (!file->block)
+	{
+		file->rowsize = ECORESULT_BLOCK;
+		file->block   = ECOMALLOC(sizeof(ecoresultrow_t) * file->rowsize,
+		                          "Allocate result block");
+	}
+
+	n = file->rowcount;
+	length = strlen(result->amplicon);
+
+	if (file->datasize + length >= file->datalength)
+	{
+		file->datalength = (file->datasize + length) * 2;
+		file->data = ECOREALLOC(file->data,file->datalength,
+		                        "Increase result block data");
+	}
+
+	file->block[n].sequence  = file->seqcount;
+	file->block[n].strand    = result->strand;
+	file->block[n].error1    = result->error1;
+	file->block[n].error2    = result->error2;
+	file->block[n].oligo1    = oligoIndex(file,result->oligo1);
+	file->block[n].oligo2    = oligoIndex(file,result->oligo2);
+	file->block[n].tm1       = result->tm1;
+	file->block[n].tm2       = result->tm2;
+	file->block[n].amplength = result->amplength;
+	file->block[n].length    = length;
+	file->block[n].packed    = packAmplicon(result->amplicon,length,
+	                                        &(file->block[n].lower_prefix),
+	                                        &(file->block[n].lower_suffix),
+	                                        file->data + file->datasize);
+
+	if (file->block[n].packed)
+		file->datasize+=packedLength(length);
+	else
+	{
+		memcpy(file->data + file->datasize,result->amplicon,length);
+		file->datasize+=length;
+	}
+
+	file->rowcount++;
+
+	if (file->rowcount == file->rowsize)
+		flushBlock(file);
+}
+
+/**
+ * Write the current block by columns
+ */
+void flushBlock(ecoresultfile_t *file)
+{
+	char    *record;
+	char    *p;
+	int32_t n;
+	int32_t size;
+	int32_t i;
+
+	n = file->rowcount;
+
+	if (!n)
+		return;
+
+	size   = 3 * sizeof(int32_t)
+	       + n * (7 * sizeof(int32_t) + 2 * sizeof(double) + 4)
+	       + file->datasize;
+	record = ECOMALLOC(size,"Allocate result block record");
+
+	p = put_int32(record,RECORD_BLOCK);
+	p = put_int32(p,n);
+	p = put_int32(p,file->datasize);
+
+	for (i=0; i < n; i++) p = put_int32(p,file->block[i].sequence);
+	for (i=0; i < n; i++) p = put_int32(p,file->block[i].amplength);
+	for (i=0; i < n; i++) p = put_int32(p,file->block[i].oligo1);
+	for (i=0; i < n; i++) p = put_int32(p,file->block[i].oligo2);
+	for (i=0; i < n; i++) p = put_int32(p,file->block[i].length);
+	for (i=0; i < n; i++) p = put_int32(p,file->block[i].lower_prefix);
+	for (i=0; i < n; i++) p = put_int32(p,file->block[i].lower_suffix);
+	for (i=0; i < n; i++) p = put_double(p,file->block[i].tm1);
+	for (i=0; i < n; i++) p = put_double(p,file->block[i].tm2);
+	for (i=0; i < n; i++) *(p++) = file->block[i].strand;
+	for (i=0; i < n; i++) *(p++) = file->block[i].error1;
+	for (i=0; i < n; i++) *(p++) = file->block[i].error2;
+	for (i=0; i < n; i++) *(p++) = file->block[i].packed;
+
+	memcpy(p,file->data,file->datasize);
+
+	write_ecorecord(file->f,record,size);
+	file->recordcount++;
+
+	ECOFREE(record,"Free result block record");
+
+	file->rowcount = 0;
+	file->datasize = 0;
+}
+
+/* -------------------------------------------- */
+/* reader                                       */
+/* -------------------------------------------- */
+
+/**
+ * Check if a file is a binary result file
+ * @param	filename	name of the file
+ *
+ * @return	1 if the file is a binary result file, else 0
+ */
+int32_t is_ecoresult_file(const char *filename)
+{
+	FILE    *f;
+	char    head[3*sizeof(int32_t)+8];
+	int32_t rep = 0;
+
+	if (!filename)
+		return 0;
+
+	f = fopen(filename,"rb");
+
+	if (f)
+	{
+		if (fread(head,1,sizeof(head),f)==sizeof(head))
+			rep = get_int32(head+2*sizeof(int32_t))==RECORD_HEADER &&
+			      !memcmp(head+3*sizeof(int32_t),ECORESULT_MAGIC,8);
+		fclose(f);
+	}
+
+	return rep;
+}
+
+/**
+ * Open a binary result file
+ * @param	filename	name of the result file
+ * @param	taxonomy	taxonomy of the database used to produce the file,
+ * 						may be NULL to skip the consistency check
+ *
+ * @return	a result file structure
+ */
+ecoresultfile_t *open_ecoresult(const char *filename,ecotaxonomy_t *taxonomy)
+{
+	ecoresultfile_t *file;
+	char            *raw;
+	char            *p;
+	int32_t         count;
+	int32_t         rs;
+	int32_t         l1;
+	int32_t         l2;
+
+	file = ECOMALLOC(sizeof(ecoresultfile_t),"Allocate result file");
+
+	file->f = open_ecorecorddb(filename,&count,1);
+
+	raw = read_ecorecord(file->f,&rs);
+
+	if (!raw || get_int32(raw)!=RECORD_HEADER || memcmp(raw+4,ECORESULT_MAGIC,8))
+		ECOERROR(ECO_IO_ERROR,"Not an ecoPCR binary result file");
+
+	p = raw + 4 + 8;
+	file->head.taxoncount  = get_int32(p);  p+=4;
+	file->head.kingdom_mode= get_int32(p);  p+=4;
+	file->head.error_max   = get_int32(p);  p+=4;
+	file->head.lmin        = get_int32(p);  p+=4;
+	file->head.lmax        = get_int32(p);  p+=4;
+	file->head.delta       = get_int32(p);  p+=4;
+	file->head.circular    = get_int32(p);  p+=4;
+	l1                     = get_int32(p);  p+=4;
+	l2                     = get_int32(p);  p+=4;
+
+	file->head.primer1 = ECOMALLOC(l1+1,"Allocate result primer");
+	file->head.primer2 = ECOMALLOC(l2+1,"Allocate result primer");
+	memcpy(file->head.primer1,p,l1);
+	memcpy(file->head.primer2,p+l1,l2);
+
+	if (taxonomy && taxonomy->taxons->count!=file->head.taxoncount)
+		ECOERROR(ECO_ASSERT_ERROR,"Result file was produced with another taxonomy");
+
+	file->seqcount = 0;
+
+	return file;
+}
+
+/**
+ * Decode a block record. Strings are kept in the file structure
+ * since the record buffer is reused by read_ecorecord.
+ */
+void readBlock(ecoresultfile_t *file,char *raw)
+{
+	char    *p;
+	char    *data;
+	int32_t n;
+	int32_t i;
+
+	n = get_int32(raw+4);
+	file->datasize = get_int32(raw+8);
+
+	if (n > file->rowsize)
+	{
+		file->rowsize = n;
+		file->block = ECOREALLOC(file->block,sizeof(ecoresultrow_t) * n,
+		                         "Allocate result block");
+	}
+
+	if (file->datasize > file->datalength)
+	{
+		file->datalength = file->datasize;
+		file->data = ECOREALLOC(file->data,file->datalength,
+		                        "Increase result block data");
+	}
+
+	p = raw + 12;
+	for (i=0; i < n; i++,p+=4) file->block[i].sequence     = get_int32(p);
+	for (i=0; i < n; i++,p+=4) file->block[i].amplength    = get_int32(p);
+	for (i=0; i < n; i++,p+=4) file->block[i].oligo1       = get_int32(p);
+	for (i=0; i < n; i++,p+=4) file->block[i].oligo2       = get_int32(p);
+	for (i=0; i < n; i++,p+=4) file->block[i].length       = get_int32(p);
+	for (i=0; i < n; i++,p+=4) file->block[i].lower_prefix = get_int32(p);
+	for (i=0; i < n; i++,p+=4) file->block[i].lower_suffix = get_int32(p);
+	for (i=0; i < n; i++,p+=8) file->block[i].tm1          = get_double(p);
+	for (i=0; i < n; i++,p+=8) file->block[i].tm2          = get_double(p);
+	for (i=0; i < n; i++)      file->block[i].strand       = *(p++);
+	for (i=0; i < n; i++)      file->block[i].error1       = *(p++);
+	for (i=0; i < n; i++)      file->block[i].error2       = *(p++);
+	for (i=0; i < n; i++)      file->block[i].packed       = *(p++);
+
+	memcpy(file->data,p,file->datasize);
+
+	for (i=0, data=file->data; i < n; i++)
+	{
+		file->block[i].data = data;
+		data+=(file->block[i].packed) ? packedLength(file->block[i].length)
+		                              : file->block[i].length;
+	}
+
+	file->rowcount = n;
+	file->current  = 0;
+}
+
+/**
+ * Read the next amplicon of a binary result file
+ * @param	file	result file returned by open_ecoresult
+ *
+ * @return	the amplicon or NULL at the end of the file. The returned
+ * 			structure is reused by the next call.
+ */
+ecoresult_t *readnext_ecoresult(ecoresultfile_t *file)
+{
+	char           *raw;
+	int32_t        rs;
+	int32_t        type;
+	int32_t        l;
+	ecoresultrow_t *row;
+	ecoresultseq_t *seq;
+	ecoresult_t    *result = &(file->result);
+
+	while (file->current >= file->rowcount)
+	{
+		raw = read_ecorecord(file->f,&rs);
+
+		if (!raw)
+			return NULL;
+
+		type = get_int32(raw);
+
+		switch (type)
+		{
+		case RECORD_SEQUENCE:
+			if (file->seqcount >= file->seqsize)
+			{
+				file->seqsize = (file->seqsize) ? file->seqsize * 2 : 1024;
+				file->sequences = ECOREALLOC(file->sequences,
+				                             sizeof(ecoresultseq_t) * file->seqsize,
+				                             "Increase result sequence table");
+			}
+			seq = file->sequences + file->seqcount;
+			seq->taxon     = get_int32(raw+4);
+			seq->SQ_length = get_int32(raw+8);
+			l              = get_int32(raw+12);
+			seq->AC        = ECOMALLOC(l+1,"Allocate result accession");
+			memcpy(seq->AC,raw+20,l);
+			seq->DE        = ECOMALLOC(get_int32(raw+16)+1,"Allocate result definition");
+			memcpy(seq->DE,raw+20+l,get_int32(raw+16));
+			file->seqcount++;
+			break;
+
+		case RECORD_OLIGO:
+			if (file->oligocount >= file->oligosize)
+			{
+				file->oligosize = (file->oligosize) ? file->oligosize * 2 : 256;
+				file->oligos = ECOREALLOC(file->oligos,sizeof(char*) * file->oligosize,
+				                          "Increase oligo dictionary");
+			}
+			l = get_int32(raw+4);
+			file->oligos[file->oligocount] = ECOMALLOC(l+1,"Allocate dictionary oligo");
+			memcpy(file->oligos[file->oligocount],raw+8,l);
+			file->oligocount++;
+			break;
+
+		case RECORD_BLOCK:
+			readBlock(file,raw);
+			break;
+
+		default:
+			ECOERROR(ECO_IO_ERROR,"Unknown record in result file");
+		}
+	}
+
+	row = file->block + file->current;
+	seq = file->sequences + row->sequence;
+
+	if (row->length >= file->amplicon_size)
+	{
+		file->amplicon_size = row->length+1;
+		file->amplicon = ECOREALLOC(file->amplicon,file->amplicon_size,
+		                            "Increase result amplicon buffer");
+	}
+
+	if (row->packed)
+		unpackAmplicon(row->data,row->length,
+		               row->lower_prefix,row->lower_suffix,
+		               file->amplicon);
+	else
+	{
+		memcpy(file->amplicon,row->data,row->length);
+		file->amplicon[row->length]=0;
+	}
+
+	result->AC        = seq->AC;
+	result->DE        = seq->DE;
+	result->SQ_length = seq->SQ_length;
+	result->taxon     = seq->taxon;
+	result->strand    = row->strand;
+	strcpy(result->oligo1,file->oligos[row->oligo1]);
+	strcpy(result->oligo2,file->oligos[row->oligo2]);
+	result->error1    = row->error1;
+	result->error2    = row->error2;
+	result->tm1       = row->tm1;
+	result->tm2       = row->tm2;
+	result->amplength = row->amplength;
+	result->amplicon  = file->amplicon;
+
+	file->current++;
+
+	return result;
+}
+
+/**
+ * Close a result file. When writing, the pending block is
+ * flushed and the record count updated.
+ */
+int32_t close_ecoresult(ecoresultfile_t *file)
+{
+	int32_t i;
+
+	if (!file)
+		return 1;
+
+	if (file->writing)
+	{
+		flushBlock(file);
+		close_ecorecorddb(file->f,file->recordcount);
+	}
+	else
+	{
+		fclose(file->f);
+
+		for (i=0; i < file->seqcount; i++)
+		{
+			ECOFREE(file->sequences[i].AC,"Free result accession");
+			ECOFREE(file->sequences[i].DE,"Free result definition");
+		}
+
+		ECOFREE(file->head.primer1,"Free result primer");
+		ECOFREE(file->head.primer2,"Free result primer");
+	}
+
+	for (i=0; i < file->oligocount; i++)
+		ECOFREE(file->oligos[i],"Free dictionary oligo");
+
+	ECOFREE(file->oligos,"Free oligo dictionary");
+	ECOFREE(file->hash,"Free oligo dictionary hash");
+	ECOFREE(file->sequences,"Free result sequence table");
+	ECOFREE(file->block,"Free result block");
+	ECOFREE(file->data,"Free result block data");
+	ECOFREE(file->amplicon,"Free result amplicon buffer");
+	ECOFREE(file,"Free result file");
+
+	return 0;
+}
+
+/* -------------------------------------------- */
+/* text output                                  */
+/* -------------------------------------------- */
+
+/*
+ * Result lines are formatted by hand in a large buffer written to
+ * the output file descriptor with write(). The conversions reproduce
+ * exactly the printf formats of the result table.
+ */
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define OUTPUT_LINE_SIZE   512            /* fixed width part of a line */
+
+static char    *sOutputBuffer = NULL;
+static int32_t sOutputSize    = 0;
+static int32_t sOutputUsed    = 0;
+static FILE    *sOutputStream = NULL;
+static FILE    *sOutputCopy   = NULL;		/* see copy_ecoresult */
+
+/**
+ * Append s to p, padded with spaces up to width characters
+ * on the right (left justified) or on the left.
+ */
+char *appendString(char *p,const char *s,int32_t width,int32_t left)
+{
+	int32_t l = strlen(s);
+
+	if (!left)
+		for (;width > l;width--)
+			*(p++)=' ';
+
+	memcpy(p,s,l);
+	p+=l;
+
+	if (left)
+		for (;width > l;width--)
+			*(p++)=' ';
+
+	return p;
+}
+
+/**
+ * Append value as printf("%<width>d") would
+ */
+char *appendInt(char *p,int32_t value,int32_t width)
+{
+	char     digits[12];
+	int32_t  l = 0;
+	uint32_t v = (value < 0) ? -(uint32_t)value : (uint32_t)value;
+
+	do
+	{
+		digits[11-l++] = '0' + v % 10;
+		v/=10;
+	} while (v);
+
+	if (value < 0)
+		digits[11-l++] = '-';
+
+	for (;width > l;width--)
+		*(p++)=' ';
+
+	memcpy(p,digits+12-l,l);
+
+	return p+l;
+}
+
+/**
+ * Append value as printf("%<width>.2f") would. Values too large,
+ * non finite or too close to a rounding tie to be safely rounded
+ * in double precision are left to snprintf.
+ */
+char *appendFixed2(char *p,double value,int32_t width)
+{
+	double   scaled;
+	double   cents;
+	int32_t  l;
+	char     digits[24];
+	uint64_t v;
+
+	scaled = value * 100.0;
+
+	if (!(scaled > -1e15 && scaled < 1e15) ||
+		fabs(scaled - floor(scaled) - 0.5) < 1e-6)
+	{
+		l = snprintf(digits,sizeof(digits),"%*.2f",(int)width,value);
+		memcpy(p,digits,l);
+		return p+l;
+	}
+
+	cents = floor(fabs(scaled) + 0.5);
+	v     = (uint64_t)cents;
+
+	l = 0;
+	digits[23-l++] = '0' + v % 10; v/=10;
+	digits[23-l++] = '0' + v % 10; v/=10;
+	digits[23-l++] = '.';
+	do
+	{
+		digits[23-l++] = '0' + v % 10;
+		v/=10;
+	} while (v);
+
+	if (signbit(value))
+		digits[23-l++] = '-';
+
+	for (;width > l;width--)
+		*(p++)=' ';
+
+	memcpy(p,digits+24-l,l);
+
+	return p+l;
+}
+
+/**
+ * Write the formatted lines pending for output. Must be called
+ * before writing anything else on this stream.
+ */
+void flush_ecoresult(FILE *output)
+{
+	char    *p  = sOutputBuffer;
+	ssize_t done;
+
+	if (!sOutputUsed || output!=sOutputStream)
+		return;
+
+	fflush(output);
+
+	if (sOutputCopy &&
+		fwrite(p,1,sOutputUsed,sOutputCopy) != (size_t)sOutputUsed)
+		ECOERROR(ECO_IO_ERROR,"Cannot write the copy of the results");
+
+	while (sOutputUsed > 0)
+	{
+		done = write(fileno(output),p,sOutputUsed);
+
+		if (done < 0)
+		{
+			if (errno==EINTR)
+				continue;
+			ECOERROR(ECO_IO_ERROR,"Cannot write results");
+		}
+
+		p+=done;
+		sOutputUsed-=done;
+	}
+}
+
+void flushOutputAtExit(void)
+{
+	flush_ecoresult(sOutputStream);
+}
+
+/**
+ * Copy the result lines written from now on to a second file,
+ * as they are flushed to the output. The lines waiting in the
+ * buffer are written before, and not copied.
+ * @param	copy	the copy file, NULL to stop copying
+ */
+void copy_ecoresult(FILE *copy)
+{
+	flush_ecoresult(sOutputStream);
+	sOutputCopy = copy;
+}
+
+/**
+ * Get room for linesize characters in the output buffer
+ * @return	where to append the characters
+ */
+char *reserveOutput(FILE *output,int32_t linesize)
+{
+	if (output!=sOutputStream)
+	{
+		flush_ecoresult(sOutputStream);
+		if (!sOutputStream)
+			atexit(flushOutputAtExit);
+		sOutputStream = output;
+	}
+
+	if (sOutputUsed + linesize > sOutputSize)
+	{
+		flush_ecoresult(output);
+
+		if (linesize > sOutputSize)
+		{
+			sOutputSize = (linesize > OUTPUT_BUFFER_SIZE) ? linesize:OUTPUT_BUFFER_SIZE;
+			if (sOutputBuffer)
+				sOutputBuffer = ECOREALLOC(sOutputBuffer,sOutputSize,
+				                           "Increase result output buffer");
+			else
+				sOutputBuffer = ECOMALLOC(sOutputSize,
+				                          "Allocate result output buffer");
+		}
+	}
+
+	return sOutputBuffer + sOutputUsed;
+}
+
+/**
+ * Validate the characters appended up to end
+ */
+void releaseOutput(FILE *output,char *end)
+{
+	sOutputUsed = end - sOutputBuffer;
+
+	if (sOutputUsed >= OUTPUT_BUFFER_SIZE)
+		flush_ecoresult(output);
+}
+
+/**
+ * Print an amplicon as a line of the ecoPCR result table
+ * @param	output			the output stream
+ * @param	result			the amplicon
+ * @param	taxonomy		the taxonomy of the database
+ * @param	kingdom_mode	print kingdom instead of superkingdom
+ */
+void print_ecoresult(FILE *output,ecoresult_t *result,
+		             ecotaxonomy_t *taxonomy,int32_t kingdom_mode)
+{
+	int32_t  taxid;
+	int32_t  species_taxid;
+	int32_t  genus_taxid;
+	int32_t  family_taxid;
+	int32_t  superkingdom_taxid;
+	char     *rank;
+	char     *scientificName;
+	char     *genus_name;
+	char     *family_name;
+	char     *superkingdom_name;
+
+	ecotx_t  *taxon;
+	ecotx_t  *main_taxon;
+
+	int32_t  linesize;
+	char     *p;
+
+	main_taxon    = &taxonomy->taxons->taxon[result->taxon];
+	taxid         = main_taxon->taxid;
+	scientificName= main_taxon->name;
+	rank          = taxonomy->ranks->label[main_taxon->rank];
+	taxon         = eco_getspecies(main_taxon,taxonomy);
+	if (taxon)
+		{
+			species_taxid = taxon->taxid;
+			scientificName= taxon->name;
+		}
+	else
+		species_taxid = -1;
+
+	taxon         = eco_getgenus((taxon) ? taxon:main_taxon,taxonomy);
+	if (taxon)
+		{
+			genus_taxid = taxon->taxid;
+			genus_name= taxon->name;
+		}
+	else
+		{
+			genus_taxid = -1;
+			genus_name  = "###";
+		}
+
+	taxon         = eco_getfamily((taxon) ? taxon:main_taxon,taxonomy);
+	if (taxon)
+		{
+			family_taxid = taxon->taxid;
+			family_name= taxon->name;
+		}
+	else
+		{
+			family_taxid = -1;
+			family_name  = "###";
+		}
+
+	if (kingdom_mode)
+		taxon         = eco_getkingdom((taxon) ? taxon:main_taxon,taxonomy);
+	else
+		taxon         = eco_getsuperkingdom((taxon) ? taxon:main_taxon,taxonomy);
+
+	if (taxon)
+		{
+			superkingdom_taxid = taxon->taxid;
+			superkingdom_name= taxon->name;
+		}
+	else
+		{
+			superkingdom_taxid = -1;
+			superkingdom_name  = "###";
+		}
+
+	/*
+	 * Same layout as
+	 * "%-15s | %9d | %8d | %-20s | %8d | %-30s | %8d | %-30s | %8d | %-30s | %8d | %-30s |
+	 *  %c | %-32s | %2d | %5.2f | %-32s | %2d | %5.2f | %5d | %s | %s\n"
+	 */
+
+	linesize = OUTPUT_LINE_SIZE
+			 + strlen(result->AC) + strlen(rank)
+			 + strlen(scientificName) + strlen(genus_name)
+			 + strlen(family_name) + strlen(superkingdom_name)
+			 + strlen(result->oligo1) + strlen(result->oligo2)
+			 + strlen(result->amplicon) + strlen(result->DE);
+
+	p = reserveOutput(output,linesize);
+
+	p = appendString(p,result->AC,15,1);
+	p = appendString(p," | ",0,0);
+	p = appendInt(p,result->SQ_length,9);
+	p = appendString(p," | ",0,0);
+	p = appendInt(p,taxid,8);
+	p = appendString(p," | ",0,0);
+	p = appendString(p,rank,20,1);
+	p = appendString(p," | ",0,0);
+	p = appendInt(p,species_taxid,8);
+	p = appendString(p," | ",0,0);
+	p = appendString(p,scientificName,30,1);
+	p = appendString(p," | ",0,0);
+	p = appendInt(p,genus_taxid,8);
+	p = appendString(p," | ",0,0);
+	p = appendString(p,genus_name,30,1);
+	p = appendString(p," | ",0,0);
+	p = appendInt(p,family_taxid,8);
+	p = appendString(p," | ",0,0);
+	p = appendString(p,family_name,30,1);
+	p = appendString(p," | ",0,0);
+	p = appendInt(p,superkingdom_taxid,8);
+	p = appendString(p," | ",0,0);
+	p = appendString(p,superkingdom_name,30,1);
+	p = appendString(p," | ",0,0);
+	*(p++) = result->strand;
+	p = appendString(p," | ",0,0);
+	p = appendString(p,result->oligo1,32,1);
+	p = appendString(p," | ",0,0);
+	p = appendInt(p,result->error1,2);
+	p = appendString(p," | ",0,0);
+	p = appendFixed2(p,result->tm1,5);
+	p = appendString(p," | ",0,0);
+	p = appendString(p,result->oligo2,32,1);
+	p = appendString(p," | ",0,0);
+	p = appendInt(p,result->error2,2);
+	p = appendString(p," | ",0,0);
+	p = appendFixed2(p,result->tm2,5);
+	p = appendString(p," | ",0,0);
+	p = appendInt(p,result->amplength,5);
+	p = appendString(p," | ",0,0);
+	p = appendString(p,result->amplicon,0,0);
+	p = appendString(p," | ",0,0);
+	p = appendString(p,result->DE,0,0);
+	*(p++) = '\n';
+
+	releaseOutput(output,p);
+}
+
+/**
+ * Print an amplicon as a fasta sequence titled by its taxid
+ * @param	output			the output stream
+ * @param	result			the amplicon
+ * @param	taxonomy		the taxonomy of the database
+ */
+void print_ecoresult_fasta(FILE *output,ecoresult_t *result,
+		                   ecotaxonomy_t *taxonomy)
+{
+	char *p;
+
+	p = reserveOutput(output,strlen(result->amplicon) + 16);
+
+	*(p++) = '>';
+	p = appendInt(p,taxonomy->taxons->taxon[result->taxon].taxid,0);
+	*(p++) = '\n';
+	p = appendString(p,result->amplicon,0,0);
+	*(p++) = '\n';
+
+	releaseOutput(output,p);
+}
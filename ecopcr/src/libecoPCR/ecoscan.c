@@ -0,0 +1,82 @@
+#include "../libapat/libstki.h"
+#include "../libapat/apat.h"
+
+#include "ecoPCR.h"
+
+/*
+ * Incremental version of ManberSub, used to scan sequences read by
+ * chunks. The bit vectors are kept in the scanner between two calls,
+ * so a chunk gives the hits that a single scan would have found while
+ * reading it, including those starting in the previous chunks.
+ */
+
+#define IS_UPPER(c) (((c) >= 'A') && ((c) <= 'Z'))
+
+/**
+ * Prepare the scan of a new sequence
+ * @param	scanner		the scanner
+ * @param	pattern		pattern looked for
+ */
+void ecoscanner_init(ecoscanner_t *scanner,PatternPtr pattern)
+{
+	UInt32 *pr;
+	int    e;
+
+	scanner->pattern = pattern;
+	scanner->r[0] = scanner->r[1] = 0x0;
+
+	for (e = 0, pr = scanner->r + 3 ; e <= pattern->maxerr ; e++, pr += 2)
+		*pr = 0x1L << pattern->patlen;
+}
+
+/**
+ * Scan the next chunk of a sequence
+ * @param	scanner		the scanner
+ * @param	data		the chunk, in upper case
+ * @param	length		length of the chunk
+ * @param	position	position of the chunk in the sequence
+ * @param	hitpos		stack receiving the hit positions
+ * @param	hiterr		stack receiving the hit error counts
+ *
+ * @return	the number of hits in the stack
+ */
+Int32 ecoscanner_feed(ecoscanner_t *scanner,const char *data,int32_t length,
+		              int32_t position,StackiPtr *hitpos,StackiPtr *hiterr)
+{
+	PatternPtr pattern = scanner->pattern;
+	int        e, emax, found;
+	int32_t    pos;
+	int32_t    end;
+	UInt32     smask, cmask, sindx;
+	UInt32     *pr;
+
+	emax  = pattern->maxerr;
+	smask = 0x1L << pattern->patlen;
+	cmask = ~ pattern->omask;
+	end   = position + length;
+
+	for (pos = position ; pos < end ; pos++, data++) {
+
+		sindx = pattern->smat[IS_UPPER(*data) ? *data - 'A' : 0x0];
+
+		for (e = found = 0, pr = scanner->r ; e <= emax ; e++, pr += 2) {
+
+			pr[2]  = pr[3] | smask;
+
+			pr[3]  =   ((pr[0] >> 1) & cmask)       /* sub   */
+			         | ((pr[2] >> 1) & sindx);      /* ident */
+
+			if (pr[3] & 0x1L) {                     /* found */
+				if (! found)  {
+					PushiIn(hitpos, pos - pattern->patlen + 1);
+					PushiIn(hiterr, e);
+				}
+				found++;
+			}
+		}
+	}
+
+	return (*hitpos)->top;
+}
+
+#undef IS_UPPER
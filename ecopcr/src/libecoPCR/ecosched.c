@@ -0,0 +1,274 @@
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+ * Work-stealing scheduler running a set of tasks of known costs.
+ *
+ * Tasks are dealt to the threads from the most to the least costly,
+ * each one to the least loaded thread. A thread runs its own tasks
+ * from the most costly one, then steals the least costly tasks left
+ * to the other threads, so the end of a run is made of small tasks.
+ */
+
+typedef struct {
+	pthread_mutex_t lock;
+	int32_t         *task;		/* task indexes, most costly first */
+	int32_t         size;
+	int32_t         head;		/* next task run by the owner */
+	int32_t         tail;		/* end of the deque, stolen first */
+	int64_t         load;
+} ecodeque_t;
+
+typedef struct {
+	int64_t cost;
+	int32_t index;
+} ecotaskcost_t;
+
+struct ecoscheduler {
+	int32_t         threads;
+	pthread_t       *thread;
+	ecodeque_t      *deque;
+	pthread_mutex_t lock;
+	pthread_cond_t  start;
+	pthread_cond_t  done;
+	int32_t         generation;	/* incremented at each run */
+	int32_t         running;	/* helper threads busy with the run */
+	int32_t         stop;
+	ecotask_t       run;
+	void            *context;
+	void            **tasks;
+};
+
+typedef struct {
+	ecoscheduler_t *scheduler;
+	int32_t        index;
+} ecoworker_t;
+
+static void *worker_loop(void *worker);
+static void  work(ecoscheduler_t *scheduler,int32_t index);
+static int   compare_costs(const void *c1,const void *c2);
+
+
+int compare_costs(const void *c1,const void *c2)
+{
+	const ecotaskcost_t *a = c1;
+	const ecotaskcost_t *b = c2;
+
+	if (a->cost != b->cost)
+		return (a->cost > b->cost) ? -1 : 1;
+
+	return a->index - b->index;
+}
+
+void work(ecoscheduler_t *scheduler,int32_t index)
+{
+	ecodeque_t *deque;
+	int32_t    task;
+	int32_t    i;
+
+	for(;;)
+	{
+		task  = -1;
+		deque = scheduler->deque + index;
+
+		pthread_mutex_lock(&(deque->lock));
+		if (deque->head < deque->tail)
+			task = deque->task[deque->head++];
+		pthread_mutex_unlock(&(deque->lock));
+
+		for (i=1; task < 0 && i < scheduler->threads; i++)
+		{
+			deque = scheduler->deque + (index + i) % scheduler->threads;
+
+			pthread_mutex_lock(&(deque->lock));
+			if (deque->head < deque->tail)
+				task = deque->task[--deque->tail];
+			pthread_mutex_unlock(&(deque->lock));
+		}
+
+		if (task < 0)
+			return;
+
+		scheduler->run(scheduler->context,scheduler->tasks[task]);
+	}
+}
+
+void *worker_loop(void *arg)
+{
+	ecoworker_t    *worker    = arg;
+	ecoscheduler_t *scheduler = worker->scheduler;
+	int32_t        generation = 0;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&(scheduler->lock));
+		while (!scheduler->stop && scheduler->generation == generation)
+			pthread_cond_wait(&(scheduler->start),&(scheduler->lock));
+		generation = scheduler->generation;
+		pthread_mutex_unlock(&(scheduler->lock));
+
+		if (scheduler->stop)
+			break;
+
+		work(scheduler,worker->index);
+
+		pthread_mutex_lock(&(scheduler->lock));
+		if (!--scheduler->running)
+			pthread_cond_signal(&(scheduler->done));
+		pthread_mutex_unlock(&(scheduler->lock));
+	}
+
+	ECOFREE(worker,"Free worker");
+
+	return NULL;
+}
+
+/**
+ * Start a scheduler
+ * @param	threads		number of threads running the tasks, including
+ * 						the one calling ecoscheduler_run
+ *
+ * @return	the scheduler
+ */
+ecoscheduler_t *new_ecoscheduler(int32_t threads)
+{
+	ecoscheduler_t *scheduler;
+	ecoworker_t    *worker;
+	int32_t        i;
+
+	if (threads < 1)
+		threads = 1;
+
+	scheduler = ECOMALLOC(sizeof(ecoscheduler_t),"Allocate scheduler");
+	scheduler->threads = threads;
+	scheduler->thread  = ECOMALLOC(sizeof(pthread_t) * threads,
+	                               "Allocate scheduler threads");
+	scheduler->deque   = ECOMALLOC(sizeof(ecodeque_t) * threads,
+	                               "Allocate scheduler deques");
+
+	pthread_mutex_init(&(scheduler->lock),NULL);
+	pthread_cond_init(&(scheduler->start),NULL);
+	pthread_cond_init(&(scheduler->done),NULL);
+
+	for (i=0; i < threads; i++)
+		pthread_mutex_init(&(scheduler->deque[i].lock),NULL);
+
+	for (i=1; i < threads; i++)
+	{
+		worker = ECOMALLOC(sizeof(ecoworker_t),"Allocate worker");
+		worker->scheduler = scheduler;
+		worker->index     = i;
+
+		if (pthread_create(scheduler->thread+i,NULL,worker_loop,worker))
+			ECOERROR(ECO_ASSERT_ERROR,"Cannot start a scheduler thread");
+	}
+
+	return scheduler;
+}
+
+/**
+ * Run a set of tasks and wait for their completion
+ * @param	scheduler	the scheduler
+ * @param	run			function running a task
+ * @param	context		first argument given to run
+ * @param	tasks		second argument given to run, one per task
+ * @param	costs		estimated cost of each task
+ * @param	count		number of tasks
+ */
+void ecoscheduler_run(ecoscheduler_t *scheduler,ecotask_t run,void *context,
+		              void **tasks,int64_t *costs,int32_t count)
+{
+	ecotaskcost_t *order;
+	ecodeque_t    *deque;
+	int32_t       i;
+	int32_t       j;
+	int32_t       best;
+
+	if (!count)
+		return;
+
+	order = ECOMALLOC(sizeof(ecotaskcost_t) * count,"Allocate task order");
+
+	for (i=0; i < count; i++)
+	{
+		order[i].cost  = costs[i];
+		order[i].index = i;
+	}
+
+	qsort(order,count,sizeof(ecotaskcost_t),compare_costs);
+
+	for (i=0; i < scheduler->threads; i++)
+	{
+		deque = scheduler->deque + i;
+
+		if (deque->size < count)
+		{
+			deque->size = count;
+			if (deque->task)
+				deque->task = ECOREALLOC(deque->task,sizeof(int32_t) * count,
+				                         "Increase scheduler deque");
+			else
+				deque->task = ECOMALLOC(sizeof(int32_t) * count,
+				                        "Allocate scheduler deque");
+		}
+
+		deque->head = deque->tail = 0;
+		deque->load = 0;
+	}
+
+	/* most costly tasks first, each one to the least loaded thread */
+
+	for (i=0; i < count; i++)
+	{
+		for (j=1,best=0; j < scheduler->threads; j++)
+			if (scheduler->deque[j].load < scheduler->deque[best].load)
+				best = j;
+
+		deque = scheduler->deque + best;
+		deque->task[deque->tail++] = order[i].index;
+		deque->load += order[i].cost;
+	}
+
+	ECOFREE(order,"Free task order");
+
+	pthread_mutex_lock(&(scheduler->lock));
+	scheduler->run     = run;
+	scheduler->context = context;
+	scheduler->tasks   = tasks;
+	scheduler->running = scheduler->threads - 1;
+	scheduler->generation++;
+	pthread_cond_broadcast(&(scheduler->start));
+	pthread_mutex_unlock(&(scheduler->lock));
+
+	work(scheduler,0);
+
+	pthread_mutex_lock(&(scheduler->lock));
+	while (scheduler->running)
+		pthread_cond_wait(&(scheduler->done),&(scheduler->lock));
+	pthread_mutex_unlock(&(scheduler->lock));
+}
+
+/**
+ * Stop the threads of a scheduler and free it
+ */
+void delete_ecoscheduler(ecoscheduler_t *scheduler)
+{
+	int32_t i;
+
+	pthread_mutex_lock(&(scheduler->lock));
+	scheduler->stop = 1;
+	pthread_cond_broadcast(&(scheduler->start));
+	pthread_mutex_unlock(&(scheduler->lock));
+
+	for (i=1; i < scheduler->threads; i++)
+		pthread_join(scheduler->thread[i],NULL);
+
+	for (i=0; i < scheduler->threads; i++)
+		if (scheduler->deque[i].task)
+			ECOFREE(scheduler->deque[i].task,"Free scheduler deque");
+
+	ECOFREE(scheduler->deque,"Free scheduler deques");
+	ECOFREE(scheduler->thread,"Free scheduler threads");
+	ECOFREE(scheduler,"Free scheduler");
+}
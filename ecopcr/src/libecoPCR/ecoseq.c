@@ -5,8 +5,81 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <stddef.h>
+#include <unistd.h>
 
-static FILE *open_seqfile(const char *prefix,int32_t index);
+static FILE     *open_seqfile(const char *prefix,int32_t index);
+static ecoseq_t *readnext_streamed(FILE *f,long start);
+static int32_t   file_selected(int32_t file_index);
+
+static int32_t iterator_file_idx      = 0;
+static long    iterator_record_offset = 0;
+
+/*
+ * record after which the next iteration started by ecoseq_iterator
+ * resumes (see ecoseq_iterator_resume)
+ */
+static int32_t resume_file_idx        = 0;
+static long    resume_offset          = 0;
+
+/*
+ * .sdx files skipped by ecoseq_iterator (see ecoseq_iterator_skip)
+ */
+static const char *skipped_files      = NULL;
+static int32_t skipped_count          = 0;
+
+/*
+ * last uncompressed sequence, shared with the records of its
+ * other owners in databases formatted with ecoPCRFormat.py -u
+ */
+static char    *last_SQ        = NULL;
+static int32_t last_SQ_size    = 0;
+static FILE    *last_SQ_file   = NULL;
+static long    last_SQ_offset  = -1;
+
+/*
+ * sequences of at least stream_min bases are not loaded by
+ * readnext_ecoseq, their compressed data are inflated by chunks
+ * of STREAM_CHUNK bytes into a sliding window
+ */
+#define STREAM_CHUNK (1 << 20)
+
+struct ecoseqstream {
+	z_stream      z;
+	int           fd;            /* own descriptor of the .sdx file */
+	off_t         offset;        /* next compressed byte to read */
+	int32_t       remaining;     /* compressed bytes not read yet */
+	int32_t       length;        /* sequence bytes already inflated */
+	unsigned char *input;
+	char          *head;         /* first bases of the sequence */
+	int32_t       head_length;
+	char          *window;       /* bases [window_start,window_end[ */
+	int32_t       window_size;
+	int32_t       window_start;
+	int32_t       window_end;
+};
+
+static int32_t stream_min      = 0;
+
+/*
+ * sequences loaded once by ecoseq_preload or attached from the
+ * database image, in database order : the iterators and ecoseq_fetch
+ * give copies of them instead of reading the .sdx files of this
+ * database again
+ */
+typedef struct {
+	int32_t  file_index;
+	long     offset;
+	ecoseq_t seq;
+} ecopreloaded_t;
+
+static char           preload_prefix[1024];
+static ecopreloaded_t *preloaded     = NULL;
+static int32_t        preload_count  = 0;
+
+static int32_t   preloaded_record(const char *prefix,int32_t file_index,long offset);
+static ecoseq_t *preloaded_copy(int32_t record);
+static void      attach_preloaded(const char *prefix);
 
 
 ecoseq_t *new_ecoseq()
@@ -23,6 +96,19 @@ int32_t delete_ecoseq(ecoseq_t * seq)
 
 	if (seq)
 	{
+		if (seq->stream)
+		{
+			if (seq->stream->input)
+			{
+				inflateEnd(&(seq->stream->z));
+				ECOFREE(seq->stream->input,"Free stream input buffer");
+				ECOFREE(seq->stream->head,"Free stream head buffer");
+				ECOFREE(seq->stream->window,"Free stream window");
+			}
+			close(seq->stream->fd);
+			ECOFREE(seq->stream,"Free sequence stream");
+		}
+
 		if (seq->AC)
 			ECOFREE(seq->AC,"Free sequence AC");
 
@@ -89,6 +175,14 @@ FILE *open_ecoseqdb(const char *filename,
 	return open_ecorecorddb(filename,sequencecount,1);
 }
 
+/**
+ * Read the next sequence of a .sdx file.
+ *
+ * A record without compressed data belongs to an other owner
+ * of the sequence stored by a previous record, its sequence is
+ * copied from there. The duplicate flag is set when that sequence
+ * is also the one of the previous record.
+ */
 ecoseq_t *readnext_ecoseq(FILE *f)
 {
 	char     *compressed=NULL;
@@ -100,6 +194,15 @@ ecoseq_t *readnext_ecoseq(FILE *f)
 	int32_t  rs;
 	char *c;
 	int32_t i;
+	long     start;
+	long     here;
+	int32_t  backoffset;
+	int64_t  timer;
+
+	start = ftell(f);
+
+	if (stream_min && (seq = readnext_streamed(f,start)))
+		return seq;
 
 	raw = read_ecorecord(f,&rs);
 
@@ -134,10 +237,42 @@ ecoseq_t *readnext_ecoseq(FILE *f)
     seq->SQ = ECOMALLOC(seqlength+1,
                         "Allocate sequence buffer");
 
+    if (!raw->CSQ_length)
+    {
+    	memcpy(&backoffset,compressed,sizeof(int32_t));
+    	if (is_big_endian())
+    		backoffset = swap_int32_t(backoffset);
+
+    	/*
+    	 * the owner record may be anywhere before : the duplicate
+    	 * flag is only set when it is the last sequence read, the
+    	 * sequence of the previous record
+    	 */
+    	seq->duplicate = (f==last_SQ_file && start - backoffset == last_SQ_offset);
+
+    	if (!seq->duplicate)
+    	{
+    		here = ftell(f);
+    		if (fseek(f,start - backoffset,SEEK_SET))
+    			ECOERROR(ECO_IO_ERROR,"Cannot seek to shared sequence record");
+    		delete_ecoseq(readnext_ecoseq(f));
+    		fseek(f,here,SEEK_SET);
+    	}
+
+    	if (last_SQ_file!=f || last_SQ_offset!=start - backoffset)
+    		ECOERROR(ECO_IO_ERROR,"Bad shared sequence record");
+
+    	memcpy(seq->SQ,last_SQ,seqlength);
+
+    	return seq;
+    }
+
+    timer = ecostat_clock();
     comp_status = uncompress((unsigned char*)seq->SQ,
                              &seqlength,
                              (unsigned char*)compressed,
                              raw->CSQ_length);
+    ecostat_add(ECOSTAT_UNCOMPRESS,timer,seqlength);
 
     if (comp_status != Z_OK)
     	ECOERROR(ECO_IO_ERROR,"I cannot uncompress sequence data");
@@ -145,10 +280,368 @@ ecoseq_t *readnext_ecoseq(FILE *f)
     for (c=seq->SQ,i=0;i<seqlength;c++,i++)
     	*c=toupper(*c);
 
+    if (seqlength >= last_SQ_size)
+    {
+    	last_SQ_size = seqlength+1;
+    	if (last_SQ)
+    		last_SQ = ECOREALLOC(last_SQ,last_SQ_size,
+    		                     "Increase shared sequence buffer");
+    	else
+    		last_SQ = ECOMALLOC(last_SQ_size,
+    		                    "Allocate shared sequence buffer");
+    }
+
+    memcpy(last_SQ,seq->SQ,seqlength);
+    last_SQ_file   = f;
+    last_SQ_offset = start;
+
 
 	return seq;
 }
 
+/**
+ * Sequences of at least min_length bases are no more loaded
+ * by readnext_ecoseq, they have to be read by chunks with
+ * ecoseq_stream_next. 0 (the default) disables streaming.
+ */
+void ecoseq_set_streaming(int32_t min_length)
+{
+	stream_min = min_length;
+}
+
+/**
+ * Read the header of the next record if its sequence has to be
+ * streamed.
+ * @param	f		the .sdx file
+ * @param	start	offset of the record
+ *
+ * @return	the sequence without SQ, or NULL with the file position
+ * 			left unchanged if the record is read as usual
+ */
+ecoseq_t *readnext_streamed(FILE *f,long start)
+{
+	ecoseqformat_t head;
+	ecoseq_t       *seq;
+	int32_t        size;
+	int32_t        target;
+	int32_t        header = offsetof(ecoseqformat_t,data);
+	int32_t        i;
+	long           compressed;
+	int32_t        csq_length;
+	char           *de;
+
+	if (fread(&size,sizeof(int32_t),1,f)!=1 ||
+		fread(&head,header,1,f)!=1)
+	{
+		fseek(f,start,SEEK_SET);
+		return NULL;
+	}
+
+	if (is_big_endian())
+	{
+		size            = swap_int32_t(size);
+		head.CSQ_length = swap_int32_t(head.CSQ_length);
+		head.DE_length  = swap_int32_t(head.DE_length);
+		head.SQ_length  = swap_int32_t(head.SQ_length);
+		head.taxid      = swap_int32_t(head.taxid);
+	}
+
+	if (head.SQ_length < stream_min)
+	{
+		fseek(f,start,SEEK_SET);
+		return NULL;
+	}
+
+	de = ECOMALLOC(head.DE_length+1,"Allocate Sequence definition");
+
+	if (fread(de,1,head.DE_length,f)!=(size_t)head.DE_length)
+		ECOERROR(ECO_IO_ERROR,"Reading record data error");
+
+	compressed = start + sizeof(int32_t) + header + head.DE_length;
+	csq_length = head.CSQ_length;
+
+	if (!csq_length)
+	{
+		/* other owner : stream the data of the shared record */
+
+		if (fread(&target,sizeof(int32_t),1,f)!=1)
+			ECOERROR(ECO_IO_ERROR,"Reading record data error");
+		if (is_big_endian())
+			target = swap_int32_t(target);
+
+		if (fseek(f,start - target + sizeof(int32_t) + offsetof(ecoseqformat_t,DE_length),
+		          SEEK_SET)                                  ||
+			fread(&head.DE_length,sizeof(int32_t),1,f)!=1    ||
+			fseek(f,sizeof(int32_t),SEEK_CUR)                ||
+			fread(&csq_length,sizeof(int32_t),1,f)!=1)
+			ECOERROR(ECO_IO_ERROR,"Cannot read shared sequence record");
+
+		if (is_big_endian())
+		{
+			head.DE_length = swap_int32_t(head.DE_length);
+			csq_length     = swap_int32_t(csq_length);
+		}
+
+		compressed = start - target + sizeof(int32_t) + header + head.DE_length;
+	}
+
+	fseek(f,start + sizeof(int32_t) + size,SEEK_SET);
+
+	seq = new_ecoseq();
+
+	seq->taxid     = head.taxid;
+	seq->SQ_length = head.SQ_length;
+	seq->DE        = de;
+
+	for (i=0; i < (int32_t)sizeof(head.AC) && head.AC[i]; i++);
+	seq->AC = ECOMALLOC(i+1,"Allocate Sequence Accesion number");
+	strncpy(seq->AC,head.AC,i);
+
+	seq->stream = ECOMALLOC(sizeof(struct ecoseqstream),
+	                        "Allocate sequence stream");
+	seq->stream->fd        = dup(fileno(f));
+	seq->stream->offset    = compressed;
+	seq->stream->remaining = csq_length;
+
+	if (seq->stream->fd < 0)
+		ECOERROR(ECO_IO_ERROR,"Cannot open sequence stream");
+
+	return seq;
+}
+
+/**
+ * Prepare the chunked reading of a streamed sequence
+ * @param	seq			a sequence returned with a stream
+ * @param	head_length	number of bases kept from the sequence start,
+ * 						see ecoseq_stream_subsequence
+ */
+void ecoseq_stream_start(ecoseq_t *seq,int32_t head_length)
+{
+	struct ecoseqstream *s = seq->stream;
+
+	if (head_length > seq->SQ_length)
+		head_length = seq->SQ_length;
+
+	s->input       = ECOMALLOC(STREAM_CHUNK,"Allocate stream input buffer");
+	s->head        = ECOMALLOC(head_length+1,"Allocate stream head buffer");
+	s->head_length = head_length;
+	s->window_size = STREAM_CHUNK * 2;
+	s->window      = ECOMALLOC(s->window_size,"Allocate stream window");
+
+	if (inflateInit(&(s->z))!=Z_OK)
+		ECOERROR(ECO_IO_ERROR,"I cannot uncompress sequence data");
+}
+
+/**
+ * Inflate the next chunk of a streamed sequence
+ * @param	seq			a sequence prepared by ecoseq_stream_start
+ * @param	keep_from	bases before this position can be dropped
+ * 						from the window
+ *
+ * @return	the number of new bases, appended at the window end,
+ * 			0 at the end of the sequence
+ */
+int32_t ecoseq_stream_next(ecoseq_t *seq,int32_t keep_from)
+{
+	struct ecoseqstream *s = seq->stream;
+	int32_t             drop;
+	int32_t             chunk;
+	int32_t             read;
+	int32_t             status;
+	char                *c;
+	int32_t             i;
+
+	if (s->length == seq->SQ_length)
+		return 0;
+
+	if (keep_from > s->window_end)
+		keep_from = s->window_end;
+
+	drop = keep_from - s->window_start;
+
+	if (drop > 0)
+	{
+		memmove(s->window,s->window+drop,s->window_end - keep_from);
+		s->window_start = keep_from;
+	}
+
+	chunk = seq->SQ_length - s->length;
+	if (chunk > STREAM_CHUNK)
+		chunk = STREAM_CHUNK;
+
+	if (s->window_end - s->window_start + chunk > s->window_size)
+	{
+		s->window_size = s->window_end - s->window_start + chunk;
+		s->window = ECOREALLOC(s->window,s->window_size,
+		                       "Increase stream window");
+	}
+
+	s->z.next_out  = (unsigned char*)s->window + (s->window_end - s->window_start);
+	s->z.avail_out = chunk;
+
+	while (s->z.avail_out)
+	{
+		if (!s->z.avail_in && s->remaining)
+		{
+			read = (s->remaining < STREAM_CHUNK) ? s->remaining:STREAM_CHUNK;
+
+			if (pread(s->fd,s->input,read,s->offset)!=read)
+				ECOERROR(ECO_IO_ERROR,"Reading record data error");
+
+			s->offset     += read;
+			s->remaining  -= read;
+			s->z.next_in   = s->input;
+			s->z.avail_in  = read;
+		}
+
+		status = inflate(&(s->z),Z_NO_FLUSH);
+
+		if (status == Z_STREAM_END)
+			break;
+
+		if (status != Z_OK)
+			ECOERROR(ECO_IO_ERROR,"I cannot uncompress sequence data");
+	}
+
+	if (s->z.avail_out)
+		ECOERROR(ECO_IO_ERROR,"Truncated sequence data");
+
+	for (c=s->window + (s->window_end - s->window_start),i=0; i < chunk; c++,i++)
+		*c=toupper(*c);
+
+	if (s->length < s->head_length)
+		memcpy(s->head + s->length,
+		       s->window + (s->window_end - s->window_start),
+		       (s->head_length - s->length < chunk) ? s->head_length - s->length:chunk);
+
+	s->window_end += chunk;
+	s->length     += chunk;
+
+	return chunk;
+}
+
+/**
+ * Give access to the bases held by the window of a streamed sequence
+ * @param	seq		the streamed sequence
+ * @param	start	receives the position of the first base of the window
+ * @param	end		receives the position following the last one
+ *
+ * @return	the window data
+ */
+char *ecoseq_stream_window(ecoseq_t *seq,int32_t *start,int32_t *end)
+{
+	*start = seq->stream->window_start;
+	*end   = seq->stream->window_end;
+
+	return seq->stream->window;
+}
+
+/**
+ * Same as getSubSequence for a streamed sequence. The bases have
+ * to be in the window, or, if begin > end, [begin,SQ_length[ has
+ * to be in the window and [0,end[ in the head.
+ */
+char *ecoseq_stream_subsequence(ecoseq_t *seq,int32_t begin,int32_t end)
+{
+	static char         *buffer  = NULL;
+	static int32_t      buffSize = 0;
+	struct ecoseqstream *s = seq->stream;
+	int32_t             length;
+	int32_t             tail;
+
+	tail   = (begin < end) ? end:seq->SQ_length;
+	length = tail - begin + ((begin < end) ? 0:end);
+
+	if (begin < s->window_start || tail > s->window_end ||
+		(begin >= end && end > s->head_length))
+		ECOERROR(ECO_ASSERT_ERROR,"Subsequence is out of the stream window");
+
+	if (length >= buffSize)
+	{
+		buffSize = length+1;
+		if (buffer)
+			buffer=ECOREALLOC(buffer,buffSize,
+			                  "Error in reallocating sub sequence buffer");
+		else
+			buffer=ECOMALLOC(buffSize,
+			                 "Error in allocating sub sequence buffer");
+	}
+
+	memcpy(buffer,s->window + (begin - s->window_start),tail - begin);
+	if (begin >= end)
+		memcpy(buffer + (tail - begin),s->head,end);
+	buffer[length]=0;
+
+	return buffer;
+}
+
+/**
+ * Append a sequence record to a .sdx file
+ * @param	f			file returned by create_ecorecorddb
+ * @param	seq			the sequence, its taxid being a taxon index
+ * @param	backoffset	if not 0, the sequence is the one stored by the
+ * 						record located backoffset bytes before and is
+ * 						not written again
+ */
+void write_ecoseq(FILE *f,ecoseq_t *seq,int32_t backoffset)
+{
+	static char     *buffer = NULL;
+	static int32_t  buffsize= 0;
+	ecoseqformat_t  *raw;
+	int32_t         delength;
+	int32_t         size;
+	uLongf          compressed;
+
+	delength  = strlen(seq->DE);
+	compressed= compressBound(seq->SQ_length);
+	size      = sizeof(ecoseqformat_t) + delength + compressed + sizeof(int32_t);
+
+	if (size > buffsize)
+	{
+		buffsize = size;
+		if (buffer)
+			buffer = ECOREALLOC(buffer,buffsize,"Increase sequence record buffer");
+		else
+			buffer = ECOMALLOC(buffsize,"Allocate sequence record buffer");
+	}
+
+	raw = (ecoseqformat_t*)buffer;
+	memset(raw,0,sizeof(ecoseqformat_t));
+
+	strncpy(raw->AC,seq->AC,sizeof(raw->AC));
+	memcpy(raw->data,seq->DE,delength);
+
+	if (backoffset)
+	{
+		compressed = sizeof(int32_t);
+		if (is_big_endian())
+			backoffset = swap_int32_t(backoffset);
+		memcpy(raw->data+delength,&backoffset,sizeof(int32_t));
+		raw->CSQ_length = 0;
+	}
+	else
+	{
+		if (compress2((unsigned char*)raw->data+delength,&compressed,
+		              (unsigned char*)seq->SQ,seq->SQ_length,9)!=Z_OK)
+			ECOERROR(ECO_IO_ERROR,"I cannot compress sequence data");
+		raw->CSQ_length = compressed;
+	}
+
+	raw->taxid      = seq->taxid;
+	raw->DE_length  = delength;
+	raw->SQ_length  = seq->SQ_length;
+
+	if (is_big_endian())
+	{
+		raw->CSQ_length = swap_int32_t(raw->CSQ_length);
+		raw->DE_length  = swap_int32_t(raw->DE_length);
+		raw->SQ_length  = swap_int32_t(raw->SQ_length);
+		raw->taxid      = swap_int32_t(raw->taxid);
+	}
+
+	write_ecorecord(f,raw,(raw->data - buffer) + delength + compressed);
+}
+
 /**
  * Open the sequences database (.sdx file)
  * @param	prefix	name of the database (radical without extension)
@@ -179,6 +672,8 @@ FILE *open_seqfile(const char *prefix,int32_t index)
 
 	input=open_ecorecorddb(filename_buffer,&seqcount,0);
 
+	last_SQ_file = NULL;  /* a new file may get the address of a closed one */
+
 	if (input)
 		fprintf(stderr,"# Reading file %s containing %d sequences...\n",
 				filename_buffer,
@@ -192,17 +687,46 @@ ecoseq_t *ecoseq_iterator(const char *prefix)
 	static FILE    *current_seq_file= NULL;
 	static int32_t current_file_idx = 1;
 	static char    current_prefix[1024];
+	static int32_t current_record   = -1;	/* in the preloaded sequences */
 	ecoseq_t       *seq;
+	int32_t        skipped;
 
 	if (prefix)
 	{
-		current_file_idx = 1;
+		attach_preloaded(prefix);
+		current_record = (preloaded && !strcmp(prefix,preload_prefix)) ? 0:-1;
+
+		if (current_record >= 0 && resume_file_idx)
+		{
+			while (current_record < preload_count &&
+			       (preloaded[current_record].file_index < resume_file_idx ||
+			        (preloaded[current_record].file_index == resume_file_idx &&
+			         preloaded[current_record].offset <= resume_offset)))
+				current_record++;
+			resume_file_idx = 0;
+		}
+	}
+
+	if (current_record >= 0)
+	{
+		while (current_record < preload_count &&
+		       !file_selected(preloaded[current_record].file_index))
+			current_record++;
+		return (current_record < preload_count) ? preloaded_copy(current_record++):NULL;
+	}
+
+	if (prefix)
+	{
+		current_file_idx = (resume_file_idx) ? resume_file_idx:1;
+
+		while (!file_selected(current_file_idx))
+			current_file_idx++;
 
 		if (current_seq_file)
 			fclose(current_seq_file);
 
 		strncpy(current_prefix,prefix,1023);
-		current_prefix[1024]=0;
+		current_prefix[1023]=0;
 
 		current_seq_file = open_seqfile(current_prefix,
 		 							    current_file_idx);
@@ -210,21 +734,417 @@ ecoseq_t *ecoseq_iterator(const char *prefix)
 		if (!current_seq_file)
 			return NULL;
 
+		/* the resume record is skipped without being uncompressed */
+		if (resume_file_idx == current_file_idx)
+		{
+			if (fseek(current_seq_file,resume_offset,SEEK_SET) ||
+				!read_ecorecord(current_seq_file,&skipped))
+				ECOERROR(ECO_IO_ERROR,"Cannot seek to the resume record");
+		}
+		resume_file_idx = 0;
 	}
 
+	iterator_file_idx      = current_file_idx;
+	iterator_record_offset = ftell(current_seq_file);
 	seq = readnext_ecoseq(current_seq_file);
 
 	if (!seq && feof(current_seq_file))
 	{
-		current_file_idx++;
+		do
+			current_file_idx++;
+		while (!file_selected(current_file_idx));
 		fclose(current_seq_file);
 		current_seq_file = open_seqfile(current_prefix,
 		 							    current_file_idx);
 
 
 		if (current_seq_file)
+		{
+			iterator_file_idx      = current_file_idx;
+			iterator_record_offset = ftell(current_seq_file);
 			seq = readnext_ecoseq(current_seq_file);
+		}
+	}
+
+	return seq;
+}
+
+/**
+ * Make the next iteration started by ecoseq_iterator begin after
+ * a record : the .sdx files before it are not read.
+ * @param	file_index	index of the .sdx file of the record
+ * @param	offset		offset of the record in this file
+ */
+void ecoseq_iterator_resume(int32_t file_index,long offset)
+{
+	resume_file_idx = file_index;
+	resume_offset   = offset;
+}
+
+/**
+ * Make the iterations started by ecoseq_iterator skip some of the
+ * .sdx files of the database : they are not opened.
+ * @param	skipped		skipped[i] is not null if file i is skipped,
+ * 						NULL to read every file. The array is
+ * 						not copied.
+ * @param	count		last file index described by skipped,
+ * 						the following files are read
+ */
+void ecoseq_iterator_skip(const char *skipped,int32_t count)
+{
+	skipped_files = skipped;
+	skipped_count = count;
+}
+
+int32_t file_selected(int32_t file_index)
+{
+	return !skipped_files || file_index > skipped_count ||
+	       !skipped_files[file_index];
+}
+
+/**
+ * Iterate over the sequences of the selected blocks of a database
+ * sorted by ecosort.
+ * @param	prefix	name of the database to start a new iteration,
+ * 					NULL to get the next sequence
+ * @param	index	block index of the database
+ *
+ * @return	the next sequence or NULL at the end of the last block
+ */
+ecoseq_t *ecoseq_block_iterator(const char *prefix,ecoblockidx_t *index)
+{
+	static FILE    *block_file     = NULL;
+	static int32_t block_file_idx  = 0;
+	static int32_t current         = 0;
+	static int32_t remaining       = 0;
+	static int32_t record          = -1;	/* in the preloaded sequences */
+	static char    block_prefix[1024];
+	ecoblock_t     *block;
+	ecoseq_t       *seq;
+
+	if (prefix)
+	{
+		strncpy(block_prefix,prefix,1023);
+		block_prefix[1023]=0;
+		current   = -1;
+		remaining = 0;
+		attach_preloaded(prefix);
+	}
+
+	if (preloaded && !strcmp(block_prefix,preload_prefix))
+	{
+		while (!remaining)
+		{
+			for (current++;
+			     current < index->count && !index->block[current].selected;
+			     current++);
+
+			if (current >= index->count)
+				return NULL;
+
+			block     = index->block + current;
+			record    = preloaded_record(block_prefix,block->file_index,block->offset);
+			remaining = block->count;
+
+			if (record < 0 || record + remaining > preload_count)
+				ECOERROR(ECO_IO_ERROR,"Cannot seek to sequence block");
+		}
+
+		remaining--;
+
+		return preloaded_copy(record++);
+	}
+
+	while (!remaining)
+	{
+		for (current++;
+		     current < index->count && !index->block[current].selected;
+		     current++);
+
+		if (current >= index->count)
+		{
+			if (block_file)
+				fclose(block_file);
+			block_file = NULL;
+			return NULL;
+		}
+
+		block = index->block + current;
+
+		if (!block_file || block_file_idx!=block->file_index)
+		{
+			if (block_file)
+				fclose(block_file);
+
+			block_file     = open_seqfile(block_prefix,block->file_index);
+			block_file_idx = block->file_index;
+
+			if (!block_file)
+				ECOERROR(ECO_IO_ERROR,"Cannot open sequence file");
+		}
+
+		if (fseek(block_file,block->offset,SEEK_SET))
+			ECOERROR(ECO_IO_ERROR,"Cannot seek to sequence block");
+
+		remaining = block->count;
+	}
+
+	iterator_file_idx      = block_file_idx;
+	iterator_record_offset = ftell(block_file);
+	seq = readnext_ecoseq(block_file);
+
+	if (!seq)
+		ECOERROR(ECO_IO_ERROR,"Truncated sequence block");
+
+	remaining--;
+
+	return seq;
+}
+
+/**
+ * Give back the location of the last sequence returned
+ * by ecoseq_iterator
+ * @param	file_index	receives the index of the .sdx file
+ * @param	offset		receives the offset of the record in this file
+ */
+void ecoseq_iterator_position(int32_t *file_index,long *offset)
+{
+	*file_index = iterator_file_idx;
+	*offset     = iterator_record_offset;
+}
+
+/**
+ * Read back a sequence from its location in the database
+ * @param	prefix		name of the database (radical without extension)
+ * @param	file_index	index of the .sdx file
+ * @param	offset		offset of the record in this file
+ *
+ * @return	the sequence
+ */
+ecoseq_t *ecoseq_fetch(const char *prefix,int32_t file_index,long offset)
+{
+	static FILE    **fetch_file = NULL;	/* open files by file index */
+	static int32_t fetch_count  = 0;
+	ecoseq_t       *seq;
+	int32_t        i;
+
+	attach_preloaded(prefix);
+
+	if ((i = preloaded_record(prefix,file_index,offset)) >= 0)
+		return preloaded_copy(i);
+
+	if (file_index >= fetch_count)
+	{
+		if (fetch_file)
+			fetch_file = ECOREALLOC(fetch_file,sizeof(FILE*) * (file_index+1),
+			                        "Increase sequence file table");
+		else
+			fetch_file = ECOMALLOC(sizeof(FILE*) * (file_index+1),
+			                       "Allocate sequence file table");
+
+		for (i=fetch_count; i <= file_index; i++)
+			fetch_file[i] = NULL;
+
+		fetch_count = file_index+1;
 	}
 
+	if (!fetch_file[file_index])
+	{
+		fetch_file[file_index] = open_seqfile(prefix,file_index);
+
+		if (!fetch_file[file_index])
+			ECOERROR(ECO_IO_ERROR,"Cannot open sequence file");
+	}
+
+	if (fseek(fetch_file[file_index],offset,SEEK_SET))
+		ECOERROR(ECO_IO_ERROR,"Cannot seek to sequence record");
+
+	seq = readnext_ecoseq(fetch_file[file_index]);
+
+	if (!seq)
+		ECOERROR(ECO_IO_ERROR,"Cannot read sequence record");
+
+	return seq;
+}
+
+/**
+ * Count the records of a database
+ * @param	prefix	name of the database (radical without extension)
+ *
+ * @return	the total record count of its .sdx files
+ */
+int32_t ecoseq_record_count(const char *prefix)
+{
+	char    filename[1024];
+	FILE    *f;
+	int32_t count;
+	int32_t total = 0;
+	int32_t i;
+
+	for (i=1; ; i++)
+	{
+		snprintf(filename,1024,"%s_%03d.sdx",prefix,i);
+		f = open_ecorecorddb(filename,&count,0);
+
+		if (!f)
+			break;
+
+		total+=count;
+		fclose(f);
+	}
+
+	return total;
+}
+
+/**
+ * Count the .sdx files of a database
+ * @param	prefix	name of the database (radical without extension)
+ *
+ * @return	the index of the last .sdx file, numbered from 1
+ */
+int32_t ecoseq_file_count(const char *prefix)
+{
+	char    filename[1024];
+	int32_t i;
+
+	for (i=0; ; i++)
+	{
+		snprintf(filename,1024,"%s_%03d.sdx",prefix,i+1);
+		if (access(filename,R_OK))
+			break;
+	}
+
+	return i;
+}
+
+/*
+ * index of a preloaded record, -1 if it is not preloaded
+ */
+int32_t preloaded_record(const char *prefix,int32_t file_index,long offset)
+{
+	int32_t low  = 0;
+	int32_t high = preload_count;
+	int32_t middle;
+
+	if (!preloaded || strcmp(prefix,preload_prefix))
+		return -1;
+
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+
+		if (preloaded[middle].file_index < file_index ||
+			(preloaded[middle].file_index == file_index &&
+			 preloaded[middle].offset < offset))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if (low < preload_count &&
+		preloaded[low].file_index == file_index &&
+		preloaded[low].offset == offset)
+		return low;
+
+	return -1;
+}
+
+/*
+ * copy of a preloaded sequence, located for ecoseq_iterator_position
+ */
+ecoseq_t *preloaded_copy(int32_t record)
+{
+	ecoseq_t *model = &(preloaded[record].seq);
+	ecoseq_t *seq;
+
+	iterator_file_idx      = preloaded[record].file_index;
+	iterator_record_offset = preloaded[record].offset;
+
+	seq = new_ecoseq();
+
+	seq->taxid     = model->taxid;
+	seq->SQ_length = model->SQ_length;
+	seq->duplicate = model->duplicate;
+
+	seq->AC = ECOMALLOC(strlen(model->AC)+1,"Allocate Sequence Accesion number");
+	strcpy(seq->AC,model->AC);
+	seq->DE = ECOMALLOC(strlen(model->DE)+1,"Allocate Sequence definition");
+	strcpy(seq->DE,model->DE);
+	seq->SQ = ECOMALLOC(model->SQ_length+1,"Allocate sequence buffer");
+	memcpy(seq->SQ,model->SQ,model->SQ_length);
+
 	return seq;
 }
+
+/**
+ * Load all the sequences of a database in memory. The sequence
+ * iterators and ecoseq_fetch then give copies of them, without
+ * reading and uncompressing the .sdx files again.
+ * @param	prefix	name of the database (radical without extension)
+ *
+ * @return	the number of sequences loaded
+ */
+int32_t ecoseq_preload(const char *prefix)
+{
+	ecoseq_t *seq;
+	int32_t  size = 0;
+
+	attach_preloaded(prefix);
+
+	if (preloaded)
+		return preload_count;
+
+	seq = ecoseq_iterator(prefix);
+
+	while (seq)
+	{
+		if (preload_count == size)
+		{
+			size = size ? size * 2 : 4096;
+			if (preloaded)
+				preloaded = ECOREALLOC(preloaded,sizeof(ecopreloaded_t) * size,
+				                       "Increase preloaded sequences");
+			else
+				preloaded = ECOMALLOC(sizeof(ecopreloaded_t) * size,
+				                      "Allocate preloaded sequences");
+		}
+
+		ecoseq_iterator_position(&(preloaded[preload_count].file_index),
+		                         &(preloaded[preload_count].offset));
+		preloaded[preload_count++].seq = *seq;
+		ECOFREE(seq,"Free preloaded sequence structure");
+
+		seq = ecoseq_iterator(NULL);
+	}
+
+	strncpy(preload_prefix,prefix,1023);
+	preload_prefix[1023]=0;
+
+	return preload_count;
+}
+
+/*
+ * the sequences of the database image, if any, are used as
+ * preloaded sequences
+ */
+void attach_preloaded(const char *prefix)
+{
+	ecoimage_t *image;
+	int32_t    i;
+
+	if (preloaded || !(image = attach_ecoimage(prefix)))
+		return;
+
+	preload_count = image_sequence_count(image);
+	preloaded     = ECOMALLOC(sizeof(ecopreloaded_t) * (preload_count + 1),
+	                          "Allocate preloaded sequences");
+
+	for (i=0; i < preload_count; i++)
+		image_sequence(image,i,
+		               &(preloaded[i].file_index),
+		               &(preloaded[i].offset),
+		               &(preloaded[i].seq));
+
+	strncpy(preload_prefix,prefix,1023);
+	preload_prefix[1023]=0;
+}
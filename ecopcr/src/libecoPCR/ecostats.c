@@ -0,0 +1,126 @@
+#include "ecoPCR.h"
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Run statistics : call count, time and processed items of the
+ * stages of a run, and the work done by the run. Counters are
+ * updated atomically by every thread, the time of a stage is then
+ * summed over the threads running it.
+ *
+ * The clock is only read once ecostats_enable has been called, a
+ * run without statistics pays a test by stage call.
+ */
+
+typedef struct {
+	int64_t calls;
+	int64_t nanoseconds;
+	int64_t items;
+} ecostat_t;
+
+static const char *stage_name[ECOSTAT_STAGES] = {"read_ecorecord",
+                                                 "uncompress",
+                                                 "EncodeSequence",
+                                                 "ManberAll",
+                                                 "pairing",
+                                                 "nparam_CalcTwoTM",
+                                                 "printRepeat"};
+
+static const char *item_name[ECOSTAT_STAGES]  = {"bytes",
+                                                 "bases",
+                                                 "bases",
+                                                 "hits",
+                                                 "pairs",
+                                                 "primers",
+                                                 "amplicons"};
+
+static int32_t   enabled = 0;
+static int64_t   started = 0;
+static ecostat_t stages[ECOSTAT_STAGES];
+
+static int64_t   monotonic_ns(void);
+
+
+int64_t monotonic_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC,&now);
+
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Start collecting statistics
+ */
+void ecostats_enable(void)
+{
+	enabled = 1;
+	started = monotonic_ns();
+}
+
+/**
+ * Time at the beginning of a stage
+ *
+ * @return	the monotonic clock in nanoseconds, 0 without statistics
+ */
+int64_t ecostat_clock(void)
+{
+	return (enabled) ? monotonic_ns() : 0;
+}
+
+/**
+ * Account for a stage call
+ * @param	stage	ECOSTAT_ stage
+ * @param	start	ecostat_clock() at the beginning of the call
+ * @param	items	items processed by the call
+ */
+void ecostat_add(int32_t stage,int64_t start,int64_t items)
+{
+	if (!start)
+		return;
+
+	__atomic_fetch_add(&(stages[stage].calls),1,__ATOMIC_RELAXED);
+	__atomic_fetch_add(&(stages[stage].nanoseconds),monotonic_ns() - start,__ATOMIC_RELAXED);
+	__atomic_fetch_add(&(stages[stage].items),items,__ATOMIC_RELAXED);
+}
+
+/**
+ * Print the statistics as a JSON object
+ * @param	output		the output stream, usually stderr
+ * @param	sequences	sequences processed by the run
+ * @param	bases		bases of these sequences
+ * @param	hits		amplicons found
+ */
+void print_ecostats(FILE *output,int64_t sequences,int64_t bases,int64_t hits)
+{
+	double  elapsed;
+	int32_t i;
+
+	if (!enabled)
+		return;
+
+	elapsed = (monotonic_ns() - started) / 1e9;
+
+	fprintf(output,"{\"elapsed\": %.6f, "
+	               "\"sequences\": %lld, \"bases\": %lld, \"hits\": %lld, "
+	               "\"sequences_per_s\": %.1f, \"bases_per_s\": %.1f, \"hits_per_s\": %.1f,\n",
+	        elapsed,
+	        (long long)sequences,(long long)bases,(long long)hits,
+	        (elapsed > 0) ? sequences / elapsed : 0,
+	        (elapsed > 0) ? bases / elapsed : 0,
+	        (elapsed > 0) ? hits / elapsed : 0);
+
+	fprintf(output," \"stages\": {\n");
+
+	for (i=0; i < ECOSTAT_STAGES; i++)
+		fprintf(output,"  \"%s\": {\"calls\": %lld, \"seconds\": %.6f, \"%s\": %lld}%s\n",
+		        stage_name[i],
+		        (long long)stages[i].calls,
+		        stages[i].nanoseconds / 1e9,
+		        item_name[i],
+		        (long long)stages[i].items,
+		        (i+1 < ECOSTAT_STAGES) ? ",":"");
+
+	fprintf(output," }\n}\n");
+}
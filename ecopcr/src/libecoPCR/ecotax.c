@@ -4,6 +4,7 @@
 #include <stdio.h>
 
 static ecotx_t *readnext_ecotaxon(FILE *f,ecotx_t *taxon);
+static ecotx_t *taxsnapshot_lineage(ecotaxonomy_t *taxonomy,ecotx_t *taxon,int32_t rank);
 
  /** 
  * Open the taxonomy database 
@@ -128,6 +129,7 @@ ecotx_t *readnext_ecotaxon(FILE *f,ecotx_t *taxon)
 ecotaxonomy_t    *read_taxonomy(const char *prefix,int32_t readAlternativeName)
 {
 	ecotaxonomy_t *tax;
+	ecoimage_t    *image;
 	char          *filename;
 	char          *filename2;
 	int           buffsize;
@@ -135,6 +137,8 @@ ecotaxonomy_t    *read_taxonomy(const char *prefix,int32_t readAlternativeName)
 	tax = ECOMALLOC(sizeof(ecotaxonomy_t),
 	                "Allocate taxonomy structure");
 	
+	image = attach_ecoimage(prefix);
+	
 	buffsize = strlen(prefix)+10;
 	
 	filename = ECOMALLOC(buffsize,
@@ -144,12 +148,25 @@ ecotaxonomy_t    *read_taxonomy(const char *prefix,int32_t readAlternativeName)
 	
 	snprintf(filename,buffsize,"%s.rdx",prefix);
 	
-	tax->ranks = read_rankidx(filename);
-	
-	snprintf(filename,buffsize,"%s.tdx",prefix);
-	snprintf(filename2,buffsize,"%s.ldx",prefix);
-	
-	tax->taxons = read_taxonomyidx(filename,filename2);
+	if (image)
+	{
+		tax->ranks  = image_rankidx(image);
+		tax->taxons = image_taxonomyidx(image);
+	}
+	else if ((tax->snapshot = read_taxsnapshot(prefix)))
+	{
+		tax->ranks  = taxsnapshot_rankidx(tax->snapshot);
+		tax->taxons = taxsnapshot_taxonomyidx(tax->snapshot);
+	}
+	else
+	{
+		tax->ranks = read_rankidx(filename);
+		
+		snprintf(filename,buffsize,"%s.tdx",prefix);
+		snprintf(filename2,buffsize,"%s.ldx",prefix);
+		
+		tax->taxons = read_taxonomyidx(filename,filename2);
+	}
 	
 	if (readAlternativeName)
 	{
@@ -218,6 +235,12 @@ ecotx_t *eco_findtaxonbytaxid(ecotaxonomy_t *taxonomy,
 	int32_t     taxoncount;
 	int32_t     i;
 	
+	if (taxonomy->snapshot)
+	{
+		i = taxsnapshot_index(taxonomy->snapshot,taxid);
+		return (i >= 0) ? taxonomy->taxons->taxon + i : NULL;
+	}
+	
 	taxoncount=taxonomy->taxons->count;
 	
 	for (current_taxon=taxonomy->taxons->taxon,
@@ -274,6 +297,9 @@ ecotx_t *eco_getspecies(ecotx_t *taxon,
 	if (!tax || rankindex < 0)
 		ECOERROR(ECO_ASSERT_ERROR,"No taxonomy defined");
 		
+	if (tax->snapshot)
+		return taxsnapshot_lineage(tax,taxon,TAXSNAPSHOT_SPECIES);
+		
 	return eco_findtaxonatrank(taxon,rankindex);
 }
 
@@ -292,6 +318,9 @@ ecotx_t *eco_getgenus(ecotx_t *taxon,
 	if (!tax || rankindex < 0)
 		ECOERROR(ECO_ASSERT_ERROR,"No taxonomy defined");
 		
+	if (tax->snapshot)
+		return taxsnapshot_lineage(tax,taxon,TAXSNAPSHOT_GENUS);
+		
 	return eco_findtaxonatrank(taxon,rankindex);
 }
 
@@ -311,6 +340,9 @@ ecotx_t *eco_getfamily(ecotx_t *taxon,
 	if (!tax || rankindex < 0)
 		ECOERROR(ECO_ASSERT_ERROR,"No taxonomy defined");
 		
+	if (tax->snapshot)
+		return taxsnapshot_lineage(tax,taxon,TAXSNAPSHOT_FAMILY);
+		
 	return eco_findtaxonatrank(taxon,rankindex);
 }
 
@@ -329,6 +361,9 @@ ecotx_t *eco_getkingdom(ecotx_t *taxon,
 	if (!tax || rankindex < 0)
 		ECOERROR(ECO_ASSERT_ERROR,"No taxonomy defined");
 		
+	if (tax->snapshot)
+		return taxsnapshot_lineage(tax,taxon,TAXSNAPSHOT_KINGDOM);
+		
 	return eco_findtaxonatrank(taxon,rankindex);
 }
 
@@ -347,5 +382,20 @@ ecotx_t *eco_getsuperkingdom(ecotx_t *taxon,
 	if (!tax || rankindex < 0)
 		ECOERROR(ECO_ASSERT_ERROR,"No taxonomy defined");
 		
+	if (tax->snapshot)
+		return taxsnapshot_lineage(tax,taxon,TAXSNAPSHOT_SUPERKINGDOM);
+		
 	return eco_findtaxonatrank(taxon,rankindex);
 }
+
+/*
+ * taxon at a lineage rank, read in the taxonomy snapshot
+ */
+ecotx_t *taxsnapshot_lineage(ecotaxonomy_t *taxonomy,ecotx_t *taxon,int32_t rank)
+{
+	int32_t ancestor;
+	
+	ancestor = taxonomy->snapshot->lineage[rank][taxon - taxonomy->taxons->taxon];
+	
+	return (ancestor >= 0) ? taxonomy->taxons->taxon + ancestor : NULL;
+}
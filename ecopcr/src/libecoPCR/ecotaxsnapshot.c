@@ -0,0 +1,493 @@
+#include "ecoPCR.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Taxonomy snapshot (.cdx) : the taxonomy of the .rdx, .tdx and .ldx
+ * files as int32 columns and a name blob, in the byte order of the
+ * machine, mapped as it is by read_taxonomy.
+ *
+ * Columns, one value per taxon in the .tdx/.ldx order : taxid, rank,
+ * parent index, name offset, preorder interval [first,last] of the
+ * subtree, taxon indices sorted by taxid, index of the species, genus,
+ * family, kingdom and super kingdom of the taxon (-1 if none). They
+ * are followed by the rank label offsets and the names.
+ *
+ * A taxon t is under a taxon o when first[o] <= first[t] <= last[o].
+ */
+
+#define TAXSNAPSHOT_MAGIC "ECOCDX01"
+
+typedef struct {
+	char     magic[8];
+	int32_t  endian;		/* 1 in the byte order of the writer */
+	int32_t  count;
+	int32_t  rankcount;
+	int32_t  namesize;
+} ecotaxsnapshothead_t;
+
+#define TAXSNAPSHOT_COLUMNS (7 + TAXSNAPSHOT_LINEAGE)
+
+static const char *lineage_rank[TAXSNAPSHOT_LINEAGE] = {"species","genus","family",
+                                                        "kingdom","superkingdom"};
+
+static int32_t   *sorted_taxid = NULL;	/* for compare_taxid */
+
+static char      *snapshot_name(const char *prefix,const char *extension);
+static int        compare_taxid(const void *i1,const void *i2);
+static void       number_subtrees(ecotxidx_t *taxons,int32_t *parent,
+                                  int32_t *first,int32_t *last);
+static int32_t    lower_taxid(ecotaxsnapshot_t *snapshot,int32_t taxid);
+
+
+char *snapshot_name(const char *prefix,const char *extension)
+{
+	char *filename;
+
+	filename = ECOMALLOC(strlen(prefix)+5,"Allocate filename");
+	sprintf(filename,"%s.%s",prefix,extension);
+
+	return filename;
+}
+
+int compare_taxid(const void *i1,const void *i2)
+{
+	int32_t t1 = *(const int32_t*)i1;
+	int32_t t2 = *(const int32_t*)i2;
+
+	if (sorted_taxid[t1] != sorted_taxid[t2])
+		return (sorted_taxid[t1] < sorted_taxid[t2]) ? -1:1;
+
+	return t1 - t2;
+}
+
+/*
+ * preorder numbering of the subtrees, children of a taxon being
+ * numbered in index order
+ */
+void number_subtrees(ecotxidx_t *taxons,int32_t *parent,
+		             int32_t *first,int32_t *last)
+{
+	int32_t count = taxons->count;
+	int32_t *childstart;
+	int32_t *children;
+	int32_t *stack;
+	int32_t *next;
+	int32_t top;
+	int32_t order = 0;
+	int32_t i;
+	int32_t t;
+
+	childstart = ECOMALLOC(sizeof(int32_t) * (count + 1),"Allocate taxon children");
+	children   = ECOMALLOC(sizeof(int32_t) * (count + 1),"Allocate taxon children");
+	stack      = ECOMALLOC(sizeof(int32_t) * (count + 1),"Allocate taxon stack");
+	next       = ECOMALLOC(sizeof(int32_t) * (count + 1),"Allocate taxon stack");
+
+	for (i=0; i < count; i++)
+		if (parent[i] != i)
+			childstart[parent[i]+1]++;
+
+	for (i=0; i < count; i++)
+		childstart[i+1]+=childstart[i];
+
+	for (i=0; i < count; i++)
+		if (parent[i] != i)
+			children[next[parent[i]]++ + childstart[parent[i]]] = i;
+
+	for (i=0; i < count; i++)
+		first[i] = -1;
+
+	/* roots are their own parent */
+
+	for (i=0; i < count; i++)
+		if (parent[i] == i)
+		{
+			top = 0;
+			stack[0] = i;
+			next[i]  = childstart[i];
+			first[i] = order++;
+
+			while (top >= 0)
+			{
+				t = stack[top];
+
+				if (next[t] < childstart[t+1])
+				{
+					t = children[next[t]++];
+					first[t] = order++;
+					next[t]  = childstart[t];
+					stack[++top] = t;
+				}
+				else
+				{
+					last[t] = order - 1;
+					top--;
+				}
+			}
+		}
+
+	/* taxa out of the trees of the roots have no descendant */
+
+	for (i=0; i < count; i++)
+		if (first[i] < 0)
+			first[i] = last[i] = order++;
+
+	ECOFREE(next,"Free taxon stack");
+	ECOFREE(stack,"Free taxon stack");
+	ECOFREE(children,"Free taxon children");
+	ECOFREE(childstart,"Free taxon children");
+}
+
+/**
+ * Build the taxonomy snapshot (.cdx) of a database from its
+ * .rdx, .tdx and .ldx files.
+ * @param	prefix	name of the database (radical without extension)
+ *
+ * @return	the number of taxa in the snapshot
+ */
+int32_t build_taxsnapshot(const char *prefix)
+{
+	ecotaxsnapshothead_t head;
+	ecotaxonomy_t        taxonomy;
+	int32_t              *column[TAXSNAPSHOT_COLUMNS];
+	int32_t              *ranklabel;
+	int32_t              rankidx[TAXSNAPSHOT_LINEAGE];
+	ecotx_t              *taxon;
+	char                 *filename;
+	char                 *filename2;
+	FILE                 *f;
+	int32_t              count;
+	int32_t              namesize = 0;
+	int32_t              length;
+	int32_t              i;
+	int32_t              j;
+	int32_t              k;
+
+	filename  = snapshot_name(prefix,"rdx");
+	taxonomy.ranks  = read_rankidx(filename);
+	ECOFREE(filename,"Free filename");
+
+	filename  = snapshot_name(prefix,"tdx");
+	filename2 = snapshot_name(prefix,"ldx");
+	taxonomy.taxons = read_taxonomyidx(filename,filename2);
+	taxonomy.names  = NULL;
+	taxonomy.snapshot = NULL;
+	ECOFREE(filename2,"Free filename");
+	ECOFREE(filename,"Free filename");
+
+	count = taxonomy.taxons->count;
+
+	for (i=0; i < TAXSNAPSHOT_COLUMNS; i++)
+		column[i] = ECOMALLOC(sizeof(int32_t) * (count + 1),
+		                      "Allocate taxonomy snapshot column");
+
+	ranklabel = ECOMALLOC(sizeof(int32_t) * (taxonomy.ranks->count + 1),
+	                      "Allocate taxonomy snapshot ranks");
+
+	for (i=0; i < TAXSNAPSHOT_LINEAGE; i++)
+		for (rankidx[i]=-1, k=0; k < taxonomy.ranks->count; k++)
+			if (!strcmp(lineage_rank[i],taxonomy.ranks->label[k]))
+				rankidx[i]=k;
+
+	for (i=0; i < count; i++)
+	{
+		taxon = taxonomy.taxons->taxon + i;
+
+		column[0][i] = taxon->taxid;
+		column[1][i] = taxon->rank;
+		column[2][i] = taxon->parent - taxonomy.taxons->taxon;
+		column[3][i] = namesize;
+		namesize    += strlen(taxon->name) + 1;
+
+		for (j=0; j < TAXSNAPSHOT_LINEAGE; j++)
+		{
+			taxon = (rankidx[j] >= 0) ? eco_findtaxonatrank(taxonomy.taxons->taxon + i,
+			                                                rankidx[j]) : NULL;
+			column[7+j][i] = (taxon) ? taxon - taxonomy.taxons->taxon : -1;
+		}
+
+		column[6][i] = i;
+	}
+
+	for (i=0; i < taxonomy.ranks->count; i++)
+	{
+		ranklabel[i] = namesize;
+		namesize    += strlen(taxonomy.ranks->label[i]) + 1;
+	}
+
+	number_subtrees(taxonomy.taxons,column[2],column[4],column[5]);
+
+	/* taxon indices sorted by taxid */
+
+	sorted_taxid = column[0];
+	qsort(column[6],count,sizeof(int32_t),compare_taxid);
+	sorted_taxid = NULL;
+
+	memset(&head,0,sizeof(head));
+	memcpy(head.magic,TAXSNAPSHOT_MAGIC,8);
+	head.endian    = 1;
+	head.count     = count;
+	head.rankcount = taxonomy.ranks->count;
+	head.namesize  = namesize;
+
+	filename = snapshot_name(prefix,"cdx");
+	f = fopen(filename,"wb");
+	if (!f)
+		ECOERROR(ECO_IO_ERROR,"Cannot open the taxonomy snapshot");
+
+	if (fwrite(&head,sizeof(head),1,f) != 1)
+		ECOERROR(ECO_IO_ERROR,"Cannot write the taxonomy snapshot");
+
+	for (i=0; i < TAXSNAPSHOT_COLUMNS; i++)
+		if (fwrite(column[i],sizeof(int32_t),count,f) != (size_t)count)
+			ECOERROR(ECO_IO_ERROR,"Cannot write the taxonomy snapshot");
+
+	if (fwrite(ranklabel,sizeof(int32_t),head.rankcount,f) != (size_t)head.rankcount)
+		ECOERROR(ECO_IO_ERROR,"Cannot write the taxonomy snapshot");
+
+	for (i=0; i < count; i++)
+	{
+		length = strlen(taxonomy.taxons->taxon[i].name) + 1;
+		if (fwrite(taxonomy.taxons->taxon[i].name,1,length,f) != (size_t)length)
+			ECOERROR(ECO_IO_ERROR,"Cannot write the taxonomy snapshot");
+	}
+
+	for (i=0; i < head.rankcount; i++)
+	{
+		length = strlen(taxonomy.ranks->label[i]) + 1;
+		if (fwrite(taxonomy.ranks->label[i],1,length,f) != (size_t)length)
+			ECOERROR(ECO_IO_ERROR,"Cannot write the taxonomy snapshot");
+	}
+
+	if (fclose(f))
+		ECOERROR(ECO_IO_ERROR,"Cannot write the taxonomy snapshot");
+
+	fprintf(stderr,"# %d taxa stored in %s\n",count,filename);
+
+	ECOFREE(filename,"Free filename");
+	ECOFREE(ranklabel,"Free taxonomy snapshot ranks");
+	for (i=0; i < TAXSNAPSHOT_COLUMNS; i++)
+		ECOFREE(column[i],"Free taxonomy snapshot column");
+
+	delete_taxonomy(taxonomy.taxons);
+
+	for (i=0; i < taxonomy.ranks->count; i++)
+		ECOFREE(taxonomy.ranks->label[i],"Free rank label");
+	ECOFREE(taxonomy.ranks,"Free rank index");
+
+	return count;
+}
+
+/**
+ * Map the taxonomy snapshot of a database.
+ * @param	prefix	name of the database (radical without extension)
+ *
+ * @return	the snapshot, or NULL if there is no snapshot of the current
+ * 			.rdx, .tdx and .ldx files
+ */
+ecotaxsnapshot_t *read_taxsnapshot(const char *prefix)
+{
+	ecotaxsnapshot_t     *snapshot;
+	ecotaxsnapshothead_t *head;
+	char                 *filename;
+	struct stat          st;
+	struct stat          source;
+	int32_t              count;
+	int32_t              count2;
+	int32_t              *column;
+	int                  fd;
+	void                 *data;
+	int32_t              i;
+	FILE                 *f;
+	static const char    *sources[3] = {"rdx","tdx","ldx"};
+
+	filename = snapshot_name(prefix,"cdx");
+	fd = open(filename,O_RDONLY);
+	ECOFREE(filename,"Free filename");
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd,&st) || st.st_size < (off_t)sizeof(ecotaxsnapshothead_t))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	/* the snapshot must be younger than the files it comes from */
+
+	for (i=0; i < 3; i++)
+	{
+		filename = snapshot_name(prefix,sources[i]);
+		if (!stat(filename,&source) && source.st_mtime > st.st_mtime)
+			st.st_size = 0;
+		ECOFREE(filename,"Free filename");
+	}
+
+	data = (st.st_size) ? mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0):MAP_FAILED;
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return NULL;
+
+	head = data;
+
+	filename = snapshot_name(prefix,"tdx");
+	f = open_ecorecorddb(filename,&count,1);
+	fclose(f);
+	ECOFREE(filename,"Free filename");
+
+	filename = snapshot_name(prefix,"ldx");
+	f = open_ecorecorddb(filename,&count2,0);
+	if (f)
+		fclose(f);
+	ECOFREE(filename,"Free filename");
+
+	if (memcmp(head->magic,TAXSNAPSHOT_MAGIC,8) ||
+		head->endian != 1 ||
+		head->count != count + count2 ||
+		st.st_size != (off_t)(sizeof(ecotaxsnapshothead_t)
+		                      + sizeof(int32_t) * ((int64_t)head->count * TAXSNAPSHOT_COLUMNS
+		                                           + head->rankcount)
+		                      + head->namesize))
+	{
+		munmap(data,st.st_size);
+		return NULL;
+	}
+
+	snapshot = ECOMALLOC(sizeof(ecotaxsnapshot_t),"Allocate taxonomy snapshot");
+
+	snapshot->count     = head->count;
+	snapshot->rankcount = head->rankcount;
+	snapshot->size      = st.st_size;
+	snapshot->data      = data;
+
+	column = (int32_t*)(head + 1);
+
+	snapshot->taxid   = column;
+	snapshot->rank    = column + head->count;
+	snapshot->parent  = column + head->count * 2;
+	snapshot->name    = column + head->count * 3;
+	snapshot->first   = column + head->count * 4;
+	snapshot->last    = column + head->count * 5;
+	snapshot->bytaxid = column + head->count * 6;
+
+	for (i=0; i < TAXSNAPSHOT_LINEAGE; i++)
+		snapshot->lineage[i] = column + head->count * (7 + i);
+
+	snapshot->ranklabel = column + head->count * TAXSNAPSHOT_COLUMNS;
+	snapshot->names     = (char*)(snapshot->ranklabel + head->rankcount);
+
+	return snapshot;
+}
+
+/**
+ * Rank labels of a snapshot, pointing into it
+ */
+ecorankidx_t *taxsnapshot_rankidx(ecotaxsnapshot_t *snapshot)
+{
+	ecorankidx_t *index;
+	int32_t      i;
+
+	index = ECOMALLOC(sizeof(ecorankidx_t) + sizeof(char*) * snapshot->rankcount,
+	                  "Allocate rank index");
+
+	index->count = snapshot->rankcount;
+
+	for (i=0; i < index->count; i++)
+		index->label[i] = snapshot->names + snapshot->ranklabel[i];
+
+	return index;
+}
+
+/**
+ * Taxa of a snapshot. The taxon structures are built in a single
+ * pass, their names point into the snapshot.
+ */
+ecotxidx_t *taxsnapshot_taxonomyidx(ecotaxsnapshot_t *snapshot)
+{
+	ecotxidx_t *index;
+	ecotx_t    *taxon;
+	int32_t    i;
+
+	index = ECOMALLOC(sizeof(ecotxidx_t) + sizeof(ecotx_t) * snapshot->count,
+	                  "Allocate taxonomy");
+
+	index->count = snapshot->count;
+
+	for (i=0, taxon=index->taxon; i < index->count; i++, taxon++)
+	{
+		taxon->taxid  = snapshot->taxid[i];
+		taxon->rank   = snapshot->rank[i];
+		taxon->parent = index->taxon + snapshot->parent[i];
+		taxon->name   = snapshot->names + snapshot->name[i];
+	}
+
+	fprintf(stderr,"# %d taxa mapped from the taxonomy snapshot\n",index->count);
+
+	return index;
+}
+
+/*
+ * first position in the taxid order of a taxid, or of the next one
+ */
+int32_t lower_taxid(ecotaxsnapshot_t *snapshot,int32_t taxid)
+{
+	int32_t low  = 0;
+	int32_t high = snapshot->count;
+	int32_t middle;
+
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+
+		if (snapshot->taxid[snapshot->bytaxid[middle]] < taxid)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+/**
+ * Index of the first taxon with a taxid, -1 if none
+ */
+int32_t taxsnapshot_index(ecotaxsnapshot_t *snapshot,int32_t taxid)
+{
+	int32_t i = lower_taxid(snapshot,taxid);
+
+	if (i < snapshot->count && snapshot->taxid[snapshot->bytaxid[i]] == taxid)
+		return snapshot->bytaxid[i];
+
+	return -1;
+}
+
+/**
+ * Tell if a taxon is a taxon with a given taxid or is under one of them
+ * @param	snapshot	the taxonomy snapshot
+ * @param	taxon		index of the taxon
+ * @param	other_taxid	taxid of the other taxon
+ *
+ * @return	1 if the taxon is under the other one, else 0
+ */
+int32_t taxsnapshot_isunder(ecotaxsnapshot_t *snapshot,int32_t taxon,int32_t other_taxid)
+{
+	int32_t i;
+	int32_t other;
+
+	for (i = lower_taxid(snapshot,other_taxid);
+		 i < snapshot->count && snapshot->taxid[(other=snapshot->bytaxid[i])] == other_taxid;
+		 i++)
+		if (snapshot->first[other] <= snapshot->first[taxon] &&
+			snapshot->first[taxon] <= snapshot->last[other])
+			return 1;
+
+	return 0;
+}
@@ -0,0 +1,168 @@
+#include "../libapat/libstki.h"
+#include "../libapat/apat.h"
+
+#include "ecoPCR.h"
+
+#include <pthread.h>
+
+/*
+ * Parallel pattern scan of long sequences.
+ *
+ * The scanned region is cut into one window per thread. A hit is
+ * reported by ManberAll only when the whole pattern lies in the
+ * scanned region, so each window is extended by the pattern length
+ * minus one over the next one : every hit is then found by the
+ * window where it starts and only by it. Appending the hits of the
+ * windows in order gives back the stacks of a single scan.
+ */
+
+#define SCAN_WINDOW_MIN (1 << 20)	/* smallest window worth a thread */
+
+typedef struct {
+	SeqPtr     seq;
+	PatternPtr pattern;
+	int        patnum;
+	int        begin;
+	int        length;
+	pthread_t  thread;
+} ecowindow_t;
+
+static SeqPtr   *window_seq   = NULL;	/* per window hit stacks */
+static int32_t  window_count  = 0;
+
+static void   *scan_window(void *window);
+static SeqPtr get_window_seq(int32_t index);
+static Int32  manberWindows(SeqPtr seq,PatternPtr pattern,int patnum,
+		                    int begin,int length,int32_t threads);
+
+
+void *scan_window(void *window)
+{
+	ecowindow_t *w = window;
+
+	ManberAll(w->seq,w->pattern,w->patnum,w->begin,w->length);
+
+	return NULL;
+}
+
+SeqPtr get_window_seq(int32_t index)
+{
+	int32_t i;
+
+	if (index >= window_count)
+	{
+		if (window_seq)
+			window_seq = ECOREALLOC(window_seq,sizeof(SeqPtr) * (index+1),
+			                        "Increase window table");
+		else
+			window_seq = ECOMALLOC(sizeof(SeqPtr) * (index+1),
+			                       "Allocate window table");
+
+		for (i=window_count; i <= index; i++)
+		{
+			window_seq[i] = ECOMALLOC(sizeof(Seq),
+			                          "Error in Allocation of a new Seq structure");
+			if (! (window_seq[i]->hitpos[0] = NewStacki(kMinStackiSize)))
+				ECOERROR(ECO_MEM_ERROR,"Error in hit stack Allocation");
+			if (! (window_seq[i]->hiterr[0] = NewStacki(kMinStackiSize)))
+				ECOERROR(ECO_MEM_ERROR,"Error in error stack Allocation");
+		}
+
+		window_count = index+1;
+	}
+
+	return window_seq[index];
+}
+
+/**
+ * Same as ManberAll, the scan of long sequences being shared
+ * between several threads.
+ *
+ * @param	seq			apat sequence
+ * @param	pattern		pattern looked for
+ * @param	patnum		index of the hit stack receiving the hits
+ * @param	begin		first position of the scanned region
+ * @param	length		length of the scanned region
+ * @param	threads		max number of threads
+ *
+ * @return	the number of hits in the stack
+ */
+Int32 ecoManberWindows(SeqPtr seq,PatternPtr pattern,int patnum,
+		               int begin,int length,int32_t threads)
+{
+	int64_t timer = ecostat_clock();
+	Int32   hits;
+
+	hits = manberWindows(seq,pattern,patnum,begin,length,threads);
+	ecostat_add(ECOSTAT_MANBER,timer,hits);
+
+	return hits;
+}
+
+Int32 manberWindows(SeqPtr seq,PatternPtr pattern,int patnum,
+		            int begin,int length,int32_t threads)
+{
+	ecowindow_t window[threads > 0 ? threads:1];
+	int64_t     end;
+	int64_t     start;
+	int64_t     stop;
+	int32_t     count;
+	int32_t     i;
+	int32_t     j;
+	StackiPtr   hitpos;
+	StackiPtr   hiterr;
+
+	end = (int64_t)begin + length;
+	if (end > seq->seqlen + seq->circular)
+		end = seq->seqlen + seq->circular;
+
+	count = (end - begin) / SCAN_WINDOW_MIN;
+	if (count > threads)
+		count = threads;
+
+	if (count < 2 || pattern->hasIndel)
+		return ManberAll(seq,pattern,patnum,begin,length);
+
+	for (i=0; i < count; i++)
+	{
+		start = begin + (end - begin) * i / count;
+		stop  = begin + (end - begin) * (i+1) / count + pattern->patlen - 1;
+		if (stop > end)
+			stop = end;
+
+		window[i].seq     = get_window_seq(i);
+		window[i].pattern = pattern;
+		window[i].patnum  = 0;
+		window[i].begin   = start;
+		window[i].length  = stop - start;
+
+		window[i].seq->seqlen   = window[i].seq->seqsiz = seq->seqlen;
+		window[i].seq->circular = seq->circular;
+		window[i].seq->data     = seq->data;
+		window[i].seq->cseq     = seq->cseq;
+		window[i].seq->hitpos[0]->top = window[i].seq->hiterr[0]->top = 0;
+	}
+
+	for (i=1; i < count; i++)
+		if (pthread_create(&(window[i].thread),NULL,scan_window,window+i))
+			ECOERROR(ECO_ASSERT_ERROR,"Cannot start a scanning thread");
+
+	scan_window(window);
+
+	for (i=1; i < count; i++)
+		pthread_join(window[i].thread,NULL);
+
+	for (i=0; i < count; i++)
+	{
+		hitpos = window[i].seq->hitpos[0];
+		hiterr = window[i].seq->hiterr[0];
+
+		for (j=0; j < hitpos->top; j++)
+		{
+			PushiIn(seq->hitpos+patnum,hitpos->val[j]);
+			PushiIn(seq->hiterr+patnum,hiterr->val[j]);
+		}
+	}
+
+	return seq->hitpos[patnum]->top;
+}
@@ -6,6 +6,8 @@ import struct
 import sys
 import time
 import getopt
+import hashlib
+import os
 
 _dbenable=False
 
@@ -386,6 +388,29 @@ def ecoSeqPacker(sq):
     
     return packed
 
+def ecoOwnerPacker(sq,backoffset):
+    
+    # A record without compressed sequence (length 0) is an other owner of
+    # the sequence stored by the record located backoffset bytes before.
+    
+    delength   = len(sq['definition'])
+    
+    totalSize = 4 + 20 + 4 + 4 + 4 + delength + 4
+    
+    packed = struct.pack('> I I 20s I I I %ds I' % delength,
+                         totalSize,
+                         sq['taxid'],
+                         sq['id'],
+                         delength,
+                         sq['length'],
+                         0,
+                         sq['definition'],
+                         backoffset)
+    
+    assert len(packed) == totalSize+4, "error in sequence packing"
+    
+    return packed
+
 def ecoTaxPacker(tx):
     
     namelength = len(tx[3])
@@ -429,13 +454,17 @@ def ecoNamePacker(name):
     
     return packed
     
-def ecoSeqWriter(file,input,taxindex,parser):
+def ecoSeqWriter(file,input,taxindex,parser,unique=False):
     output = open(file,'wb')
     input  = universalOpen(input)
     inputsize = fileSize(input)
     entries = parser(input)
     seqcount=0
     skipped = []
+    
+    # with unique, a sequence already stored in the file is not written
+    # again : the record of an other owner refers to the first one
+    firsts = {}
 
     output.write(struct.pack('> I',seqcount))
     
@@ -448,7 +477,19 @@ def ecoSeqWriter(file,input,taxindex,parser):
                 entry['taxid']=None
             if entry['taxid'] is not None:
                 seqcount+=1
-                output.write(ecoSeqPacker(entry))
+                here = output.tell()
+                if unique:
+                    key = hashlib.sha1(entry['sequence']).digest()
+                    first = firsts.get(key)
+                    # back offsets are signed 32 bits integers
+                    if first is not None and here - first < 0x7FFFFFFF:
+                        entry['length']=len(entry['sequence'])
+                        output.write(ecoOwnerPacker(entry,here-first))
+                    else:
+                        firsts[key]=here
+                        output.write(ecoSeqPacker(entry))
+                else:
+                    output.write(ecoSeqPacker(entry))
             else:
                 skipped.append(entry['id'])
             where = universalTell(input)
@@ -457,6 +498,9 @@ def ecoSeqWriter(file,input,taxindex,parser):
         else:
             skipped.append(entry['id'])
         
+    if unique:
+        print >>sys.stderr," Distinct sequences : %d     " % len(firsts),
+        
     print >>sys.stderr
     output.seek(0,0)
     output.write(struct.pack('> I',seqcount))
@@ -507,7 +551,7 @@ def ecoNameWriter(file,names):
 
     output.close()
     
-def ecoDBWriter(prefix,taxonomy,seqFileNames,parser):
+def ecoDBWriter(prefix,taxonomy,seqFileNames,parser,unique=False):
     
     ecoRankWriter('%s.rdx' % prefix, taxonomy[1])
     ecoTaxWriter('%s.tdx' % prefix, taxonomy[0])
@@ -519,27 +563,205 @@ def ecoDBWriter(prefix,taxonomy,seqFileNames,parser):
         sk=ecoSeqWriter('%s_%03d.sdx' % (prefix,filecount), 
                      filename, 
                      taxonomy[3], 
-                     parser)
+                     parser,
+                     unique)
         if sk:
             print >>sys.stderr,"Skipped entry :"
             print >>sys.stderr,sk
+            
+    ecoManifestWriter(prefix,['%s_%03d.sdx' % (prefix,i+1) for i in xrange(filecount)])
+
+
+#####
+#
+#
+# Database manifest and incremental update
+#
+#
+#####
+
+def ecoRecordCount(file):
+    input = open(file,'rb')
+    count = struct.unpack('> I',input.read(4))[0]
+    input.close()
+    return count
+
+def ecoManifestVersion(prefix):
+    version = 0
+    try:
+        for line in open('%s.mdx' % prefix):
+            if line[0] not in '#\n':
+                version = max(version,int(line.split()[0]))
+    except IOError:
+        pass
+    return version
+
+# the lines of the given files are added to the manifest (.mdx)
+# under the next database version. ecoPCR -n reads the manifest,
+# ecoindex -M updates it.
+
+def ecoManifestWriter(prefix,files):
+    version = ecoManifestVersion(prefix) + 1
+    
+    output = open('%s.mdx' % prefix,'a')
+    if version == 1:
+        print >>output,"#@ecopcr-manifest-v1"
+        print >>output,"# version file records bytes crc32"
+        
+    for file in files:
+        crc  = 0
+        size = 0
+        input = open(file,'rb')
+        data = input.read(1024*1024)
+        while data:
+            crc = gzip.zlib.crc32(data,crc)
+            size+=len(data)
+            data = input.read(1024*1024)
+        input.close()
+        print >>output,"%d %s %d %d %08x" % (version,
+                                             os.path.basename(file),
+                                             ecoRecordCount(file),
+                                             size,
+                                             crc & 0xFFFFFFFF)
+    output.close()
+    print >>sys.stderr,"Database version %d" % version
+    
+def ecoTaxReader(file):
+    taxa = []
+    try:
+        input = open(file,'rb')
+    except IOError:
+        return taxa
+    count = struct.unpack('> I',input.read(4))[0]
+    for i in xrange(count):
+        size,taxid,rank,parent,namelength = struct.unpack('> I I I I I',input.read(20))
+        taxa.append([taxid,rank,parent,input.read(namelength)])
+    input.close()
+    return taxa
+
+def ecoRankReader(file):
+    input = open(file,'rb')
+    count = struct.unpack('> I',input.read(4))[0]
+    ranks = []
+    for i in xrange(count):
+        namelength = struct.unpack('> I',input.read(4))[0]
+        ranks.append(input.read(namelength))
+    input.close()
+    return ranks
+
+# taxon indices of an existing database for the taxids of the
+# appended sequences. Taxa of the taxonomy dump missing from the
+# database become local taxa (.ldx), after their missing ancestors.
+
+class ecoLocalTaxonIndex(object):
+    def __init__(self,prefix,taxonomy):
+        self.dump   = taxonomy
+        self.ranks  = ecoRankReader('%s.rdx' % prefix)
+        self.taxa   = ecoTaxReader('%s.tdx' % prefix)
+        self.taxa.extend(ecoTaxReader('%s.ldx' % prefix))
+        self.first  = len(self.taxa)
+        self.index  = dict((t[0],i) for i,t in enumerate(self.taxa))
+        self.rankname = dict((v,k) for k,v in taxonomy[1].items())
+        
+    def __getitem__(self,taxid):
+        dumpidx = self.dump[3][taxid]
+        if dumpidx is None:
+            raise KeyError,taxid
+        taxon = self.dump[0][dumpidx]
+        if taxon[0] not in self.index:
+            if taxon[2] == dumpidx:
+                raise ValueError,'Root taxon %d is not in the database' % taxon[0]
+            parent = self[self.dump[0][taxon[2]][0]]
+            rank   = self.rankname[taxon[1]]
+            if rank not in self.ranks:
+                raise ValueError,'Rank %s is not in the database' % rank
+            self.index[taxon[0]]=len(self.taxa)
+            self.taxa.append([taxon[0],self.ranks.index(rank),parent,taxon[3]])
+        return self.index[taxon[0]]
+    
+    def local(self):
+        return self.taxa[self.first:]
+
+# taxa are appended to the .ldx file, only its record count is
+# written again
+
+def ecoLocalTaxWriter(file,taxa):
+    if os.path.exists(file):
+        output = open(file,'r+b')
+        count  = struct.unpack('> I',output.read(4))[0]
+        output.seek(0,2)
+    else:
+        output = open(file,'wb')
+        count  = 0
+        output.write(struct.pack('> I',count))
+        
+    for tx in taxa:
+        output.write(ecoTaxPacker(tx))
+        
+    output.seek(0,0)
+    output.write(struct.pack('> I',count+len(taxa)))
+    output.close()
+
+# new .sdx files are added after the existing ones, which are not
+# rewritten. A database without manifest first gets one listing its
+# current files.
+    
+def ecoDBAppender(prefix,taxonomy,seqFileNames,parser,unique=False):
+    filecount = 0
+    while os.path.exists('%s_%03d.sdx' % (prefix,filecount+1)):
+        filecount+=1
+        
+    if not filecount:
+        raise ValueError,'No database %s to append to' % prefix
+    
+    if not ecoManifestVersion(prefix):
+        current = ['%s_%03d.sdx' % (prefix,i+1) for i in xrange(filecount)]
+        if os.path.exists('%s.ldx' % prefix):
+            current.append('%s.ldx' % prefix)
+        ecoManifestWriter(prefix,current)
+    
+    taxindex = ecoLocalTaxonIndex(prefix,taxonomy)
+    appended = []
+    
+    for filename in seqFileNames:
+        filecount+=1
+        appended.append('%s_%03d.sdx' % (prefix,filecount))
+        sk=ecoSeqWriter(appended[-1], 
+                     filename, 
+                     taxindex, 
+                     parser,
+                     unique)
+        if sk:
+            print >>sys.stderr,"Skipped entry :"
+            print >>sys.stderr,sk
+            
+    if taxindex.local():
+        print >>sys.stderr,"Adding %d local taxa" % len(taxindex.local())
+        ecoLocalTaxWriter('%s.ldx' % prefix,taxindex.local())
+        appended.append('%s.ldx' % prefix)
+        
+    ecoManifestWriter(prefix,appended)
         
 def ecoParseOptions(arguments):
     opt = {
             'prefix' : 'ecodb',
+            'unique' : False,
+            'append' : False,
             'taxdir' : 'taxdump',
             'parser' : sequenceIteratorFactory(genbankEntryParser,
                                                   entryIterator)
            }
     
     o,filenames = getopt.getopt(arguments,
-                                'ht:n:gfe',
+                                'ht:n:gfeua',
                                 ['help',
                                  'taxonomy=',
                                  'name=',
                                  'genbank',
                                  'fasta',
-                                 'embl'])
+                                 'embl',
+                                 'unique',
+                                 'append'])
     
     for name,value in o:
         if name in ('-h','--help'):
@@ -561,6 +783,12 @@ def ecoParseOptions(arguments):
         elif name in ('-e','--embl'):
             opt['parser']=sequenceIteratorFactory(emblEntryParser,
                                                   entryIterator)
+            
+        elif name in ('-u','--unique'):
+            opt['unique']=True
+            
+        elif name in ('-a','--append'):
+            opt['append']=True
         else:
             raise ValueError,'Unknown option %s' % name
 
@@ -573,6 +801,10 @@ def printHelp():
     print "-----------------------------------"
     print "ecoPCRFormat.py [option] <argument>"
     print "-----------------------------------"
+    print "-a    --append      :[A]ppend the sequences to the database given"
+    print "                    :by -n as new .sdx files, existing files are"
+    print "                    :not rewritten. Taxa missing from the database"
+    print "                    :are added to its local taxa (.ldx)."
     print "-e    --embl        :[E]mbl format"
     print "-f    --fasta       :[F]asta format"
     print "-g    --genbank     :[G]enbank format"
@@ -580,6 +812,9 @@ def printHelp():
     print "-n    --name        :[N]ame of the new database created"
     print "-t    --taxonomy    :[T]axonomy - path to the taxonomy database"
     print "                    :bcp-like dump from GenBank taxonomy database."
+    print "-u    --unique      :[U]nique - store identical sequences of a file"
+    print "                    :only once, the records of their other owners"
+    print "                    :refer to it. Records keep the input order."
     print "-----------------------------------"
 
 if __name__ == '__main__':
@@ -588,5 +823,8 @@ if __name__ == '__main__':
     
     taxonomy = readTaxonomyDump(opt['taxdir'])
     
-    ecoDBWriter(opt['prefix'], taxonomy, filenames, opt['parser'])
+    if opt['append']:
+        ecoDBAppender(opt['prefix'], taxonomy, filenames, opt['parser'], opt['unique'])
+    else:
+        ecoDBWriter(opt['prefix'], taxonomy, filenames, opt['parser'], opt['unique'])
     